@@ -0,0 +1,445 @@
+#include "pch.h"
+#include "BotSwarm.h"
+
+namespace
+{
+	inline uint64_t toNanoseconds(ClayEngine::TimePoint t)
+	{
+		return uint64_t(std::chrono::duration_cast<ClayEngine::Nanoseconds>(t.time_since_epoch()).count());
+	}
+
+	inline uint64_t toMicroseconds(ClayEngine::TimePoint from, ClayEngine::TimePoint to)
+	{
+		return uint64_t(std::max<int64_t>(std::chrono::duration_cast<ClayEngine::Microseconds>(to - from).count(), 0));
+	}
+
+	inline ClayEngine::TimePoint::duration toDuration(float seconds)
+	{
+		return std::chrono::duration_cast<ClayEngine::TimePoint::duration>(std::chrono::duration<float>(seconds));
+	}
+}
+
+#pragma region Bot Profile
+ClayEngine::BotProfile ClayEngine::BotProfile::Load(String filename)
+{
+	BotProfile profile = {};
+
+	auto json = std::make_unique<Platform::JsonFile>(filename);
+	auto& document = json->GetDocument();
+
+	profile.Server = document.value("server", profile.Server);
+	profile.Port = document.value("port", profile.Port);
+	profile.Bots = document.value("bots", profile.Bots);
+	profile.Threads = document.value("threads", profile.Threads);
+	profile.ConnectRate = document.value("connect_rate", profile.ConnectRate);
+	profile.Compress = document.value("compress", profile.Compress);
+
+	if (document.contains("phases"))
+	{
+		for (auto& element : document["phases"])
+		{
+			BotPhase phase = {};
+			phase.Name = element.value("name", phase.Name);
+			phase.Duration = element.value("duration", phase.Duration);
+			phase.Rate = element.value("rate", phase.Rate);
+			phase.Payload = std::clamp(element.value("payload", phase.Payload), size_t(c_bot_probe_header_size), size_t(c_max_message_size));
+			profile.Phases.push_back(phase);
+		}
+	}
+	if (profile.Phases.empty()) profile.Phases.push_back(BotPhase{});
+
+	if (profile.Bots == 0) throw std::exception("BotProfile ERROR: At least one bot is required");
+	if (profile.ConnectRate <= 0.f) throw std::exception("BotProfile ERROR: connect_rate must be positive");
+
+	return profile;
+}
+#pragma endregion
+
+#pragma region Bot Stats
+void ClayEngine::BotPhaseStats::Merge(const BotPhaseStats& other)
+{
+	RoundTrip.Merge(other.RoundTrip);
+	Sent += other.Sent;
+	Received += other.Received;
+	BytesSent += other.BytesSent;
+	BytesReceived += other.BytesReceived;
+}
+
+void ClayEngine::BotStats::Merge(const BotStats& other)
+{
+	Connect.Merge(other.Connect);
+	Connected += other.Connected;
+	ConnectFailures += other.ConnectFailures;
+	Disconnects += other.Disconnects;
+
+	Phases.resize(std::max(Phases.size(), other.Phases.size()));
+	for (size_t i = 0; i < other.Phases.size(); ++i)
+	{
+		Phases[i].Merge(other.Phases[i]);
+	}
+}
+#pragma endregion
+
+#pragma region Bot Thread Functor
+ClayEngine::BotThreadFunctor::BotThreadFunctor(const BotProfile* profile, size_t first, size_t count, TimePoint start, BotStats* stats)
+	: m_profile{ profile }
+	, m_first{ first }
+	, m_count{ count }
+	, m_start{ start }
+	, m_stats{ stats }
+{
+	// The script starts once the last bot of the whole swarm has had its turn to connect
+	m_script_start = m_start + toDuration(float(m_profile->Bots) / m_profile->ConnectRate);
+	m_script_end = m_script_start;
+	for (auto& phase : m_profile->Phases)
+	{
+		m_script_end += toDuration(phase.Duration);
+	}
+}
+
+void ClayEngine::BotThreadFunctor::operator()()
+{
+	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
+	m_hints = ns->GetClientConnectionHints();
+	m_connect_timeout = ns->GetClientConnectionTimeout() > 0 ? ns->GetClientConnectionTimeout() : c_connect_timeout_default;
+	m_transforms = ns->GetTransformPipeline();
+
+	if (InetPtonA(AF_INET, m_profile->Server.c_str(), &m_sin.sin_addr.s_addr) != 1) throw std::exception("BotSwarm ERROR: InetPtonA() invalid server address");
+	m_sin.sin_family = AF_INET;
+	m_sin.sin_port = htons(m_profile->Port);
+
+	m_stats->Phases.resize(m_profile->Phases.size());
+	m_random.seed(uint32_t(m_first) ^ std::random_device{}());
+	m_reactor = MakeReactorBackend();
+
+	m_bots.resize(m_count);
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		// Socket handles double as reactor tokens, zero is reserved so they are offset by one
+		auto& socket = m_bots[i].m_socket;
+		socket.m_handle = ConnectionHandle(i + 1);
+		socket.m_recv = std::make_unique<ReceiveRing>();
+		socket.m_send = std::make_unique<SendQueue>();
+		socket.m_stats = std::make_unique<ConnectionStats>();
+		socket.m_send->Bind(socket.m_handle, socket.m_stats.get());
+	}
+
+	InboundContext inbound = {};
+	inbound.Handler = [this](ConnectionHandle h, const MessageView& view) { receiveProbe(size_t(h) - 1, view); };
+	inbound.Transforms = m_transforms;
+	inbound.Scratch = std::make_unique<uint8_t[]>(size_t(c_transform_scratch_size));
+
+	ReactorEvents events = {};
+	events.reserve(c_reactor_max_events);
+
+	auto stop = m_script_end + Milliseconds(c_bot_drain_time);
+	while (true)
+	{
+		auto now = Clock::now();
+		if (now >= stop) break;
+
+		while (m_next_connect < m_count && connectTime(m_next_connect) <= now)
+		{
+			beginConnect(m_next_connect++, now);
+		}
+
+		events.clear();
+		if (m_reactor->Wait(events, getWaitTimeout(now)) == SOCKET_ERROR) continue;
+
+		now = Clock::now();
+		for (auto& element : events)
+		{
+			auto index = size_t(element.Token) - 1;
+			auto& bot = m_bots[index];
+
+			if (bot.m_state == Bot::State::Connecting)
+			{
+				finishConnect(index, now);
+				continue;
+			}
+			if (bot.m_state != Bot::State::Connected) continue;
+
+			auto alive = true;
+			if (element.Flags & (c_reactor_readable | c_reactor_closed)) alive = bot.m_socket.Receive(inbound);
+			if (alive && (element.Flags & c_reactor_writable)) alive = bot.m_socket.Flush(m_reactor.get());
+			if (!alive) closeBot(index, false);
+		}
+
+		// Attempts that never completed count as failures, a refused connect isn't always reported
+		for (size_t i = 0; i < m_connecting.size();)
+		{
+			auto index = m_connecting[i];
+			if (m_bots[index].m_state == Bot::State::Connecting && now - m_bots[index].m_connect_start < Milliseconds(m_connect_timeout))
+			{
+				++i;
+				continue;
+			}
+
+			if (m_bots[index].m_state == Bot::State::Connecting) closeBot(index, true);
+			m_connecting[i] = m_connecting.back();
+			m_connecting.pop_back();
+		}
+
+		sendProbes(now);
+	}
+
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		if (m_bots[i].m_state == Bot::State::Connected || m_bots[i].m_state == Bot::State::Connecting)
+		{
+			m_reactor->Remove(m_bots[i].m_socket.m_s);
+			shutdown(m_bots[i].m_socket.m_s, SD_BOTH);
+			closesocket(m_bots[i].m_socket.m_s);
+		}
+	}
+}
+
+ClayEngine::TimePoint ClayEngine::BotThreadFunctor::connectTime(size_t index)
+{
+	return m_start + toDuration(float(m_first + index) / m_profile->ConnectRate);
+}
+
+int ClayEngine::BotThreadFunctor::phaseAt(TimePoint now)
+{
+	if (now < m_script_start) return -1;
+
+	auto end = m_script_start;
+	for (size_t i = 0; i < m_profile->Phases.size(); ++i)
+	{
+		end += toDuration(m_profile->Phases[i].Duration);
+		if (now < end) return int(i);
+	}
+	return -1;
+}
+
+void ClayEngine::BotThreadFunctor::beginConnect(size_t index, TimePoint now)
+{
+	auto& bot = m_bots[index];
+	bot.m_connect_start = now;
+
+	auto& s = bot.m_socket.m_s;
+	s = socket(m_hints.ai_family, m_hints.ai_socktype, m_hints.ai_protocol);
+	if (s == INVALID_SOCKET)
+	{
+		++m_stats->ConnectFailures;
+		bot.m_state = Bot::State::Closed;
+		return;
+	}
+
+	u_long argp = 1ul;
+	ioctlsocket(s, FIONBIO, &argp);
+
+	if (connect(s, (SOCKADDR*)&m_sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+	{
+		auto error = WSAGetLastError();
+		if (error != WSAEWOULDBLOCK && error != WSAEINPROGRESS)
+		{
+			closeBot(index, true);
+			return;
+		}
+	}
+
+	bot.m_state = Bot::State::Connecting;
+	bot.m_socket.m_want_write = true;
+	m_reactor->Add(s, bot.m_socket.m_handle, c_reactor_writable);
+	m_connecting.push_back(index);
+}
+
+void ClayEngine::BotThreadFunctor::finishConnect(size_t index, TimePoint now)
+{
+	auto& bot = m_bots[index];
+
+	int error = 0;
+	int length = sizeof(error);
+	if (getsockopt(bot.m_socket.m_s, SOL_SOCKET, SO_ERROR, (char*)&error, &length) == SOCKET_ERROR || error != 0)
+	{
+		closeBot(index, true);
+		return;
+	}
+
+	bot.m_state = Bot::State::Connected;
+	bot.m_socket.m_want_write = false;
+	m_reactor->Modify(bot.m_socket.m_s, bot.m_socket.m_handle, c_reactor_readable);
+
+	m_stats->Connect.Record(toMicroseconds(bot.m_connect_start, now));
+	++m_stats->Connected;
+
+	// Spread each bot's first probe across one interval of the opening phase so the swarm doesn't send in lockstep
+	auto rate = m_profile->Phases.front().Rate;
+	auto interval = (rate > 0.f) ? 1.f / rate : 1.f;
+	bot.m_next_send = std::max(now, m_script_start) + toDuration(std::uniform_real_distribution<float>(0.f, interval)(m_random));
+	m_schedule.emplace(bot.m_next_send, index);
+}
+
+void ClayEngine::BotThreadFunctor::closeBot(size_t index, bool failed)
+{
+	auto& bot = m_bots[index];
+	if (bot.m_state == Bot::State::Closed) return;
+
+	if (failed) ++m_stats->ConnectFailures;
+	else ++m_stats->Disconnects;
+
+	m_reactor->Remove(bot.m_socket.m_s);
+	closesocket(bot.m_socket.m_s);
+	bot.m_socket.m_s = INVALID_SOCKET;
+	bot.m_state = Bot::State::Closed;
+}
+
+void ClayEngine::BotThreadFunctor::sendProbes(TimePoint now)
+{
+	auto phase = phaseAt(now);
+
+	while (!m_schedule.empty() && m_schedule.top().first <= now)
+	{
+		auto index = m_schedule.top().second;
+		m_schedule.pop();
+
+		auto& bot = m_bots[index];
+		if (bot.m_state != Bot::State::Connected) continue;
+
+		if (phase < 0)
+		{
+			// Between the ramp and the script, or after it, check back when the script starts
+			if (now < m_script_start) m_schedule.emplace(m_script_start, index);
+			continue;
+		}
+
+		auto& script = m_profile->Phases[size_t(phase)];
+		if (script.Rate <= 0.f)
+		{
+			bot.m_next_send = now + Milliseconds(100);
+			m_schedule.emplace(bot.m_next_send, index);
+			continue;
+		}
+
+		m_probe.assign(script.Payload, 0);
+		auto stamp = toNanoseconds(now);
+		for (int i = 0; i < 8; ++i) m_probe[size_t(i)] = uint8_t(stamp >> (8 * i));
+		m_probe[8] = uint8_t(phase);
+
+		auto status = bot.m_socket.m_send->Enqueue(bot.m_socket.m_handle, c_opcode_echo, 0, m_probe.data(), m_probe.size(), m_transforms);
+		if (status == EnqueueStatus::FlushRequired) m_dirty.push_back(index);
+
+		auto& stats = m_stats->Phases[size_t(phase)];
+		++stats.Sent;
+		stats.BytesSent += m_probe.size();
+
+		// Keep to the schedule rather than to when we got round to it, but never try to catch up a backlog
+		bot.m_next_send = std::max(bot.m_next_send + toDuration(1.f / script.Rate), now);
+		m_schedule.emplace(bot.m_next_send, index);
+	}
+
+	for (auto index : m_dirty)
+	{
+		auto& bot = m_bots[index];
+		bot.m_socket.m_send->TakeFlushRequest();
+		if (!bot.m_socket.Flush(m_reactor.get())) closeBot(index, false);
+	}
+	m_dirty.clear();
+}
+
+void ClayEngine::BotThreadFunctor::receiveProbe(size_t index, const MessageView& view)
+{
+	if (view.Opcode == c_opcode_keepalive)
+	{
+		// Answer so the server doesn't drop a bot that is between phases, it goes out with the next probes
+		auto& bot = m_bots[index];
+		if (bot.m_socket.m_send->Enqueue(bot.m_socket.m_handle, c_opcode_keepalive, 0, nullptr, 0, m_transforms) == EnqueueStatus::FlushRequired) m_dirty.push_back(index);
+		return;
+	}
+
+	if (view.Opcode != c_opcode_echo || view.Length < c_bot_probe_header_size) return;
+
+	uint64_t stamp = 0;
+	for (int i = 0; i < 8; ++i) stamp |= uint64_t(view.Data[i]) << (8 * i);
+	auto phase = size_t(view.Data[8]);
+	if (phase >= m_stats->Phases.size()) return;
+
+	auto now = toNanoseconds(Clock::now());
+	auto& stats = m_stats->Phases[phase];
+	stats.RoundTrip.Record((now > stamp) ? (now - stamp) / 1000 : 0);
+	++stats.Received;
+	stats.BytesReceived += view.Length;
+}
+
+int ClayEngine::BotThreadFunctor::getWaitTimeout(TimePoint now)
+{
+	auto next = m_script_end + Milliseconds(c_bot_drain_time);
+	if (m_next_connect < m_count) next = std::min(next, connectTime(m_next_connect));
+	if (!m_schedule.empty()) next = std::min(next, m_schedule.top().first);
+	if (!m_connecting.empty()) next = std::min(next, now + Milliseconds(100));
+
+	auto remaining = std::chrono::duration_cast<Milliseconds>(next - now).count();
+	return int(std::clamp<int64_t>(remaining, 0, 1000));
+}
+#pragma endregion
+
+#pragma region Bot Swarm
+ClayEngine::BotSwarm::BotSwarm(BotProfile profile)
+	: m_profile{ profile }
+{
+}
+
+void ClayEngine::BotSwarm::Run()
+{
+	auto threads = m_profile.Threads ? m_profile.Threads : size_t(std::max(1u, std::thread::hardware_concurrency()));
+	threads = std::min(threads, m_profile.Bots);
+	m_thread_stats.resize(threads);
+
+	std::stringstream ss;
+	ss << "BotSwarm INFO: " << m_profile.Bots << " bots on " << threads << " threads against " << m_profile.Server << ":" << m_profile.Port;
+	WriteLine(ss.str());
+
+	// Bots are dealt out in contiguous slices, every thread ramps its slice in its place in the global order
+	auto start = Clock::now();
+	Threads workers = {};
+	size_t first = 0;
+	for (size_t i = 0; i < threads; ++i)
+	{
+		auto count = m_profile.Bots / threads + ((i < m_profile.Bots % threads) ? 1 : 0);
+		workers.emplace_back(BotThreadFunctor(&m_profile, first, count, start, &m_thread_stats[i]));
+		first += count;
+	}
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	m_stats = {};
+	for (auto& stats : m_thread_stats)
+	{
+		m_stats.Merge(stats);
+	}
+}
+
+void ClayEngine::BotSwarm::WriteReport()
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1);
+
+	ss << "Connect: " << m_stats.Connected << " ok, " << m_stats.ConnectFailures << " failed, " << m_stats.Disconnects << " dropped" << std::endl;
+	ss << "Connect time (us): p50 " << m_stats.Connect.GetPercentile(50.0)
+		<< " p99 " << m_stats.Connect.GetPercentile(99.0)
+		<< " p99.9 " << m_stats.Connect.GetPercentile(99.9)
+		<< " max " << m_stats.Connect.GetMax() << std::endl;
+
+	for (size_t i = 0; i < m_stats.Phases.size() && i < m_profile.Phases.size(); ++i)
+	{
+		auto& phase = m_profile.Phases[i];
+		auto& stats = m_stats.Phases[i];
+		auto seconds = std::max(double(phase.Duration), 0.001);
+
+		ss << "Phase " << phase.Name << " (" << phase.Duration << " s, " << phase.Rate << "/s per bot, " << phase.Payload << " B)" << std::endl;
+		ss << "  sent " << stats.Sent << " received " << stats.Received
+			<< " (" << double(stats.Received) / seconds << " msg/s, " << double(stats.BytesReceived) / seconds / 1024.0 << " KiB/s)" << std::endl;
+		ss << "  round trip (us): p50 " << stats.RoundTrip.GetPercentile(50.0)
+			<< " p99 " << stats.RoundTrip.GetPercentile(99.0)
+			<< " p99.9 " << stats.RoundTrip.GetPercentile(99.9)
+			<< " max " << stats.RoundTrip.GetMax()
+			<< " mean " << stats.RoundTrip.GetMean() << std::endl;
+	}
+
+	WriteLine(ss.str());
+}
+#pragma endregion
@@ -0,0 +1,177 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Bot Swarm Class Library (C) 2022 Epoch Meridian, LLC.           */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "Histogram.h"
+#include "NetworkSystem.h"
+
+namespace ClayEngine
+{
+	using namespace ClayEngine;
+	using namespace ClayEngine::Networking;
+
+	constexpr auto c_bot_profile_json = "botprofile.json";
+
+	/// <summary>
+	/// Every echo probe starts with [send time ns:64][phase:8], the rest is padding up to the phase payload size
+	/// </summary>
+	constexpr auto c_bot_probe_header_size = 9ull;
+
+	/// <summary>
+	/// How long after the last phase ends the swarm keeps listening for echoes still in flight
+	/// </summary>
+	constexpr auto c_bot_drain_time = 2000; // ms
+
+	/// <summary>
+	/// One step of the traffic script, every connected bot sends Rate echo probes per second of Payload bytes
+	/// </summary>
+	struct BotPhase
+	{
+		String Name = "steady";
+		float Duration = 10.f; // Seconds
+		float Rate = 10.f; // Probes per second per bot
+		size_t Payload = 64; // Bytes
+	};
+
+	/// <summary>
+	/// The whole load test. Bots connect at ConnectRate per second; the script starts once they all have had
+	/// their turn, so every phase runs against the full population.
+	/// </summary>
+	struct BotProfile
+	{
+		String Server = "127.0.0.1";
+		USHORT Port = 48000;
+		size_t Bots = 1000;
+		size_t Threads = 0; // Zero uses one per hardware thread
+		float ConnectRate = 500.f; // Connects per second across the swarm
+		bool Compress = true; // Must match the server's transforms
+		std::vector<BotPhase> Phases = {};
+
+		/// <summary>
+		/// Read a profile from JSON, any key that is missing keeps its default
+		/// </summary>
+		static BotProfile Load(String filename);
+	};
+
+	/// <summary>
+	/// Measurements from one phase, merged across threads for the report. Round trips are in microseconds.
+	/// </summary>
+	struct BotPhaseStats
+	{
+		Histogram RoundTrip = {};
+		uint64_t Sent = 0;
+		uint64_t Received = 0;
+		uint64_t BytesSent = 0;
+		uint64_t BytesReceived = 0;
+
+		void Merge(const BotPhaseStats& other);
+	};
+
+	struct BotStats
+	{
+		Histogram Connect = {}; // Microseconds from connect() to writable
+		uint64_t Connected = 0;
+		uint64_t ConnectFailures = 0;
+		uint64_t Disconnects = 0;
+		std::vector<BotPhaseStats> Phases = {};
+
+		void Merge(const BotStats& other);
+	};
+
+	/// <summary>
+	/// A simulated client, the stream socket and framing are the same ClientSocket the client connection uses
+	/// </summary>
+	struct Bot
+	{
+		enum class State
+		{
+			Idle,
+			Connecting,
+			Connected,
+			Closed,
+		};
+
+		State m_state = State::Idle;
+		ClientSocket m_socket = {};
+		TimePoint m_connect_start = {};
+		TimePoint m_next_send = {};
+	};
+
+	/// <summary>
+	/// Thread entry point for a slice of the swarm. One reactor multiplexes all of the slice's sockets, so a
+	/// handful of threads can drive thousands of connections.
+	/// </summary>
+	struct BotThreadFunctor
+	{
+		BotThreadFunctor(const BotProfile* profile, size_t first, size_t count, TimePoint start, BotStats* stats);
+
+		/// <summary>
+		/// Runs the slice through the whole profile and returns, closing every socket
+		/// </summary>
+		void operator()();
+	private:
+		using SendSchedule = std::priority_queue<std::pair<TimePoint, size_t>, std::vector<std::pair<TimePoint, size_t>>, std::greater<std::pair<TimePoint, size_t>>>;
+
+		const BotProfile* m_profile = nullptr;
+		size_t m_first = 0; // Index of our first bot in the whole swarm, spaces out the connect ramp
+		size_t m_count = 0;
+		TimePoint m_start = {};
+		TimePoint m_script_start = {};
+		TimePoint m_script_end = {};
+		BotStats* m_stats = nullptr;
+
+		ReactorBackendPtr m_reactor = nullptr;
+		std::vector<Bot> m_bots = {};
+		SOCKADDR_IN m_sin = {};
+		ADDRINFO m_hints = {};
+		int m_connect_timeout = c_connect_timeout_default;
+		TransformPipelineRaw m_transforms = nullptr;
+
+		size_t m_next_connect = 0;
+		std::vector<size_t> m_connecting = {};
+		SendSchedule m_schedule = {};
+		std::vector<size_t> m_dirty = {}; // Bots with freshly queued probes or keepalive replies
+		std::vector<uint8_t> m_probe = {};
+		std::mt19937 m_random;
+
+		TimePoint connectTime(size_t index);
+		int phaseAt(TimePoint now);
+
+		void beginConnect(size_t index, TimePoint now);
+		void finishConnect(size_t index, TimePoint now);
+		void closeBot(size_t index, bool failed);
+		void sendProbes(TimePoint now);
+		void receiveProbe(size_t index, const MessageView& view);
+		int getWaitTimeout(TimePoint now);
+	};
+
+	/// <summary>
+	/// Headless load generator for the listen server. Splits the bots across worker threads, runs the profile
+	/// to completion and reports connect time, round trip percentiles and throughput for every phase.
+	/// </summary>
+	class BotSwarm
+	{
+		using Threads = std::vector<std::thread>;
+
+		BotProfile m_profile = {};
+		std::vector<BotStats> m_thread_stats = {};
+		BotStats m_stats = {};
+
+	public:
+		BotSwarm(BotProfile profile);
+		~BotSwarm() = default;
+
+		/// <summary>
+		/// Blocks until every phase has run and the echoes in flight have drained
+		/// </summary>
+		void Run();
+
+		void WriteReport();
+	};
+	using BotSwarmPtr = std::unique_ptr<BotSwarm>;
+}
@@ -0,0 +1,184 @@
+#include "pch.h"
+#include "MessageBenchmark.h"
+#include "Storage.h"
+
+namespace
+{
+	using namespace ClayEngine;
+
+	// Results are folded in here so the optimizer can't drop work whose output is never looked at
+	volatile uint64_t g_sink = 0;
+
+	inline uint64_t toNanoseconds(TimePoint from, TimePoint to)
+	{
+		return uint64_t(std::max<int64_t>(std::chrono::duration_cast<Nanoseconds>(to - from).count(), 0));
+	}
+
+	bool isSame(const BenchEntityMessage& a, const BenchEntityMessage& b)
+	{
+		auto same = a.Entity == b.Entity && a.Heading == b.Heading && a.Health == b.Health && a.Name == b.Name && a.Effects == b.Effects && a.Team == b.Team;
+		same = same && a.Position.x == b.Position.x && a.Position.y == b.Position.y && a.Position.z == b.Position.z;
+		same = same && a.Velocity.x == b.Velocity.x && a.Velocity.y == b.Velocity.y && a.Velocity.z == b.Velocity.z;
+		same = same && a.Items.size() == b.Items.size();
+		for (size_t i = 0; same && i < a.Items.size(); ++i) same = a.Items[i].Id == b.Items[i].Id && a.Items[i].Count == b.Items[i].Count;
+		return same;
+	}
+
+	void writeJson(const BenchEntityMessage& message, Platform::Document& document)
+	{
+		document["entity"] = message.Entity;
+		document["position"] = { message.Position.x, message.Position.y, message.Position.z };
+		document["velocity"] = { message.Velocity.x, message.Velocity.y, message.Velocity.z };
+		document["heading"] = message.Heading;
+		document["health"] = message.Health;
+		document["name"] = message.Name;
+		document["effects"] = message.Effects;
+
+		auto& items = document["items"] = Platform::Document::array();
+		for (auto& item : message.Items) items.push_back({ { "id", item.Id }, { "count", item.Count } });
+
+		if (message.Team.has_value()) document["team"] = *message.Team;
+	}
+
+	void readJson(const Platform::Document& document, BenchEntityMessage& message)
+	{
+		message.Entity = document.at("entity").get<uint32_t>();
+
+		auto& position = document.at("position");
+		message.Position = DirectX::XMFLOAT3(position.at(0).get<float>(), position.at(1).get<float>(), position.at(2).get<float>());
+		auto& velocity = document.at("velocity");
+		message.Velocity = DirectX::XMFLOAT3(velocity.at(0).get<float>(), velocity.at(1).get<float>(), velocity.at(2).get<float>());
+
+		message.Heading = document.at("heading").get<float>();
+		message.Health = document.at("health").get<uint16_t>();
+		message.Name = document.at("name").get<String>();
+		message.Effects = document.at("effects").get<std::vector<uint32_t>>();
+
+		auto& items = document.at("items");
+		message.Items.resize(items.size());
+		for (size_t i = 0; i < items.size(); ++i)
+		{
+			message.Items[i].Id = items[i].at("id").get<uint32_t>();
+			message.Items[i].Count = items[i].at("count").get<uint16_t>();
+		}
+
+		if (document.contains("team")) message.Team = document.at("team").get<uint8_t>();
+		else message.Team.reset();
+	}
+}
+
+#pragma region Message Benchmark
+ClayEngine::MessageBenchmark::MessageBenchmark(uint64_t iterations)
+	: m_iterations{ std::max(iterations, uint64_t(c_bench_batch_size)) }
+{
+	m_binary.Name = "Reflected binary";
+	m_json.Name = "nlohmann::json";
+
+	m_message.Entity = 0x00012345;
+	m_message.Position = DirectX::XMFLOAT3(1024.25f, 12.5f, -768.75f);
+	m_message.Velocity = DirectX::XMFLOAT3(3.5f, 0.f, -1.25f);
+	m_message.Heading = 1.5707964f;
+	m_message.Health = 870;
+	m_message.Name = "Ranger of the Northern Reach";
+	m_message.Effects = { 17, 203, 4096, 65541 };
+	m_message.Items = { { 1001, 1 }, { 1002, 20 }, { 2050, 3 }, { 9000, 250 } };
+	m_message.Team = uint8_t(3);
+}
+
+void ClayEngine::MessageBenchmark::runBinary()
+{
+	std::array<uint8_t, c_max_message_size> buffer = {};
+
+	for (uint64_t done = 0; done < m_iterations; done += c_bench_batch_size)
+	{
+		auto start = Clock::now();
+		for (size_t i = 0; i < c_bench_batch_size; ++i)
+		{
+			m_binary.Bytes = EncodeMessage(m_message, buffer.data(), buffer.size());
+			g_sink = g_sink + buffer[m_binary.Bytes - 1];
+		}
+		m_binary.Encode.Record(toNanoseconds(start, Clock::now()) / c_bench_batch_size);
+	}
+
+	BenchEntityMessage decoded = {};
+	for (uint64_t done = 0; done < m_iterations; done += c_bench_batch_size)
+	{
+		auto start = Clock::now();
+		for (size_t i = 0; i < c_bench_batch_size; ++i)
+		{
+			if (!DecodeMessage(buffer.data(), m_binary.Bytes, decoded)) throw std::exception("MessageBenchmark ERROR: Binary decode failed");
+			g_sink = g_sink + decoded.Entity;
+		}
+		m_binary.Decode.Record(toNanoseconds(start, Clock::now()) / c_bench_batch_size);
+	}
+
+	if (!isSame(m_message, decoded)) throw std::exception("MessageBenchmark ERROR: Binary round trip mismatch");
+}
+
+void ClayEngine::MessageBenchmark::runJson()
+{
+	String text = {};
+
+	for (uint64_t done = 0; done < m_iterations; done += c_bench_batch_size)
+	{
+		auto start = Clock::now();
+		for (size_t i = 0; i < c_bench_batch_size; ++i)
+		{
+			Platform::Document document = {};
+			writeJson(m_message, document);
+			text = document.dump();
+			g_sink = g_sink + uint8_t(text.back());
+		}
+		m_json.Encode.Record(toNanoseconds(start, Clock::now()) / c_bench_batch_size);
+	}
+	m_json.Bytes = text.size();
+
+	BenchEntityMessage decoded = {};
+	for (uint64_t done = 0; done < m_iterations; done += c_bench_batch_size)
+	{
+		auto start = Clock::now();
+		for (size_t i = 0; i < c_bench_batch_size; ++i)
+		{
+			readJson(Platform::Document::parse(text), decoded);
+			g_sink = g_sink + decoded.Entity;
+		}
+		m_json.Decode.Record(toNanoseconds(start, Clock::now()) / c_bench_batch_size);
+	}
+
+	if (!isSame(m_message, decoded)) throw std::exception("MessageBenchmark ERROR: JSON round trip mismatch");
+}
+
+void ClayEngine::MessageBenchmark::Run()
+{
+	std::stringstream ss;
+	ss << "MessageBenchmark INFO: " << m_iterations << " encodes and decodes per serializer";
+	WriteLine(ss.str());
+
+	runBinary();
+	runJson();
+}
+
+void ClayEngine::MessageBenchmark::WriteReport()
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1);
+
+	for (auto result : { &m_binary, &m_json })
+	{
+		ss << result->Name << " (" << result->Bytes << " B)" << std::endl;
+		ss << "  encode (ns): p50 " << result->Encode.GetPercentile(50.0)
+			<< " p99 " << result->Encode.GetPercentile(99.0)
+			<< " mean " << result->Encode.GetMean() << std::endl;
+		ss << "  decode (ns): p50 " << result->Decode.GetPercentile(50.0)
+			<< " p99 " << result->Decode.GetPercentile(99.0)
+			<< " mean " << result->Decode.GetMean() << std::endl;
+	}
+
+	auto ratio = [](double json, double binary) { return binary > 0.0 ? json / binary : 0.0; };
+	ss << "Binary vs JSON: " << ratio(double(m_json.Bytes), double(m_binary.Bytes)) << "x smaller, encode "
+		<< ratio(m_json.Encode.GetMean(), m_binary.Encode.GetMean()) << "x faster, decode "
+		<< ratio(m_json.Decode.GetMean(), m_binary.Decode.GetMean()) << "x faster";
+
+	WriteLine(ss.str());
+}
+#pragma endregion
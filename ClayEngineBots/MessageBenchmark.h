@@ -0,0 +1,114 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Message Benchmark Class Library (C) 2022 Epoch Meridian, LLC.   */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "Histogram.h"
+#include "NetworkMessages.h"
+
+namespace ClayEngine
+{
+	using namespace ClayEngine;
+	using namespace ClayEngine::Networking;
+
+	constexpr auto c_bench_messages_switch = L"--bench-messages";
+	constexpr auto c_bench_iterations_default = 1000000ull;
+
+	/// <summary>
+	/// Operations timed together, one clock read per batch keeps the timer out of the figures
+	/// </summary>
+	constexpr auto c_bench_batch_size = 1000ull;
+
+	/// <summary>
+	/// Nested record used by the benchmark message, exercises the length prefixed nested path
+	/// </summary>
+	struct BenchItemMessage
+	{
+		static constexpr uint8_t Version = 1;
+
+		uint32_t Id = 0;
+		uint16_t Count = 0;
+
+		static constexpr auto GetFields()
+		{
+			return std::make_tuple(
+				MakeMessageField(&BenchItemMessage::Id),
+				MakeMessageField(&BenchItemMessage::Count));
+		}
+	};
+
+	/// <summary>
+	/// A typical entity update: scalars, vectors, a name, an optional field from a later version and nested items
+	/// </summary>
+	struct BenchEntityMessage
+	{
+		static constexpr uint8_t Opcode = 0x40;
+		static constexpr uint8_t Version = 2;
+
+		uint32_t Entity = 0;
+		DirectX::XMFLOAT3 Position = {};
+		DirectX::XMFLOAT3 Velocity = {};
+		float Heading = 0.f;
+		uint16_t Health = 0;
+		String Name = {};
+		std::vector<uint32_t> Effects = {};
+		std::vector<BenchItemMessage> Items = {};
+		std::optional<uint8_t> Team = {};
+
+		static constexpr auto GetFields()
+		{
+			return std::make_tuple(
+				MakeMessageField(&BenchEntityMessage::Entity),
+				MakeMessageField(&BenchEntityMessage::Position),
+				MakeMessageField(&BenchEntityMessage::Velocity),
+				MakeMessageField(&BenchEntityMessage::Heading),
+				MakeMessageField(&BenchEntityMessage::Health),
+				MakeMessageField(&BenchEntityMessage::Name),
+				MakeMessageField(&BenchEntityMessage::Effects),
+				MakeMessageField(&BenchEntityMessage::Items),
+				MakeMessageField(&BenchEntityMessage::Team, 2));
+		}
+	};
+
+	/// <summary>
+	/// Timings for one serializer, ns per operation as recorded per batch
+	/// </summary>
+	struct BenchResult
+	{
+		String Name = {};
+		size_t Bytes = 0;
+		Histogram Encode = {};
+		Histogram Decode = {};
+	};
+
+	/// <summary>
+	/// Compares the reflected binary serializers against the nlohmann::json Document path the rest of the
+	/// engine uses, encoding and decoding the same message and checking that both round trip
+	/// </summary>
+	class MessageBenchmark
+	{
+		uint64_t m_iterations = c_bench_iterations_default;
+		BenchEntityMessage m_message = {};
+		BenchResult m_binary = {};
+		BenchResult m_json = {};
+
+		void runBinary();
+		void runJson();
+
+	public:
+		MessageBenchmark(uint64_t iterations);
+		~MessageBenchmark() = default;
+
+		/// <summary>
+		/// Blocks until both serializers have run every iteration, throws if either fails to round trip
+		/// </summary>
+		void Run();
+
+		void WriteReport();
+	};
+	using MessageBenchmarkPtr = std::unique_ptr<MessageBenchmark>;
+}
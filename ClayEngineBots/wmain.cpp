@@ -0,0 +1,64 @@
+#include "pch.h"
+
+#include "ClayEngine.h"
+#include "NetworkSystem.h"
+#include "BotSwarm.h"
+#include "MessageBenchmark.h"
+
+using namespace ClayEngine;
+using namespace ClayEngine::Networking;
+
+namespace
+{
+	NetworkSystemPtr g_network = nullptr;
+	BotSwarmPtr g_swarm = nullptr;
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+	// ClayEngineBots --bench-messages [iterations] measures the message serializers offline, no server needed
+	if (argc > 1 && std::wstring(argv[1]) == c_bench_messages_switch)
+	{
+		try
+		{
+			MessageBenchmark benchmark(argc > 2 ? std::stoull(argv[2]) : c_bench_iterations_default);
+			benchmark.Run();
+			benchmark.WriteReport();
+		}
+		catch (std::exception ex)
+		{
+			std::cout << ex.what();
+			return -1;
+		}
+		return 0;
+	}
+
+	BotProfile profile = {};
+	try
+	{
+		profile = BotProfile::Load(argc > 1 ? ToString(argv[1]) : String(c_bot_profile_json));
+	}
+	catch (std::exception ex)
+	{
+		std::cout << ex.what();
+		return -1;
+	}
+
+	g_network = Services::MakeService<NetworkSystem>();
+	g_network->SetClientConnectionHints(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	g_network->SetClientConnectionPort(profile.Port);
+	if (profile.Compress) g_network->AddTransform(std::make_unique<LZTransform>());
+
+	g_swarm = std::make_unique<BotSwarm>(profile);
+	g_swarm->Run();
+	g_swarm->WriteReport();
+
+	g_swarm.reset();
+	g_swarm = nullptr;
+
+	Services::RemoveService<NetworkSystem>();
+	g_network.reset();
+	g_network = nullptr;
+
+	return 0;
+}
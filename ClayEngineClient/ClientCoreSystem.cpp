@@ -119,6 +119,7 @@ void ClientCoreSystem::OnStateChanged()
 			m_network = Services::MakeService<ClayEngine::Networking::NetworkSystem>();
 			m_network->SetClientConnectionHints(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 			m_network->SetClientConnectionPort(48000);
+			m_network->AddTransform(std::make_unique<ClayEngine::Networking::LZTransform>());
 			//m_network->StartClientConnection("73.210.118.242");
 		}
 		break;
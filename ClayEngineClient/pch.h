@@ -105,13 +105,18 @@
 #include <thread>
 #include <future>
 #include <mutex>
+#include <atomic>
 
 #include <vector>
 #include <tuple>
 #include <array>
 #include <list>
+#include <deque>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <set>
+#include <random>
 
 #include <string>
 #include <sstream>
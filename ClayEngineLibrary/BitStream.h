@@ -0,0 +1,326 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Bit Stream Library (C) 2022 Epoch Meridian, LLC.                */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+
+namespace ClayEngine
+{
+	/// <summary>
+	/// Number of bits needed to hold every value in [0, range]
+	/// </summary>
+	constexpr uint32_t BitsRequired(uint32_t range)
+	{
+		uint32_t bits = 0;
+		while (bits < 32 && (range >> bits) != 0) ++bits;
+		return bits;
+	}
+
+	/// <summary>
+	/// Map a float clamped into [min, max] onto the integers [0, 2^bits - 1], rounding to the nearest step. This
+	/// is the general form of Voxel::EncodeVoxelVector; both ends have to agree on min, max and bits.
+	/// </summary>
+	inline uint32_t QuantizeFloat(float value, float min, float max, uint32_t bits)
+	{
+		auto steps = float((1ull << bits) - 1);
+		auto t = std::clamp((value - min) / (max - min), 0.f, 1.f);
+		return uint32_t(t * steps + 0.5f);
+	}
+
+	inline float DequantizeFloat(uint32_t value, float min, float max, uint32_t bits)
+	{
+		auto steps = float((1ull << bits) - 1);
+		return min + (float(value) / steps) * (max - min);
+	}
+
+	/// <summary>
+	/// Interleave signed values onto the unsigned integers (0, -1, 1, -2, ...) so that small magnitudes of
+	/// either sign make small varints
+	/// </summary>
+	constexpr uint32_t ZigZagEncode(int32_t value) { return (uint32_t(value) << 1) ^ uint32_t(value >> 31); }
+	constexpr int32_t ZigZagDecode(uint32_t value) { return int32_t(value >> 1) ^ -int32_t(value & 1u); }
+
+	/// <summary>
+	/// Once the largest component of a unit quaternion is dropped, the other three lie within [-1/sqrt(2), 1/sqrt(2)]
+	/// </summary>
+	constexpr auto c_quaternion_component_range = 0.707107f;
+	constexpr auto c_default_quaternion_bits = 10u;
+
+	/// <summary>
+	/// Varints are written in 7 bit groups, each followed by a continuation bit, low group first
+	/// </summary>
+	constexpr auto c_varint_group_bits = 7u;
+	constexpr auto c_max_varint_groups = 5u;
+
+	/// <summary>
+	/// Packs values of any width from 1 to 32 bits into a caller supplied buffer, least significant bit first.
+	/// Bits collect in a 64 bit scratch register and leave it a 32 bit word at a time. Writing past the end of
+	/// the buffer sets the overflow flag and drops the data instead of throwing, check IsOverflowed() once at the end.
+	/// </summary>
+	class BitWriter
+	{
+		uint8_t* m_data = nullptr;
+		size_t m_capacity = 0; // Bytes
+		size_t m_bytes = 0; // Whole bytes flushed out of the scratch register
+		uint64_t m_scratch = 0;
+		uint32_t m_scratch_bits = 0;
+		bool m_overflow = false;
+
+		void writeWord()
+		{
+			if (m_bytes + 4 > m_capacity)
+			{
+				m_overflow = true;
+			}
+			else
+			{
+				auto word = uint32_t(m_scratch);
+				m_data[m_bytes + 0] = uint8_t(word);
+				m_data[m_bytes + 1] = uint8_t(word >> 8);
+				m_data[m_bytes + 2] = uint8_t(word >> 16);
+				m_data[m_bytes + 3] = uint8_t(word >> 24);
+				m_bytes += 4;
+			}
+			m_scratch >>= 32;
+			m_scratch_bits -= 32;
+		}
+
+	public:
+		BitWriter(uint8_t* data, size_t capacity) : m_data(data), m_capacity(capacity) {}
+
+		void WriteBits(uint32_t value, uint32_t bits)
+		{
+			m_scratch |= uint64_t(value & uint32_t((1ull << bits) - 1)) << m_scratch_bits;
+			m_scratch_bits += bits;
+			if (m_scratch_bits >= 32) writeWord();
+		}
+
+		void WriteBool(bool value) { WriteBits(value ? 1u : 0u, 1); }
+
+		/// <summary>
+		/// Write an integer known to lie in [min, max] using only as many bits as that range needs
+		/// </summary>
+		void WriteInteger(int32_t value, int32_t min, int32_t max)
+		{
+			auto range = uint32_t(int64_t(max) - int64_t(min));
+			auto clamped = std::clamp(value, min, max);
+			WriteBits(uint32_t(int64_t(clamped) - int64_t(min)), BitsRequired(range));
+		}
+
+		/// <summary>
+		/// Write a float clamped into [min, max] at a resolution of (max - min) / (2^bits - 1)
+		/// </summary>
+		void WriteFloat(float value, float min, float max, uint32_t bits)
+		{
+			WriteBits(QuantizeFloat(value, min, max, bits), bits);
+		}
+
+		/// <summary>
+		/// Write a rotation as the index of its largest component (2 bits) and the other three at bits each.
+		/// The largest component is rebuilt from the unit length constraint, and its sign is folded away by
+		/// negating the quaternion, which represents the same rotation.
+		/// </summary>
+		void WriteQuaternion(const DirectX::XMFLOAT4& q, uint32_t bits = c_default_quaternion_bits)
+		{
+			float c[4] = { q.x, q.y, q.z, q.w };
+
+			uint32_t largest = 0;
+			for (uint32_t i = 1; i < 4; ++i)
+			{
+				if (std::fabs(c[i]) > std::fabs(c[largest])) largest = i;
+			}
+			auto sign = (c[largest] < 0.f) ? -1.f : 1.f;
+
+			WriteBits(largest, 2);
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				if (i != largest) WriteFloat(c[i] * sign, -c_quaternion_component_range, c_quaternion_component_range, bits);
+			}
+		}
+
+		/// <summary>
+		/// Write an unsigned integer in as few 7 bit groups as it needs, 8 bits on the wire for values below 128
+		/// </summary>
+		void WriteVarint(uint32_t value)
+		{
+			auto groups = std::max(1u, (BitsRequired(value) + c_varint_group_bits - 1) / c_varint_group_bits);
+			for (uint32_t i = 1; i < groups; ++i)
+			{
+				WriteBits((value & 0x7Fu) | 0x80u, c_varint_group_bits + 1);
+				value >>= c_varint_group_bits;
+			}
+			WriteBits(value, c_varint_group_bits + 1);
+		}
+
+		void WriteSignedVarint(int32_t value) { WriteVarint(ZigZagEncode(value)); }
+
+		/// <summary>
+		/// Write raw bytes a 32 bit word at a time, the stream doesn't need to be aligned
+		/// </summary>
+		void WriteBytes(const uint8_t* data, size_t length)
+		{
+			size_t i = 0;
+			for (; i + 4 <= length; i += 4)
+			{
+				WriteBits(uint32_t(data[i]) | (uint32_t(data[i + 1]) << 8) | (uint32_t(data[i + 2]) << 16) | (uint32_t(data[i + 3]) << 24), 32);
+			}
+			for (; i < length; ++i) WriteBits(data[i], 8);
+		}
+
+		/// <summary>
+		/// Pad with zero bits up to the next byte boundary
+		/// </summary>
+		void WriteAlign()
+		{
+			WriteBits(0, (8u - (m_scratch_bits & 7u)) & 7u);
+		}
+
+		/// <summary>
+		/// Push any bits still in the scratch register out to the buffer, padded to a whole byte
+		/// </summary>
+		void Flush()
+		{
+			while (m_scratch_bits > 0)
+			{
+				if (m_bytes >= m_capacity)
+				{
+					m_overflow = true;
+					break;
+				}
+				m_data[m_bytes++] = uint8_t(m_scratch);
+				m_scratch >>= 8;
+				m_scratch_bits = (m_scratch_bits > 8) ? m_scratch_bits - 8 : 0;
+			}
+			m_scratch = 0;
+			m_scratch_bits = 0;
+		}
+
+		size_t GetBitsWritten() const { return m_bytes * 8 + m_scratch_bits; }
+		size_t GetBytesWritten() const { return m_bytes + (m_scratch_bits + 7) / 8; }
+		bool IsOverflowed() const { return m_overflow; }
+	};
+
+	/// <summary>
+	/// Reads back what a BitWriter produced. Reading past the end yields zeros and sets the overflow flag, so a
+	/// decoder can run to completion on a truncated or hostile buffer and check IsOverflowed() once.
+	/// </summary>
+	class BitReader
+	{
+		const uint8_t* m_data = nullptr;
+		size_t m_length = 0; // Bytes
+		size_t m_bytes = 0; // Bytes loaded into the scratch register so far
+		size_t m_bits_read = 0;
+		uint64_t m_scratch = 0;
+		uint32_t m_scratch_bits = 0;
+
+		void readWord()
+		{
+			uint64_t word = 0;
+			if (m_bytes + 4 <= m_length)
+			{
+				auto p = m_data + m_bytes;
+				word = uint64_t(uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24));
+			}
+			else
+			{
+				// Only the tail of the buffer takes the byte at a time path
+				for (uint32_t i = 0; i < 4 && m_bytes + i < m_length; ++i) word |= uint64_t(m_data[m_bytes + i]) << (8 * i);
+			}
+			m_bytes += 4;
+
+			m_scratch |= word << m_scratch_bits;
+			m_scratch_bits += 32;
+		}
+
+	public:
+		BitReader(const uint8_t* data, size_t length) : m_data(data), m_length(length) {}
+
+		uint32_t ReadBits(uint32_t bits)
+		{
+			if (m_scratch_bits < bits) readWord();
+
+			auto value = uint32_t(m_scratch & ((1ull << bits) - 1));
+			m_scratch >>= bits;
+			m_scratch_bits -= bits;
+			m_bits_read += bits;
+			return value;
+		}
+
+		bool ReadBool() { return ReadBits(1) != 0; }
+
+		/// <summary>
+		/// Read an integer written with the same [min, max], out of range values from a hostile stream are clamped
+		/// </summary>
+		int32_t ReadInteger(int32_t min, int32_t max)
+		{
+			auto range = uint32_t(int64_t(max) - int64_t(min));
+			auto value = std::min(ReadBits(BitsRequired(range)), range);
+			return int32_t(int64_t(min) + int64_t(value));
+		}
+
+		float ReadFloat(float min, float max, uint32_t bits)
+		{
+			return DequantizeFloat(ReadBits(bits), min, max, bits);
+		}
+
+		DirectX::XMFLOAT4 ReadQuaternion(uint32_t bits = c_default_quaternion_bits)
+		{
+			auto largest = ReadBits(2);
+
+			float c[4] = {};
+			auto sum = 0.f;
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				if (i == largest) continue;
+				c[i] = ReadFloat(-c_quaternion_component_range, c_quaternion_component_range, bits);
+				sum += c[i] * c[i];
+			}
+			c[largest] = std::sqrt(std::max(0.f, 1.f - sum));
+
+			return DirectX::XMFLOAT4(c[0], c[1], c[2], c[3]);
+		}
+
+		/// <summary>
+		/// Read a varint, a stream that never ends the value is cut off after c_max_varint_groups
+		/// </summary>
+		uint32_t ReadVarint()
+		{
+			uint32_t value = 0;
+			for (uint32_t i = 0; i < c_max_varint_groups; ++i)
+			{
+				auto group = ReadBits(c_varint_group_bits + 1);
+				value |= (group & 0x7Fu) << (c_varint_group_bits * i);
+				if ((group & 0x80u) == 0) break;
+			}
+			return value;
+		}
+
+		int32_t ReadSignedVarint() { return ZigZagDecode(ReadVarint()); }
+
+		void ReadBytes(uint8_t* data, size_t length)
+		{
+			size_t i = 0;
+			for (; i + 4 <= length; i += 4)
+			{
+				auto word = ReadBits(32);
+				data[i + 0] = uint8_t(word);
+				data[i + 1] = uint8_t(word >> 8);
+				data[i + 2] = uint8_t(word >> 16);
+				data[i + 3] = uint8_t(word >> 24);
+			}
+			for (; i < length; ++i) data[i] = uint8_t(ReadBits(8));
+		}
+
+		void ReadAlign()
+		{
+			ReadBits((8u - uint32_t(m_bits_read & 7u)) & 7u);
+		}
+
+		size_t GetBitsRead() const { return m_bits_read; }
+		bool IsOverflowed() const { return m_bits_read > m_length * 8; }
+	};
+}
@@ -0,0 +1,87 @@
+#include "pch.h"
+#include "Histogram.h"
+
+#include <intrin.h>
+
+namespace
+{
+	// Index of the highest set bit, value must be non-zero
+	inline uint32_t highestBit(uint64_t value)
+	{
+		unsigned long index = 0;
+		_BitScanReverse64(&index, value);
+		return uint32_t(index);
+	}
+}
+
+#pragma region Histogram
+ClayEngine::Histogram::Histogram()
+	: m_counts(c_histogram_buckets, 0)
+{
+}
+
+size_t ClayEngine::Histogram::bucketIndex(uint64_t value)
+{
+	if (value < (1ull << c_histogram_sub_bucket_bits)) return size_t(value);
+
+	// Keep the top c_histogram_sub_bucket_bits bits, each shift is another run of half the sub-buckets
+	auto shift = highestBit(value) - (c_histogram_sub_bucket_bits - 1);
+	auto mantissa = value >> shift;
+	return size_t(shift * c_histogram_sub_bucket_half + mantissa);
+}
+
+uint64_t ClayEngine::Histogram::bucketUpperBound(size_t index)
+{
+	if (index < (1ull << c_histogram_sub_bucket_bits)) return uint64_t(index);
+
+	auto shift = uint32_t(index / c_histogram_sub_bucket_half) - 1;
+	auto mantissa = uint64_t(index % c_histogram_sub_bucket_half) + c_histogram_sub_bucket_half;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void ClayEngine::Histogram::Record(uint64_t value)
+{
+	++m_counts[bucketIndex(value)];
+	++m_total;
+	m_min = std::min(m_min, value);
+	m_max = std::max(m_max, value);
+	m_sum += double(value);
+}
+
+void ClayEngine::Histogram::Merge(const Histogram& other)
+{
+	for (size_t i = 0; i < c_histogram_buckets; ++i)
+	{
+		m_counts[i] += other.m_counts[i];
+	}
+	m_total += other.m_total;
+	m_min = std::min(m_min, other.m_min);
+	m_max = std::max(m_max, other.m_max);
+	m_sum += other.m_sum;
+}
+
+void ClayEngine::Histogram::Reset()
+{
+	std::fill(m_counts.begin(), m_counts.end(), 0);
+	m_total = 0;
+	m_min = UINT64_MAX;
+	m_max = 0;
+	m_sum = 0.0;
+}
+
+uint64_t ClayEngine::Histogram::GetPercentile(double percentile) const
+{
+	if (m_total == 0) return 0;
+
+	auto rank = uint64_t(std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * double(m_total)));
+	rank = std::max(rank, uint64_t(1));
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < c_histogram_buckets; ++i)
+	{
+		seen += m_counts[i];
+		if (seen >= rank) return std::min(bucketUpperBound(i), m_max);
+	}
+	return m_max;
+}
+#pragma endregion
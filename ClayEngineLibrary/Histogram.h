@@ -0,0 +1,58 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Histogram Library (C) 2022 Epoch Meridian, LLC.                 */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+
+namespace ClayEngine
+{
+	/// <summary>
+	/// Sub-buckets per power of two, values are recorded to within 1 / 2^(c_histogram_sub_bucket_bits - 1)
+	/// of their true value (under 1%) across the whole 64 bit range
+	/// </summary>
+	constexpr auto c_histogram_sub_bucket_bits = 8u;
+	constexpr auto c_histogram_sub_bucket_half = 1ull << (c_histogram_sub_bucket_bits - 1);
+	constexpr auto c_histogram_buckets = size_t((64 - c_histogram_sub_bucket_bits + 1) * c_histogram_sub_bucket_half + (1ull << c_histogram_sub_bucket_bits));
+
+	/// <summary>
+	/// HDR style log-linear histogram for latencies and sizes. Values below 2^c_histogram_sub_bucket_bits are
+	/// counted exactly, above that every power of two is split into equal sub-buckets so the relative error is
+	/// constant. Recording is a bit scan and an increment, cheap enough for every message. Not thread safe,
+	/// give each thread its own and Merge() them for reporting.
+	/// </summary>
+	class Histogram
+	{
+		std::vector<uint64_t> m_counts;
+		uint64_t m_total = 0;
+		uint64_t m_min = UINT64_MAX;
+		uint64_t m_max = 0;
+		double m_sum = 0.0;
+
+		static size_t bucketIndex(uint64_t value);
+		static uint64_t bucketUpperBound(size_t index);
+
+	public:
+		Histogram();
+
+		void Record(uint64_t value);
+		void Merge(const Histogram& other);
+		void Reset();
+
+		/// <summary>
+		/// Smallest recorded value that at least percentile (0 to 100) percent of recordings are at or below,
+		/// reported as the upper edge of its bucket
+		/// </summary>
+		uint64_t GetPercentile(double percentile) const;
+
+		uint64_t GetCount() const { return m_total; }
+		uint64_t GetMin() const { return m_total ? m_min : 0; }
+		uint64_t GetMax() const { return m_max; }
+		double GetMean() const { return m_total ? m_sum / double(m_total) : 0.0; }
+	};
+	using HistogramPtr = std::unique_ptr<Histogram>;
+	using HistogramRaw = Histogram*;
+}
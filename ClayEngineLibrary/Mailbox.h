@@ -0,0 +1,139 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Mailbox Library (C) 2022 Epoch Meridian, LLC.                   */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_cache_line_size = 64ull;
+
+	/// <summary>
+	/// Bounded lock free queue for many producers and one consumer, with a fixed ring of cells allocated up front
+	/// so nothing allocates once it is built. Every cell carries a sequence number: a producer claims a slot by
+	/// bumping the tail with a CAS, writes the value and then publishes it by advancing the cell's sequence, and
+	/// the consumer only reads a cell whose sequence says it has been published. With a single producer it is
+	/// an SPSC queue and the CAS never retries. A full mailbox refuses the push rather than block the sender.
+	/// </summary>
+	template<typename T>
+	class Mailbox
+	{
+		struct alignas(c_cache_line_size) Cell
+		{
+			std::atomic<size_t> Sequence = 0;
+			T Value = {};
+		};
+		using Cells = std::unique_ptr<Cell[]>;
+
+		Cells m_cells = nullptr;
+		size_t m_mask = 0;
+
+		// Producers and the consumer each get their own cache line
+		alignas(c_cache_line_size) std::atomic<size_t> m_tail = 0;
+		alignas(c_cache_line_size) size_t m_head = 0;
+		alignas(c_cache_line_size) std::atomic<uint64_t> m_rejected = 0;
+
+	public:
+		/// <summary>
+		/// Capacity is rounded up to a power of two, throws if it is zero
+		/// </summary>
+		Mailbox(size_t capacity)
+		{
+			if (capacity == 0) throw std::exception("Mailbox ERROR: Capacity must be positive");
+
+			size_t size = 1;
+			while (size < capacity) size <<= 1;
+
+			m_cells = std::make_unique<Cell[]>(size);
+			m_mask = size - 1;
+			for (size_t i = 0; i < size; ++i) m_cells[i].Sequence.store(i, std::memory_order_relaxed);
+		}
+		Mailbox(Mailbox const&) = delete;
+		Mailbox& operator=(Mailbox const&) = delete;
+		~Mailbox() = default;
+
+		/// <summary>
+		/// Any thread, false if the mailbox is full
+		/// </summary>
+		bool TryPush(const T& value)
+		{
+			auto tail = m_tail.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				auto& cell = m_cells[tail & m_mask];
+				auto sequence = cell.Sequence.load(std::memory_order_acquire);
+				auto lag = intptr_t(sequence) - intptr_t(tail);
+
+				if (lag == 0)
+				{
+					if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+					{
+						cell.Value = value;
+						cell.Sequence.store(tail + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (lag < 0)
+				{
+					// The consumer hasn't freed this cell from the last lap yet
+					m_rejected.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				else
+				{
+					// Another producer took this slot first
+					tail = m_tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/// <summary>
+		/// Consumer thread only, false if the mailbox is empty
+		/// </summary>
+		bool TryPop(T& out)
+		{
+			auto& cell = m_cells[m_head & m_mask];
+			auto sequence = cell.Sequence.load(std::memory_order_acquire);
+			if (intptr_t(sequence) - intptr_t(m_head + 1) < 0) return false;
+
+			out = std::move(cell.Value);
+			cell.Sequence.store(m_head + m_mask + 1, std::memory_order_release);
+			++m_head;
+			return true;
+		}
+
+		/// <summary>
+		/// Consumer thread only, hand up to limit values to fn in the order they were pushed and return how many.
+		/// The limit keeps producers that never stop from starving the consumer's other work.
+		/// </summary>
+		template<typename F>
+		size_t Drain(F&& fn, size_t limit)
+		{
+			size_t count = 0;
+			T value = {};
+			while (count < limit && TryPop(value))
+			{
+				fn(value);
+				++count;
+			}
+			return count;
+		}
+
+		size_t GetCapacity() const
+		{
+			return m_mask + 1;
+		}
+
+		/// <summary>
+		/// Pushes refused because the mailbox was full
+		/// </summary>
+		uint64_t GetRejected() const
+		{
+			return m_rejected.load(std::memory_order_relaxed);
+		}
+	};
+}
@@ -0,0 +1,520 @@
+#include "pch.h"
+#include "NetworkBuffers.h"
+#include "NetworkTransforms.h"
+
+#pragma region Receive Ring
+ClayEngine::Networking::ReceiveRing::ReceiveRing()
+{
+	m_storage = std::make_unique<uint8_t[]>(size_t(c_receive_ring_size + c_max_message_size));
+}
+
+std::pair<uint8_t*, size_t> ClayEngine::Networking::ReceiveRing::GetWriteRegion()
+{
+	auto offset = size_t(m_tail & c_mask);
+	auto contiguous = size_t(c_receive_ring_size) - offset;
+	return std::make_pair(m_storage.get() + offset, std::min(contiguous, GetWritable()));
+}
+
+void ClayEngine::Networking::ReceiveRing::CommitWrite(size_t count)
+{
+	m_tail += count;
+}
+
+ClayEngine::Networking::FrameStatus ClayEngine::Networking::ReceiveRing::PeekFrame(MessageView& view)
+{
+	auto readable = GetReadable();
+	if (readable < c_message_header_size) return FrameStatus::Incomplete;
+
+	// The header itself may straddle the end of the ring, so read it a byte at a time
+	auto length = size_t(byteAt(m_head)) | (size_t(byteAt(m_head + 1)) << 8);
+	if (length > c_max_message_size) return FrameStatus::Malformed;
+	if (readable < c_message_header_size + length) return FrameStatus::Incomplete;
+
+	auto start = size_t((m_head + c_message_header_size) & c_mask);
+	auto end = start + length;
+	if (end > c_receive_ring_size)
+	{
+		// Mirror the wrapped part of the payload into the slop so the handler sees one contiguous span
+		std::memcpy(m_storage.get() + c_receive_ring_size, m_storage.get(), end - size_t(c_receive_ring_size));
+	}
+
+	view.Opcode = byteAt(m_head + 2);
+	view.Flags = byteAt(m_head + 3);
+	view.Data = m_storage.get() + start;
+	view.Length = length;
+
+	return FrameStatus::Ready;
+}
+
+void ClayEngine::Networking::ReceiveRing::ConsumeFrame(const MessageView& view)
+{
+	m_head += c_message_header_size + view.Length;
+}
+
+void ClayEngine::Networking::ReceiveRing::Reset()
+{
+	m_head = 0;
+	m_tail = 0;
+}
+#pragma endregion
+
+#pragma region Shared Message
+ClayEngine::Networking::SharedMessage::SharedMessage(uint8_t opcode, const uint8_t* data, size_t length, const TransformPipeline* transforms)
+{
+	if (length > c_max_message_size) throw std::exception("SharedMessage ERROR: Message exceeds c_max_message_size");
+
+	// Encode into a worst case buffer and keep only what was used, the frame lives as long as its slowest reader
+	std::array<uint8_t, c_message_header_size + c_transform_scratch_size> frame;
+
+	uint8_t applied = 0;
+	auto encoded = (transforms && !transforms->IsEmpty()) ? transforms->Forward(data, length, frame.data() + c_message_header_size, c_max_message_size, applied) : 0;
+	if (encoded == 0)
+	{
+		if (length > 0) std::memcpy(frame.data() + c_message_header_size, data, length);
+		encoded = length;
+	}
+	WriteMessageHeader(frame.data(), uint16_t(encoded), opcode, applied);
+
+	m_length = size_t(c_message_header_size) + encoded;
+	m_frame = std::make_unique<uint8_t[]>(m_length);
+	std::memcpy(m_frame.get(), frame.data(), m_length);
+}
+#pragma endregion
+
+#pragma region Token Bucket
+void ClayEngine::Networking::TokenBucket::Reset()
+{
+	m_tokens = 0.0;
+	m_last = {};
+}
+
+void ClayEngine::Networking::TokenBucket::Refill(TimePoint now, uint32_t rate, uint32_t burst)
+{
+	auto capacity = double(burst ? burst : rate);
+	auto elapsed = std::chrono::duration<double>(now - m_last).count();
+	m_last = now;
+
+	// A reset bucket's timestamp is the epoch, so its first refill tops it straight up
+	m_tokens = std::min(capacity, m_tokens + elapsed * double(rate));
+}
+#pragma endregion
+
+#pragma region Send Queue
+ClayEngine::Networking::SendQueue::Segment& ClayEngine::Networking::SendQueue::reserveSegment(size_t length)
+{
+	// Messages are only ever packed behind the tail when it is a buffer of our own
+	if (!m_segments.empty() && m_segments.back().Data && m_segments.back().Length + length <= c_send_segment_size)
+	{
+		return m_segments.back();
+	}
+
+	if (!m_free_segments.empty())
+	{
+		m_segments.push_back(std::move(m_free_segments.back()));
+		m_free_segments.pop_back();
+	}
+	else
+	{
+		m_segments.push_back(Segment{ std::make_unique<uint8_t[]>(size_t(c_send_segment_size)), nullptr, 0, 0 });
+	}
+
+	return m_segments.back();
+}
+
+void ClayEngine::Networking::SendQueue::recycleSegment(Segment&& segment)
+{
+	segment.Offset = 0;
+	segment.Length = 0;
+	segment.Shared = nullptr; // May be the last reference, which frees the shared message
+	if (segment.Data && m_free_segments.size() < c_max_free_send_segments)
+	{
+		m_free_segments.push_back(std::move(segment));
+	}
+}
+
+void ClayEngine::Networking::SendQueue::releaseBytes(size_t count)
+{
+	m_pending_bytes -= count;
+
+	// Runs on past the last byte released to drop any empty segments that follow
+	while (!m_segments.empty())
+	{
+		auto& front = m_segments.front();
+		auto remaining = front.Length - front.Offset;
+		if (count < remaining)
+		{
+			front.Offset += count;
+			return;
+		}
+
+		count -= remaining;
+		recycleSegment(std::move(front));
+		m_segments.pop_front();
+	}
+}
+
+bool ClayEngine::Networking::SendQueue::isThrottled()
+{
+	if (!m_throttled && m_backpressure.HighWatermark > 0 && m_pending_bytes >= m_backpressure.HighWatermark)
+	{
+		m_throttled = true;
+	}
+
+	return m_throttled;
+}
+
+ClayEngine::Networking::EnqueueStatus ClayEngine::Networking::SendQueue::dropMessage()
+{
+	if (m_stats) m_stats->Add(NetworkCounter::MessagesDropped, 1);
+
+	// Only the first overflow needs to reach the reactor, it closes the connection on its next flush
+	if (m_backpressure.Policy == BackpressurePolicy::Disconnect && !m_failed)
+	{
+		m_failed = true;
+		return EnqueueStatus::Overflowed;
+	}
+
+	return EnqueueStatus::Dropped;
+}
+
+ClayEngine::Networking::EnqueueStatus ClayEngine::Networking::SendQueue::holdMessage(const SharedMessagePtr& message)
+{
+	for (auto& held : m_held)
+	{
+		if (held->GetOpcode() == message->GetOpcode())
+		{
+			held = message;
+			if (m_stats) m_stats->Add(NetworkCounter::MessagesDropped, 1);
+			return EnqueueStatus::Held;
+		}
+	}
+
+	m_held.push_back(message);
+	return EnqueueStatus::Held;
+}
+
+void ClayEngine::Networking::SendQueue::releaseHeld()
+{
+	m_throttled = false;
+
+	// Held messages go out behind everything queued before the peer fell behind, in the order first held
+	for (auto& held : m_held)
+	{
+		m_segments.push_back(Segment{ nullptr, held, 0, held->GetLength() });
+		m_pending_bytes += held->GetLength();
+		if (m_stats) m_stats->Add(NetworkCounter::MessagesOut, 1);
+	}
+	m_held.clear();
+}
+
+void ClayEngine::Networking::SendQueue::Bind(uint32_t owner, ConnectionStats* stats)
+{
+	std::scoped_lock guard(m_mutex);
+	m_owner = owner;
+	m_stats = stats;
+}
+
+void ClayEngine::Networking::SendQueue::Unbind()
+{
+	std::scoped_lock guard(m_mutex);
+	m_owner = 0;
+
+	if (m_pending_bytes > 0) releaseBytes(m_pending_bytes);
+	if (m_stats) m_stats->SetQueuedBytes(0);
+	m_flush_requested.store(false, std::memory_order_release);
+
+	m_held.clear();
+	m_throttled = false;
+	m_failed = false;
+}
+
+void ClayEngine::Networking::SendQueue::SetBackpressure(const BackpressureSettings& settings)
+{
+	std::scoped_lock guard(m_mutex);
+	m_backpressure = settings;
+}
+
+ClayEngine::Networking::EnqueueStatus ClayEngine::Networking::SendQueue::Enqueue(uint32_t owner, uint8_t opcode, uint8_t flags, const uint8_t* data, size_t length, const TransformPipeline* transforms)
+{
+	if (length > c_max_message_size) throw std::exception("SendQueue ERROR: Message exceeds c_max_message_size");
+
+	{
+		std::scoped_lock guard(m_mutex);
+		if (owner == 0 || owner != m_owner) return EnqueueStatus::Rejected;
+
+		if (isThrottled())
+		{
+			if (m_backpressure.Policy != BackpressurePolicy::Coalesce) return dropMessage();
+			return holdMessage(std::make_shared<SharedMessage>(opcode, data, length, transforms));
+		}
+
+		auto frame_length = size_t(c_message_header_size) + length;
+		auto payload_length = length;
+		auto payload_flags = uint8_t(flags & ~c_message_transform_mask);
+
+		if (transforms && !transforms->IsEmpty())
+		{
+			// Reserve room for the worst case and let the last stage encode directly behind the header
+			auto& segment = reserveSegment(size_t(c_message_header_size) + c_transform_scratch_size);
+			auto dst = segment.Data.get() + segment.Length;
+
+			uint8_t applied = 0;
+			auto encoded = transforms->Forward(data, length, dst + c_message_header_size, c_max_message_size, applied);
+			if (encoded > 0)
+			{
+				payload_length = encoded;
+				payload_flags |= applied;
+				frame_length = size_t(c_message_header_size) + encoded;
+			}
+			else if (length > 0)
+			{
+				std::memcpy(dst + c_message_header_size, data, length);
+			}
+
+			WriteMessageHeader(dst, uint16_t(payload_length), opcode, payload_flags);
+			segment.Length += frame_length;
+		}
+		else
+		{
+			auto& segment = reserveSegment(frame_length);
+			auto dst = segment.Data.get() + segment.Length;
+
+			WriteMessageHeader(dst, uint16_t(length), opcode, payload_flags);
+			if (length > 0) std::memcpy(dst + c_message_header_size, data, length);
+
+			segment.Length += frame_length;
+		}
+
+		m_pending_bytes += frame_length;
+
+		if (m_stats)
+		{
+			m_stats->Add(NetworkCounter::MessagesOut, 1);
+			m_stats->SetQueuedBytes(m_pending_bytes);
+		}
+	}
+
+	return m_flush_requested.exchange(true, std::memory_order_acq_rel) ? EnqueueStatus::Queued : EnqueueStatus::FlushRequired;
+}
+
+ClayEngine::Networking::EnqueueStatus ClayEngine::Networking::SendQueue::Enqueue(uint32_t owner, uint8_t opcode, uint8_t flags, const PayloadWriter& writer, const TransformPipeline* transforms)
+{
+	if (transforms && !transforms->IsEmpty())
+	{
+		std::array<uint8_t, c_max_message_size> payload;
+		auto length = writer(payload.data(), payload.size());
+		if (length > c_max_message_size) throw std::exception("SendQueue ERROR: Message exceeds c_max_message_size");
+
+		return Enqueue(owner, opcode, flags, payload.data(), length, transforms);
+	}
+
+	{
+		std::scoped_lock guard(m_mutex);
+		if (owner == 0 || owner != m_owner) return EnqueueStatus::Rejected;
+
+		if (isThrottled())
+		{
+			if (m_backpressure.Policy != BackpressurePolicy::Coalesce) return dropMessage();
+
+			std::array<uint8_t, c_max_message_size> payload;
+			auto length = writer(payload.data(), payload.size());
+			if (length > c_max_message_size) throw std::exception("SendQueue ERROR: Message exceeds c_max_message_size");
+
+			return holdMessage(std::make_shared<SharedMessage>(opcode, payload.data(), length));
+		}
+
+		// Reserve for the largest payload, the writer reports how much of it was used
+		auto segments = m_segments.size();
+		auto& segment = reserveSegment(size_t(c_message_header_size) + c_max_message_size);
+		auto dst = segment.Data.get() + segment.Length;
+
+		auto length = writer(dst + c_message_header_size, c_max_message_size);
+		if (length > c_max_message_size)
+		{
+			// Don't leave a segment we just took sitting empty in the queue
+			if (m_segments.size() > segments)
+			{
+				recycleSegment(std::move(m_segments.back()));
+				m_segments.pop_back();
+			}
+			throw std::exception("SendQueue ERROR: Message exceeds c_max_message_size");
+		}
+
+		auto frame_length = size_t(c_message_header_size) + length;
+		WriteMessageHeader(dst, uint16_t(length), opcode, uint8_t(flags & ~c_message_transform_mask));
+		segment.Length += frame_length;
+
+		m_pending_bytes += frame_length;
+
+		if (m_stats)
+		{
+			m_stats->Add(NetworkCounter::MessagesOut, 1);
+			m_stats->SetQueuedBytes(m_pending_bytes);
+		}
+	}
+
+	return m_flush_requested.exchange(true, std::memory_order_acq_rel) ? EnqueueStatus::Queued : EnqueueStatus::FlushRequired;
+}
+
+ClayEngine::Networking::EnqueueStatus ClayEngine::Networking::SendQueue::Enqueue(uint32_t owner, const SharedMessagePtr& message)
+{
+	if (!message) return EnqueueStatus::Rejected;
+
+	{
+		std::scoped_lock guard(m_mutex);
+		if (owner == 0 || owner != m_owner) return EnqueueStatus::Rejected;
+
+		if (isThrottled())
+		{
+			if (m_backpressure.Policy != BackpressurePolicy::Coalesce) return dropMessage();
+			return holdMessage(message);
+		}
+
+		m_segments.push_back(Segment{ nullptr, message, 0, message->GetLength() });
+		m_pending_bytes += message->GetLength();
+
+		if (m_stats)
+		{
+			m_stats->Add(NetworkCounter::MessagesOut, 1);
+			m_stats->SetQueuedBytes(m_pending_bytes);
+		}
+	}
+
+	return m_flush_requested.exchange(true, std::memory_order_acq_rel) ? EnqueueStatus::Queued : EnqueueStatus::FlushRequired;
+}
+
+ClayEngine::Networking::EnqueueStatus ClayEngine::Networking::SendQueue::EnqueueFrames(uint32_t owner, const uint8_t* data, size_t length)
+{
+	{
+		std::scoped_lock guard(m_mutex);
+		if (owner == 0 || owner != m_owner) return EnqueueStatus::Rejected;
+
+		size_t offset = 0;
+		while (offset + c_message_header_size <= length)
+		{
+			auto frame_length = size_t(c_message_header_size) + size_t(data[offset] | (data[offset + 1] << 8));
+			if (offset + frame_length > length) throw std::exception("SendQueue ERROR: Frames end part way through a message");
+
+			auto& segment = reserveSegment(frame_length);
+			std::memcpy(segment.Data.get() + segment.Length, data + offset, frame_length);
+			segment.Length += frame_length;
+
+			m_pending_bytes += frame_length;
+			if (m_stats) m_stats->Add(NetworkCounter::MessagesOut, 1);
+			offset += frame_length;
+		}
+
+		if (m_stats) m_stats->SetQueuedBytes(m_pending_bytes);
+	}
+
+	return m_flush_requested.exchange(true, std::memory_order_acq_rel) ? EnqueueStatus::Queued : EnqueueStatus::FlushRequired;
+}
+
+void ClayEngine::Networking::SendQueue::TakeUnsent(std::vector<uint8_t>& out)
+{
+	std::scoped_lock guard(m_mutex);
+
+	for (auto& segment : m_segments)
+	{
+		auto bytes = segment.GetBytes();
+
+		// Walk an owned segment's frames from the start to find the one the kernel stopped in
+		size_t start = 0;
+		while (segment.Data && start < segment.Offset)
+		{
+			auto frame_length = size_t(c_message_header_size) + size_t(bytes[start] | (bytes[start + 1] << 8));
+			if (start + frame_length > segment.Offset) break;
+			start += frame_length;
+		}
+
+		out.insert(out.end(), bytes + start, bytes + segment.Length);
+	}
+
+	for (auto& held : m_held)
+	{
+		out.insert(out.end(), held->GetFrame(), held->GetFrame() + held->GetLength());
+	}
+
+	if (m_pending_bytes > 0) releaseBytes(m_pending_bytes);
+	m_held.clear();
+	m_throttled = false;
+	m_failed = false;
+	if (m_stats) m_stats->SetQueuedBytes(0);
+}
+
+bool ClayEngine::Networking::SendQueue::Close(uint32_t owner)
+{
+	std::scoped_lock guard(m_mutex);
+	if (owner == 0 || owner != m_owner) return false;
+
+	m_failed = true;
+	return true;
+}
+
+bool ClayEngine::Networking::SendQueue::TakeFlushRequest()
+{
+	return m_flush_requested.exchange(false, std::memory_order_acq_rel);
+}
+
+ClayEngine::Networking::FlushStatus ClayEngine::Networking::SendQueue::Flush(SOCKET s)
+{
+	std::scoped_lock guard(m_mutex);
+
+	if (m_failed) return FlushStatus::Failed;
+
+	while (!m_segments.empty())
+	{
+		// Empty segments at the front have nothing to send, drop them rather than hand the kernel zero bytes
+		releaseBytes(0);
+		if (m_segments.empty()) break;
+
+		size_t count = 0;
+		size_t requested = 0;
+
+		std::array<WSABUF, c_max_send_buffers> buffers;
+		for (auto it = m_segments.begin(); it != m_segments.end() && count < buffers.size(); ++it, ++count)
+		{
+			buffers[count].buf = reinterpret_cast<char*>(const_cast<uint8_t*>(it->GetBytes() + it->Offset));
+			buffers[count].len = ULONG(it->Length - it->Offset);
+			requested += buffers[count].len;
+		}
+
+		DWORD sent = 0;
+		if (WSASend(s, buffers.data(), DWORD(count), &sent, 0, nullptr, nullptr) == SOCKET_ERROR)
+		{
+			return (WSAGetLastError() == WSAEWOULDBLOCK) ? FlushStatus::Pending : FlushStatus::Failed;
+		}
+
+		releaseBytes(size_t(sent));
+		if (m_throttled && m_pending_bytes <= m_backpressure.LowWatermark) releaseHeld();
+
+		if (m_stats)
+		{
+			m_stats->Add(NetworkCounter::BytesOut, uint64_t(sent));
+			m_stats->SetQueuedBytes(m_pending_bytes);
+		}
+
+		// A short write means the kernel buffer is full, resume from the recorded offset once writable
+		if (size_t(sent) < requested)
+		{
+			++m_partial_writes;
+			if (m_stats) m_stats->Add(NetworkCounter::PartialWrites, 1);
+			return FlushStatus::Pending;
+		}
+	}
+
+	return FlushStatus::Complete;
+}
+
+size_t ClayEngine::Networking::SendQueue::GetPendingBytes()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_pending_bytes;
+}
+
+uint64_t ClayEngine::Networking::SendQueue::GetPartialWrites()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_partial_writes;
+}
+#pragma endregion
@@ -0,0 +1,380 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Buffers Library (C) 2022 Epoch Meridian, LLC.           */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkTelemetry.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// Wire format constants, every message on a stream socket is a MessageHeader followed by Length payload bytes
+		/// </summary>
+		constexpr auto c_message_header_size = 4ull;
+		constexpr auto c_max_message_size = 4096ull; // Largest payload we accept, anything bigger is a protocol error
+		constexpr auto c_receive_ring_size = 32768ull; // Must be a power of two and hold at least one full message
+
+		static_assert((c_receive_ring_size & (c_receive_ring_size - 1)) == 0, "Receive ring size must be a power of two");
+		static_assert(c_receive_ring_size >= c_message_header_size + c_max_message_size, "Receive ring must hold a full message");
+
+		/// <summary>
+		/// Little endian length prefix, followed by the message type and transport flags
+		/// </summary>
+		struct MessageHeader
+		{
+			uint16_t Length = 0;
+			uint8_t Opcode = 0;
+			uint8_t Flags = 0;
+		};
+		static_assert(sizeof(MessageHeader) == c_message_header_size);
+
+		/// <summary>
+		/// Write a header in wire order into the first c_message_header_size bytes of dst
+		/// </summary>
+		inline void WriteMessageHeader(uint8_t* dst, uint16_t length, uint8_t opcode, uint8_t flags)
+		{
+			dst[0] = uint8_t(length & 0xFF);
+			dst[1] = uint8_t(length >> 8);
+			dst[2] = opcode;
+			dst[3] = flags;
+		}
+
+		/// <summary>
+		/// Wrap-around aware comparison for 16 bit sequence numbers, true if a is more recent than b
+		/// </summary>
+		constexpr bool SequenceGreaterThan(uint16_t a, uint16_t b)
+		{
+			return ((a > b) && (a - b <= 32768)) || ((a < b) && (b - a > 32768));
+		}
+
+		/// <summary>
+		/// A complete message as seen by a handler. Data points into the connection's receive ring and is only
+		/// valid for the duration of the handler call, copy out anything that needs to live longer.
+		/// </summary>
+		struct MessageView
+		{
+			uint8_t Opcode = 0;
+			uint8_t Flags = 0;
+			const uint8_t* Data = nullptr;
+			size_t Length = 0;
+		};
+
+		/// <summary>
+		/// Result of pulling the next frame out of a ReceiveRing
+		/// </summary>
+		enum class FrameStatus
+		{
+			Incomplete,
+			Ready,
+			Malformed,
+		};
+
+		/// <summary>
+		/// Fixed size receive buffer for a single connection. recv() writes straight into the ring and complete
+		/// messages are handed out as views, so steady state receive does no allocation and no copying. The
+		/// storage carries c_max_message_size bytes of slop past the end of the ring: when a payload wraps,
+		/// its wrapped tail is mirrored into the slop so the view is always contiguous. That mirror copy is
+		/// bounded by one message and only happens on the frame that straddles the end.
+		/// </summary>
+		class ReceiveRing
+		{
+			using Storage = std::unique_ptr<uint8_t[]>;
+			Storage m_storage = nullptr;
+
+			// Monotonic read/write cursors, masked into the ring on use
+			uint64_t m_head = 0;
+			uint64_t m_tail = 0;
+
+			static constexpr uint64_t c_mask = c_receive_ring_size - 1;
+
+			uint8_t byteAt(uint64_t position) const { return m_storage[size_t(position & c_mask)]; }
+
+		public:
+			ReceiveRing();
+			ReceiveRing(ReceiveRing const&) = delete;
+			ReceiveRing& operator=(ReceiveRing const&) = delete;
+			ReceiveRing(ReceiveRing&&) = default;
+			ReceiveRing& operator=(ReceiveRing&&) = default;
+			~ReceiveRing() = default;
+
+			size_t GetReadable() const { return size_t(m_tail - m_head); }
+			size_t GetWritable() const { return size_t(c_receive_ring_size - (m_tail - m_head)); }
+
+			/// <summary>
+			/// The largest contiguous free region starting at the write cursor, fill it and then CommitWrite()
+			/// </summary>
+			std::pair<uint8_t*, size_t> GetWriteRegion();
+			void CommitWrite(size_t count);
+
+			/// <summary>
+			/// Look at the next frame without consuming it, on Ready the view is filled in
+			/// </summary>
+			FrameStatus PeekFrame(MessageView& view);
+
+			/// <summary>
+			/// Release the frame last returned by PeekFrame
+			/// </summary>
+			void ConsumeFrame(const MessageView& view);
+
+			void Reset();
+		};
+		using ReceiveRingPtr = std::unique_ptr<ReceiveRing>;
+
+		class TransformPipeline;
+
+		/// <summary>
+		/// Outbound queue sizing, messages are packed back to back into segments and each flush hands up to
+		/// c_max_send_buffers segments to the kernel in a single scatter-gather call
+		/// </summary>
+		constexpr auto c_send_segment_size = 16384ull;
+		constexpr auto c_max_send_buffers = 64ull;
+		constexpr auto c_max_free_send_segments = 1ull;
+
+		static_assert(c_send_segment_size >= c_message_header_size + c_max_message_size, "Send segment must hold a full message");
+
+		/// <summary>
+		/// Result of handing queued bytes to the kernel
+		/// </summary>
+		enum class FlushStatus
+		{
+			Complete, // Queue is empty
+			Pending, // Kernel buffer is full, wait for the socket to become writable and flush again
+			Failed, // Socket error, the connection should be dropped
+		};
+
+		/// <summary>
+		/// Result of queueing a message
+		/// </summary>
+		enum class EnqueueStatus
+		{
+			Rejected, // The queue is not bound to the connection the caller asked for
+			Queued, // A flush is already scheduled
+			FlushRequired, // First message since the last flush, the caller must notify the owning reactor
+			Dropped, // The queue is over its high watermark and the message was discarded
+			Held, // The queue is over its high watermark, the message replaced any held one with the same opcode
+			Overflowed, // Dropped under the disconnect policy, the caller must notify the owning reactor to close
+		};
+
+		/// <summary>
+		/// What a send queue does with new messages once it is over its high watermark. It keeps doing so
+		/// until the peer has read enough for the queue to drain to the low watermark.
+		/// </summary>
+		enum class BackpressurePolicy
+		{
+			Drop, // Discard them, for traffic where a newer message will soon supersede the lost one
+			Coalesce, // Hold back only the newest message of each opcode and queue those once drained
+			Disconnect, // The peer can't keep up, fail the next flush so the reactor drops the connection
+		};
+
+		/// <summary>
+		/// Output limits for one connection, a zero high watermark (the default) lets the queue grow unbounded
+		/// </summary>
+		struct BackpressureSettings
+		{
+			size_t HighWatermark = 0;
+			size_t LowWatermark = 0;
+			BackpressurePolicy Policy = BackpressurePolicy::Drop;
+		};
+
+		/// <summary>
+		/// Inbound limits for one connection, rates are per second and bursts are how far a quiet client may
+		/// save up. A zero rate disables that limit, a zero burst allows one second's worth.
+		/// </summary>
+		struct RateLimitSettings
+		{
+			uint32_t MessagesPerSecond = 0;
+			uint32_t MessageBurst = 0;
+			uint32_t BytesPerSecond = 0;
+			uint32_t ByteBurst = 0;
+		};
+
+		/// <summary>
+		/// Classic token bucket. The rate is passed in on refill rather than stored, so the per-connection state
+		/// is just a balance and a timestamp and the settings live once per reactor.
+		/// </summary>
+		class TokenBucket
+		{
+			double m_tokens = 0.0;
+			TimePoint m_last = {};
+
+		public:
+			/// <summary>
+			/// Empty the bucket, the first refill after a reset fills it to the burst
+			/// </summary>
+			void Reset();
+
+			void Refill(TimePoint now, uint32_t rate, uint32_t burst);
+
+			bool TryTake(double count)
+			{
+				if (m_tokens < count) return false;
+				m_tokens -= count;
+				return true;
+			}
+		};
+
+		/// <summary>
+		/// An immutable message framed, and passed through the transform pipeline, exactly once. Any number of
+		/// send queues can hold a reference to it at the same time; their flushes point the kernel straight at
+		/// these bytes, and they are freed when the last queue has sent them.
+		/// </summary>
+		class SharedMessage
+		{
+			std::unique_ptr<uint8_t[]> m_frame = nullptr;
+			size_t m_length = 0;
+
+		public:
+			/// <summary>
+			/// Frame a copy of data, running it through transforms when given
+			/// </summary>
+			SharedMessage(uint8_t opcode, const uint8_t* data, size_t length, const TransformPipeline* transforms = nullptr);
+			SharedMessage(SharedMessage const&) = delete;
+			SharedMessage& operator=(SharedMessage const&) = delete;
+			~SharedMessage() = default;
+
+			/// <summary>
+			/// The whole frame, header included
+			/// </summary>
+			const uint8_t* GetFrame() const { return m_frame.get(); }
+			size_t GetLength() const { return m_length; }
+			uint8_t GetOpcode() const { return m_frame[2]; }
+		};
+		using SharedMessagePtr = std::shared_ptr<const SharedMessage>;
+
+		constexpr auto c_payload_overflow = SIZE_MAX; // Returned by a payload writer whose payload doesn't fit
+
+		/// <summary>
+		/// Produces a payload in place: handed the message slot and its capacity, returns the length written, which
+		/// may be zero, or c_payload_overflow if the payload doesn't fit
+		/// </summary>
+		using PayloadWriter = std::function<size_t(uint8_t* dst, size_t capacity)>;
+
+		/// <summary>
+		/// Per-connection outbound message queue. Any thread may enqueue, only the connection's reactor flushes.
+		/// Messages are framed and appended to the tail segment, so many small game messages share one buffer
+		/// and a flush of many segments is still only one WSASend. Short writes leave the front segment's
+		/// offset where the kernel stopped and the next flush resumes from there. A queue with a high watermark
+		/// applies its backpressure policy to whatever is enqueued while the peer is that far behind.
+		/// </summary>
+		class SendQueue
+		{
+			// A segment either owns a buffer that messages are packed into, or refers to one shared message
+			struct Segment
+			{
+				std::unique_ptr<uint8_t[]> Data = nullptr;
+				SharedMessagePtr Shared = nullptr;
+				size_t Offset = 0; // Bytes already sent
+				size_t Length = 0; // Bytes written into the segment
+
+				const uint8_t* GetBytes() const { return Shared ? Shared->GetFrame() : Data.get(); }
+			};
+			using Segments = std::deque<Segment>;
+
+			Segments m_segments = {};
+			Segments m_free_segments = {};
+			size_t m_pending_bytes = 0;
+			uint64_t m_partial_writes = 0;
+			uint32_t m_owner = 0;
+			ConnectionStats* m_stats = nullptr;
+			std::mutex m_mutex = {};
+
+			std::atomic<bool> m_flush_requested = false;
+
+			BackpressureSettings m_backpressure = {};
+			bool m_throttled = false; // Set at the high watermark, cleared at the low watermark
+			bool m_failed = false; // Set by an overflow under the disconnect policy or by Close(), fails every flush
+			std::vector<SharedMessagePtr> m_held = {}; // Coalesced while throttled, at most one per opcode
+
+			Segment& reserveSegment(size_t length);
+			void recycleSegment(Segment&& segment);
+			void releaseBytes(size_t count);
+
+			// Backpressure, all called under the queue lock
+			bool isThrottled();
+			EnqueueStatus dropMessage();
+			EnqueueStatus holdMessage(const SharedMessagePtr& message);
+			void releaseHeld();
+
+		public:
+			SendQueue() = default;
+			SendQueue(SendQueue const&) = delete;
+			SendQueue& operator=(SendQueue const&) = delete;
+			~SendQueue() = default;
+
+			/// <summary>
+			/// Attach the queue to a connection, only messages addressed to that owner are accepted. Messages
+			/// queued and bytes flushed are counted into stats when given.
+			/// </summary>
+			void Bind(uint32_t owner, ConnectionStats* stats = nullptr);
+
+			/// <summary>
+			/// Detach the queue and drop anything still pending, any sender racing with this sees Rejected
+			/// </summary>
+			void Unbind();
+
+			/// <summary>
+			/// Output limits applied to every enqueue from now on, messages already queued are kept
+			/// </summary>
+			void SetBackpressure(const BackpressureSettings& settings);
+
+			/// <summary>
+			/// Frame and queue a message for the given owner. The check and the append happen under the queue
+			/// lock, so a sender holding a stale connection handle can never write into a reused slot. With a
+			/// transform pipeline the encoded payload is written straight into the segment behind its header.
+			/// </summary>
+			EnqueueStatus Enqueue(uint32_t owner, uint8_t opcode, uint8_t flags, const uint8_t* data, size_t length, const TransformPipeline* transforms = nullptr);
+
+			/// <summary>
+			/// Frame and queue a message whose payload is serialized by writer straight into the send segment,
+			/// without an intermediate copy. With a transform pipeline the payload is built on the stack first,
+			/// since the transforms need it whole as their input.
+			/// </summary>
+			EnqueueStatus Enqueue(uint32_t owner, uint8_t opcode, uint8_t flags, const PayloadWriter& writer, const TransformPipeline* transforms = nullptr);
+
+			/// <summary>
+			/// Queue a reference to a shared message, its bytes are sent in place and never copied into the queue
+			/// </summary>
+			EnqueueStatus Enqueue(uint32_t owner, const SharedMessagePtr& message);
+
+			/// <summary>
+			/// Queue frames that were already built for this connection's stream, such as those a resumed session
+			/// carried over from its previous connection. data must hold whole frames back to back.
+			/// </summary>
+			EnqueueStatus EnqueueFrames(uint32_t owner, const uint8_t* data, size_t length);
+
+			/// <summary>
+			/// Move every frame the kernel has not fully taken out of the queue and into out, along with any held
+			/// back by backpressure. A frame the kernel took part of is taken whole, the peer never saw all of it.
+			/// The queue is left empty and healthy, ready for the next connection.
+			/// </summary>
+			void TakeUnsent(std::vector<uint8_t>& out);
+
+			/// <summary>
+			/// Any thread, fail the next flush so the owning reactor drops the connection. Returns false if the
+			/// queue is not bound to owner.
+			/// </summary>
+			bool Close(uint32_t owner);
+
+			/// <summary>
+			/// Reactor side, clears the flush request flag and returns whether it was set
+			/// </summary>
+			bool TakeFlushRequest();
+
+			/// <summary>
+			/// Write as much of the queue as the kernel will take in as few calls as possible. Fails once the
+			/// queue has overflowed under the disconnect policy or been closed.
+			/// </summary>
+			FlushStatus Flush(SOCKET s);
+
+			size_t GetPendingBytes();
+			uint64_t GetPartialWrites();
+		};
+		using SendQueuePtr = std::unique_ptr<SendQueue>;
+	}
+}
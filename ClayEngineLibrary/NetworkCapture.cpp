@@ -0,0 +1,189 @@
+#include "pch.h"
+#include "NetworkCapture.h"
+#include "NetworkDispatch.h"
+
+namespace
+{
+	template<typename T>
+	void putLittleEndian(std::vector<uint8_t>& out, T value)
+	{
+		for (size_t i = 0; i < sizeof(T); ++i) out.push_back(uint8_t(uint64_t(value) >> (8 * i)));
+	}
+
+	template<typename T>
+	T getLittleEndian(const uint8_t* data)
+	{
+		uint64_t value = 0;
+		for (size_t i = 0; i < sizeof(T); ++i) value |= uint64_t(data[i]) << (8 * i);
+		return T(value);
+	}
+}
+
+#pragma region Capture Writer
+ClayEngine::Networking::CaptureWriter::~CaptureWriter()
+{
+	Close();
+}
+
+void ClayEngine::Networking::CaptureWriter::Open(String filename)
+{
+	Close();
+
+	std::scoped_lock guard(m_mutex);
+
+	m_file.open(filename, std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open()) throw std::exception("CaptureWriter ERROR: Unable to create capture file");
+
+	m_block.clear();
+	m_block.reserve(c_capture_block_size + c_capture_record_header_size + c_max_message_size);
+	putLittleEndian(m_block, c_capture_magic);
+	putLittleEndian(m_block, c_capture_version);
+	putLittleEndian(m_block, uint16_t(0));
+
+	m_records = 0;
+	m_start = Clock::now();
+	m_open.store(true, std::memory_order_release);
+}
+
+uint64_t ClayEngine::Networking::CaptureWriter::Close()
+{
+	std::scoped_lock guard(m_mutex);
+	if (!m_open.load(std::memory_order_relaxed)) return 0;
+
+	m_open.store(false, std::memory_order_relaxed);
+	writeBlock();
+	m_file.close();
+
+	return m_records;
+}
+
+bool ClayEngine::Networking::CaptureWriter::IsOpen() const
+{
+	return m_open.load(std::memory_order_relaxed);
+}
+
+void ClayEngine::Networking::CaptureWriter::Write(ConnectionHandle h, const MessageView& view)
+{
+	if (!m_open.load(std::memory_order_relaxed)) return;
+
+	// Stamped before the lock, so the order of records is the order threads got the lock in but the times are
+	// when the messages arrived
+	auto time = std::chrono::duration_cast<Nanoseconds>(Clock::now() - m_start).count();
+
+	std::scoped_lock guard(m_mutex);
+	if (!m_open.load(std::memory_order_relaxed)) return; // Closed while we waited
+
+	putLittleEndian(m_block, uint64_t(std::max<int64_t>(time, 0)));
+	putLittleEndian(m_block, h);
+	m_block.push_back(view.Opcode);
+	m_block.push_back(view.Flags);
+	putLittleEndian(m_block, uint16_t(view.Length));
+	m_block.insert(m_block.end(), view.Data, view.Data + view.Length);
+	++m_records;
+
+	if (m_block.size() >= c_capture_block_size) writeBlock();
+}
+
+void ClayEngine::Networking::CaptureWriter::writeBlock()
+{
+	if (m_block.empty()) return;
+
+	m_file.write(reinterpret_cast<const char*>(m_block.data()), std::streamsize(m_block.size()));
+	m_block.clear();
+}
+#pragma endregion
+
+#pragma region Capture Reader
+ClayEngine::Networking::CaptureReader::CaptureReader(String filename)
+{
+	std::ifstream ifs{ filename, std::ios::binary };
+	if (!ifs.is_open()) throw std::exception("CaptureReader ERROR: Unable to open capture file");
+
+	m_data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+
+	if (m_data.size() < c_capture_header_size || getLittleEndian<uint32_t>(m_data.data()) != c_capture_magic)
+	{
+		throw std::exception("CaptureReader ERROR: Not a capture file");
+	}
+	if (getLittleEndian<uint16_t>(m_data.data() + 4) != c_capture_version)
+	{
+		throw std::exception("CaptureReader ERROR: Unsupported capture version");
+	}
+}
+
+bool ClayEngine::Networking::CaptureReader::Next(CaptureRecord& out)
+{
+	if (m_offset == m_data.size()) return false;
+	if (m_offset + c_capture_record_header_size > m_data.size()) throw std::exception("CaptureReader ERROR: Capture ends part way through a record");
+
+	auto header = m_data.data() + m_offset;
+	out.Time = getLittleEndian<uint64_t>(header);
+	out.Handle = getLittleEndian<uint32_t>(header + 8);
+	out.View.Opcode = header[12];
+	out.View.Flags = header[13];
+	out.View.Length = getLittleEndian<uint16_t>(header + 14);
+	out.View.Data = header + c_capture_record_header_size;
+
+	if (m_offset + c_capture_record_header_size + out.View.Length > m_data.size()) throw std::exception("CaptureReader ERROR: Capture ends part way through a record");
+
+	m_offset += c_capture_record_header_size + out.View.Length;
+	return true;
+}
+
+void ClayEngine::Networking::CaptureReader::Rewind()
+{
+	m_offset = c_capture_header_size;
+}
+#pragma endregion
+
+#pragma region Capture Replay
+ClayEngine::String ClayEngine::Networking::ReplayStats::ToString() const
+{
+	auto seconds = double(ReplayNanoseconds) / 1000000000.0;
+
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1);
+	ss << "Replay: " << Messages << " msgs, " << Bytes << " B, " << Skipped << " transport msgs skipped" << std::endl;
+	ss << "Time: captured over " << double(CaptureNanoseconds) / 1000000.0 << " ms, replayed in " << double(ReplayNanoseconds) / 1000000.0 << " ms";
+	ss << ", max late " << double(MaxLateNanoseconds) / 1000000.0 << " ms" << std::endl;
+	ss << "Throughput: " << (seconds > 0.0 ? double(Messages) / seconds : 0.0) << " msgs/s, "
+		<< (seconds > 0.0 ? double(Bytes) / seconds / 1048576.0 : 0.0) << " MiB/s, "
+		<< (Messages ? double(ReplayNanoseconds) / double(Messages) : 0.0) << " ns/msg";
+
+	return ss.str();
+}
+
+ClayEngine::Networking::ReplayStats ClayEngine::Networking::ReplayCapture(CaptureReader& reader, const ReplayHandler& handler, ReplayPacing pacing)
+{
+	ReplayStats stats = {};
+	CaptureRecord record = {};
+
+	auto start = Clock::now();
+	while (reader.Next(record))
+	{
+		stats.CaptureNanoseconds = record.Time;
+
+		if (record.View.Opcode >= c_opcode_reserved_first)
+		{
+			++stats.Skipped;
+			continue;
+		}
+
+		if (pacing == ReplayPacing::Original)
+		{
+			auto due = start + Nanoseconds(record.Time);
+			auto now = Clock::now();
+			if (now < due) std::this_thread::sleep_until(due);
+			else stats.MaxLateNanoseconds = std::max(stats.MaxLateNanoseconds, uint64_t(std::chrono::duration_cast<Nanoseconds>(now - due).count()));
+		}
+
+		handler(record.Handle, record.View);
+
+		++stats.Messages;
+		stats.Bytes += record.View.Length;
+	}
+	stats.ReplayNanoseconds = uint64_t(std::chrono::duration_cast<Nanoseconds>(Clock::now() - start).count());
+
+	return stats;
+}
+#pragma endregion
@@ -0,0 +1,137 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Capture Library (C) 2022 Epoch Meridian, LLC.           */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkBuffers.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		using ConnectionHandle = uint32_t;
+
+		/// <summary>
+		/// A capture file starts with [magic:32][version:16][reserved:16], then one record per inbound message:
+		/// [time:64][handle:32][opcode:8][flags:8][length:16][payload]. Time is nanoseconds since the capture
+		/// started, the payload is the message as handlers see it, after the inbound transforms. Little endian.
+		/// </summary>
+		constexpr uint32_t c_capture_magic = 0x50414345; // "ECAP"
+		constexpr uint16_t c_capture_version = 1;
+		constexpr auto c_capture_header_size = 8ull;
+		constexpr auto c_capture_record_header_size = 16ull;
+
+		/// <summary>
+		/// Records are gathered in memory and written in blocks of this size, reactors never wait on the disk
+		/// for a single message
+		/// </summary>
+		constexpr auto c_capture_block_size = 65536ull;
+
+		/// <summary>
+		/// One message read back from a capture, the view points into the reader's copy of the file
+		/// </summary>
+		struct CaptureRecord
+		{
+			uint64_t Time = 0;
+			ConnectionHandle Handle = 0;
+			MessageView View = {};
+		};
+
+		/// <summary>
+		/// Appends every inbound message on the listen server to a capture file while open. The network system
+		/// keeps one for its lifetime and every server thread writes through it, a closed writer costs one
+		/// relaxed load per message.
+		/// </summary>
+		class CaptureWriter
+		{
+			std::ofstream m_file = {};
+			std::vector<uint8_t> m_block = {};
+			TimePoint m_start = {};
+			uint64_t m_records = 0;
+			std::atomic<bool> m_open = false;
+			std::mutex m_mutex = {};
+
+			void writeBlock();
+
+		public:
+			CaptureWriter() = default;
+			CaptureWriter(CaptureWriter const&) = delete;
+			CaptureWriter& operator=(CaptureWriter const&) = delete;
+			~CaptureWriter();
+
+			/// <summary>
+			/// Start a new capture, closing any open one. Throws if the file can't be created.
+			/// </summary>
+			void Open(String filename);
+
+			/// <summary>
+			/// Write out what is gathered and close the file, returns the number of messages captured
+			/// </summary>
+			uint64_t Close();
+
+			bool IsOpen() const;
+
+			/// <summary>
+			/// Any thread, does nothing unless a capture is open
+			/// </summary>
+			void Write(ConnectionHandle h, const MessageView& view);
+		};
+		using CaptureWriterPtr = std::unique_ptr<CaptureWriter>;
+		using CaptureWriterRaw = CaptureWriter*;
+
+		/// <summary>
+		/// Loads a whole capture into memory up front so that a replay measures the handlers and not the disk
+		/// </summary>
+		class CaptureReader
+		{
+			std::vector<uint8_t> m_data = {};
+			size_t m_offset = c_capture_header_size;
+
+		public:
+			/// <summary>
+			/// Throws if the file can't be read or is not a capture this version understands
+			/// </summary>
+			CaptureReader(String filename);
+			~CaptureReader() = default;
+
+			/// <summary>
+			/// The next record in capture order, false at the end. Throws if the file ends part way through one.
+			/// </summary>
+			bool Next(CaptureRecord& out);
+			void Rewind();
+		};
+		using CaptureReaderPtr = std::unique_ptr<CaptureReader>;
+
+		enum class ReplayPacing
+		{
+			Unpaced, // Every message as soon as the last one returns, for throughput
+			Original, // Each message at the offset it arrived at, for reproducing a load profile
+		};
+
+		/// <summary>
+		/// Outcome of feeding a capture through the message handlers
+		/// </summary>
+		struct ReplayStats
+		{
+			uint64_t Messages = 0;
+			uint64_t Bytes = 0;
+			uint64_t Skipped = 0; // Transport messages, they need a live connection to mean anything
+			uint64_t CaptureNanoseconds = 0; // Start of the capture to its last message
+			uint64_t ReplayNanoseconds = 0;
+			uint64_t MaxLateNanoseconds = 0; // Original pacing only, the furthest a message fell behind its offset
+
+			String ToString() const;
+		};
+
+		/// <summary>
+		/// Feed every game message in a capture to handler on the calling thread, with the connection handles
+		/// it was captured with. No sockets and no reactors are involved.
+		/// </summary>
+		using ReplayHandler = std::function<void(ConnectionHandle, const MessageView&)>;
+		ReplayStats ReplayCapture(CaptureReader& reader, const ReplayHandler& handler, ReplayPacing pacing);
+	}
+}
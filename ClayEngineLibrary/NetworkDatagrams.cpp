@@ -0,0 +1,325 @@
+#include "pch.h"
+#include "NetworkDatagrams.h"
+
+namespace
+{
+	inline void writeU16(uint8_t* p, uint16_t v) { p[0] = uint8_t(v & 0xFF); p[1] = uint8_t(v >> 8); }
+	inline void writeU32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; ++i) p[i] = uint8_t(v >> (8 * i)); }
+	inline uint16_t readU16(const uint8_t* p) { return uint16_t(p[0] | (p[1] << 8)); }
+	inline uint32_t readU32(const uint8_t* p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); }
+
+	inline float elapsedMilliseconds(ClayEngine::TimePoint from, ClayEngine::TimePoint to)
+	{
+		return std::chrono::duration<float, std::milli>(to - from).count();
+	}
+}
+
+#pragma region Datagram Channel
+ClayEngine::Networking::DatagramChannel::DatagramChannel()
+{
+	m_received.fill(-1);
+	m_received_reliable.fill(-1);
+}
+
+ClayEngine::Networking::DatagramChannel::DatagramChannel(uint32_t handle, uint32_t key)
+	: DatagramChannel()
+{
+	m_handle = handle;
+	m_key = key;
+}
+
+void ClayEngine::Networking::DatagramChannel::Bind(uint32_t handle, uint32_t key)
+{
+	std::scoped_lock guard(m_mutex);
+	m_handle = handle;
+	m_key = key;
+}
+
+void ClayEngine::Networking::DatagramChannel::Reset()
+{
+	std::scoped_lock guard(m_mutex);
+	m_handle = 0;
+	m_key = 0;
+
+	m_local_sequence = 0;
+	m_remote_sequence = 0;
+	m_received_any = false;
+	m_ack_pending = false;
+
+	m_sent = {};
+	m_received.fill(-1);
+	m_received_reliable.fill(-1);
+
+	m_next_reliable_id = 0;
+	m_reliable.clear();
+	m_unreliable.clear();
+	m_rtt = 0.f;
+}
+
+bool ClayEngine::Networking::DatagramChannel::IsBound()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_handle != 0;
+}
+
+uint32_t ClayEngine::Networking::DatagramChannel::GetKey()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_key;
+}
+
+ClayEngine::Networking::EnqueueStatus ClayEngine::Networking::DatagramChannel::Queue(uint8_t opcode, const uint8_t* data, size_t length, bool reliable)
+{
+	if (length > c_max_datagram_payload) throw std::exception("DatagramChannel ERROR: Message exceeds c_max_datagram_payload");
+
+	std::scoped_lock guard(m_mutex);
+	auto was_empty = m_unreliable.empty() && m_reliable.empty();
+
+	if (reliable)
+	{
+		// The receiver only remembers the last c_datagram_window ids, so no resend may be older than that
+		if (!m_reliable.empty() && uint16_t(m_next_reliable_id - m_reliable.front().Id) >= c_datagram_window) return EnqueueStatus::Rejected;
+
+		ReliableMessage message = {};
+		message.Id = m_next_reliable_id++;
+		message.Opcode = opcode;
+		message.Data.assign(data, data + length);
+		m_reliable.push_back(std::move(message));
+		return was_empty ? EnqueueStatus::FlushRequired : EnqueueStatus::Queued;
+	}
+
+	if (m_unreliable.size() + c_datagram_message_header_size + length > c_max_datagram_backlog) return EnqueueStatus::Rejected;
+
+	auto offset = m_unreliable.size();
+	m_unreliable.resize(offset + c_datagram_message_header_size + length);
+	auto dst = m_unreliable.data() + offset;
+	dst[0] = opcode;
+	dst[1] = 0;
+	writeU16(dst + 2, uint16_t(length));
+	if (length > 0) std::memcpy(dst + c_datagram_message_header_size, data, length);
+
+	return was_empty ? EnqueueStatus::FlushRequired : EnqueueStatus::Queued;
+}
+
+size_t ClayEngine::Networking::DatagramChannel::BuildPacket(uint8_t* buffer, TimePoint now)
+{
+	std::scoped_lock guard(m_mutex);
+	if (m_handle == 0) return 0;
+
+	auto since_send = elapsedMilliseconds(m_last_send, now);
+	auto resend_after = std::max(float(c_datagram_resend_interval), m_rtt * 2.f);
+
+	auto out = buffer + c_datagram_header_size;
+	auto end = buffer + c_max_datagram_size;
+	auto has_messages = false;
+
+	std::vector<uint16_t> reliable = {};
+
+	// Reliable messages that were never sent or whose packet has gone unacked for too long ride first
+	for (auto& message : m_reliable)
+	{
+		if (message.Sent && elapsedMilliseconds(message.SentAt, now) < resend_after) continue;
+
+		auto record = c_datagram_message_header_size + c_datagram_reliable_id_size + message.Data.size();
+		if (size_t(end - out) < record) break;
+
+		out[0] = message.Opcode;
+		out[1] = c_datagram_message_reliable;
+		writeU16(out + 2, uint16_t(message.Data.size()));
+		writeU16(out + 4, message.Id);
+		if (!message.Data.empty()) std::memcpy(out + 6, message.Data.data(), message.Data.size());
+		out += record;
+
+		if (message.Sent) ++m_resends;
+		message.Sent = true;
+		message.SentAt = now;
+		reliable.push_back(message.Id);
+		has_messages = true;
+	}
+
+	// Then as many whole unreliable records as fit, the rest waits for the next packet
+	size_t taken = 0;
+	while (taken < m_unreliable.size())
+	{
+		auto record = c_datagram_message_header_size + readU16(m_unreliable.data() + taken + 2);
+		if (size_t(end - out) < record) break;
+
+		std::memcpy(out, m_unreliable.data() + taken, record);
+		out += record;
+		taken += record;
+		has_messages = true;
+	}
+	if (taken > 0) m_unreliable.erase(m_unreliable.begin(), m_unreliable.begin() + ptrdiff_t(taken));
+
+	// Until we hear from the peer, say hello periodically so it learns our endpoint and NAT mappings open
+	auto ack_due = m_ack_pending && since_send >= float(c_datagram_ack_interval);
+	auto hello_due = !m_received_any && since_send >= float(c_datagram_resend_interval);
+	if (!has_messages && !ack_due && !hello_due) return 0;
+
+	auto sequence = m_local_sequence++;
+	writeU32(buffer, m_handle);
+	writeU32(buffer + 4, m_key);
+	writeU16(buffer + 8, sequence);
+	writeU16(buffer + 10, m_remote_sequence);
+	writeU32(buffer + 12, buildAckBits());
+
+	auto& sent = m_sent[sequence & (c_datagram_window - 1)];
+	if (sent.Sequence >= 0 && !sent.Acked) ++m_packets_lost; // Fell out of the window without an ack
+	sent.Sequence = sequence;
+	sent.Acked = false;
+	sent.SentAt = now;
+	sent.Reliable = std::move(reliable);
+
+	m_last_send = now;
+	m_ack_pending = false;
+	++m_packets_sent;
+
+	return size_t(out - buffer);
+}
+
+bool ClayEngine::Networking::DatagramChannel::ProcessPacket(const uint8_t* data, size_t length, TimePoint now, std::vector<MessageView>& messages)
+{
+	if (length < c_datagram_header_size) return false;
+
+	auto sequence = readU16(data + 8);
+	auto ack = readU16(data + 10);
+	auto ack_bits = readU32(data + 12);
+
+	std::scoped_lock guard(m_mutex);
+
+	if (ack_bits & c_datagram_ack_valid)
+	{
+		ackPacket(ack, now);
+		for (uint32_t i = 0; i < c_datagram_ack_bits; ++i)
+		{
+			if (ack_bits & (1u << i)) ackPacket(uint16_t(ack - 1 - i), now);
+		}
+	}
+
+	auto& received = m_received[sequence & (c_datagram_window - 1)];
+	if (received == sequence) return true; // Duplicate
+
+	auto newest = !m_received_any || SequenceGreaterThan(sequence, m_remote_sequence);
+	if (!newest && !SequenceGreaterThan(sequence, uint16_t(m_remote_sequence - c_datagram_window))) return true; // Too old to track
+
+	// Ack-only packets aren't acked back, or two idle peers would bounce acks forever. The very first packet
+	// is the exception, it is what tells a peer saying hello that we can hear it.
+	if (length > c_datagram_header_size || !m_received_any) m_ack_pending = true;
+
+	received = sequence;
+	if (newest) m_remote_sequence = sequence;
+	m_received_any = true;
+	++m_packets_received;
+
+	auto in = data + c_datagram_header_size;
+	auto in_end = data + length;
+	while (in < in_end)
+	{
+		if (size_t(in_end - in) < c_datagram_message_header_size) return false;
+
+		auto opcode = in[0];
+		auto flags = in[1];
+		auto payload_length = size_t(readU16(in + 2));
+		in += c_datagram_message_header_size;
+
+		auto deliver = newest;
+		if (flags & c_datagram_message_reliable)
+		{
+			if (size_t(in_end - in) < c_datagram_reliable_id_size) return false;
+			auto id = readU16(in);
+			in += c_datagram_reliable_id_size;
+
+			// Reliable messages are delivered from late packets too, but only once
+			auto& seen = m_received_reliable[id & (c_datagram_window - 1)];
+			deliver = (seen != id);
+			seen = id;
+		}
+
+		if (size_t(in_end - in) < payload_length) return false;
+		if (deliver) messages.push_back(MessageView{ opcode, c_message_flag_datagram, in, payload_length });
+		in += payload_length;
+	}
+
+	return true;
+}
+
+void ClayEngine::Networking::DatagramChannel::ackPacket(uint16_t sequence, TimePoint now)
+{
+	auto& sent = m_sent[sequence & (c_datagram_window - 1)];
+	if (sent.Sequence != sequence || sent.Acked) return;
+
+	sent.Acked = true;
+
+	auto sample = elapsedMilliseconds(sent.SentAt, now);
+	m_rtt = (m_rtt == 0.f) ? sample : m_rtt + (sample - m_rtt) * 0.1f;
+
+	for (auto id : sent.Reliable)
+	{
+		auto it = std::find_if(m_reliable.begin(), m_reliable.end(), [id](const ReliableMessage& m) { return m.Id == id; });
+		if (it != m_reliable.end()) m_reliable.erase(it);
+	}
+	sent.Reliable.clear();
+}
+
+uint32_t ClayEngine::Networking::DatagramChannel::buildAckBits()
+{
+	if (!m_received_any) return 0;
+
+	uint32_t bits = c_datagram_ack_valid;
+	for (uint32_t i = 0; i < c_datagram_ack_bits; ++i)
+	{
+		auto sequence = uint16_t(m_remote_sequence - 1 - i);
+		if (m_received[sequence & (c_datagram_window - 1)] == sequence) bits |= (1u << i);
+	}
+	return bits;
+}
+
+bool ClayEngine::Networking::DatagramChannel::ReadPacketIdentity(const uint8_t* data, size_t length, uint32_t& handle, uint32_t& key)
+{
+	if (length < c_datagram_header_size) return false;
+
+	handle = readU32(data);
+	key = readU32(data + 4);
+	return true;
+}
+
+float ClayEngine::Networking::DatagramChannel::GetRoundTripTime()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_rtt;
+}
+
+uint64_t ClayEngine::Networking::DatagramChannel::GetPacketsSent()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_packets_sent;
+}
+
+uint64_t ClayEngine::Networking::DatagramChannel::GetPacketsReceived()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_packets_received;
+}
+
+uint64_t ClayEngine::Networking::DatagramChannel::GetPacketsLost()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_packets_lost;
+}
+
+uint64_t ClayEngine::Networking::DatagramChannel::GetResends()
+{
+	std::scoped_lock guard(m_mutex);
+	return m_resends;
+}
+
+void ClayEngine::Networking::DatagramChannel::GetTelemetry(ConnectionTelemetry& out)
+{
+	std::scoped_lock guard(m_mutex);
+	out.RoundTrip = m_rtt;
+	out.PacketsSent = m_packets_sent;
+	out.PacketsReceived = m_packets_received;
+	out.PacketsLost = m_packets_lost;
+	out.Resends = m_resends;
+}
+#pragma endregion
@@ -0,0 +1,161 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Datagrams Library (C) 2022 Epoch Meridian, LLC.         */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkBuffers.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// Datagram wire format. Every packet starts with the session identity and the ack state:
+		/// [handle:32][key:32][sequence:16][ack:16][ack bits:32], followed by messages laid out as
+		/// [opcode:8][flags:8][length:16][reliable id:16, only if flagged reliable][payload]. All fields little endian.
+		/// </summary>
+		constexpr auto c_max_datagram_size = 1200ull; // Stays under the path MTU of practically every route
+		constexpr auto c_datagram_header_size = 16ull;
+		constexpr auto c_datagram_message_header_size = 4ull;
+		constexpr auto c_datagram_reliable_id_size = 2ull;
+		constexpr auto c_max_datagram_payload = c_max_datagram_size - c_datagram_header_size - c_datagram_message_header_size - c_datagram_reliable_id_size;
+
+		constexpr auto c_datagram_window = 256u; // Sent and received packet history, must be a power of two
+		constexpr auto c_datagram_ack_bits = 31u; // History bits behind the ack field
+		constexpr auto c_datagram_ack_valid = 0x80000000u; // Top ack bit, clear until we have received anything to ack
+		constexpr auto c_max_datagram_backlog = 65536ull; // Queued unreliable bytes beyond this are dropped at the sender
+
+		constexpr auto c_datagram_ack_interval = 20; // ms, longest an ack waits for outbound traffic to ride on
+		constexpr auto c_datagram_resend_interval = 100; // ms, floor for reliable resends and the hello period
+
+		constexpr uint8_t c_datagram_message_reliable = 0x01;
+
+		/// <summary>
+		/// MessageView::Flags bit in the transport nibble, set on messages that arrived over the datagram channel
+		/// </summary>
+		constexpr uint8_t c_message_flag_datagram = 0x10;
+
+		static_assert((c_datagram_window & (c_datagram_window - 1)) == 0, "Datagram window must be a power of two");
+
+		/// <summary>
+		/// Sequencing, acknowledgement and optional reliability for one session's datagrams, with no socket of
+		/// its own so the same logic runs on both ends. Unreliable messages are sequenced: anything arriving in a
+		/// packet older than the newest one already received is dropped. Reliable messages are resent until the
+		/// packet carrying them is acked and are delivered exactly once, but not ordered against each other.
+		/// Any thread may queue, the owning reactor builds and processes packets.
+		/// </summary>
+		class DatagramChannel
+		{
+			struct SentPacket
+			{
+				int32_t Sequence = -1;
+				bool Acked = false;
+				TimePoint SentAt = {};
+				std::vector<uint16_t> Reliable = {};
+			};
+
+			struct ReliableMessage
+			{
+				uint16_t Id = 0;
+				uint8_t Opcode = 0;
+				std::vector<uint8_t> Data = {};
+				TimePoint SentAt = {};
+				bool Sent = false;
+			};
+
+			using SentPackets = std::array<SentPacket, c_datagram_window>;
+			using ReceivedPackets = std::array<int32_t, c_datagram_window>;
+			using ReliableMessages = std::deque<ReliableMessage>;
+			using Backlog = std::vector<uint8_t>;
+
+			uint32_t m_handle = 0;
+			uint32_t m_key = 0;
+
+			uint16_t m_local_sequence = 0;
+			uint16_t m_remote_sequence = 0;
+			bool m_received_any = false;
+			bool m_ack_pending = false;
+
+			SentPackets m_sent = {};
+			ReceivedPackets m_received = {};
+			ReceivedPackets m_received_reliable = {};
+
+			uint16_t m_next_reliable_id = 0;
+			ReliableMessages m_reliable = {};
+			Backlog m_unreliable = {}; // Pre-encoded message records, packed whole into packets
+
+			TimePoint m_last_send = {};
+			float m_rtt = 0.f; // Smoothed round trip in ms, zero until the first ack
+
+			uint64_t m_packets_sent = 0;
+			uint64_t m_packets_received = 0;
+			uint64_t m_packets_lost = 0;
+			uint64_t m_resends = 0; // Reliable messages sent again because their packet went unacked
+
+			std::mutex m_mutex = {};
+
+			void ackPacket(uint16_t sequence, TimePoint now);
+			uint32_t buildAckBits();
+
+		public:
+			DatagramChannel();
+			DatagramChannel(uint32_t handle, uint32_t key);
+			DatagramChannel(DatagramChannel const&) = delete;
+			DatagramChannel& operator=(DatagramChannel const&) = delete;
+			~DatagramChannel() = default;
+
+			/// <summary>
+			/// Attach the session identity carried in every packet, the client learns it from the server over TCP
+			/// </summary>
+			void Bind(uint32_t handle, uint32_t key);
+			bool IsBound();
+
+			/// <summary>
+			/// Unbind and forget all sequence state and queued messages, ready for a new session. The packet
+			/// counters keep running.
+			/// </summary>
+			void Reset();
+			uint32_t GetKey();
+
+			/// <summary>
+			/// Queue a message from any thread. FlushRequired means the channel had nothing queued before and the
+			/// caller should wake the owning reactor. Unreliable messages over the backlog limit are Rejected, as are
+			/// reliable ones once the oldest still unacked is c_datagram_window ids behind.
+			/// </summary>
+			EnqueueStatus Queue(uint8_t opcode, const uint8_t* data, size_t length, bool reliable);
+
+			/// <summary>
+			/// Reactor side, write the next packet that is due into buffer (at least c_max_datagram_size bytes).
+			/// Returns zero once there is nothing to send: no queued messages, no due resends and no ack owed.
+			/// </summary>
+			size_t BuildPacket(uint8_t* buffer, TimePoint now);
+
+			/// <summary>
+			/// Reactor side, apply the acks in a packet and append views of every message to deliver. The views
+			/// point into data. Returns false if the packet is malformed.
+			/// </summary>
+			bool ProcessPacket(const uint8_t* data, size_t length, TimePoint now, std::vector<MessageView>& messages);
+
+			/// <summary>
+			/// Read the session identity from a packet header without touching any channel
+			/// </summary>
+			static bool ReadPacketIdentity(const uint8_t* data, size_t length, uint32_t& handle, uint32_t& key);
+
+			float GetRoundTripTime();
+			uint64_t GetPacketsSent();
+			uint64_t GetPacketsReceived();
+			uint64_t GetPacketsLost();
+			uint64_t GetResends();
+
+			/// <summary>
+			/// Fill in the datagram half of a connection's telemetry under one lock, the stream counters are left alone
+			/// </summary>
+			void GetTelemetry(ConnectionTelemetry& out);
+		};
+		using DatagramChannelPtr = std::shared_ptr<DatagramChannel>;
+	}
+}
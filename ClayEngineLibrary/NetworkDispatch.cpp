@@ -0,0 +1,88 @@
+#include "pch.h"
+#include "NetworkDispatch.h"
+
+#pragma region Message Dispatcher
+ClayEngine::String ClayEngine::Networking::DispatchStats::ToString() const
+{
+	std::stringstream ss;
+	ss << "0x" << std::hex << std::setw(2) << std::setfill('0') << uint32_t(Opcode) << std::dec << std::setfill(' ')
+		<< " calls " << Calls << " errors " << Errors
+		<< std::fixed << std::setprecision(1) << " total " << double(Nanoseconds) / 1000000.0 << " ms"
+		<< " mean " << (Calls ? double(Nanoseconds) / double(Calls) : 0.0) << " ns";
+
+	return ss.str();
+}
+
+ClayEngine::Networking::MessageDispatcher::MessageDispatcher()
+{
+	m_entries = std::make_unique<Entry[]>(size_t(c_dispatch_table_size));
+}
+
+void ClayEngine::Networking::MessageDispatcher::setEntry(uint8_t opcode, Thunk invoke, void* object, Function handler)
+{
+	if (opcode >= c_opcode_reserved_first) throw std::exception("MessageDispatcher ERROR: Opcode is reserved for the transport");
+
+	auto& entry = m_entries[opcode];
+	if (entry.Invoke) throw std::exception("MessageDispatcher ERROR: Opcode already has a handler");
+
+	entry.Invoke = invoke;
+	entry.Object = object;
+	entry.Handler = handler;
+}
+
+bool ClayEngine::Networking::MessageDispatcher::invokeRaw(void* object, Function function, ConnectionHandle h, const MessageView& view)
+{
+	UNREFERENCED_PARAMETER(object);
+
+	reinterpret_cast<void(*)(ConnectionHandle, const MessageView&)>(function)(h, view);
+	return true;
+}
+
+void ClayEngine::Networking::MessageDispatcher::RegisterRaw(uint8_t opcode, void (*handler)(ConnectionHandle, const MessageView&))
+{
+	setEntry(opcode, &invokeRaw, nullptr, reinterpret_cast<Function>(handler));
+}
+
+bool ClayEngine::Networking::MessageDispatcher::Dispatch(ConnectionHandle h, const MessageView& view)
+{
+	auto& entry = m_entries[view.Opcode];
+	if (!entry.Invoke) return false;
+
+	auto start = Clock::now();
+	auto decoded = entry.Invoke(entry.Object, entry.Handler, h, view);
+	auto elapsed = std::chrono::duration_cast<Nanoseconds>(Clock::now() - start).count();
+
+	entry.Calls.fetch_add(1, std::memory_order_relaxed);
+	entry.Nanoseconds.fetch_add(uint64_t(elapsed), std::memory_order_relaxed);
+	if (!decoded) entry.Errors.fetch_add(1, std::memory_order_relaxed);
+
+	return true;
+}
+
+void ClayEngine::Networking::MessageDispatcher::GetStats(std::vector<DispatchStats>& out) const
+{
+	out.clear();
+	for (size_t i = 0; i < c_dispatch_table_size; ++i)
+	{
+		auto& entry = m_entries[i];
+		if (!entry.Invoke) continue;
+
+		DispatchStats stats = {};
+		stats.Opcode = uint8_t(i);
+		stats.Calls = entry.Calls.load(std::memory_order_relaxed);
+		stats.Errors = entry.Errors.load(std::memory_order_relaxed);
+		stats.Nanoseconds = entry.Nanoseconds.load(std::memory_order_relaxed);
+		out.push_back(stats);
+	}
+}
+
+void ClayEngine::Networking::MessageDispatcher::ResetStats()
+{
+	for (size_t i = 0; i < c_dispatch_table_size; ++i)
+	{
+		m_entries[i].Calls.store(0, std::memory_order_relaxed);
+		m_entries[i].Errors.store(0, std::memory_order_relaxed);
+		m_entries[i].Nanoseconds.store(0, std::memory_order_relaxed);
+	}
+}
+#pragma endregion
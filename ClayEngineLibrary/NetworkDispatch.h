@@ -0,0 +1,136 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Dispatch Library (C) 2022 Epoch Meridian, LLC.          */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkBuffers.h"
+#include "NetworkMessages.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		using ConnectionHandle = uint32_t;
+
+		/// <summary>
+		/// Opcodes from here up belong to the transport and are consumed before dispatch, game messages use the rest
+		/// </summary>
+		constexpr uint8_t c_opcode_reserved_first = 0xF0;
+		constexpr auto c_dispatch_table_size = 256ull;
+
+		/// <summary>
+		/// Profiling counters for one registered opcode, time is wall time spent decoding and in the handler
+		/// </summary>
+		struct DispatchStats
+		{
+			uint8_t Opcode = 0;
+			uint64_t Calls = 0;
+			uint64_t Errors = 0; // Payloads that failed to decode and never reached the handler
+			uint64_t Nanoseconds = 0;
+
+			String ToString() const;
+		};
+
+		/// <summary>
+		/// Routes inbound messages to typed handlers through a flat table indexed by opcode: one load and one
+		/// indirect call per message, no map lookup and no std::function. A registered message is decoded into
+		/// a local straight from the receive ring and handed to its handler by const reference. Handlers are
+		/// registered once at startup, before the listen server or client connection starts, and the table is
+		/// read only after that, so every reactor thread dispatches through it without a lock.
+		/// </summary>
+		class MessageDispatcher
+		{
+			using Function = void(*)();
+			using Thunk = bool(*)(void* object, Function function, ConnectionHandle h, const MessageView& view);
+
+			// One cache line per opcode so reactors counting different opcodes never share a line
+			struct alignas(64) Entry
+			{
+				Thunk Invoke = nullptr;
+				void* Object = nullptr;
+				Function Handler = nullptr;
+
+				std::atomic<uint64_t> Calls = 0;
+				std::atomic<uint64_t> Errors = 0;
+				std::atomic<uint64_t> Nanoseconds = 0;
+			};
+			using Entries = std::unique_ptr<Entry[]>;
+
+			Entries m_entries = nullptr;
+
+			void setEntry(uint8_t opcode, Thunk invoke, void* object, Function handler);
+
+			template<typename T>
+			static bool invokeFunction(void* object, Function function, ConnectionHandle h, const MessageView& view)
+			{
+				UNREFERENCED_PARAMETER(object);
+
+				T message = {};
+				if (!DecodeMessage(view.Data, view.Length, message)) return false;
+
+				reinterpret_cast<void(*)(ConnectionHandle, const T&)>(function)(h, message);
+				return true;
+			}
+
+			template<typename T, typename C, void (C::*Method)(ConnectionHandle, const T&)>
+			static bool invokeMethod(void* object, Function function, ConnectionHandle h, const MessageView& view)
+			{
+				UNREFERENCED_PARAMETER(function);
+
+				T message = {};
+				if (!DecodeMessage(view.Data, view.Length, message)) return false;
+
+				(static_cast<C*>(object)->*Method)(h, message);
+				return true;
+			}
+
+			static bool invokeRaw(void* object, Function function, ConnectionHandle h, const MessageView& view);
+
+		public:
+			MessageDispatcher();
+			~MessageDispatcher() = default;
+
+			/// <summary>
+			/// Handle T::Opcode with a free function, throws if the opcode is taken or reserved
+			/// </summary>
+			template<typename T>
+			void Register(void (*handler)(ConnectionHandle, const T&))
+			{
+				setEntry(T::Opcode, &invokeFunction<T>, nullptr, reinterpret_cast<Function>(handler));
+			}
+
+			/// <summary>
+			/// Handle T::Opcode with a member of object, which must outlive the network system:
+			/// dispatcher->Register<ChatMessage, ServerCoreSystem, &ServerCoreSystem::OnChat>(this);
+			/// </summary>
+			template<typename T, typename C, void (C::*Method)(ConnectionHandle, const T&)>
+			void Register(C* object)
+			{
+				setEntry(T::Opcode, &invokeMethod<T, C, Method>, object, nullptr);
+			}
+
+			/// <summary>
+			/// Handle an opcode that has no reflected schema, the view points into the receive ring
+			/// </summary>
+			void RegisterRaw(uint8_t opcode, void (*handler)(ConnectionHandle, const MessageView&));
+
+			/// <summary>
+			/// Any thread. Returns false if nothing is registered for the opcode, the message is left to the
+			/// caller. A payload that fails to decode is counted and dropped.
+			/// </summary>
+			bool Dispatch(ConnectionHandle h, const MessageView& view);
+
+			/// <summary>
+			/// Counters for every registered opcode, in opcode order
+			/// </summary>
+			void GetStats(std::vector<DispatchStats>& out) const;
+			void ResetStats();
+		};
+		using MessageDispatcherPtr = std::unique_ptr<MessageDispatcher>;
+		using MessageDispatcherRaw = MessageDispatcher*;
+	}
+}
@@ -0,0 +1,272 @@
+#include "pch.h"
+#include "NetworkInterest.h"
+
+namespace
+{
+	// Keeps cell coordinates, and the distance between any two, well inside int32_t for any float we are handed
+	constexpr auto c_max_cell_coordinate = 1 << 28;
+}
+
+#pragma region Interest Grid
+ClayEngine::Networking::InterestGrid::InterestGrid(InterestSettings settings)
+	: m_settings(settings)
+{
+	if (m_settings.CellSize <= 0.f) throw std::exception("InterestGrid ERROR: CellSize must be positive");
+	if (m_settings.ViewRadius < 0) throw std::exception("InterestGrid ERROR: ViewRadius must not be negative");
+}
+
+int32_t ClayEngine::Networking::InterestGrid::cellCoordinate(float value) const
+{
+	auto cell = std::floor(value / m_settings.CellSize);
+	if (!(cell == cell)) return 0; // NaN
+
+	return int32_t(std::clamp(cell, -float(c_max_cell_coordinate), float(c_max_cell_coordinate)));
+}
+
+ClayEngine::Networking::InterestGrid::CellKey ClayEngine::Networking::InterestGrid::makeKey(int32_t x, int32_t z)
+{
+	return (CellKey(uint32_t(x)) << 32) | CellKey(uint32_t(z));
+}
+
+int32_t ClayEngine::Networking::InterestGrid::keyX(CellKey key)
+{
+	return int32_t(uint32_t(key >> 32));
+}
+
+int32_t ClayEngine::Networking::InterestGrid::keyZ(CellKey key)
+{
+	return int32_t(uint32_t(key));
+}
+
+bool ClayEngine::Networking::InterestGrid::sees(const Observer& observer, CellKey key) const
+{
+	return std::abs(keyX(key) - observer.CellX) <= m_settings.ViewRadius
+		&& std::abs(keyZ(key) - observer.CellZ) <= m_settings.ViewRadius;
+}
+
+void ClayEngine::Networking::InterestGrid::addEntityToCell(uint32_t id, CellKey key)
+{
+	auto& cell = m_cells[key];
+	cell.Entities.push_back(id);
+
+	for (auto h : cell.Observers)
+	{
+		m_observers[h].Entities.insert(id);
+	}
+}
+
+void ClayEngine::Networking::InterestGrid::removeEntityFromCell(uint32_t id, CellKey key)
+{
+	auto it = m_cells.find(key);
+	if (it == m_cells.end()) return;
+
+	auto& entities = it->second.Entities;
+	auto entity = std::find(entities.begin(), entities.end(), id);
+	if (entity != entities.end())
+	{
+		*entity = entities.back();
+		entities.pop_back();
+	}
+}
+
+void ClayEngine::Networking::InterestGrid::watchCell(uint32_t h, Observer& observer, int32_t x, int32_t z)
+{
+	auto& cell = m_cells[makeKey(x, z)];
+	cell.Observers.push_back(h);
+
+	observer.Entities.insert(cell.Entities.begin(), cell.Entities.end());
+}
+
+void ClayEngine::Networking::InterestGrid::unwatchCell(uint32_t h, Observer& observer, int32_t x, int32_t z)
+{
+	auto key = makeKey(x, z);
+	auto it = m_cells.find(key);
+	if (it == m_cells.end()) return;
+
+	auto& observers = it->second.Observers;
+	auto watcher = std::find(observers.begin(), observers.end(), h);
+	if (watcher != observers.end())
+	{
+		*watcher = observers.back();
+		observers.pop_back();
+	}
+
+	for (auto id : it->second.Entities)
+	{
+		observer.Entities.erase(id);
+	}
+
+	releaseCell(key);
+}
+
+void ClayEngine::Networking::InterestGrid::releaseCell(CellKey key)
+{
+	auto it = m_cells.find(key);
+	if (it != m_cells.end() && it->second.Entities.empty() && it->second.Observers.empty()) m_cells.erase(it);
+}
+
+void ClayEngine::Networking::InterestGrid::UpdateEntity(const EntityState& state)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto key = makeKey(cellCoordinate(state.X), cellCoordinate(state.Z));
+
+	auto it = m_entities.find(state.Id);
+	if (it == m_entities.end())
+	{
+		m_entities.emplace(state.Id, Entity{ state, key });
+		addEntityToCell(state.Id, key);
+		return;
+	}
+
+	it->second.State = state;
+	if (it->second.Key == key) return;
+
+	// Crossed a border: observers of the old cell that can't see the new one lose the entity, observers of the
+	// new cell gain it (for those that saw both, the insert finds it already there)
+	auto previous = it->second.Key;
+	it->second.Key = key;
+
+	removeEntityFromCell(state.Id, previous);
+	auto old_cell = m_cells.find(previous);
+	if (old_cell != m_cells.end())
+	{
+		for (auto h : old_cell->second.Observers)
+		{
+			auto& observer = m_observers[h];
+			if (!sees(observer, key)) observer.Entities.erase(state.Id);
+		}
+	}
+	releaseCell(previous);
+
+	addEntityToCell(state.Id, key);
+}
+
+void ClayEngine::Networking::InterestGrid::RemoveEntity(uint32_t id)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_entities.find(id);
+	if (it == m_entities.end()) return;
+
+	auto key = it->second.Key;
+	m_entities.erase(it);
+
+	removeEntityFromCell(id, key);
+	auto cell = m_cells.find(key);
+	if (cell != m_cells.end())
+	{
+		for (auto h : cell->second.Observers)
+		{
+			m_observers[h].Entities.erase(id);
+		}
+	}
+	releaseCell(key);
+}
+
+void ClayEngine::Networking::InterestGrid::UpdateObserver(uint32_t h, float x, float z)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto cx = cellCoordinate(x);
+	auto cz = cellCoordinate(z);
+	auto r = m_settings.ViewRadius;
+
+	auto it = m_observers.find(h);
+	if (it == m_observers.end())
+	{
+		auto& observer = m_observers[h];
+		observer.CellX = cx;
+		observer.CellZ = cz;
+
+		for (auto i = cx - r; i <= cx + r; ++i)
+		{
+			for (auto j = cz - r; j <= cz + r; ++j) watchCell(h, observer, i, j);
+		}
+		return;
+	}
+
+	auto& observer = it->second;
+	auto ox = observer.CellX;
+	auto oz = observer.CellZ;
+	if (ox == cx && oz == cz) return;
+
+	auto inOld = [&](int32_t i, int32_t j) { return std::abs(i - ox) <= r && std::abs(j - oz) <= r; };
+	auto inNew = [&](int32_t i, int32_t j) { return std::abs(i - cx) <= r && std::abs(j - cz) <= r; };
+
+	// Only the cells on the trailing and leading edges change hands, the overlap is left alone
+	for (auto i = ox - r; i <= ox + r; ++i)
+	{
+		for (auto j = oz - r; j <= oz + r; ++j)
+		{
+			if (!inNew(i, j)) unwatchCell(h, observer, i, j);
+		}
+	}
+
+	for (auto i = cx - r; i <= cx + r; ++i)
+	{
+		for (auto j = cz - r; j <= cz + r; ++j)
+		{
+			if (!inOld(i, j)) watchCell(h, observer, i, j);
+		}
+	}
+
+	observer.CellX = cx;
+	observer.CellZ = cz;
+}
+
+void ClayEngine::Networking::InterestGrid::RemoveObserver(uint32_t h)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_observers.find(h);
+	if (it == m_observers.end()) return;
+
+	auto& observer = it->second;
+	auto r = m_settings.ViewRadius;
+	for (auto i = observer.CellX - r; i <= observer.CellX + r; ++i)
+	{
+		for (auto j = observer.CellZ - r; j <= observer.CellZ + r; ++j) unwatchCell(h, observer, i, j);
+	}
+
+	m_observers.erase(it);
+}
+
+bool ClayEngine::Networking::InterestGrid::BuildSnapshot(uint32_t h, Snapshot& out)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_observers.find(h);
+	if (it == m_observers.end()) return false;
+
+	out.Entities.clear();
+	out.Entities.reserve(it->second.Entities.size());
+	for (auto id : it->second.Entities)
+	{
+		auto entity = m_entities.find(id);
+		if (entity != m_entities.end()) out.Entities.push_back(entity->second.State);
+	}
+
+	return true;
+}
+
+void ClayEngine::Networking::InterestGrid::GetObservers(std::vector<uint32_t>& out)
+{
+	std::scoped_lock guard(m_mutex);
+
+	out.clear();
+	out.reserve(m_observers.size());
+	for (auto& element : m_observers)
+	{
+		out.push_back(element.first);
+	}
+}
+
+size_t ClayEngine::Networking::InterestGrid::GetRelevantCount(uint32_t h)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_observers.find(h);
+	return (it == m_observers.end()) ? 0 : it->second.Entities.size();
+}
+#pragma endregion
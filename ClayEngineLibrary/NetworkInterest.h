@@ -0,0 +1,104 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Interest Library (C) 2022 Epoch Meridian, LLC.          */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkSnapshots.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// Interest grid layout, cells are square on the ground plane (X, Z) and an observer sees every cell within
+		/// ViewRadius cells of its own in both directions, a (2r + 1)^2 block
+		/// </summary>
+		struct InterestSettings
+		{
+			float CellSize = 64.f;
+			int32_t ViewRadius = 2;
+		};
+
+		/// <summary>
+		/// Area of interest management over a uniform spatial hash grid. Replicated entities are bucketed by the
+		/// cell they stand in and each observer (one per client connection) keeps the set of entities relevant
+		/// to it. The sets are maintained incrementally: work is only done when an entity crosses a cell border
+		/// or an observer moves to another cell, and only for the cells on the edge of the change.
+		/// </summary>
+		class InterestGrid
+		{
+			using CellKey = uint64_t;
+			using Relevant = std::unordered_set<uint32_t>;
+
+			struct Cell
+			{
+				std::vector<uint32_t> Entities = {};
+				std::vector<uint32_t> Observers = {};
+			};
+
+			struct Entity
+			{
+				EntityState State = {};
+				CellKey Key = 0;
+			};
+
+			struct Observer
+			{
+				int32_t CellX = 0;
+				int32_t CellZ = 0;
+				Relevant Entities = {};
+			};
+
+			InterestSettings m_settings = {};
+
+			std::unordered_map<CellKey, Cell> m_cells = {};
+			std::unordered_map<uint32_t, Entity> m_entities = {};
+			std::unordered_map<uint32_t, Observer> m_observers = {}; // Keyed by connection handle
+			std::mutex m_mutex = {};
+
+			int32_t cellCoordinate(float value) const;
+			static CellKey makeKey(int32_t x, int32_t z);
+			static int32_t keyX(CellKey key);
+			static int32_t keyZ(CellKey key);
+			bool sees(const Observer& observer, CellKey key) const;
+
+			void addEntityToCell(uint32_t id, CellKey key);
+			void removeEntityFromCell(uint32_t id, CellKey key);
+			void watchCell(uint32_t h, Observer& observer, int32_t x, int32_t z);
+			void unwatchCell(uint32_t h, Observer& observer, int32_t x, int32_t z);
+			void releaseCell(CellKey key);
+
+		public:
+			InterestGrid(InterestSettings settings = {});
+
+			const InterestSettings& GetSettings() const { return m_settings; }
+
+			/// <summary>
+			/// Add an entity or record its latest state, moving it between cells if it crossed a border
+			/// </summary>
+			void UpdateEntity(const EntityState& state);
+			void RemoveEntity(uint32_t id);
+
+			/// <summary>
+			/// Add an observer for a connection or move it, its relevant set follows the cells it can now see
+			/// </summary>
+			void UpdateObserver(uint32_t h, float x, float z);
+			void RemoveObserver(uint32_t h);
+
+			/// <summary>
+			/// Copy the latest state of every entity relevant to an observer into out. Returns false if the
+			/// connection has no observer.
+			/// </summary>
+			bool BuildSnapshot(uint32_t h, Snapshot& out);
+
+			void GetObservers(std::vector<uint32_t>& out);
+			size_t GetRelevantCount(uint32_t h);
+		};
+		using InterestGridPtr = std::unique_ptr<InterestGrid>;
+		using InterestGridRaw = InterestGrid*;
+	}
+}
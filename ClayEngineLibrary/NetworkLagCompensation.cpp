@@ -0,0 +1,227 @@
+#include "pch.h"
+#include "NetworkLagCompensation.h"
+
+namespace
+{
+	// Distance along a normalized ray to where it enters the sphere, false if it misses or the sphere is behind
+	inline bool raySphere(float ox, float oy, float oz, float dx, float dy, float dz, float cx, float cy, float cz, float radius, float& distance)
+	{
+		auto mx = ox - cx;
+		auto my = oy - cy;
+		auto mz = oz - cz;
+		auto b = mx * dx + my * dy + mz * dz;
+		auto c = mx * mx + my * my + mz * mz - radius * radius;
+		if (c > 0.f && b > 0.f) return false;
+
+		auto discriminant = b * b - c;
+		if (discriminant < 0.f) return false;
+
+		distance = std::max(-b - std::sqrt(discriminant), 0.f); // Zero when the ray starts inside
+		return true;
+	}
+}
+
+#pragma region Rewind View
+bool ClayEngine::Networking::RewindView::position(size_t slot, float& x, float& y, float& z) const
+{
+	auto& history = *m_history;
+	auto from = m_from * history.m_capacity + slot;
+	auto to = m_to * history.m_capacity + slot;
+
+	// Not there yet at the earlier tick, so not there to be hit
+	if (!history.m_present[from]) return false;
+
+	x = history.m_x[from];
+	y = history.m_y[from];
+	z = history.m_z[from];
+
+	// Gone by the later tick, it is where it was last seen
+	if (!history.m_present[to]) return true;
+
+	x += (history.m_x[to] - x) * m_alpha;
+	y += (history.m_y[to] - y) * m_alpha;
+	z += (history.m_z[to] - z) * m_alpha;
+	return true;
+}
+
+bool ClayEngine::Networking::RewindView::GetPosition(uint32_t id, float& x, float& y, float& z) const
+{
+	if (!m_history) return false;
+
+	auto it = m_history->m_slots.find(id);
+	if (it == m_history->m_slots.end()) return false;
+
+	return position(it->second, x, y, z);
+}
+
+bool ClayEngine::Networking::RewindView::Raycast(float ox, float oy, float oz, float dx, float dy, float dz, float range, uint32_t ignore, RewindHit& out) const
+{
+	if (!m_history) return false;
+
+	auto length = std::sqrt(dx * dx + dy * dy + dz * dz);
+	if (length <= 0.f) return false;
+	dx /= length;
+	dy /= length;
+	dz /= length;
+
+	auto& history = *m_history;
+	auto found = false;
+	auto nearest = range;
+	for (size_t slot = 0; slot < history.m_slots_used; ++slot)
+	{
+		if (history.m_ids[slot] == ignore) continue;
+
+		float x, y, z;
+		if (!position(slot, x, y, z)) continue;
+
+		float distance;
+		if (!raySphere(ox, oy, oz, dx, dy, dz, x, y, z, history.m_radii[slot], distance)) continue;
+		if (distance > nearest) continue;
+
+		found = true;
+		nearest = distance;
+		out.Id = history.m_ids[slot];
+		out.Distance = distance;
+		out.X = x;
+		out.Y = y;
+		out.Z = z;
+	}
+
+	return found;
+}
+
+void ClayEngine::Networking::RewindView::Overlap(float cx, float cy, float cz, float radius, std::vector<uint32_t>& out) const
+{
+	if (!m_history) return;
+
+	auto& history = *m_history;
+	for (size_t slot = 0; slot < history.m_slots_used; ++slot)
+	{
+		float x, y, z;
+		if (!position(slot, x, y, z)) continue;
+
+		auto reach = radius + history.m_radii[slot];
+		auto ex = x - cx;
+		auto ey = y - cy;
+		auto ez = z - cz;
+		if (ex * ex + ey * ey + ez * ez <= reach * reach) out.push_back(history.m_ids[slot]);
+	}
+}
+#pragma endregion
+
+#pragma region Lag Compensator
+ClayEngine::Networking::LagCompensator::LagCompensator(LagCompensationSettings settings)
+	: m_settings{ settings }
+{
+	if (m_settings.TickRate == 0 || m_settings.History <= 0 || m_settings.MaxEntities == 0)
+		throw std::exception("LagCompensator ERROR: Tick rate, history and entity count must be positive");
+
+	// One more than the history spans so that both ends of the oldest interval are still there
+	m_depth = size_t((int64_t(m_settings.History) * m_settings.TickRate + 999) / 1000) + 1;
+	m_capacity = m_settings.MaxEntities;
+
+	// Everything is allocated up front, recording and rewinding never allocate
+	m_x.resize(m_depth * m_capacity);
+	m_y.resize(m_depth * m_capacity);
+	m_z.resize(m_depth * m_capacity);
+	m_present.resize(m_depth * m_capacity);
+
+	m_ids.resize(m_capacity);
+	m_radii.resize(m_capacity);
+	m_slots.reserve(m_capacity);
+}
+
+size_t ClayEngine::Networking::LagCompensator::getFrame(uint64_t tick) const
+{
+	return size_t(tick % m_depth);
+}
+
+size_t ClayEngine::Networking::LagCompensator::acquireSlot(uint32_t id, uint64_t tick)
+{
+	size_t slot = 0;
+	if (!m_free.empty() && tick - m_free.front().second >= m_depth)
+	{
+		slot = m_free.front().first;
+		m_free.pop_front();
+	}
+	else if (m_slots_used < m_capacity)
+	{
+		slot = m_slots_used++;
+	}
+	else
+	{
+		throw std::exception("LagCompensator ERROR: More entities than MaxEntities");
+	}
+
+	m_ids[slot] = id;
+	m_radii[slot] = m_settings.DefaultRadius;
+	m_slots.emplace(id, slot);
+	return slot;
+}
+
+void ClayEngine::Networking::LagCompensator::Record(uint64_t tick, const std::vector<EntityState>& states)
+{
+	if (m_recorded && tick <= m_newest) throw std::exception("LagCompensator ERROR: Ticks must be recorded in increasing order");
+
+	// A gap would leave stale rows between the ends, so the history starts over from here
+	if (m_recorded && tick != m_newest + 1) m_recorded = 0;
+
+	auto frame = getFrame(tick);
+	auto row = frame * m_capacity;
+	std::fill_n(m_present.begin() + row, m_slots_used, uint8_t(0));
+
+	for (auto& state : states)
+	{
+		auto it = m_slots.find(state.Id);
+		auto slot = (it != m_slots.end()) ? it->second : acquireSlot(state.Id, tick);
+
+		m_x[row + slot] = state.X;
+		m_y[row + slot] = state.Y;
+		m_z[row + slot] = state.Z;
+		m_present[row + slot] = 1;
+	}
+
+	m_newest = tick;
+	m_recorded = std::min(m_recorded + 1, m_depth);
+}
+
+void ClayEngine::Networking::LagCompensator::RemoveEntity(uint32_t id)
+{
+	auto it = m_slots.find(id);
+	if (it == m_slots.end()) return;
+
+	m_free.emplace_back(it->second, m_newest);
+	m_slots.erase(it);
+}
+
+void ClayEngine::Networking::LagCompensator::SetRadius(uint32_t id, float radius)
+{
+	auto it = m_slots.find(id);
+	if (it != m_slots.end()) m_radii[it->second] = radius;
+}
+
+double ClayEngine::Networking::LagCompensator::GetViewTick(uint64_t tick, int latency, int interpolation) const
+{
+	return double(tick) - double(latency + interpolation) * double(m_settings.TickRate) / 1000.0;
+}
+
+ClayEngine::Networking::RewindView ClayEngine::Networking::LagCompensator::Rewind(double tick) const
+{
+	RewindView view = {};
+	if (!m_recorded) return view;
+
+	auto oldest = double(GetOldestTick());
+	auto newest = double(m_newest);
+	view.m_clamped = tick < oldest || tick > newest;
+	view.m_tick = std::clamp(tick, oldest, newest);
+
+	auto from = uint64_t(std::floor(view.m_tick));
+	auto to = (from < m_newest) ? from + 1 : from;
+
+	view.m_history = this;
+	view.m_from = getFrame(from);
+	view.m_to = getFrame(to);
+	view.m_alpha = float(view.m_tick - double(from));
+	return view;
+}
+#pragma endregion
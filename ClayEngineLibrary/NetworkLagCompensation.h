@@ -0,0 +1,157 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Lag Compensation Library (C) 2022 Epoch Meridian, LLC.  */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkSnapshots.h"
+#include "TickLoop.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		constexpr auto c_lag_history_default = 1000; // ms
+		constexpr auto c_lag_entities_default = 4096ull;
+
+		struct LagCompensationSettings
+		{
+			uint32_t TickRate = c_tick_rate_default; // The rate Record() is called at
+			int History = c_lag_history_default; // Milliseconds of the past that can be rewound to
+			size_t MaxEntities = c_lag_entities_default;
+			float DefaultRadius = 0.5f; // Hit sphere for entities without one of their own
+		};
+
+		/// <summary>
+		/// Nearest entity a ray hit in the past
+		/// </summary>
+		struct RewindHit
+		{
+			uint32_t Id = 0;
+			float Distance = 0.f;
+			float X = 0.f; // Where the entity was, interpolated to the rewound time
+			float Y = 0.f;
+			float Z = 0.f;
+		};
+
+		class LagCompensator;
+		using LagCompensatorRaw = LagCompensator*;
+
+		/// <summary>
+		/// The world as it was at a fractional tick: two stored ticks and how far between them. Reads the history
+		/// in place, nothing is copied, so it is only good until the next Record().
+		/// </summary>
+		class RewindView
+		{
+			friend class LagCompensator;
+
+			const LagCompensator* m_history = nullptr;
+			size_t m_from = 0; // Frame of the earlier tick
+			size_t m_to = 0; // Frame of the later tick, the same frame when there is nothing to interpolate
+			float m_alpha = 0.f;
+			double m_tick = 0.0;
+			bool m_clamped = false;
+
+			bool position(size_t slot, float& x, float& y, float& z) const;
+
+		public:
+			/// <summary>
+			/// The tick actually rewound to, and whether the one asked for was outside the history and clamped
+			/// </summary>
+			double GetTick() const { return m_tick; }
+			bool IsClamped() const { return m_clamped; }
+			bool IsValid() const { return m_history != nullptr; }
+
+			/// <summary>
+			/// Entities not yet removed, false if it wasn't there at the time
+			/// </summary>
+			bool GetPosition(uint32_t id, float& x, float& y, float& z) const;
+
+			/// <summary>
+			/// Nearest entity whose hit sphere the ray passes through within range, ignoring the shooter. The
+			/// direction need not be normalized. Returns false on a miss.
+			/// </summary>
+			bool Raycast(float ox, float oy, float oz, float dx, float dy, float dz, float range, uint32_t ignore, RewindHit& out) const;
+
+			/// <summary>
+			/// Every entity whose hit sphere touches the sphere given, for area effects
+			/// </summary>
+			void Overlap(float cx, float cy, float cz, float radius, std::vector<uint32_t>& out) const;
+		};
+
+		/// <summary>
+		/// Server side history of where every entity was, for validating hits against what a client actually saw.
+		/// Positions are kept as structure of arrays, one column per axis with a row per tick in a ring deep enough
+		/// for the configured milliseconds of history, so a rewound query is a linear sweep over contiguous floats.
+		/// Entities keep their slot for life, a freed slot is only handed out again once the old entity has aged
+		/// out of the ring. Simulation thread only.
+		/// </summary>
+		class LagCompensator
+		{
+			friend class RewindView;
+
+			LagCompensationSettings m_settings = {};
+			size_t m_depth = 0; // Ticks kept
+			size_t m_capacity = 0; // Entity slots per tick
+
+			// [frame * m_capacity + slot]
+			std::vector<float> m_x = {};
+			std::vector<float> m_y = {};
+			std::vector<float> m_z = {};
+			std::vector<uint8_t> m_present = {};
+
+			uint64_t m_newest = 0;
+			size_t m_recorded = 0; // Frames filled so far, up to m_depth
+
+			// Per slot, not per tick
+			std::vector<uint32_t> m_ids = {};
+			std::vector<float> m_radii = {};
+			size_t m_slots_used = 0; // High water mark, sweeps stop here
+
+			std::unordered_map<uint32_t, size_t> m_slots = {};
+			std::deque<std::pair<size_t, uint64_t>> m_free = {}; // Slot and the tick it was freed on
+
+			size_t getFrame(uint64_t tick) const;
+			size_t acquireSlot(uint32_t id, uint64_t tick);
+
+		public:
+			/// <summary>
+			/// Throws if the rate, history or entity count is zero
+			/// </summary>
+			LagCompensator(LagCompensationSettings settings = {});
+			~LagCompensator() = default;
+
+			/// <summary>
+			/// Store where every entity is at tick, once per tick with ticks increasing. Entities not in states are
+			/// absent at this tick. Throws if there are more live entities than MaxEntities.
+			/// </summary>
+			void Record(uint64_t tick, const std::vector<EntityState>& states);
+
+			/// <summary>
+			/// The entity is gone for good, its history stays until it ages out
+			/// </summary>
+			void RemoveEntity(uint32_t id);
+			void SetRadius(uint32_t id, float radius);
+
+			/// <summary>
+			/// The tick a client was seeing when it acted: its one way latency plus the interpolation delay it
+			/// renders with, taken back from the current tick
+			/// </summary>
+			double GetViewTick(uint64_t tick, int latency, int interpolation) const;
+
+			/// <summary>
+			/// Rewind to a fractional tick, interpolating between the stored ticks on either side. A tick outside the
+			/// history is clamped to the nearest end. The view is invalid if nothing has been recorded.
+			/// </summary>
+			RewindView Rewind(double tick) const;
+
+			size_t GetDepth() const { return m_depth; }
+			uint64_t GetNewestTick() const { return m_newest; }
+			uint64_t GetOldestTick() const { return m_recorded ? m_newest + 1 - m_recorded : 0; }
+		};
+		using LagCompensatorPtr = std::unique_ptr<LagCompensator>;
+	}
+}
@@ -0,0 +1,354 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Messages Library (C) 2022 Epoch Meridian, LLC.          */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkBuffers.h"
+
+#include <optional>
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// One reflected member of a message: where it lives and the schema version that introduced it
+		/// </summary>
+		template<typename T, typename M>
+		struct MessageField
+		{
+			M T::* Member = nullptr;
+			uint8_t Since = 1;
+		};
+
+		template<typename T, typename M>
+		constexpr MessageField<T, M> MakeMessageField(M T::* member, uint8_t since = 1)
+		{
+			return MessageField<T, M>{ member, since };
+		}
+
+		/// <summary>
+		/// A message is a plain struct that declares its schema once, alongside its members:
+		///
+		///     struct ChatMessage
+		///     {
+		///         static constexpr uint8_t Opcode = 0x20; // Only needed to send it as a top level message
+		///         static constexpr uint8_t Version = 2;
+		///
+		///         uint32_t Sender = 0;
+		///         String Text = {};
+		///         std::optional<uint8_t> Channel = {}; // Added in version 2
+		///
+		///         static constexpr auto GetFields()
+		///         {
+		///             return std::make_tuple(
+		///                 MakeMessageField(&ChatMessage::Sender),
+		///                 MakeMessageField(&ChatMessage::Text),
+		///                 MakeMessageField(&ChatMessage::Channel, 2));
+		///         }
+		///     };
+		///
+		/// Members may be any trivially copyable type (written as is), String, std::optional, std::vector and
+		/// other messages. Versioning is append only: new fields go on the end with a higher Since, a reader
+		/// leaves fields newer than the writer at their defaults and ignores fields it has never heard of.
+		/// </summary>
+		template<typename T, typename = void>
+		struct IsReflectedMessage : std::false_type {};
+
+		template<typename T>
+		struct IsReflectedMessage<T, std::void_t<decltype(T::GetFields()), decltype(T::Version)>> : std::true_type {};
+
+		template<typename T>
+		struct IsOptionalField : std::false_type {};
+
+		template<typename T>
+		struct IsOptionalField<std::optional<T>> : std::true_type {};
+
+		template<typename T>
+		struct IsVectorField : std::false_type {};
+
+		template<typename T>
+		struct IsVectorField<std::vector<T>> : std::true_type {};
+
+		/// <summary>
+		/// True if every field's Since is within the message version and no field is older than the one before
+		/// it, which is what lets an old reader stop at the fields it knows
+		/// </summary>
+		template<typename T>
+		constexpr bool IsAppendOnlySchema()
+		{
+			auto valid = true;
+			uint8_t last = 1;
+			std::apply([&](const auto&... field) { ((valid = valid && field.Since >= last && field.Since <= T::Version, last = field.Since), ...); }, T::GetFields());
+			return valid;
+		}
+
+		/// <summary>
+		/// Lengths and counts on the wire, payloads are never larger than c_max_message_size
+		/// </summary>
+		using MessageLength = uint16_t;
+
+		/// <summary>
+		/// Serializes reflected messages straight into a caller supplied buffer, normally the message slot of a
+		/// send segment. Values are copied in host order, which is little endian on every platform we ship, so a
+		/// run of scalar fields is a run of fixed size copies with one capacity check each. Writing past the end
+		/// sets the overflow flag and drops the data, check IsOverflowed() once at the end.
+		/// </summary>
+		class MessageWriter
+		{
+			uint8_t* m_data = nullptr;
+			size_t m_capacity = 0;
+			size_t m_length = 0;
+			bool m_overflow = false;
+
+			template<typename T>
+			void writeFields(const T& message)
+			{
+				static_assert(IsAppendOnlySchema<T>(), "Message fields must be listed in order of the version that added them");
+
+				Write(T::Version);
+				std::apply([&](const auto&... field) { (Write(message.*(field.Member)), ...); }, T::GetFields());
+			}
+
+		public:
+			MessageWriter(uint8_t* data, size_t capacity) : m_data(data), m_capacity(capacity) {}
+
+			void WriteBytes(const void* data, size_t length)
+			{
+				if (m_length + length > m_capacity)
+				{
+					m_overflow = true;
+					return;
+				}
+				if (length > 0) std::memcpy(m_data + m_length, data, length);
+				m_length += length;
+			}
+
+			template<typename V>
+			void Write(const V& value)
+			{
+				if constexpr (IsReflectedMessage<V>::value)
+				{
+					// Nested messages are length prefixed so an older reader can step over fields it doesn't know
+					auto start = m_length;
+					Write(MessageLength(0));
+					writeFields(value);
+
+					if (!m_overflow)
+					{
+						auto length = MessageLength(m_length - start - sizeof(MessageLength));
+						std::memcpy(m_data + start, &length, sizeof(MessageLength));
+					}
+				}
+				else if constexpr (std::is_same_v<V, String>)
+				{
+					if (value.size() > c_max_message_size) m_overflow = true;
+					Write(MessageLength(value.size()));
+					WriteBytes(value.data(), value.size());
+				}
+				else if constexpr (IsOptionalField<V>::value)
+				{
+					Write(value.has_value());
+					if (value.has_value()) Write(*value);
+				}
+				else if constexpr (IsVectorField<V>::value)
+				{
+					using E = typename V::value_type;
+
+					if (value.size() > c_max_message_size) m_overflow = true;
+					Write(MessageLength(value.size()));
+					if constexpr (std::is_trivially_copyable_v<E> && !IsReflectedMessage<E>::value)
+					{
+						WriteBytes(value.data(), value.size() * sizeof(E));
+					}
+					else
+					{
+						for (auto& element : value) Write(element);
+					}
+				}
+				else
+				{
+					static_assert(std::is_trivially_copyable_v<V>, "Message fields must be trivially copyable, String, optional, vector or a message");
+					WriteBytes(&value, sizeof(V));
+				}
+			}
+
+			/// <summary>
+			/// Write a whole message: its version, then its fields in declaration order
+			/// </summary>
+			template<typename T>
+			void WriteMessage(const T& message)
+			{
+				static_assert(IsReflectedMessage<T>::value, "WriteMessage requires GetFields() and Version");
+				writeFields(message);
+			}
+
+			size_t GetLength() const { return m_length; }
+			bool IsOverflowed() const { return m_overflow; }
+		};
+
+		/// <summary>
+		/// Reads back what a MessageWriter produced. Reading past the end yields zeros and sets the overflow flag,
+		/// and counts are checked against the bytes that remain before anything is allocated, so a truncated or
+		/// hostile payload can't make a decoder run away.
+		/// </summary>
+		class MessageReader
+		{
+			const uint8_t* m_data = nullptr;
+			size_t m_length = 0;
+			size_t m_position = 0;
+			bool m_overflow = false;
+
+			template<typename T>
+			void readFields(T& message)
+			{
+				uint8_t version = 0;
+				Read(version);
+				if (version == 0) m_overflow = true;
+
+				// Fields the writer's schema didn't have yet keep their defaults
+				std::apply([&](const auto&... field) { ((field.Since <= version ? Read(message.*(field.Member)) : void()), ...); }, T::GetFields());
+			}
+
+			size_t getRemaining() const { return m_length - m_position; }
+
+		public:
+			MessageReader(const uint8_t* data, size_t length) : m_data(data), m_length(length) {}
+
+			void ReadBytes(void* data, size_t length)
+			{
+				if (length > getRemaining())
+				{
+					m_overflow = true;
+					m_position = m_length;
+					if (length > 0) std::memset(data, 0, length);
+					return;
+				}
+				if (length > 0) std::memcpy(data, m_data + m_position, length);
+				m_position += length;
+			}
+
+			template<typename V>
+			void Read(V& value)
+			{
+				if constexpr (IsReflectedMessage<V>::value)
+				{
+					MessageLength length = 0;
+					Read(length);
+					if (length > getRemaining())
+					{
+						m_overflow = true;
+						return;
+					}
+
+					// Decode within the nested message's own bytes and skip whatever a newer writer appended
+					MessageReader nested(m_data + m_position, length);
+					nested.readFields(value);
+					m_overflow = m_overflow || nested.IsOverflowed();
+					m_position += length;
+				}
+				else if constexpr (std::is_same_v<V, String>)
+				{
+					MessageLength length = 0;
+					Read(length);
+					if (length > getRemaining())
+					{
+						m_overflow = true;
+						return;
+					}
+
+					value.assign(reinterpret_cast<const char*>(m_data + m_position), length);
+					m_position += length;
+				}
+				else if constexpr (IsOptionalField<V>::value)
+				{
+					uint8_t present = 0;
+					Read(present);
+					if (present != 0) Read(value.emplace());
+					else value.reset();
+				}
+				else if constexpr (IsVectorField<V>::value)
+				{
+					using E = typename V::value_type;
+
+					// Every element takes at least one byte, so a count larger than what is left is a lie
+					MessageLength count = 0;
+					Read(count);
+					if (count > getRemaining())
+					{
+						m_overflow = true;
+						return;
+					}
+
+					value.resize(count);
+					if constexpr (std::is_trivially_copyable_v<E> && !IsReflectedMessage<E>::value)
+					{
+						ReadBytes(value.data(), value.size() * sizeof(E));
+					}
+					else
+					{
+						for (auto& element : value) Read(element);
+					}
+				}
+				else if constexpr (std::is_same_v<V, bool>)
+				{
+					// Any byte other than zero is true, never copy a hostile byte into a bool
+					uint8_t byte = 0;
+					ReadBytes(&byte, sizeof(byte));
+					value = (byte != 0);
+				}
+				else
+				{
+					static_assert(std::is_trivially_copyable_v<V>, "Message fields must be trivially copyable, String, optional, vector or a message");
+					ReadBytes(&value, sizeof(V));
+				}
+			}
+
+			template<typename T>
+			void ReadMessage(T& message)
+			{
+				static_assert(IsReflectedMessage<T>::value, "ReadMessage requires GetFields() and Version");
+				readFields(message);
+			}
+
+			bool IsOverflowed() const { return m_overflow; }
+		};
+
+		/// <summary>
+		/// Serialize message into dst, returns the payload length or c_payload_overflow if it doesn't fit in capacity
+		/// </summary>
+		template<typename T>
+		size_t EncodeMessage(const T& message, uint8_t* dst, size_t capacity)
+		{
+			MessageWriter writer(dst, capacity);
+			writer.WriteMessage(message);
+			return writer.IsOverflowed() ? c_payload_overflow : writer.GetLength();
+		}
+
+		/// <summary>
+		/// Deserialize a payload into message, returns false if it is truncated or malformed. Trailing bytes are
+		/// fields from a newer schema and are ignored.
+		/// </summary>
+		template<typename T>
+		bool DecodeMessage(const uint8_t* src, size_t length, T& message)
+		{
+			MessageReader reader(src, length);
+			reader.ReadMessage(message);
+			return !reader.IsOverflowed();
+		}
+
+		/// <summary>
+		/// Deserialize a received message, false if it isn't a T or doesn't decode
+		/// </summary>
+		template<typename T>
+		bool DecodeMessage(const MessageView& view, T& message)
+		{
+			if (view.Opcode != T::Opcode) return false;
+			return DecodeMessage(view.Data, view.Length, message);
+		}
+	}
+}
@@ -0,0 +1,196 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Prediction Library (C) 2022 Epoch Meridian, LLC.        */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// Input commands are numbered in the order they are issued, starting from one and wrapping
+		/// </summary>
+		using InputSequence = uint32_t;
+
+		constexpr auto c_prediction_capacity_default = 128ull; // Commands in flight, over four seconds at 30 Hz
+
+		/// <summary>
+		/// Counters since the predictor was built
+		/// </summary>
+		struct PredictionStats
+		{
+			uint64_t Predicted = 0;
+			uint64_t Refused = 0; // Commands not applied because the ring was full of unacknowledged ones
+			uint64_t Reconciled = 0; // Authoritative states taken
+			uint64_t Mispredicted = 0; // Of those, ones the match function found disagreed with the prediction
+			uint64_t Replayed = 0; // Commands simulated again during replays
+			uint64_t Ignored = 0; // Authoritative states older than one already taken, or for commands never issued
+		};
+
+		/// <summary>
+		/// Client side prediction. Each local input command gets the next sequence number and is simulated at once,
+		/// so the player sees the result without waiting a round trip. The command and the state it predicted are
+		/// kept in a ring until the server acknowledges that sequence with its own state; that state then replaces
+		/// the prediction and the commands still in flight are simulated again on top of it. The ring is allocated
+		/// up front and never grows, when it is full new commands are refused until the server catches up.
+		/// The simulate function must be the same deterministic step the server runs. One thread only.
+		/// </summary>
+		template<typename TInput, typename TState>
+		class Predictor
+		{
+		public:
+			using SimulateFunction = std::function<void(TState& state, const TInput& input, float elapsed)>;
+			using MatchFunction = std::function<bool(const TState& predicted, const TState& authoritative)>;
+
+		private:
+			struct Command
+			{
+				TInput Input = {};
+				float Elapsed = 0.f;
+				TState Predicted = {}; // State after this command was applied
+			};
+			using Commands = std::unique_ptr<Command[]>;
+
+			SimulateFunction m_simulate = nullptr;
+			MatchFunction m_match = nullptr;
+
+			Commands m_commands = nullptr;
+			size_t m_mask = 0;
+
+			InputSequence m_oldest = 1; // First command not yet acknowledged
+			InputSequence m_next = 1; // Sequence the next command gets
+			TState m_state = {};
+
+			PredictionStats m_stats = {};
+
+			Command& getCommand(InputSequence sequence)
+			{
+				return m_commands[sequence & m_mask];
+			}
+
+		public:
+			/// <summary>
+			/// Capacity is rounded up to a power of two, throws if it is zero or there is no simulate function. With
+			/// a match function an authoritative state that agrees with the prediction is taken without a replay.
+			/// </summary>
+			Predictor(SimulateFunction simulate, size_t capacity = c_prediction_capacity_default, TState initial = {}, MatchFunction match = nullptr)
+				: m_simulate{ simulate }
+				, m_match{ match }
+				, m_state{ initial }
+			{
+				if (!m_simulate) throw std::exception("Predictor ERROR: A simulate function is required");
+				if (capacity == 0) throw std::exception("Predictor ERROR: Capacity must be positive");
+
+				size_t size = 1;
+				while (size < capacity) size <<= 1;
+
+				m_commands = std::make_unique<Command[]>(size);
+				m_mask = size - 1;
+			}
+			Predictor(Predictor const&) = delete;
+			Predictor& operator=(Predictor const&) = delete;
+			~Predictor() = default;
+
+			/// <summary>
+			/// Apply a local command and give back the sequence to send it to the server with. False if too many are
+			/// already waiting for acknowledgement, the command was not applied.
+			/// </summary>
+			bool Predict(const TInput& input, float elapsed, InputSequence& sequence)
+			{
+				if (GetPending() > m_mask)
+				{
+					++m_stats.Refused;
+					return false;
+				}
+
+				m_simulate(m_state, input, elapsed);
+
+				sequence = m_next++;
+				auto& command = getCommand(sequence);
+				command.Input = input;
+				command.Elapsed = elapsed;
+				command.Predicted = m_state;
+
+				++m_stats.Predicted;
+				return true;
+			}
+
+			/// <summary>
+			/// The server's state after it applied every command up to and including acknowledged, zero before it
+			/// has applied any. Commands after it are replayed on top and the result becomes the current state. The
+			/// same acknowledgement may come with several states, the server's world moves on without our input.
+			/// False if it acknowledges less than an earlier state did, or a command never issued, and was ignored.
+			/// </summary>
+			bool Reconcile(InputSequence acknowledged, const TState& authoritative)
+			{
+				// How many of the pending commands this acknowledges, from none up to all of them
+				auto count = size_t(InputSequence(acknowledged + 1 - m_oldest));
+				if (count > GetPending())
+				{
+					++m_stats.Ignored;
+					return false;
+				}
+
+				++m_stats.Reconciled;
+
+				auto compared = count > 0 && m_match;
+				auto agreed = compared && m_match(getCommand(acknowledged).Predicted, authoritative);
+				m_oldest = acknowledged + 1;
+				if (agreed) return true;
+				if (compared) ++m_stats.Mispredicted;
+
+				m_state = authoritative;
+				for (auto sequence = m_oldest; sequence != m_next; ++sequence)
+				{
+					auto& command = getCommand(sequence);
+					m_simulate(m_state, command.Input, command.Elapsed);
+					command.Predicted = m_state;
+					++m_stats.Replayed;
+				}
+
+				return true;
+			}
+
+			/// <summary>
+			/// Hand every unacknowledged command to fn oldest first, as (sequence, input), for resending alongside
+			/// the newest one so a lost packet doesn't lose input
+			/// </summary>
+			template<typename F>
+			void ForEachPending(F&& fn) const
+			{
+				for (auto sequence = m_oldest; sequence != m_next; ++sequence)
+				{
+					fn(sequence, m_commands[sequence & m_mask].Input);
+				}
+			}
+
+			/// <summary>
+			/// The predicted present, what the player should be shown
+			/// </summary>
+			const TState& GetState() const
+			{
+				return m_state;
+			}
+
+			size_t GetPending() const
+			{
+				return size_t(InputSequence(m_next - m_oldest));
+			}
+
+			size_t GetCapacity() const
+			{
+				return m_mask + 1;
+			}
+
+			const PredictionStats& GetStats() const
+			{
+				return m_stats;
+			}
+		};
+	}
+}
@@ -0,0 +1,98 @@
+#include "pch.h"
+#include "NetworkSessions.h"
+
+#pragma region Session Table
+ClayEngine::Networking::SessionToken ClayEngine::Networking::SessionTable::Open(ConnectionHandle h)
+{
+	std::scoped_lock guard(m_mutex);
+
+	// Straight from the OS generator, one token says nothing about any other
+	SessionToken token = c_invalid_session;
+	while (token == c_invalid_session || m_sessions.count(token) != 0)
+	{
+		token = (SessionToken(m_random()) << 32) | SessionToken(m_random());
+	}
+
+	m_sessions[token] = Session{ h, false, {}, {} };
+	m_tokens[h] = token;
+	return token;
+}
+
+ClayEngine::Networking::SessionToken ClayEngine::Networking::SessionTable::GetToken(ConnectionHandle h)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_tokens.find(h);
+	return (it != m_tokens.end()) ? it->second : c_invalid_session;
+}
+
+ClayEngine::Networking::SessionToken ClayEngine::Networking::SessionTable::Park(ConnectionHandle h, ParkedSession&& state, TimePoint expires)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_tokens.find(h);
+	if (it == m_tokens.end()) return c_invalid_session;
+
+	auto token = it->second;
+	m_tokens.erase(it);
+
+	auto& session = m_sessions[token];
+	session.Parked = true;
+	session.Expires = expires;
+	session.State = std::move(state);
+	session.State.Handle = h;
+	return token;
+}
+
+void ClayEngine::Networking::SessionTable::Close(ConnectionHandle h)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_tokens.find(h);
+	if (it == m_tokens.end()) return;
+
+	m_sessions.erase(it->second);
+	m_tokens.erase(it);
+}
+
+ClayEngine::Networking::ResumeStatus ClayEngine::Networking::SessionTable::Resume(SessionToken token, ConnectionHandle h, ParkedSession& out)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_sessions.find(token);
+	if (it == m_sessions.end()) return ResumeStatus::Unknown;
+
+	auto& session = it->second;
+	if (!session.Parked)
+	{
+		out.Handle = session.Handle;
+		return ResumeStatus::Live;
+	}
+
+	out = std::move(session.State);
+	session = Session{ h, false, {}, {} };
+	m_tokens[h] = token;
+	++m_resumed;
+	return ResumeStatus::Resumed;
+}
+
+bool ClayEngine::Networking::SessionTable::Expire(SessionToken token, TimePoint expires, ParkedSession& out)
+{
+	std::scoped_lock guard(m_mutex);
+
+	auto it = m_sessions.find(token);
+	if (it == m_sessions.end() || !it->second.Parked || it->second.Expires != expires) return false;
+
+	out = std::move(it->second.State);
+	m_sessions.erase(it);
+	return true;
+}
+
+void ClayEngine::Networking::SessionTable::GetTelemetry(NetworkTelemetry& out)
+{
+	std::scoped_lock guard(m_mutex);
+	out.Sessions += m_tokens.size();
+	out.ParkedSessions += m_sessions.size() - m_tokens.size();
+	out.ResumedSessions += m_resumed;
+}
+#pragma endregion
@@ -0,0 +1,144 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Sessions Library (C) 2022 Epoch Meridian, LLC.          */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkDatagrams.h"
+#include "NetworkSnapshots.h"
+#include "NetworkTelemetry.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		using ConnectionHandle = uint32_t;
+
+		/// <summary>
+		/// Random 64 bit secret that names a session, zero is never issued
+		/// </summary>
+		using SessionToken = uint64_t;
+		constexpr auto c_invalid_session = SessionToken(0);
+
+		/// <summary>
+		/// First message a client sends on every connection, carrying the token of the session it wants to
+		/// resume or zero for a new one. The server answers with the session's token, the grace window in
+		/// milliseconds the client has to come back in, and whether the old session was resumed.
+		/// </summary>
+		constexpr uint8_t c_opcode_session = 0xFA;
+		constexpr auto c_session_hello_size = 8ull;
+		constexpr auto c_session_reply_size = 13ull;
+
+		enum class SessionStatus : uint8_t
+		{
+			Opened,
+			Resumed,
+		};
+
+		/// <summary>
+		/// Server side, Opened and Resumed are raised for the connection that now holds the session (previous is
+		/// the handle it had before a resume) and Closed for the last handle of a session that is gone for good
+		/// </summary>
+		enum class SessionEvent
+		{
+			Opened,
+			Resumed,
+			Closed,
+		};
+		using SessionHandler = std::function<void(SessionEvent event, ConnectionHandle h, ConnectionHandle previous)>;
+
+		/// <summary>
+		/// Everything a dropped connection leaves behind for its session to pick up again on resume
+		/// </summary>
+		struct ParkedSession
+		{
+			ConnectionHandle Handle = 0;
+			SnapshotReplicator::ClientHistoryPtr Replication = nullptr;
+			DatagramChannelPtr Channel = nullptr;
+			std::vector<uint8_t> Unsent = {}; // Whole stream frames the old connection never got to send
+		};
+
+		/// <summary>
+		/// Result of trying to resume a session
+		/// </summary>
+		enum class ResumeStatus
+		{
+			Resumed, // The parked state has been handed over
+			Live, // The session is still attached to a connection the server hasn't seen drop yet
+			Unknown, // Never issued, or already expired
+		};
+
+		/// <summary>
+		/// Every session the listen server has issued, shared by all shards since a client that reconnects may
+		/// land on any of them. A session is live while a connection holds it and parked for a grace window
+		/// after that connection drops. Only connects, disconnects and expiry touch the table, so one lock will do.
+		/// </summary>
+		class SessionTable
+		{
+			struct Session
+			{
+				ConnectionHandle Handle = 0; // Current connection, or the last one while parked
+				bool Parked = false;
+				TimePoint Expires = {};
+				ParkedSession State = {};
+			};
+			using Sessions = std::unordered_map<SessionToken, Session>;
+			using Tokens = std::unordered_map<ConnectionHandle, SessionToken>; // Live sessions only
+
+			Sessions m_sessions = {};
+			Tokens m_tokens = {};
+			uint64_t m_resumed = 0;
+			std::random_device m_random = {};
+			std::mutex m_mutex = {};
+
+		public:
+			SessionTable() = default;
+			SessionTable(SessionTable const&) = delete;
+			SessionTable& operator=(SessionTable const&) = delete;
+			~SessionTable() = default;
+
+			/// <summary>
+			/// Issue a new session to a connection
+			/// </summary>
+			SessionToken Open(ConnectionHandle h);
+
+			/// <summary>
+			/// The session a connection holds, c_invalid_session if it has not opened one
+			/// </summary>
+			SessionToken GetToken(ConnectionHandle h);
+
+			/// <summary>
+			/// The connection holding a session has dropped, keep its state until expires. Returns the token, or
+			/// c_invalid_session if the connection held no session.
+			/// </summary>
+			SessionToken Park(ConnectionHandle h, ParkedSession&& state, TimePoint expires);
+
+			/// <summary>
+			/// The connection holding a session has dropped and the session ends with it
+			/// </summary>
+			void Close(ConnectionHandle h);
+
+			/// <summary>
+			/// Hand a parked session over to connection h. On Resumed out holds the parked state, on Live
+			/// out.Handle is the connection that still holds the session.
+			/// </summary>
+			ResumeStatus Resume(SessionToken token, ConnectionHandle h, ParkedSession& out);
+
+			/// <summary>
+			/// End a session that is still parked with the deadline it was given, out receives its state so the
+			/// caller can release it. Returns false if the session was resumed (and perhaps parked again) since.
+			/// </summary>
+			bool Expire(SessionToken token, TimePoint expires, ParkedSession& out);
+
+			/// <summary>
+			/// Add the session counts to a roll up
+			/// </summary>
+			void GetTelemetry(NetworkTelemetry& out);
+		};
+		using SessionTablePtr = std::unique_ptr<SessionTable>;
+		using SessionTableRaw = SessionTable*;
+	}
+}
@@ -0,0 +1,339 @@
+#include "pch.h"
+#include "NetworkSnapshots.h"
+
+#pragma region Snapshot Codec
+ClayEngine::Networking::SnapshotCodec::SnapshotCodec(SnapshotSchema schema)
+	: m_schema(schema)
+{
+	m_bits[uint32_t(SnapshotField::X)] = schema.PositionBits;
+	m_bits[uint32_t(SnapshotField::Y)] = schema.PositionBits;
+	m_bits[uint32_t(SnapshotField::Z)] = schema.PositionBits;
+	m_bits[uint32_t(SnapshotField::Yaw)] = schema.YawBits;
+	m_bits[uint32_t(SnapshotField::Animation)] = 16;
+	m_bits[uint32_t(SnapshotField::Health)] = 8;
+}
+
+void ClayEngine::Networking::SnapshotCodec::Quantize(const Snapshot& snapshot, QuantizedSnapshot& out) const
+{
+	out.Sequence = snapshot.Sequence;
+	out.Entities.resize(snapshot.Entities.size());
+
+	auto yaw_steps = float(1ull << m_schema.YawBits);
+	for (size_t i = 0; i < snapshot.Entities.size(); ++i)
+	{
+		auto& e = snapshot.Entities[i];
+		auto& q = out.Entities[i];
+
+		q.Id = e.Id;
+		q.Fields[uint32_t(SnapshotField::X)] = QuantizeFloat(e.X, m_schema.Min, m_schema.Max, m_schema.PositionBits);
+		q.Fields[uint32_t(SnapshotField::Y)] = QuantizeFloat(e.Y, m_schema.Min, m_schema.Max, m_schema.PositionBits);
+		q.Fields[uint32_t(SnapshotField::Z)] = QuantizeFloat(e.Z, m_schema.Min, m_schema.Max, m_schema.PositionBits);
+
+		// Yaw wraps, so the top step folds back onto zero instead of clamping
+		auto turns = e.Yaw / c_2pi;
+		turns -= std::floor(turns);
+		q.Fields[uint32_t(SnapshotField::Yaw)] = uint32_t(turns * yaw_steps + 0.5f) & uint32_t((1ull << m_schema.YawBits) - 1);
+
+		q.Fields[uint32_t(SnapshotField::Animation)] = e.Animation;
+		q.Fields[uint32_t(SnapshotField::Health)] = e.Health;
+	}
+
+	std::sort(out.Entities.begin(), out.Entities.end(), [](const QuantizedEntity& a, const QuantizedEntity& b) { return a.Id < b.Id; });
+}
+
+void ClayEngine::Networking::SnapshotCodec::Dequantize(const QuantizedSnapshot& snapshot, Snapshot& out) const
+{
+	out.Sequence = uint16_t(snapshot.Sequence);
+	out.Entities.resize(snapshot.Entities.size());
+
+	auto yaw_steps = float(1ull << m_schema.YawBits);
+	for (size_t i = 0; i < snapshot.Entities.size(); ++i)
+	{
+		auto& q = snapshot.Entities[i];
+		auto& e = out.Entities[i];
+
+		e.Id = q.Id;
+		e.X = DequantizeFloat(q.Fields[uint32_t(SnapshotField::X)], m_schema.Min, m_schema.Max, m_schema.PositionBits);
+		e.Y = DequantizeFloat(q.Fields[uint32_t(SnapshotField::Y)], m_schema.Min, m_schema.Max, m_schema.PositionBits);
+		e.Z = DequantizeFloat(q.Fields[uint32_t(SnapshotField::Z)], m_schema.Min, m_schema.Max, m_schema.PositionBits);
+		e.Yaw = float(q.Fields[uint32_t(SnapshotField::Yaw)]) / yaw_steps * c_2pi;
+		e.Animation = uint16_t(q.Fields[uint32_t(SnapshotField::Animation)]);
+		e.Health = uint8_t(q.Fields[uint32_t(SnapshotField::Health)]);
+	}
+}
+
+void ClayEngine::Networking::SnapshotCodec::Encode(const QuantizedSnapshot* baseline, const QuantizedSnapshot& current, BitWriter& writer)
+{
+	writer.WriteBits(uint32_t(current.Sequence), 16);
+	writer.WriteBool(baseline != nullptr);
+	if (baseline) writer.WriteBits(uint32_t(baseline->Sequence), 16);
+
+	// Walk both sorted lists once to find what left and what is new or changed
+	m_removed.clear();
+	m_changed.clear();
+
+	static const QuantizedSnapshot s_empty = {};
+	auto& base = baseline ? baseline->Entities : s_empty.Entities;
+
+	size_t b = 0;
+	for (size_t c = 0; c < current.Entities.size(); ++c)
+	{
+		auto id = current.Entities[c].Id;
+		while (b < base.size() && base[b].Id < id) m_removed.push_back(base[b++].Id);
+
+		if (b < base.size() && base[b].Id == id)
+		{
+			if (base[b].Fields != current.Entities[c].Fields) m_changed.push_back(c);
+			++b;
+		}
+		else
+		{
+			m_changed.push_back(c);
+		}
+	}
+	while (b < base.size()) m_removed.push_back(base[b++].Id);
+
+	writer.WriteVarint(uint32_t(m_removed.size()));
+	uint32_t previous = 0;
+	for (auto id : m_removed)
+	{
+		writer.WriteVarint(id - previous);
+		previous = id;
+	}
+
+	writer.WriteVarint(uint32_t(m_changed.size()));
+	previous = 0;
+	b = 0;
+	for (auto c : m_changed)
+	{
+		auto& entity = current.Entities[c];
+		writer.WriteVarint(entity.Id - previous);
+		previous = entity.Id;
+
+		// m_changed is in id order, so the matching baseline entry can be found by walking forward
+		while (b < base.size() && base[b].Id < entity.Id) ++b;
+		auto existing = (b < base.size() && base[b].Id == entity.Id) ? &base[b] : nullptr;
+
+		writer.WriteBool(existing == nullptr);
+		if (!existing)
+		{
+			for (uint32_t f = 0; f < c_snapshot_field_count; ++f) writer.WriteBits(entity.Fields[f], m_bits[f]);
+			continue;
+		}
+
+		uint32_t mask = 0;
+		for (uint32_t f = 0; f < c_snapshot_field_count; ++f)
+		{
+			if (entity.Fields[f] != existing->Fields[f]) mask |= (1u << f);
+		}
+
+		writer.WriteBits(mask, c_snapshot_field_count);
+		for (uint32_t f = 0; f < c_snapshot_field_count; ++f)
+		{
+			if (mask & (1u << f)) writer.WriteBits(entity.Fields[f], m_bits[f]);
+		}
+	}
+}
+
+int32_t ClayEngine::Networking::SnapshotCodec::PeekBaseline(const uint8_t* data, size_t length)
+{
+	BitReader reader(data, length);
+	reader.ReadBits(16);
+	if (!reader.ReadBool()) return -1;
+
+	auto baseline = int32_t(reader.ReadBits(16));
+	return reader.IsOverflowed() ? -1 : baseline;
+}
+
+bool ClayEngine::Networking::SnapshotCodec::Decode(const QuantizedSnapshot* baseline, BitReader& reader, QuantizedSnapshot& out)
+{
+	out.Sequence = int32_t(reader.ReadBits(16));
+	auto has_baseline = reader.ReadBool();
+	if (has_baseline != (baseline != nullptr)) return false;
+	if (has_baseline && int32_t(reader.ReadBits(16)) != baseline->Sequence) return false;
+
+	static const QuantizedSnapshot s_empty = {};
+	auto& base = baseline ? baseline->Entities : s_empty.Entities;
+
+	auto removed_count = reader.ReadVarint();
+	if (removed_count > base.size()) return false;
+
+	m_removed.clear();
+	uint32_t previous = 0;
+	for (uint32_t i = 0; i < removed_count; ++i)
+	{
+		previous += reader.ReadVarint();
+		m_removed.push_back(previous);
+	}
+
+	// Merge the baseline, minus removals, with the new and changed entities as they are read. Both lists are in
+	// id order so the output is too.
+	out.Entities.clear();
+	out.Entities.reserve(base.size() + 16);
+
+	size_t b = 0;
+	size_t r = 0;
+	auto copyBaselineBefore = [&](uint64_t id)
+	{
+		while (b < base.size() && base[b].Id < id)
+		{
+			while (r < m_removed.size() && m_removed[r] < base[b].Id) ++r;
+			if (r >= m_removed.size() || m_removed[r] != base[b].Id) out.Entities.push_back(base[b]);
+			++b;
+		}
+	};
+
+	auto changed_count = reader.ReadVarint();
+	previous = 0;
+	for (uint32_t i = 0; i < changed_count; ++i)
+	{
+		auto gap = reader.ReadVarint();
+		if (i > 0 && gap == 0) return false;
+		previous += gap;
+		if (reader.IsOverflowed()) return false;
+
+		copyBaselineBefore(previous);
+
+		QuantizedEntity entity = {};
+		entity.Id = previous;
+
+		auto is_new = reader.ReadBool();
+		if (is_new)
+		{
+			for (uint32_t f = 0; f < c_snapshot_field_count; ++f) entity.Fields[f] = reader.ReadBits(m_bits[f]);
+		}
+		else
+		{
+			if (b >= base.size() || base[b].Id != previous) return false;
+			entity.Fields = base[b++].Fields;
+
+			auto mask = reader.ReadBits(c_snapshot_field_count);
+			for (uint32_t f = 0; f < c_snapshot_field_count; ++f)
+			{
+				if (mask & (1u << f)) entity.Fields[f] = reader.ReadBits(m_bits[f]);
+			}
+		}
+
+		out.Entities.push_back(entity);
+	}
+	copyBaselineBefore(1ull << 32);
+
+	return !reader.IsOverflowed();
+}
+#pragma endregion
+
+#pragma region Snapshot Replicator
+ClayEngine::Networking::SnapshotReplicator::SnapshotReplicator(SnapshotSchema schema)
+	: m_schema(schema)
+{
+}
+
+ClayEngine::Networking::SnapshotReplicator::ClientHistoryPtr ClayEngine::Networking::SnapshotReplicator::getClient(uint32_t h, bool create)
+{
+	std::scoped_lock guard(m_clients_mutex);
+
+	auto it = m_clients.find(h);
+	if (it != m_clients.end()) return it->second;
+	if (!create) return nullptr;
+
+	auto client = std::make_shared<ClientHistory>();
+	client->Codec = SnapshotCodec(m_schema);
+	m_clients.emplace(h, client);
+	return client;
+}
+
+size_t ClayEngine::Networking::SnapshotReplicator::Encode(uint32_t h, const Snapshot& snapshot, uint8_t* buffer, size_t capacity)
+{
+	auto client = getClient(h, true);
+	std::scoped_lock guard(client->Mutex);
+
+	auto sequence = client->NextSequence;
+	auto& slot = client->Ring[sequence % c_snapshot_history];
+
+	// Delta against the newest acked snapshot if it is still in the ring and isn't the slot about to be reused
+	const QuantizedSnapshot* baseline = nullptr;
+	if (client->AckedSequence >= 0)
+	{
+		auto& candidate = client->Ring[uint32_t(client->AckedSequence) % c_snapshot_history];
+		if (candidate.Sequence == client->AckedSequence && &candidate != &slot) baseline = &candidate;
+	}
+
+	client->Codec.Quantize(snapshot, client->Pending);
+	client->Pending.Sequence = sequence;
+
+	BitWriter writer(buffer, capacity);
+	client->Codec.Encode(baseline, client->Pending, writer);
+	writer.Flush();
+	if (writer.IsOverflowed()) return 0;
+
+	std::swap(slot, client->Pending);
+	++client->NextSequence;
+
+	return writer.GetBytesWritten();
+}
+
+void ClayEngine::Networking::SnapshotReplicator::Acknowledge(uint32_t h, uint16_t sequence)
+{
+	auto client = getClient(h, false);
+	if (!client) return;
+
+	std::scoped_lock guard(client->Mutex);
+	if (client->AckedSequence < 0 || SequenceGreaterThan(sequence, uint16_t(client->AckedSequence)))
+	{
+		client->AckedSequence = sequence;
+	}
+}
+
+void ClayEngine::Networking::SnapshotReplicator::RemoveClient(uint32_t h)
+{
+	std::scoped_lock guard(m_clients_mutex);
+	m_clients.erase(h);
+}
+
+ClayEngine::Networking::SnapshotReplicator::ClientHistoryPtr ClayEngine::Networking::SnapshotReplicator::DetachClient(uint32_t h)
+{
+	std::scoped_lock guard(m_clients_mutex);
+
+	auto it = m_clients.find(h);
+	if (it == m_clients.end()) return nullptr;
+
+	auto client = it->second;
+	m_clients.erase(it);
+	return client;
+}
+
+void ClayEngine::Networking::SnapshotReplicator::AttachClient(uint32_t h, ClientHistoryPtr client)
+{
+	std::scoped_lock guard(m_clients_mutex);
+	m_clients[h] = client;
+}
+#pragma endregion
+
+#pragma region Snapshot Receiver
+ClayEngine::Networking::SnapshotReceiver::SnapshotReceiver(SnapshotSchema schema)
+	: m_codec(schema)
+{
+}
+
+const ClayEngine::Networking::Snapshot* ClayEngine::Networking::SnapshotReceiver::Receive(const uint8_t* data, size_t length)
+{
+	const QuantizedSnapshot* baseline = nullptr;
+
+	auto sequence = SnapshotCodec::PeekBaseline(data, length);
+	if (sequence >= 0)
+	{
+		auto& candidate = m_ring[uint32_t(sequence) % c_snapshot_history];
+		if (candidate.Sequence != sequence) return nullptr;
+		baseline = &candidate;
+	}
+
+	BitReader reader(data, length);
+	if (!m_codec.Decode(baseline, reader, m_decoded)) return nullptr;
+
+	auto& slot = m_ring[uint32_t(m_decoded.Sequence) % c_snapshot_history];
+	std::swap(slot, m_decoded);
+
+	m_codec.Dequantize(slot, m_current);
+	return &m_current;
+}
+#pragma endregion
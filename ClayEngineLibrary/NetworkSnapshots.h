@@ -0,0 +1,208 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Snapshots Library (C) 2022 Epoch Meridian, LLC.         */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "BitStream.h"
+#include "NetworkBuffers.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// Snapshots kept per client on both ends, the server only deltas against a snapshot the client acked
+		/// within this window and falls back to a full snapshot otherwise
+		/// </summary>
+		constexpr auto c_snapshot_history = 32u;
+
+		/// <summary>
+		/// Replicated state of a single entity, as the game sees it
+		/// </summary>
+		struct EntityState
+		{
+			uint32_t Id = 0;
+			float X = 0.f;
+			float Y = 0.f;
+			float Z = 0.f;
+			float Yaw = 0.f; // Radians, wrapped into [0, 2pi)
+			uint16_t Animation = 0;
+			uint8_t Health = 0;
+		};
+
+		/// <summary>
+		/// The world as one client should see it at one tick
+		/// </summary>
+		struct Snapshot
+		{
+			uint16_t Sequence = 0;
+			std::vector<EntityState> Entities = {};
+		};
+
+		/// <summary>
+		/// Quantization for every field, both ends must agree on it. Positions are clamped into [Min, Max].
+		/// </summary>
+		struct SnapshotSchema
+		{
+			float Min = -4096.f;
+			float Max = 4096.f;
+			uint32_t PositionBits = 20;
+			uint32_t YawBits = 10;
+		};
+
+		/// <summary>
+		/// Changed-field mask bits, one per replicated field
+		/// </summary>
+		enum class SnapshotField : uint32_t
+		{
+			X = 0,
+			Y,
+			Z,
+			Yaw,
+			Animation,
+			Health,
+			Count,
+		};
+		constexpr auto c_snapshot_field_count = uint32_t(SnapshotField::Count);
+
+		/// <summary>
+		/// An entity after quantization, this is what both ends store as history so that the server's idea of a
+		/// baseline is bit for bit what the client reconstructed
+		/// </summary>
+		struct QuantizedEntity
+		{
+			uint32_t Id = 0;
+			std::array<uint32_t, c_snapshot_field_count> Fields = {};
+		};
+
+		struct QuantizedSnapshot
+		{
+			int32_t Sequence = -1; // -1 while the history slot is empty
+			std::vector<QuantizedEntity> Entities = {}; // Sorted by Id
+		};
+
+		/// <summary>
+		/// Bit level snapshot delta coding. A delta names its baseline, lists the ids that left since the baseline,
+		/// then every entity that is new or changed: new ones in full, changed ones as a field mask followed by
+		/// only the fields whose quantized value moved. Entities that didn't change cost nothing.
+		/// </summary>
+		class SnapshotCodec
+		{
+			SnapshotSchema m_schema = {};
+			std::array<uint32_t, c_snapshot_field_count> m_bits = {};
+
+			// Scratch reused across calls, a codec is only used by one thread at a time
+			std::vector<uint32_t> m_removed = {};
+			std::vector<size_t> m_changed = {};
+
+		public:
+			SnapshotCodec(SnapshotSchema schema = {});
+
+			const SnapshotSchema& GetSchema() const { return m_schema; }
+
+			void Quantize(const Snapshot& snapshot, QuantizedSnapshot& out) const;
+			void Dequantize(const QuantizedSnapshot& snapshot, Snapshot& out) const;
+
+			/// <summary>
+			/// Write current as a delta against baseline, or in full when baseline is null
+			/// </summary>
+			void Encode(const QuantizedSnapshot* baseline, const QuantizedSnapshot& current, BitWriter& writer);
+
+			/// <summary>
+			/// Read the baseline sequence a delta was written against, -1 for a full snapshot
+			/// </summary>
+			static int32_t PeekBaseline(const uint8_t* data, size_t length);
+
+			/// <summary>
+			/// Rebuild the full snapshot from the baseline it names (null for a full snapshot). Returns false on
+			/// malformed input or a delta that doesn't fit the baseline.
+			/// </summary>
+			bool Decode(const QuantizedSnapshot* baseline, BitReader& reader, QuantizedSnapshot& out);
+		};
+
+		/// <summary>
+		/// Server side, per-client snapshot history and encoding. Each published snapshot is stored in the
+		/// client's ring and encoded against the newest one that client has acknowledged.
+		/// </summary>
+		class SnapshotReplicator
+		{
+		public:
+			/// <summary>
+			/// One client's delta history, a disconnected session holds on to it while it waits to be resumed
+			/// </summary>
+			struct ClientHistory
+			{
+				std::array<QuantizedSnapshot, c_snapshot_history> Ring = {};
+				QuantizedSnapshot Pending = {}; // Encoded into before it replaces the oldest ring entry
+				uint16_t NextSequence = 0;
+				int32_t AckedSequence = -1;
+				SnapshotCodec Codec = {};
+				std::mutex Mutex = {};
+			};
+			using ClientHistoryPtr = std::shared_ptr<ClientHistory>;
+
+		private:
+			using Clients = std::unordered_map<uint32_t, ClientHistoryPtr>; // Keyed by connection handle
+
+			SnapshotSchema m_schema = {};
+			Clients m_clients = {};
+			std::mutex m_clients_mutex = {};
+
+			ClientHistoryPtr getClient(uint32_t h, bool create);
+
+		public:
+			SnapshotReplicator(SnapshotSchema schema = {});
+
+			/// <summary>
+			/// Record a snapshot for a client and encode it into buffer. Returns the encoded byte count, or zero
+			/// if it didn't fit in capacity (the snapshot is then not recorded).
+			/// </summary>
+			size_t Encode(uint32_t h, const Snapshot& snapshot, uint8_t* buffer, size_t capacity);
+
+			/// <summary>
+			/// The client has reconstructed the snapshot with this sequence, future deltas may be based on it
+			/// </summary>
+			void Acknowledge(uint32_t h, uint16_t sequence);
+
+			void RemoveClient(uint32_t h);
+
+			/// <summary>
+			/// Take a client's history out of the replicator, null if it has none
+			/// </summary>
+			ClientHistoryPtr DetachClient(uint32_t h);
+
+			/// <summary>
+			/// Give a client a detached history, its next snapshot is a delta against what it last acknowledged
+			/// </summary>
+			void AttachClient(uint32_t h, ClientHistoryPtr client);
+		};
+		using SnapshotReplicatorPtr = std::unique_ptr<SnapshotReplicator>;
+		using SnapshotReplicatorRaw = SnapshotReplicator*;
+
+		/// <summary>
+		/// Client side, keeps the last c_snapshot_history reconstructed snapshots to serve as baselines
+		/// </summary>
+		class SnapshotReceiver
+		{
+			std::array<QuantizedSnapshot, c_snapshot_history> m_ring = {};
+			QuantizedSnapshot m_decoded = {};
+			SnapshotCodec m_codec = {};
+			Snapshot m_current = {};
+
+		public:
+			SnapshotReceiver(SnapshotSchema schema = {});
+
+			/// <summary>
+			/// Decode a snapshot message. On success the reconstructed snapshot is returned and its sequence
+			/// should be acknowledged to the server. Returns null if the baseline is gone or the data is bad.
+			/// </summary>
+			const Snapshot* Receive(const uint8_t* data, size_t length);
+		};
+		using SnapshotReceiverPtr = std::unique_ptr<SnapshotReceiver>;
+		using SnapshotReceiverRaw = SnapshotReceiver*;
+	}
+}
@@ -1,6 +1,65 @@
 #include "pch.h"
 #include "NetworkSystem.h"
 
+namespace
+{
+	using namespace ClayEngine::Networking;
+
+	/// <summary>
+	/// Snapshot acks, echo probes and keepalives are transport traffic, they are consumed here on whichever server thread received them
+	/// </summary>
+	MessageHandler makeServerHandler(NetworkSystemRaw ns, MessageHandler handler, SnapshotReplicatorRaw snapshots)
+	{
+		auto dispatcher = ns->GetMessageDispatcher();
+		auto capture = ns->GetCaptureWriter();
+		return [ns, handler, snapshots, dispatcher, capture](ConnectionHandle h, const MessageView& view)
+		{
+			capture->Write(h, view);
+
+			if (view.Opcode == c_opcode_snapshot_ack)
+			{
+				if (snapshots && view.Length == c_snapshot_ack_size) snapshots->Acknowledge(h, uint16_t(view.Data[0] | (view.Data[1] << 8)));
+			}
+			else if (view.Opcode == c_opcode_echo)
+			{
+				if (view.Flags & c_message_flag_datagram) ns->SendDatagram(h, c_opcode_echo, view.Data, view.Length);
+				else ns->Send(h, c_opcode_echo, view.Data, view.Length);
+			}
+			else if (view.Opcode == c_opcode_keepalive)
+			{
+				// Nothing to do, the bytes have already counted towards the idle timeout
+			}
+			else if (view.Opcode == c_opcode_session)
+			{
+				// Sessions are only opened over the stream, the owning reactor takes those before they get here
+			}
+			else if (!dispatcher->Dispatch(h, view) && handler) handler(h, view);
+		};
+	}
+
+	/// <summary>
+	/// Strip the transport's handshake frames out of a stream that is carried over to a new connection, the new
+	/// connection has made its own
+	/// </summary>
+	void removeHandshakeFrames(std::vector<uint8_t>& frames)
+	{
+		size_t read = 0;
+		size_t write = 0;
+		while (read + c_message_header_size <= frames.size())
+		{
+			auto length = size_t(c_message_header_size) + size_t(frames[read] | (frames[read + 1] << 8));
+			auto opcode = frames[read + 2];
+			if (opcode != c_opcode_session && opcode != c_opcode_datagram_bind)
+			{
+				if (write != read) std::memmove(frames.data() + write, frames.data() + read, length);
+				write += length;
+			}
+			read += length;
+		}
+		frames.resize(write);
+	}
+}
+
 #pragma region Network Helpers
 int ClayEngine::Networking::ProcessWSALastError()
 {
@@ -164,251 +223,2224 @@ void ClayEngine::Networking::AddressResolver::FreeSocket(SOCKET s)
 }
 #pragma endregion
 
-#pragma region Listen Server Module
-void ClayEngine::Networking::AcceptThreadFunctor::operator()(std::future<void> future)
+#pragma region Client Socket
+bool ClayEngine::Networking::ClientSocket::Receive(InboundContext& context)
 {
-	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
-	auto port = ns->GetListenServerPort();
-	auto hints = ns->GetListenServerHints();
-	auto timeout = ns->GetListenServerTimeout();
-	int rc = 0;
-
-	// Create a basic socket with the provided configuration
-	auto s = socket(hints.ai_family, hints.ai_socktype, hints.ai_protocol);
-	if (s == INVALID_SOCKET)
+	while (true)
 	{
-		rc = ProcessWSALastError();
-		throw std::exception("WSA ERROR: socket() INVALID_SOCKET");
-	}
+		// After every dispatch at most one partial frame is left behind, so there is always room to write
+		auto [data, size] = m_recv->GetWriteRegion();
 
-	// Reconfigure the socket for non-blocking I/O mode
-	u_long argp = 1ul;
-	if (ioctlsocket(s, FIONBIO, &argp) == SOCKET_ERROR)
-	{
-		rc = ProcessWSALastError();
-		throw std::exception("WSA ERROR: ioctlsocket() SOCKET_ERROR");
-	}
+		auto rc = recv(m_s, reinterpret_cast<char*>(data), int(size), 0);
+		if (rc == 0) return false;
+		if (rc == SOCKET_ERROR) return ProcessWSALastError() == WSAEWOULDBLOCK;
 
-	// Create an inbound socket configuration for listening
-	SOCKADDR_IN s_sin = { 0 };
-	s_sin.sin_family = ADDRESS_FAMILY(hints.ai_family);
-	s_sin.sin_addr.s_addr = htonl(INADDR_ANY);
-	s_sin.sin_port = htons(port);
+		m_recv->CommitWrite(size_t(rc));
+		m_stats->Add(NetworkCounter::BytesIn, uint64_t(rc));
 
-	// Bind the socket configuration to the socket
-	if (bind(s, (SOCKADDR*)&s_sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
-	{
-		rc = ProcessWSALastError();
-		throw std::exception("WSA ERROR: bind() SOCKET_ERROR");
+		// Budgets are topped up once per read rather than once per message
+		auto& limits = context.Limits;
+		auto limited = limits.MessagesPerSecond > 0 || limits.BytesPerSecond > 0;
+		if (limited)
+		{
+			auto now = Clock::now();
+			m_message_tokens.Refill(now, limits.MessagesPerSecond, limits.MessageBurst);
+			m_byte_tokens.Refill(now, limits.BytesPerSecond, limits.ByteBurst);
+		}
+
+		MessageView view = {};
+		while (true)
+		{
+			auto status = m_recv->PeekFrame(view);
+			if (status == FrameStatus::Incomplete) break;
+			if (status == FrameStatus::Malformed)
+			{
+				WriteLine("WSA ERROR: Malformed frame, dropping connection");
+				m_stats->Add(NetworkCounter::ProtocolErrors, 1);
+				return false;
+			}
+			m_stats->Add(NetworkCounter::MessagesIn, 1);
+
+			// Over budget messages are skipped on the strength of their header, nothing is decoded or dispatched
+			if (limited && ((limits.MessagesPerSecond > 0 && !m_message_tokens.TryTake(1.0)) ||
+				(limits.BytesPerSecond > 0 && !m_byte_tokens.TryTake(double(c_message_header_size + view.Length)))))
+			{
+				m_stats->Add(NetworkCounter::RateLimited, 1);
+				m_recv->ConsumeFrame(view);
+				continue;
+			}
+
+			if (context.Handler)
+			{
+				if (view.Flags & c_message_transform_mask)
+				{
+					// Decode out of the ring into the reactor's scratch, the handler only ever sees plain payloads
+					size_t length = 0;
+					if (!context.Transforms || !context.Transforms->Reverse(view.Data, view.Length, view.Flags, context.Scratch.get(), c_max_message_size, length))
+					{
+						WriteLine("WSA ERROR: Payload transform failed, dropping connection");
+						m_stats->Add(NetworkCounter::ProtocolErrors, 1);
+						return false;
+					}
+
+					MessageView decoded = { view.Opcode, uint8_t(view.Flags & ~c_message_transform_mask), context.Scratch.get(), length };
+					context.Handler(m_handle, decoded);
+				}
+				else
+				{
+					context.Handler(m_handle, view);
+				}
+			}
+			m_recv->ConsumeFrame(view);
+		}
 	}
+}
 
-	// Set the socket to listen
-	auto backlog = int(std::thread::hardware_concurrency() * 2);
-	if (listen(s, backlog) == SOCKET_ERROR)
+bool ClayEngine::Networking::ClientSocket::Flush(ReactorBackendRaw reactor)
+{
+	switch (m_send->Flush(m_s))
 	{
-		rc = ProcessWSALastError();
-		throw std::exception("WSA ERROR: listen() SOCKET_ERROR");
+	case FlushStatus::Complete:
+		if (m_want_write)
+		{
+			m_want_write = false;
+			reactor->Modify(m_s, m_handle, c_reactor_readable);
+		}
+		return true;
+	case FlushStatus::Pending:
+		if (!m_want_write)
+		{
+			m_want_write = true;
+			reactor->Modify(m_s, m_handle, c_reactor_readable | c_reactor_writable);
+		}
+		return true;
+	default:
+		return false;
 	}
+}
+#pragma endregion
 
-	WriteLine("WSA SUCCESS: ListenServerModule started");
+#pragma region Client Socket Module
+ClayEngine::Networking::ClientSocketModule::ClientSocketModule(ReactorBackendRaw reactor, uint32_t shard, TransformPipelineRaw transforms)
+	: m_shard{ shard }
+	, m_reactor{ reactor }
+	, m_transforms{ transforms }
+{
+	m_slots = std::make_unique<Slot[]>(c_max_connections_per_shard);
+}
 
-	auto csm = ns->GetClientSocketModule();
-	while (future.wait_for(std::chrono::milliseconds(timeout)) == std::future_status::timeout)
+ClayEngine::Networking::ClientSocketModule::~ClientSocketModule()
+{
+	auto used = m_slots_used.load(std::memory_order_acquire);
+	for (uint32_t i = 0; i < used; ++i)
 	{
-		auto [b, r_s, r_sa] = checkAcceptForClient(s);
-		if (b)
+		if (m_slots[i].Generation.load(std::memory_order_acquire) & 1u)
 		{
-			WriteLine("WSA SUCCESS: Connection accepted!");
-			csm->AddClientSocket(r_s, r_sa);
+			closesocket(m_slots[i].Socket.m_s);
 		}
 	}
-
-	shutdown(s, SD_BOTH);
-	closesocket(s);
 }
 
-std::tuple<bool, SOCKET, SOCKADDR> ClayEngine::Networking::AcceptThreadFunctor::checkAcceptForClient(SOCKET s)
+ClayEngine::Networking::ClientSocketModule::Slot* ClayEngine::Networking::ClientSocketModule::resolve(ConnectionHandle h)
 {
-	SOCKADDR sa = { 0 };
-	int sa_length = sizeof(SOCKADDR_IN);
-	int rc = 0;
+	if (GetHandleShard(h) != m_shard) return nullptr;
 
-	auto rs = accept(s, &sa, &sa_length);
-	if (rs == INVALID_SOCKET) rc = ProcessWSALastError();
+	auto index = GetHandleIndex(h);
+	if (index >= m_slots_used.load(std::memory_order_acquire)) return nullptr;
 
-	if (rc != WSAEWOULDBLOCK)
-	{
-		WriteLine("WSA Connection accepted!");
-		return std::make_tuple(true, rs, sa);
-	}
+	auto& slot = m_slots[index];
+	auto generation = slot.Generation.load(std::memory_order_acquire);
+	if (!(generation & 1u) || generation != GetHandleGeneration(h)) return nullptr;
 
-	return std::make_tuple(false, NULL, SOCKADDR{ 0 });
+	return &slot;
 }
 
-ClayEngine::Networking::AcceptThreadContext::AcceptThreadContext()
+void ClayEngine::Networking::ClientSocketModule::SetReactorThread(std::thread::id id)
 {
-	try
+	m_reactor_thread = id;
+}
+
+void ClayEngine::Networking::ClientSocketModule::SetBackpressure(const BackpressureSettings& settings)
+{
+	m_backpressure = settings;
+}
+
+ClayEngine::Networking::ConnectionHandle ClayEngine::Networking::ClientSocketModule::AddClientSocket(SOCKET s, SOCKADDR sa)
+{
+	uint32_t index = 0;
+	if (!m_free_slots.empty())
 	{
-		m_thread = std::thread{ AcceptThreadFunctor(), std::move(m_promise.get_future()) };
+		index = m_free_slots.front();
+		m_free_slots.pop_front();
 	}
-	catch (std::exception ex)
+	else
 	{
-		WriteLine(ex.what());
+		index = m_slots_used.load(std::memory_order_relaxed);
+		if (index >= c_max_connections_per_shard)
+		{
+			m_refused.fetch_add(1, std::memory_order_relaxed);
+			return c_invalid_connection;
+		}
 	}
+
+	auto& slot = m_slots[index];
+	auto generation = (slot.Generation.load(std::memory_order_relaxed) + 1u) & c_handle_generation_mask;
+	auto h = MakeConnectionHandle(m_shard, index, generation);
+
+	// Buffers are allocated the first time a slot is used and recycled with it from then on
+	auto& socket = slot.Socket;
+	if (!socket.m_recv) socket.m_recv = std::make_unique<ReceiveRing>();
+	if (!socket.m_send) socket.m_send = std::make_unique<SendQueue>();
+	if (!socket.m_stats) socket.m_stats = std::make_unique<ConnectionStats>();
+	socket.m_recv->Reset();
+	socket.m_stats->Begin();
+	socket.m_send->Bind(h, socket.m_stats.get());
+	socket.m_send->SetBackpressure(m_backpressure);
+	socket.m_message_tokens.Reset();
+	socket.m_byte_tokens.Reset();
+	socket.m_s = s;
+	socket.m_sa = sa;
+	socket.m_handle = h;
+	socket.m_want_write = false;
+
+	// Publish: the generation store releases the socket state to any thread that resolves this handle
+	slot.Generation.store(generation, std::memory_order_release);
+	if (index == m_slots_used.load(std::memory_order_relaxed)) m_slots_used.store(index + 1, std::memory_order_release);
+	m_client_count.fetch_add(1, std::memory_order_relaxed);
+	m_accepted.fetch_add(1, std::memory_order_relaxed);
+
+	return h;
 }
 
-ClayEngine::Networking::AcceptThreadContext::~AcceptThreadContext()
+void ClayEngine::Networking::ClientSocketModule::RemoveClientSocket(ConnectionHandle h)
 {
-	m_promise.set_value();
-	if (m_thread.joinable()) m_thread.join();
+	auto slot = resolve(h);
+	if (!slot) return;
+
+	slot->Generation.store((GetHandleGeneration(h) + 1u) & c_handle_generation_mask, std::memory_order_release);
+	slot->Socket.m_send->Unbind();
+
+	shutdown(slot->Socket.m_s, SD_BOTH);
+	closesocket(slot->Socket.m_s);
+	slot->Socket.m_s = INVALID_SOCKET;
+	slot->Socket.m_handle = c_invalid_connection;
+
+	m_free_slots.push_back(GetHandleIndex(h));
+	m_client_count.fetch_sub(1, std::memory_order_relaxed);
+	m_closed.fetch_add(1, std::memory_order_relaxed);
 }
 
-ClayEngine::Networking::ListenServerModule::ListenServerModule()
+ClayEngine::Networking::ClientSocket* ClayEngine::Networking::ClientSocketModule::GetClientSocket(ConnectionHandle h)
 {
-	m_listeners.emplace_back(std::make_unique<AcceptThreadContext>());
+	auto slot = resolve(h);
+	return slot ? &slot->Socket : nullptr;
 }
 
-ClayEngine::Networking::ListenServerModule::~ListenServerModule()
+bool ClayEngine::Networking::ClientSocketModule::Send(ConnectionHandle h, uint8_t opcode, const uint8_t* data, size_t length)
 {
-	for (auto& element : m_listeners)
-	{
-		element.reset();
-	}
+	auto slot = resolve(h);
+	if (!slot) return false;
+
+	// The queue re-checks ownership under its own lock, which closes the race with RemoveClientSocket
+	return requestFlush(h, slot->Socket.m_send->Enqueue(h, opcode, 0, data, length, m_transforms));
 }
-#pragma endregion
 
-#pragma region Network System (Network Service API)
-ClayEngine::Networking::NetworkSystem::NetworkSystem()
+bool ClayEngine::Networking::ClientSocketModule::Send(ConnectionHandle h, uint8_t opcode, const PayloadWriter& writer)
 {
-	auto rc = WSAStartup(MAKEWORD(2, 2), &m_wsadata);
-	if (rc != 0) throw;
+	auto slot = resolve(h);
+	if (!slot) return false;
 
-	m_client_sockets = std::make_unique<ClientSocketModule>();
+	return requestFlush(h, slot->Socket.m_send->Enqueue(h, opcode, 0, writer, m_transforms));
 }
 
-ClayEngine::Networking::NetworkSystem::~NetworkSystem()
+bool ClayEngine::Networking::ClientSocketModule::Send(ConnectionHandle h, const SharedMessagePtr& message)
 {
-	StopListenServer();
+	auto slot = resolve(h);
+	if (!slot) return false;
 
-	m_client_sockets.reset();
-	m_client_sockets = nullptr;
+	return requestFlush(h, slot->Socket.m_send->Enqueue(h, message));
+}
 
-	WSACleanup();
+bool ClayEngine::Networking::ClientSocketModule::SendFrames(ConnectionHandle h, const uint8_t* data, size_t length)
+{
+	auto slot = resolve(h);
+	if (!slot) return false;
+
+	return requestFlush(h, slot->Socket.m_send->EnqueueFrames(h, data, length));
 }
 
-void ClayEngine::Networking::NetworkSystem::StartListenServer()
+bool ClayEngine::Networking::ClientSocketModule::Disconnect(ConnectionHandle h)
 {
-	if (!m_listen_server)
-	{
-		m_listen_server = std::make_unique<ListenServerModule>();
-	}
+	auto slot = resolve(h);
+	if (!slot || !slot->Socket.m_send->Close(h)) return false;
+
+	// The closed queue fails its next flush and the reactor drops the client the same as for a socket error
+	requestFlush(h, EnqueueStatus::FlushRequired);
+	return true;
 }
 
-void ClayEngine::Networking::NetworkSystem::StopListenServer()
+bool ClayEngine::Networking::ClientSocketModule::requestFlush(ConnectionHandle h, EnqueueStatus status)
 {
-	if (m_listen_server)
+	if (status == EnqueueStatus::Rejected || status == EnqueueStatus::Dropped) return false;
+
+	// An overflowed queue fails its next flush, which is what gets the connection closed
+	if (status == EnqueueStatus::FlushRequired || status == EnqueueStatus::Overflowed)
 	{
-		m_listen_server.reset();
-		m_listen_server = nullptr;
+		{
+			std::scoped_lock guard(m_flush_requests_mutex);
+			m_flush_requests.push_back(h);
+		}
+
+		if (std::this_thread::get_id() != m_reactor_thread) m_reactor->Wake();
 	}
+
+	return status != EnqueueStatus::Overflowed;
 }
 
-void ClayEngine::Networking::NetworkSystem::SetListenServerTimeout(int timeout)
+void ClayEngine::Networking::ClientSocketModule::TakeFlushRequests(FlushRequests& requests)
 {
-	m_listen_server_loop_timeout = timeout;
+	requests.clear();
+	std::scoped_lock guard(m_flush_requests_mutex);
+	std::swap(requests, m_flush_requests);
 }
 
-int ClayEngine::Networking::NetworkSystem::GetListenServerTimeout()
+size_t ClayEngine::Networking::ClientSocketModule::GetClientCount()
 {
-	return m_listen_server_loop_timeout;
+	return m_client_count.load(std::memory_order_relaxed);
 }
 
-void ClayEngine::Networking::NetworkSystem::SetListenServerHints(int family, int socktype, int protocol)
+void ClayEngine::Networking::ClientSocketModule::GetTelemetry(NetworkTelemetry& out)
 {
-	m_listen_server_hints.ai_family = family;
-	m_listen_server_hints.ai_socktype = socktype;
-	m_listen_server_hints.ai_protocol = protocol;
+	out.Connections += m_client_count.load(std::memory_order_relaxed);
+	out.Accepted += m_accepted.load(std::memory_order_relaxed);
+	out.Refused += m_refused.load(std::memory_order_relaxed);
+	out.Closed += m_closed.load(std::memory_order_relaxed);
+
+	// Every slot below m_slots_used has had its stats allocated before the store that published it, and they
+	// live as long as the module, so they can be read whether or not the slot holds a connection right now
+	NetworkCounters totals = {};
+	auto used = m_slots_used.load(std::memory_order_acquire);
+	for (uint32_t i = 0; i < used; ++i)
+	{
+		auto& stats = *m_slots[i].Socket.m_stats;
+		stats.GetTotals(totals);
+		for (size_t c = 0; c < c_network_counter_count; ++c) out.Totals[c] += totals[c];
+
+		if (m_slots[i].Generation.load(std::memory_order_acquire) & 1u)
+		{
+			auto queued = stats.GetQueuedBytes();
+			out.QueuedBytes += queued;
+			out.MaxQueuedBytes = std::max(out.MaxQueuedBytes, queued);
+		}
+	}
 }
 
-ADDRINFO ClayEngine::Networking::NetworkSystem::GetListenServerHints()
+bool ClayEngine::Networking::ClientSocketModule::GetConnectionTelemetry(ConnectionHandle h, ConnectionTelemetry& out)
 {
-	return m_listen_server_hints;
+	auto slot = resolve(h);
+	if (!slot) return false;
+
+	out.Handle = h;
+	slot->Socket.m_stats->GetCounters(out.Counters);
+	out.QueuedBytes = slot->Socket.m_stats->GetQueuedBytes();
+	return true;
 }
+#pragma endregion
 
-void ClayEngine::Networking::NetworkSystem::SetListenServerPort(USHORT port)
+#pragma region Reactor Backends
+namespace
 {
-	m_listen_server_port = port;
+	using namespace ClayEngine::Networking;
+
+	/// <summary>
+	/// WSAPoll based backend. The wake signal is a connected loopback UDP socket pair, the read end
+	/// always lives in slot zero of the poll set so the socket list can be swap-removed around it.
+	/// </summary>
+	class WSAPollReactorBackend : public IReactorBackend
+	{
+		using PollSet = std::vector<WSAPOLLFD>;
+		using Tokens = std::vector<uint64_t>;
+		using Indices = std::unordered_map<SOCKET, size_t>;
+
+		PollSet m_fds = {};
+		Tokens m_tokens = {};
+		Indices m_indices = {};
+
+		SOCKET m_wake_recv = INVALID_SOCKET;
+		SOCKET m_wake_send = INVALID_SOCKET;
+		std::atomic<bool> m_wake_pending = false;
+
+		static SHORT toPollEvents(uint32_t interest)
+		{
+			SHORT events = 0;
+			if (interest & c_reactor_readable) events |= POLLRDNORM;
+			if (interest & c_reactor_writable) events |= POLLWRNORM;
+			return events;
+		}
+
+		void drainWake()
+		{
+			char buffer[64];
+			while (recv(m_wake_recv, buffer, int(sizeof(buffer)), 0) > 0) {}
+			m_wake_pending.store(false, std::memory_order_release);
+		}
+
+	public:
+		WSAPollReactorBackend()
+		{
+			SOCKADDR_IN sin = {};
+			sin.sin_family = AF_INET;
+			sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			sin.sin_port = 0;
+			int sin_length = sizeof(SOCKADDR_IN);
+
+			m_wake_recv = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+			m_wake_send = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+			if (m_wake_recv == INVALID_SOCKET || m_wake_send == INVALID_SOCKET)
+			{
+				ProcessWSALastError();
+				throw std::exception("WSA ERROR: socket() INVALID_SOCKET (reactor wake)");
+			}
+
+			if (bind(m_wake_recv, (SOCKADDR*)&sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR
+				|| getsockname(m_wake_recv, (SOCKADDR*)&sin, &sin_length) == SOCKET_ERROR
+				|| connect(m_wake_send, (SOCKADDR*)&sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+			{
+				ProcessWSALastError();
+				throw std::exception("WSA ERROR: reactor wake socket setup failed");
+			}
+
+			u_long argp = 1ul;
+			ioctlsocket(m_wake_recv, FIONBIO, &argp);
+			ioctlsocket(m_wake_send, FIONBIO, &argp);
+
+			m_fds.push_back(WSAPOLLFD{ m_wake_recv, POLLRDNORM, 0 });
+			m_tokens.push_back(0);
+		}
+		~WSAPollReactorBackend()
+		{
+			closesocket(m_wake_send);
+			closesocket(m_wake_recv);
+		}
+
+		bool Add(SOCKET s, uint64_t token, uint32_t interest) override
+		{
+			if (m_indices.find(s) != m_indices.end()) return Modify(s, token, interest);
+
+			m_indices.emplace(s, m_fds.size());
+			m_fds.push_back(WSAPOLLFD{ s, toPollEvents(interest), 0 });
+			m_tokens.push_back(token);
+			return true;
+		}
+
+		bool Modify(SOCKET s, uint64_t token, uint32_t interest) override
+		{
+			auto it = m_indices.find(s);
+			if (it == m_indices.end()) return false;
+
+			m_fds[it->second].events = toPollEvents(interest);
+			m_tokens[it->second] = token;
+			return true;
+		}
+
+		void Remove(SOCKET s) override
+		{
+			auto it = m_indices.find(s);
+			if (it == m_indices.end()) return;
+
+			auto index = it->second;
+			auto last = m_fds.size() - 1;
+			if (index != last)
+			{
+				m_fds[index] = m_fds[last];
+				m_tokens[index] = m_tokens[last];
+				m_indices[m_fds[index].fd] = index;
+			}
+			m_fds.pop_back();
+			m_tokens.pop_back();
+			m_indices.erase(it);
+		}
+
+		int Wait(ReactorEvents& events, int timeout) override
+		{
+			auto rc = WSAPoll(m_fds.data(), ULONG(m_fds.size()), timeout < 0 ? -1 : timeout);
+			if (rc == SOCKET_ERROR) return SOCKET_ERROR;
+
+			int count = 0;
+			for (size_t i = 0; i < m_fds.size() && rc > 0; ++i)
+			{
+				auto revents = m_fds[i].revents;
+				if (revents == 0) continue;
+				--rc;
+
+				if (i == 0)
+				{
+					drainWake();
+					continue;
+				}
+
+				uint32_t flags = 0;
+				if (revents & (POLLRDNORM | POLLHUP)) flags |= c_reactor_readable;
+				if (revents & POLLWRNORM) flags |= c_reactor_writable;
+				if (revents & (POLLERR | POLLHUP | POLLNVAL)) flags |= c_reactor_closed;
+
+				events.push_back(ReactorEvent{ m_tokens[i], flags });
+				++count;
+			}
+
+			return count;
+		}
+
+		void Wake() override
+		{
+			if (m_wake_pending.exchange(true, std::memory_order_acq_rel)) return;
+
+			char signal = 1;
+			send(m_wake_send, &signal, 1, 0);
+		}
+	};
 }
 
-USHORT ClayEngine::Networking::NetworkSystem::GetListenServerPort()
+ClayEngine::Networking::ReactorBackendPtr ClayEngine::Networking::MakeReactorBackend()
 {
-	return m_listen_server_port;
+	return std::make_unique<WSAPollReactorBackend>();
 }
+#pragma endregion
 
-ClayEngine::Networking::ClientSocketModuleRaw ClayEngine::Networking::NetworkSystem::GetClientSocketModule()
+#pragma region Listen Server Module
+ClayEngine::Networking::AcceptThreadFunctor::AcceptThreadFunctor(ReactorBackendRaw reactor, SOCKET listener, ClientSocketModuleRaw clients, size_t shard)
+	: m_reactor{ reactor }
+	, m_listener{ listener }
+	, m_clients{ clients }
+	, m_shard{ shard }
 {
-	return m_client_sockets.get();
+
 }
-#pragma endregion
 
-#pragma region Client Connection Module
-bool ClayEngine::Networking::ClientConnectionModule::tryConnectToServer()
+void ClayEngine::Networking::AcceptThreadFunctor::operator()(std::future<void> future)
 {
-	if (connect(m_s, (SOCKADDR*)&m_sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
+	auto timeout = ns->GetListenServerTimeout();
+	m_snapshots = ns->GetSnapshotReplicator();
+	m_interest = ns->GetInterestGrid();
+	m_sessions = ns->GetSessionTable();
+	m_session_handler = ns->GetSessionHandler();
+	m_session_grace = Milliseconds(ns->GetListenServerSessionGrace());
+
+	// Session hellos need this shard's timers, everything else is handled the same on every server thread
+	auto handler = makeServerHandler(ns, ns->GetMessageHandler(), m_snapshots);
+	m_inbound.Handler = [this, handler](ConnectionHandle h, const MessageView& view)
+	{
+		if (view.Opcode == c_opcode_session) receiveSession(h, view);
+		else handler(h, view);
+	};
+	m_inbound.Transforms = ns->GetTransformPipeline();
+	m_inbound.Scratch = std::make_unique<uint8_t[]>(size_t(c_transform_scratch_size));
+	m_inbound.Limits = ns->GetListenServerRateLimits();
+	m_datagrams = ns->GetDatagramServerModule();
+	m_clients->SetReactorThread(std::this_thread::get_id());
+	m_clients->SetBackpressure(ns->GetListenServerBackpressure());
+
+	m_idle_timeout = Milliseconds(ns->GetListenServerIdleTimeout());
+	m_keepalive_interval = Milliseconds(ns->GetListenServerKeepaliveInterval());
+	m_timers = std::make_unique<TimingWheel>(Clock::now());
+	m_connection_timers.resize(size_t(c_max_connections_per_shard));
+
+	m_reactor->Add(m_listener, c_reactor_listener_token, c_reactor_readable);
+
+	std::stringstream ss;
+	ss << "WSA SUCCESS: ListenServerModule shard " << m_shard << " started";
+	WriteLine(ss.str());
+
+	ReactorEvents events = {};
+	events.reserve(c_reactor_max_events);
+
+	std::vector<ConnectionHandle> flushes = {};
+
+	while (future.wait_for(Nanoseconds(0)) == std::future_status::timeout)
 	{
-		auto rc = ProcessWSALastError();
-		if (rc != WSAEWOULDBLOCK)
+		events.clear();
+		if (m_reactor->Wait(events, getWaitTimeout(timeout)) == SOCKET_ERROR)
+		{
+			ProcessWSALastError();
+			continue;
+		}
+
+		for (auto& element : events)
+		{
+			if (element.Token == c_reactor_listener_token)
+			{
+				acceptClients();
+				continue;
+			}
+
+			auto h = ConnectionHandle(element.Token);
+			if (element.Flags & (c_reactor_readable | c_reactor_closed)) receiveFromClient(h);
+			if (element.Flags & c_reactor_writable) flushClient(h);
+		}
+
+		// Timers run after reads so a client that spoke this pass is never taken for idle, and before the
+		// flush so that any keepalives they queue leave on this pass
+		m_timers->Advance(Clock::now());
+
+		// Everything queued since the last pass, including replies sent by the handlers above, goes out now
+		m_clients->TakeFlushRequests(flushes);
+		for (auto h : flushes)
 		{
-			return false;
+			flushClient(h);
 		}
 	}
 
-	return true;
+	m_reactor->Remove(m_listener);
+	m_clients->ForEachConnection([&](ConnectionHandle h) { disconnectClient(h); });
 }
 
-ClayEngine::Networking::ClientConnectionModule::ClientConnectionModule(String address)
+std::tuple<bool, SOCKET, SOCKADDR> ClayEngine::Networking::AcceptThreadFunctor::checkAcceptForClient(SOCKET s)
 {
-	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
-	auto port = ns->GetClientConnectionPort();
-	auto hints = ns->GetClientConnectionHints();
-	auto timeout = ns->GetClientConnectionTimeout();
-	UNREFERENCED_PARAMETER(timeout);
-	int rc = 0;
+	SOCKADDR sa = { 0 };
+	int sa_length = sizeof(SOCKADDR_IN);
 
-	// Create a basic socket with the provided configuration
-	m_s = socket(hints.ai_family, hints.ai_socktype, hints.ai_protocol);
-	if (m_s == INVALID_SOCKET)
-	{
-		rc = ProcessWSALastError();
-		throw std::exception("WSA ERROR: socket() INVALID_SOCKET");
-	}
-	
-	// Reconfigure the socket for non-blocking I/O mode
-	u_long argp = 1ul;
-	if (ioctlsocket(m_s, FIONBIO, &argp) == SOCKET_ERROR)
+	auto rs = accept(s, &sa, &sa_length);
+	if (rs == INVALID_SOCKET)
 	{
-		rc = ProcessWSALastError();
-		throw std::exception("WSA ERROR: ioctlsocket() SOCKET_ERROR");
+		ProcessWSALastError();
+		return std::make_tuple(false, INVALID_SOCKET, SOCKADDR{ 0 });
 	}
 
-	if (InetPtonA(AF_INET, address.c_str(), &m_sin.sin_addr.s_addr) == SOCKET_ERROR) throw;
-	m_sin.sin_family = ADDRESS_FAMILY(hints.ai_family);
-	m_sin.sin_port = htons(port);
+	return std::make_tuple(true, rs, sa);
+}
 
-	while (!tryConnectToServer())
+void ClayEngine::Networking::AcceptThreadFunctor::acceptClients()
+{
+	// Drain the backlog, a single readiness notification may cover any number of pending connections. When the
+	// listener is shared between shards another reactor may beat us to it, which just shows up as WSAEWOULDBLOCK.
+	while (true)
 	{
-		//Sleep(timeout);
+		auto [b, r_s, r_sa] = checkAcceptForClient(m_listener);
+		if (!b) break;
+
+		// Accepted sockets inherit non-blocking mode from the listener on Windows, but not everywhere
+		u_long argp = 1ul;
+		ioctlsocket(r_s, FIONBIO, &argp);
 
-		//if (future.wait_for(std::chrono::milliseconds(timeout)) != std::future_status::timeout) break;
+		auto h = m_clients->AddClientSocket(r_s, r_sa);
+		if (h == c_invalid_connection)
+		{
+			WriteLine("WSA WARNING: Shard at connection capacity, refusing client");
+			closesocket(r_s);
+			continue;
+		}
+
+		// The client speaks first, its session hello says whether it is new or coming back
+		WriteLine("WSA SUCCESS: Connection accepted!");
+		m_reactor->Add(r_s, h, c_reactor_readable);
+		armTimers(h);
 	}
+}
 
-	WriteLine("WSA SUCCESS: ClientConnectionModule started");
+void ClayEngine::Networking::AcceptThreadFunctor::receiveFromClient(ConnectionHandle h)
+{
+	auto client = m_clients->GetClientSocket(h);
+	if (!client) return;
+
+	if (!client->Receive(m_inbound)) disconnectClient(h);
 }
 
-ClayEngine::Networking::ClientConnectionModule::~ClientConnectionModule()
+void ClayEngine::Networking::AcceptThreadFunctor::flushClient(ConnectionHandle h)
 {
-	shutdown(m_s, SD_BOTH);
-	closesocket(m_s);
+	// The client may already have been dropped earlier in this pass
+	auto client = m_clients->GetClientSocket(h);
+	if (!client) return;
+
+	client->m_send->TakeFlushRequest();
+	if (!client->Flush(m_reactor)) disconnectClient(h);
 }
-#pragma endregion
 
+void ClayEngine::Networking::AcceptThreadFunctor::disconnectClient(ConnectionHandle h)
+{
+	auto client = m_clients->GetClientSocket(h);
+	if (!client) return;
+
+	WriteLine("WSA INFO: Client disconnected");
+
+	// With a grace window the session keeps whatever the client would otherwise have to be sent again, the
+	// stream backlog has to be taken before the slot is cleared
+	auto token = m_sessions ? m_sessions->GetToken(h) : c_invalid_session;
+	auto park = token != c_invalid_session && m_session_grace.count() > 0;
+
+	ParkedSession parked = {};
+	if (park)
+	{
+		client->m_send->TakeUnsent(parked.Unsent);
+		removeHandshakeFrames(parked.Unsent);
+	}
+
+	m_reactor->Remove(client->m_s);
+	m_clients->RemoveClientSocket(h);
+
+	auto& timers = m_connection_timers[GetHandleIndex(h)];
+	m_timers->Cancel(timers.Idle);
+	m_timers->Cancel(timers.Keepalive);
+	timers = {};
+
+	if (park)
+	{
+		if (m_datagrams) parked.Channel = m_datagrams->DetachChannel(h);
+		if (m_snapshots) parked.Replication = m_snapshots->DetachClient(h);
+
+		auto expires = Clock::now() + m_session_grace;
+		m_sessions->Park(h, std::move(parked), expires);
+		m_timers->Schedule(m_session_grace, [this, token, expires]() { expireSession(token, expires); });
+	}
+	else
+	{
+		if (m_datagrams) m_datagrams->CloseChannel(h);
+		if (m_snapshots) m_snapshots->RemoveClient(h);
+
+		if (token != c_invalid_session)
+		{
+			m_sessions->Close(h);
+			if (m_session_handler) m_session_handler(SessionEvent::Closed, h, c_invalid_connection);
+		}
+	}
+
+	if (m_interest) m_interest->RemoveObserver(h);
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::armTimers(ConnectionHandle h)
+{
+	auto client = m_clients->GetClientSocket(h);
+	if (!client) return;
+
+	// Marks start from the slot's running totals, which carry over from whoever held it before
+	auto& timers = m_connection_timers[GetHandleIndex(h)];
+	timers.IdleMark = client->m_stats->GetTotal(NetworkCounter::BytesIn);
+	timers.KeepaliveMark = client->m_stats->GetTotal(NetworkCounter::MessagesOut);
+
+	if (m_idle_timeout.count() > 0) timers.Idle = m_timers->Schedule(m_idle_timeout, [this, h]() { checkIdle(h); });
+	if (m_keepalive_interval.count() > 0) timers.Keepalive = m_timers->Schedule(m_keepalive_interval, [this, h]() { checkKeepalive(h); });
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::checkIdle(ConnectionHandle h)
+{
+	auto client = m_clients->GetClientSocket(h);
+	if (!client) return;
+
+	// Rather than push the deadline back on every read, look once per timeout at whether anything arrived
+	auto& timers = m_connection_timers[GetHandleIndex(h)];
+	auto mark = client->m_stats->GetTotal(NetworkCounter::BytesIn);
+	if (mark == timers.IdleMark)
+	{
+		WriteLine("WSA INFO: Client idle timeout");
+		timers.Idle = c_invalid_timer;
+		disconnectClient(h);
+		return;
+	}
+
+	timers.IdleMark = mark;
+	timers.Idle = m_timers->Schedule(m_idle_timeout, [this, h]() { checkIdle(h); });
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::checkKeepalive(ConnectionHandle h)
+{
+	auto client = m_clients->GetClientSocket(h);
+	if (!client) return;
+
+	// Only a client we have had nothing else to say to needs prompting
+	auto& timers = m_connection_timers[GetHandleIndex(h)];
+	auto mark = client->m_stats->GetTotal(NetworkCounter::MessagesOut);
+	if (mark == timers.KeepaliveMark)
+	{
+		m_clients->Send(h, c_opcode_keepalive, nullptr, 0);
+		mark = client->m_stats->GetTotal(NetworkCounter::MessagesOut);
+	}
+
+	timers.KeepaliveMark = mark;
+	timers.Keepalive = m_timers->Schedule(m_keepalive_interval, [this, h]() { checkKeepalive(h); });
+}
+
+int ClayEngine::Networking::AcceptThreadFunctor::getWaitTimeout(int timeout)
+{
+	// Negative means wait forever on both sides
+	auto wheel = m_timers->GetWaitTimeout(Clock::now());
+	if (wheel < 0) return timeout;
+	if (timeout < 0) return wheel;
+	return std::min(timeout, wheel);
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::receiveSession(ConnectionHandle h, const MessageView& view)
+{
+	// Only the first hello on a connection counts
+	if (!m_sessions || view.Length != c_session_hello_size || m_sessions->GetToken(h) != c_invalid_session) return;
+
+	SessionToken token = c_invalid_session;
+	for (int i = 0; i < 8; ++i) token |= SessionToken(view.Data[i]) << (8 * i);
+
+	if (token == c_invalid_session) openSession(h);
+	else resumeSession(h, token, 0);
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::resumeSession(ConnectionHandle h, SessionToken token, int attempt)
+{
+	// The client may have dropped again while we waited on its old connection
+	if (!m_clients->GetClientSocket(h)) return;
+
+	ParkedSession parked = {};
+	auto status = m_sessions->Resume(token, h, parked);
+	if (status == ResumeStatus::Resumed)
+	{
+		restoreSession(h, token, parked);
+		return;
+	}
+
+	if (status == ResumeStatus::Live && parked.Handle != h && attempt < c_session_resume_attempts)
+	{
+		// The old connection is most likely half open, close it and its reactor parks the session for us
+		if (attempt == 0) ClayEngine::Services::GetService<NetworkSystem>()->Disconnect(parked.Handle);
+
+		m_timers->Schedule(Milliseconds(c_session_resume_retry), [this, h, token, attempt]() { resumeSession(h, token, attempt + 1); });
+		return;
+	}
+
+	if (status == ResumeStatus::Live && parked.Handle == h) return; // Already ours, the hello was repeated
+
+	openSession(h);
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::openSession(ConnectionHandle h)
+{
+	if (m_sessions->GetToken(h) != c_invalid_session) return;
+
+	auto token = m_sessions->Open(h);
+	sendSession(h, token, SessionStatus::Opened);
+	if (m_datagrams) bindDatagrams(h, m_datagrams->OpenChannel(h));
+
+	if (m_session_handler) m_session_handler(SessionEvent::Opened, h, c_invalid_connection);
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::restoreSession(ConnectionHandle h, SessionToken token, ParkedSession& parked)
+{
+	// The client still has the baselines it acknowledged, so its next snapshot is a delta and not the whole world
+	if (m_snapshots && parked.Replication) m_snapshots->AttachClient(h, parked.Replication);
+
+	// Reply, then the channel, then the backlog, the client needs each before it can make sense of the next
+	sendSession(h, token, SessionStatus::Resumed);
+	if (m_datagrams) bindDatagrams(h, parked.Channel ? m_datagrams->AttachChannel(h, parked.Channel) : m_datagrams->OpenChannel(h));
+	if (!parked.Unsent.empty()) m_clients->SendFrames(h, parked.Unsent.data(), parked.Unsent.size());
+
+	WriteLine("WSA SUCCESS: Session resumed");
+	if (m_session_handler) m_session_handler(SessionEvent::Resumed, h, parked.Handle);
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::expireSession(SessionToken token, TimePoint expires)
+{
+	ParkedSession parked = {};
+	if (!m_sessions->Expire(token, expires, parked)) return;
+
+	if (m_datagrams && parked.Channel) m_datagrams->RetireChannel(parked.Channel);
+
+	WriteLine("WSA INFO: Session expired");
+	if (m_session_handler) m_session_handler(SessionEvent::Closed, parked.Handle, c_invalid_connection);
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::sendSession(ConnectionHandle h, SessionToken token, SessionStatus status)
+{
+	auto grace = uint32_t(m_session_grace.count());
+
+	std::array<uint8_t, c_session_reply_size> reply = {};
+	for (int i = 0; i < 8; ++i) reply[i] = uint8_t(token >> (8 * i));
+	for (int i = 0; i < 4; ++i) reply[8 + i] = uint8_t(grace >> (8 * i));
+	reply[12] = uint8_t(status);
+	m_clients->Send(h, c_opcode_session, reply.data(), reply.size());
+}
+
+void ClayEngine::Networking::AcceptThreadFunctor::bindDatagrams(ConnectionHandle h, uint32_t key)
+{
+	// Hand the client its datagram session, it proves ownership by echoing the key in every packet
+	auto port = m_datagrams->GetPort();
+
+	std::array<uint8_t, c_datagram_bind_size> bind = {};
+	for (int i = 0; i < 4; ++i) bind[i] = uint8_t(h >> (8 * i));
+	for (int i = 0; i < 4; ++i) bind[4 + i] = uint8_t(key >> (8 * i));
+	bind[8] = uint8_t(port & 0xFF);
+	bind[9] = uint8_t(port >> 8);
+	m_clients->Send(h, c_opcode_datagram_bind, bind.data(), bind.size());
+}
+
+SOCKET ClayEngine::Networking::AcceptThreadContext::CreateListenSocket(bool reuse_port)
+{
+	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
+	auto port = ns->GetListenServerPort();
+	auto hints = ns->GetListenServerHints();
+
+	// Create a basic socket with the provided configuration
+	auto s = socket(hints.ai_family, hints.ai_socktype, hints.ai_protocol);
+	if (s == INVALID_SOCKET)
+	{
+		ProcessWSALastError();
+		throw std::exception("WSA ERROR: socket() INVALID_SOCKET");
+	}
+
+	// Reconfigure the socket for non-blocking I/O mode
+	u_long argp = 1ul;
+	if (ioctlsocket(s, FIONBIO, &argp) == SOCKET_ERROR)
+	{
+		ProcessWSALastError();
+		closesocket(s);
+		throw std::exception("WSA ERROR: ioctlsocket() SOCKET_ERROR");
+	}
+
+#if defined(SO_REUSEPORT)
+	// Allow every shard to bind the same port, the kernel load balances incoming connections between them
+	if (reuse_port)
+	{
+		int enable = 1;
+		if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&enable, sizeof(enable)) == SOCKET_ERROR)
+		{
+			ProcessWSALastError();
+			closesocket(s);
+			throw std::exception("WSA ERROR: setsockopt() SO_REUSEPORT SOCKET_ERROR");
+		}
+	}
+#else
+	UNREFERENCED_PARAMETER(reuse_port);
+#endif
+
+	// Create an inbound socket configuration for listening
+	SOCKADDR_IN s_sin = { 0 };
+	s_sin.sin_family = ADDRESS_FAMILY(hints.ai_family);
+	s_sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	s_sin.sin_port = htons(port);
+
+	// Bind the socket configuration to the socket
+	if (bind(s, (SOCKADDR*)&s_sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+	{
+		ProcessWSALastError();
+		closesocket(s);
+		throw std::exception("WSA ERROR: bind() SOCKET_ERROR");
+	}
+
+	// Set the socket to listen
+	if (listen(s, SOMAXCONN) == SOCKET_ERROR)
+	{
+		ProcessWSALastError();
+		closesocket(s);
+		throw std::exception("WSA ERROR: listen() SOCKET_ERROR");
+	}
+
+	return s;
+}
+
+ClayEngine::Networking::AcceptThreadContext::AcceptThreadContext(size_t shard, SOCKET listener)
+{
+	try
+	{
+		// Socket setup happens on the calling thread so failures surface here instead of inside the reactor
+		m_reactor = MakeReactorBackend();
+		m_clients = std::make_unique<ClientSocketModule>(m_reactor.get(), uint32_t(shard), ClayEngine::Services::GetService<NetworkSystem>()->GetTransformPipeline());
+
+		m_owns_listener = (listener == INVALID_SOCKET);
+		m_listener = m_owns_listener ? CreateListenSocket(true) : listener;
+
+		m_thread = std::thread{ AcceptThreadFunctor(m_reactor.get(), m_listener, m_clients.get(), shard), std::move(m_promise.get_future()) };
+	}
+	catch (std::exception ex)
+	{
+		WriteLine(ex.what());
+	}
+}
+
+ClayEngine::Networking::AcceptThreadContext::~AcceptThreadContext()
+{
+	m_promise.set_value();
+	if (m_reactor) m_reactor->Wake();
+	if (m_thread.joinable()) m_thread.join();
+
+	if (m_owns_listener && m_listener != INVALID_SOCKET)
+	{
+		shutdown(m_listener, SD_BOTH);
+		closesocket(m_listener);
+	}
+
+	m_clients.reset();
+	m_clients = nullptr;
+}
+
+ClayEngine::Networking::ClientSocketModuleRaw ClayEngine::Networking::AcceptThreadContext::GetClientSocketModule()
+{
+	return m_clients.get();
+}
+
+ClayEngine::Networking::ListenServerModule::ListenServerModule()
+{
+	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
+	auto threads = ns->GetListenServerThreads();
+	if (threads == 0) threads = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+	threads = std::min(threads, c_max_listen_shards);
+
+#if !defined(SO_REUSEPORT)
+	try
+	{
+		m_shared_listener = AcceptThreadContext::CreateListenSocket(false);
+	}
+	catch (std::exception ex)
+	{
+		WriteLine(ex.what());
+		return;
+	}
+#endif
+
+	for (size_t i = 0; i < threads; ++i)
+	{
+		m_listeners.emplace_back(std::make_unique<AcceptThreadContext>(i, m_shared_listener));
+	}
+}
+
+ClayEngine::Networking::ListenServerModule::~ListenServerModule()
+{
+	for (auto& element : m_listeners)
+	{
+		element.reset();
+	}
+
+	if (m_shared_listener != INVALID_SOCKET)
+	{
+		shutdown(m_shared_listener, SD_BOTH);
+		closesocket(m_shared_listener);
+	}
+}
+
+size_t ClayEngine::Networking::ListenServerModule::GetShardCount()
+{
+	return m_listeners.size();
+}
+
+ClayEngine::Networking::ClientSocketModuleRaw ClayEngine::Networking::ListenServerModule::GetClientSocketModule(size_t shard)
+{
+	if (shard >= m_listeners.size()) return nullptr;
+	return m_listeners[shard]->GetClientSocketModule();
+}
+#pragma endregion
+
+#pragma region Datagram Server Module
+ClayEngine::Networking::DatagramThreadFunctor::DatagramThreadFunctor(ReactorBackendRaw reactor, SOCKET s, DatagramServerModuleRaw datagrams)
+	: m_reactor{ reactor }
+	, m_s{ s }
+	, m_datagrams{ datagrams }
+{
+
+}
+
+void ClayEngine::Networking::DatagramThreadFunctor::operator()(std::future<void> future)
+{
+	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
+	m_handler = makeServerHandler(ns, ns->GetMessageHandler(), ns->GetSnapshotReplicator());
+
+	m_reactor->Add(m_s, c_reactor_datagram_token, c_reactor_readable);
+
+	WriteLine("WSA SUCCESS: DatagramServerModule started");
+
+	ReactorEvents events = {};
+	events.reserve(c_reactor_max_events);
+
+	while (future.wait_for(Nanoseconds(0)) == std::future_status::timeout)
+	{
+		events.clear();
+		if (m_reactor->Wait(events, c_datagram_ack_interval) == SOCKET_ERROR)
+		{
+			ProcessWSALastError();
+			continue;
+		}
+
+		for (auto& element : events)
+		{
+			if (element.Token == c_reactor_datagram_token) receivePackets();
+		}
+
+		// Runs on every wake and at least once per ack interval, so acks and resends go out even when idle
+		flushChannels();
+	}
+
+	m_reactor->Remove(m_s);
+}
+
+void ClayEngine::Networking::DatagramThreadFunctor::receivePackets()
+{
+	while (true)
+	{
+		SOCKADDR_IN from = {};
+		int from_length = sizeof(from);
+
+		auto rc = recvfrom(m_s, reinterpret_cast<char*>(m_buffer.data()), int(m_buffer.size()), 0, (SOCKADDR*)&from, &from_length);
+		if (rc == SOCKET_ERROR)
+		{
+			// Oversized datagrams and ICMP port unreachable from a vanished client are per packet, keep draining
+			auto error = WSAGetLastError();
+			if (error == WSAEMSGSIZE || error == WSAECONNRESET) continue;
+			if (error != WSAEWOULDBLOCK) ProcessWSALastError();
+			return;
+		}
+
+		uint32_t handle = 0;
+		uint32_t key = 0;
+		if (!DatagramChannel::ReadPacketIdentity(m_buffer.data(), size_t(rc), handle, key)) continue;
+
+		auto channel = m_datagrams->AcceptPacket(handle, key, from);
+		if (!channel) continue;
+
+		m_messages.clear();
+		if (!channel->ProcessPacket(m_buffer.data(), size_t(rc), Clock::now(), m_messages)) continue;
+
+		if (m_handler)
+		{
+			for (auto& view : m_messages)
+			{
+				m_handler(handle, view);
+			}
+		}
+	}
+}
+
+void ClayEngine::Networking::DatagramThreadFunctor::flushChannels()
+{
+	m_targets.clear();
+	m_datagrams->GetFlushTargets(m_targets);
+
+	auto now = Clock::now();
+	for (auto& [channel, endpoint] : m_targets)
+	{
+		while (auto length = channel->BuildPacket(m_buffer.data(), now))
+		{
+			if (sendto(m_s, reinterpret_cast<const char*>(m_buffer.data()), int(length), 0, (const SOCKADDR*)&endpoint, sizeof(endpoint)) == SOCKET_ERROR)
+			{
+				// A full send buffer just loses this packet, which is what the channel is built to tolerate
+				if (ProcessWSALastError() != WSAEWOULDBLOCK) break;
+			}
+		}
+	}
+}
+
+ClayEngine::Networking::DatagramServerModule::DatagramServerModule(USHORT port)
+	: m_port{ port }
+	, m_keys{ std::random_device{}() }
+{
+	m_s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_s == INVALID_SOCKET)
+	{
+		ProcessWSALastError();
+		throw std::exception("WSA ERROR: socket() INVALID_SOCKET");
+	}
+
+	// Reconfigure the socket for non-blocking I/O mode
+	u_long argp = 1ul;
+	if (ioctlsocket(m_s, FIONBIO, &argp) == SOCKET_ERROR)
+	{
+		ProcessWSALastError();
+		closesocket(m_s);
+		throw std::exception("WSA ERROR: ioctlsocket() SOCKET_ERROR");
+	}
+
+	SOCKADDR_IN s_sin = { 0 };
+	s_sin.sin_family = AF_INET;
+	s_sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	s_sin.sin_port = htons(port);
+
+	if (bind(m_s, (SOCKADDR*)&s_sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+	{
+		ProcessWSALastError();
+		closesocket(m_s);
+		throw std::exception("WSA ERROR: bind() SOCKET_ERROR");
+	}
+
+	m_reactor = MakeReactorBackend();
+	m_thread = std::thread{ DatagramThreadFunctor(m_reactor.get(), m_s, this), std::move(m_promise.get_future()) };
+}
+
+ClayEngine::Networking::DatagramServerModule::~DatagramServerModule()
+{
+	m_promise.set_value();
+	if (m_reactor) m_reactor->Wake();
+	if (m_thread.joinable()) m_thread.join();
+
+	closesocket(m_s);
+}
+
+USHORT ClayEngine::Networking::DatagramServerModule::GetPort()
+{
+	return m_port;
+}
+
+uint32_t ClayEngine::Networking::DatagramServerModule::OpenChannel(ConnectionHandle h)
+{
+	return AttachChannel(h, std::make_shared<DatagramChannel>());
+}
+
+void ClayEngine::Networking::DatagramServerModule::CloseChannel(ConnectionHandle h)
+{
+	auto channel = DetachChannel(h);
+	if (channel) RetireChannel(channel);
+}
+
+ClayEngine::Networking::DatagramChannelPtr ClayEngine::Networking::DatagramServerModule::DetachChannel(ConnectionHandle h)
+{
+	std::scoped_lock guard(m_sessions_mutex);
+
+	auto it = m_sessions.find(h);
+	if (it == m_sessions.end()) return nullptr;
+
+	auto channel = it->second.Channel;
+	m_sessions.erase(it);
+	return channel;
+}
+
+uint32_t ClayEngine::Networking::DatagramServerModule::AttachChannel(ConnectionHandle h, DatagramChannelPtr channel)
+{
+	std::scoped_lock guard(m_sessions_mutex);
+
+	// Zero is reserved so a forged packet with a blank header never matches
+	uint32_t key = 0;
+	while (key == 0) key = uint32_t(m_keys());
+
+	// The endpoint is learned again from the first packet, a reconnecting client may well have a new address
+	channel->Bind(h, key);
+	m_sessions[h] = Session{ channel, {}, false };
+	return key;
+}
+
+void ClayEngine::Networking::DatagramServerModule::RetireChannel(const DatagramChannelPtr& channel)
+{
+	ConnectionTelemetry closing = {};
+	channel->GetTelemetry(closing);
+
+	std::scoped_lock guard(m_sessions_mutex);
+	m_retired.PacketsSent += closing.PacketsSent;
+	m_retired.PacketsReceived += closing.PacketsReceived;
+	m_retired.PacketsLost += closing.PacketsLost;
+	m_retired.Resends += closing.Resends;
+}
+
+bool ClayEngine::Networking::DatagramServerModule::Send(ConnectionHandle h, uint8_t opcode, const uint8_t* data, size_t length, bool reliable)
+{
+	DatagramChannelPtr channel = nullptr;
+	{
+		std::scoped_lock guard(m_sessions_mutex);
+		auto it = m_sessions.find(h);
+		if (it == m_sessions.end()) return false;
+		channel = it->second.Channel;
+	}
+
+	auto status = channel->Queue(opcode, data, length, reliable);
+	if (status == EnqueueStatus::FlushRequired) m_reactor->Wake();
+
+	return status != EnqueueStatus::Rejected;
+}
+
+ClayEngine::Networking::DatagramChannelPtr ClayEngine::Networking::DatagramServerModule::AcceptPacket(ConnectionHandle h, uint32_t key, const SOCKADDR_IN& from)
+{
+	std::scoped_lock guard(m_sessions_mutex);
+
+	auto it = m_sessions.find(h);
+	if (it == m_sessions.end() || key == 0 || it->second.Channel->GetKey() != key) return nullptr;
+
+	it->second.Endpoint = from;
+	it->second.HasEndpoint = true;
+	return it->second.Channel;
+}
+
+void ClayEngine::Networking::DatagramServerModule::GetFlushTargets(FlushTargets& targets)
+{
+	std::scoped_lock guard(m_sessions_mutex);
+
+	for (auto& [h, session] : m_sessions)
+	{
+		if (session.HasEndpoint) targets.emplace_back(session.Channel, session.Endpoint);
+	}
+}
+
+ClayEngine::Networking::DatagramChannelPtr ClayEngine::Networking::DatagramServerModule::GetChannel(ConnectionHandle h)
+{
+	std::scoped_lock guard(m_sessions_mutex);
+
+	auto it = m_sessions.find(h);
+	return (it == m_sessions.end()) ? nullptr : it->second.Channel;
+}
+
+void ClayEngine::Networking::DatagramServerModule::GetTelemetry(NetworkTelemetry& out)
+{
+	std::scoped_lock guard(m_sessions_mutex);
+
+	out.PacketsSent += m_retired.PacketsSent;
+	out.PacketsReceived += m_retired.PacketsReceived;
+	out.PacketsLost += m_retired.PacketsLost;
+	out.Resends += m_retired.Resends;
+
+	auto measured = 0;
+	auto rtt_sum = 0.f;
+	for (auto& [h, session] : m_sessions)
+	{
+		ConnectionTelemetry channel = {};
+		session.Channel->GetTelemetry(channel);
+		out.PacketsSent += channel.PacketsSent;
+		out.PacketsReceived += channel.PacketsReceived;
+		out.PacketsLost += channel.PacketsLost;
+		out.Resends += channel.Resends;
+
+		if (channel.RoundTrip > 0.f)
+		{
+			++measured;
+			rtt_sum += channel.RoundTrip;
+			out.MaxRoundTrip = std::max(out.MaxRoundTrip, channel.RoundTrip);
+		}
+	}
+	if (measured > 0) out.MeanRoundTrip = rtt_sum / float(measured);
+}
+#pragma endregion
+
+#pragma region Telemetry Module
+ClayEngine::Networking::TelemetryThreadFunctor::TelemetryThreadFunctor(String filename, int interval)
+	: m_filename{ filename }
+	, m_interval{ interval }
+{
+}
+
+void ClayEngine::Networking::TelemetryThreadFunctor::operator()(std::future<void> future)
+{
+	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
+
+	std::ofstream ofs{ m_filename, std::ios::app };
+	if (!ofs.is_open())
+	{
+		WriteLine("TelemetryThreadFunctor ERROR: Unable to open " + m_filename);
+		return;
+	}
+
+	// The future doubles as the interval timer, so shutting down never waits out a whole interval
+	NetworkTelemetry telemetry = {};
+	while (future.wait_for(Milliseconds(m_interval)) == std::future_status::timeout)
+	{
+		ns->GetTelemetry(telemetry);
+		ofs << telemetry.ToJson() << std::endl;
+	}
+}
+
+ClayEngine::Networking::TelemetryModule::TelemetryModule(String filename, int interval)
+{
+	if (interval <= 0) throw std::exception("TelemetryModule ERROR: Interval must be positive");
+
+	m_thread = std::thread{ TelemetryThreadFunctor(filename, interval), std::move(m_promise.get_future()) };
+}
+
+ClayEngine::Networking::TelemetryModule::~TelemetryModule()
+{
+	m_promise.set_value();
+	if (m_thread.joinable()) m_thread.join();
+}
+#pragma endregion
+
+#pragma region Network System (Network Service API)
+ClayEngine::Networking::NetworkSystem::NetworkSystem()
+{
+	auto rc = WSAStartup(MAKEWORD(2, 2), &m_wsadata);
+	if (rc != 0) throw;
+
+	m_transforms = std::make_unique<TransformPipeline>();
+	m_dispatcher = std::make_unique<MessageDispatcher>();
+	m_capture = std::make_unique<CaptureWriter>();
+}
+
+ClayEngine::Networking::NetworkSystem::~NetworkSystem()
+{
+	StopListenServer();
+
+	WSACleanup();
+}
+
+void ClayEngine::Networking::NetworkSystem::SetMessageHandler(MessageHandler handler)
+{
+	m_message_handler = handler;
+}
+
+const ClayEngine::Networking::MessageHandler& ClayEngine::Networking::NetworkSystem::GetMessageHandler()
+{
+	return m_message_handler;
+}
+
+ClayEngine::Networking::MessageDispatcherRaw ClayEngine::Networking::NetworkSystem::GetMessageDispatcher()
+{
+	return m_dispatcher.get();
+}
+
+void ClayEngine::Networking::NetworkSystem::AddTransform(TransformPtr transform)
+{
+	m_transforms->AddTransform(std::move(transform));
+}
+
+ClayEngine::Networking::TransformPipelineRaw ClayEngine::Networking::NetworkSystem::GetTransformPipeline()
+{
+	return m_transforms.get();
+}
+
+void ClayEngine::Networking::NetworkSystem::SetSnapshotSchema(SnapshotSchema schema)
+{
+	m_snapshot_schema = schema;
+}
+
+const ClayEngine::Networking::SnapshotSchema& ClayEngine::Networking::NetworkSystem::GetSnapshotSchema()
+{
+	return m_snapshot_schema;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetSnapshotHandler(SnapshotHandler handler)
+{
+	m_snapshot_handler = handler;
+}
+
+const ClayEngine::Networking::SnapshotHandler& ClayEngine::Networking::NetworkSystem::GetSnapshotHandler()
+{
+	return m_snapshot_handler;
+}
+
+void ClayEngine::Networking::NetworkSystem::StartListenServer()
+{
+	// Server threads pick up the replicator when they start, so it has to exist before any of them do
+	if (!m_snapshots)
+	{
+		m_snapshots = std::make_unique<SnapshotReplicator>(m_snapshot_schema);
+	}
+
+	if (!m_interest)
+	{
+		m_interest = std::make_unique<InterestGrid>(m_interest_settings);
+	}
+
+	if (!m_sessions)
+	{
+		m_sessions = std::make_unique<SessionTable>();
+	}
+
+	// The datagram module comes up first so every accepted client can be bound to a channel
+	if (!m_datagram_server && m_listen_server_datagram_port != 0)
+	{
+		m_datagram_server = std::make_unique<DatagramServerModule>(m_listen_server_datagram_port);
+	}
+
+	if (!m_listen_server)
+	{
+		m_listen_server = std::make_unique<ListenServerModule>();
+	}
+
+	if (!m_telemetry && m_telemetry_interval > 0)
+	{
+		m_telemetry = std::make_unique<TelemetryModule>(m_telemetry_filename, m_telemetry_interval);
+	}
+}
+
+void ClayEngine::Networking::NetworkSystem::StopListenServer()
+{
+	// The dump reads the shards, so it stops before they do
+	if (m_telemetry)
+	{
+		m_telemetry.reset();
+		m_telemetry = nullptr;
+	}
+
+	if (m_listen_server)
+	{
+		m_listen_server.reset();
+		m_listen_server = nullptr;
+	}
+
+	// Parked sessions hold channels of the datagram module, they go first
+	if (m_sessions)
+	{
+		m_sessions.reset();
+		m_sessions = nullptr;
+	}
+
+	if (m_datagram_server)
+	{
+		m_datagram_server.reset();
+		m_datagram_server = nullptr;
+	}
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerTimeout(int timeout)
+{
+	m_listen_server_loop_timeout = timeout;
+}
+
+int ClayEngine::Networking::NetworkSystem::GetListenServerTimeout()
+{
+	return m_listen_server_loop_timeout;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerHints(int family, int socktype, int protocol)
+{
+	m_listen_server_hints.ai_family = family;
+	m_listen_server_hints.ai_socktype = socktype;
+	m_listen_server_hints.ai_protocol = protocol;
+}
+
+ADDRINFO ClayEngine::Networking::NetworkSystem::GetListenServerHints()
+{
+	return m_listen_server_hints;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerPort(USHORT port)
+{
+	m_listen_server_port = port;
+}
+
+USHORT ClayEngine::Networking::NetworkSystem::GetListenServerPort()
+{
+	return m_listen_server_port;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerDatagramPort(USHORT port)
+{
+	m_listen_server_datagram_port = port;
+}
+
+USHORT ClayEngine::Networking::NetworkSystem::GetListenServerDatagramPort()
+{
+	return m_listen_server_datagram_port;
+}
+
+ClayEngine::Networking::DatagramServerModuleRaw ClayEngine::Networking::NetworkSystem::GetDatagramServerModule()
+{
+	return m_datagram_server.get();
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerThreads(size_t threads)
+{
+	m_listen_server_threads = threads;
+}
+
+size_t ClayEngine::Networking::NetworkSystem::GetListenServerThreads()
+{
+	return m_listen_server_threads;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerIdleTimeout(int timeout)
+{
+	m_listen_server_idle_timeout = timeout;
+}
+
+int ClayEngine::Networking::NetworkSystem::GetListenServerIdleTimeout()
+{
+	return m_listen_server_idle_timeout;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerKeepaliveInterval(int interval)
+{
+	m_listen_server_keepalive_interval = interval;
+}
+
+int ClayEngine::Networking::NetworkSystem::GetListenServerKeepaliveInterval()
+{
+	return m_listen_server_keepalive_interval;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerBackpressure(BackpressureSettings settings)
+{
+	if (settings.LowWatermark > settings.HighWatermark) throw std::exception("NetworkSystem ERROR: Backpressure low watermark is above the high watermark");
+
+	m_listen_server_backpressure = settings;
+}
+
+ClayEngine::Networking::BackpressureSettings ClayEngine::Networking::NetworkSystem::GetListenServerBackpressure()
+{
+	return m_listen_server_backpressure;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerRateLimits(RateLimitSettings limits)
+{
+	m_listen_server_rate_limits = limits;
+}
+
+ClayEngine::Networking::RateLimitSettings ClayEngine::Networking::NetworkSystem::GetListenServerRateLimits()
+{
+	return m_listen_server_rate_limits;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetListenServerSessionGrace(int grace)
+{
+	m_listen_server_session_grace = grace;
+}
+
+int ClayEngine::Networking::NetworkSystem::GetListenServerSessionGrace()
+{
+	return m_listen_server_session_grace;
+}
+
+void ClayEngine::Networking::NetworkSystem::SetSessionHandler(SessionHandler handler)
+{
+	m_session_handler = handler;
+}
+
+const ClayEngine::Networking::SessionHandler& ClayEngine::Networking::NetworkSystem::GetSessionHandler()
+{
+	return m_session_handler;
+}
+
+ClayEngine::Networking::SessionTableRaw ClayEngine::Networking::NetworkSystem::GetSessionTable()
+{
+	return m_sessions.get();
+}
+
+size_t ClayEngine::Networking::NetworkSystem::GetListenServerShardCount()
+{
+	if (!m_listen_server) return 0;
+	return m_listen_server->GetShardCount();
+}
+
+ClayEngine::Networking::ClientSocketModuleRaw ClayEngine::Networking::NetworkSystem::GetClientSocketModule(size_t shard)
+{
+	if (!m_listen_server) return nullptr;
+	return m_listen_server->GetClientSocketModule(shard);
+}
+
+bool ClayEngine::Networking::NetworkSystem::Send(ConnectionHandle h, uint8_t opcode, const uint8_t* data, size_t length)
+{
+	auto csm = GetClientSocketModule(GetHandleShard(h));
+	if (!csm) return false;
+
+	return csm->Send(h, opcode, data, length);
+}
+
+ClayEngine::Networking::SharedMessagePtr ClayEngine::Networking::NetworkSystem::MakeSharedMessage(uint8_t opcode, const uint8_t* data, size_t length)
+{
+	return std::make_shared<const SharedMessage>(opcode, data, length, m_transforms.get());
+}
+
+bool ClayEngine::Networking::NetworkSystem::Send(ConnectionHandle h, const SharedMessagePtr& message)
+{
+	auto csm = GetClientSocketModule(GetHandleShard(h));
+	if (!csm) return false;
+
+	return csm->Send(h, message);
+}
+
+bool ClayEngine::Networking::NetworkSystem::Disconnect(ConnectionHandle h)
+{
+	auto csm = GetClientSocketModule(GetHandleShard(h));
+	if (!csm) return false;
+
+	return csm->Disconnect(h);
+}
+
+void ClayEngine::Networking::NetworkSystem::Broadcast(uint8_t opcode, const uint8_t* data, size_t length)
+{
+	Broadcast(MakeSharedMessage(opcode, data, length));
+}
+
+void ClayEngine::Networking::NetworkSystem::Broadcast(const SharedMessagePtr& message)
+{
+	auto shards = GetListenServerShardCount();
+	for (size_t i = 0; i < shards; ++i)
+	{
+		auto csm = m_listen_server->GetClientSocketModule(i);
+		csm->ForEachConnection([&](ConnectionHandle h) { csm->Send(h, message); });
+	}
+}
+
+bool ClayEngine::Networking::NetworkSystem::SendDatagram(ConnectionHandle h, uint8_t opcode, const uint8_t* data, size_t length, bool reliable)
+{
+	if (!m_datagram_server) return false;
+
+	return m_datagram_server->Send(h, opcode, data, length, reliable);
+}
+
+bool ClayEngine::Networking::NetworkSystem::PublishSnapshot(ConnectionHandle h, const Snapshot& snapshot)
+{
+	if (!m_snapshots) return false;
+
+	std::array<uint8_t, c_max_message_size> buffer = {};
+	auto length = m_snapshots->Encode(h, snapshot, buffer.data(), buffer.size());
+	if (length == 0)
+	{
+		WriteLine("NetworkSystem WARNING: Snapshot exceeds c_max_message_size and was not sent");
+		return false;
+	}
+
+	// A lost snapshot only costs the client one frame, the next is coded against whatever it did ack
+	if (length <= c_max_datagram_payload && SendDatagram(h, c_opcode_snapshot, buffer.data(), length)) return true;
+
+	return Send(h, c_opcode_snapshot, buffer.data(), length);
+}
+
+ClayEngine::Networking::SnapshotReplicatorRaw ClayEngine::Networking::NetworkSystem::GetSnapshotReplicator()
+{
+	return m_snapshots.get();
+}
+
+void ClayEngine::Networking::NetworkSystem::SetInterestSettings(InterestSettings settings)
+{
+	m_interest_settings = settings;
+}
+
+ClayEngine::Networking::InterestGridRaw ClayEngine::Networking::NetworkSystem::GetInterestGrid()
+{
+	return m_interest.get();
+}
+
+void ClayEngine::Networking::NetworkSystem::PublishSnapshots()
+{
+	if (!m_interest) return;
+
+	m_interest->GetObservers(m_publish_observers);
+	for (auto h : m_publish_observers)
+	{
+		if (m_interest->BuildSnapshot(h, m_publish_snapshot)) PublishSnapshot(h, m_publish_snapshot);
+	}
+}
+
+void ClayEngine::Networking::NetworkSystem::SetTelemetryDump(String filename, int interval)
+{
+	m_telemetry_filename = filename;
+	m_telemetry_interval = interval;
+}
+
+void ClayEngine::Networking::NetworkSystem::StartCapture(String filename)
+{
+	m_capture->Open(filename);
+}
+
+uint64_t ClayEngine::Networking::NetworkSystem::StopCapture()
+{
+	return m_capture->Close();
+}
+
+ClayEngine::Networking::CaptureWriterRaw ClayEngine::Networking::NetworkSystem::GetCaptureWriter()
+{
+	return m_capture.get();
+}
+
+ClayEngine::Networking::ReplayStats ClayEngine::Networking::NetworkSystem::ReplayCapture(String filename, ReplayPacing pacing)
+{
+	CaptureReader reader(filename);
+
+	// Only the game's half of the server handler, the transport half needs the connections the capture came from
+	auto dispatcher = m_dispatcher.get();
+	auto handler = m_message_handler;
+	return Networking::ReplayCapture(reader, [dispatcher, handler](ConnectionHandle h, const MessageView& view)
+		{
+			if (!dispatcher->Dispatch(h, view) && handler) handler(h, view);
+		}, pacing);
+}
+
+void ClayEngine::Networking::NetworkSystem::GetTelemetry(NetworkTelemetry& out)
+{
+	out = {};
+	out.Timestamp = uint64_t(std::chrono::duration_cast<Milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+
+	auto shards = GetListenServerShardCount();
+	for (size_t i = 0; i < shards; ++i)
+	{
+		m_listen_server->GetClientSocketModule(i)->GetTelemetry(out);
+	}
+
+	if (m_datagram_server) m_datagram_server->GetTelemetry(out);
+	if (m_sessions) m_sessions->GetTelemetry(out);
+}
+
+bool ClayEngine::Networking::NetworkSystem::GetConnectionTelemetry(ConnectionHandle h, ConnectionTelemetry& out)
+{
+	out = {};
+
+	auto csm = GetClientSocketModule(GetHandleShard(h));
+	if (!csm || !csm->GetConnectionTelemetry(h, out)) return false;
+
+	if (m_datagram_server)
+	{
+		auto channel = m_datagram_server->GetChannel(h);
+		if (channel) channel->GetTelemetry(out);
+	}
+
+	return true;
+}
+
+void ClayEngine::Networking::NetworkSystem::GetConnectionTelemetry(std::vector<ConnectionTelemetry>& out)
+{
+	out.clear();
+
+	auto shards = GetListenServerShardCount();
+	for (size_t i = 0; i < shards; ++i)
+	{
+		m_listen_server->GetClientSocketModule(i)->ForEachConnection([&](ConnectionHandle h)
+			{
+				ConnectionTelemetry connection = {};
+				if (GetConnectionTelemetry(h, connection)) out.push_back(connection);
+			});
+	}
+}
+#pragma endregion
+
+#pragma region Client Connection Module
+void ClayEngine::Networking::DatagramSocket::Receive(const MessageHandler& handler, ConnectionHandle h)
+{
+	while (true)
+	{
+		SOCKADDR_IN from = {};
+		int from_length = sizeof(from);
+
+		auto rc = recvfrom(m_s, reinterpret_cast<char*>(m_buffer.data()), int(m_buffer.size()), 0, (SOCKADDR*)&from, &from_length);
+		if (rc == SOCKET_ERROR)
+		{
+			auto error = WSAGetLastError();
+			if (error == WSAEMSGSIZE || error == WSAECONNRESET) continue;
+			if (error != WSAEWOULDBLOCK) ProcessWSALastError();
+			return;
+		}
+
+		// Only the server knows our key, anything else on this port is noise
+		uint32_t handle = 0;
+		uint32_t key = 0;
+		if (!DatagramChannel::ReadPacketIdentity(m_buffer.data(), size_t(rc), handle, key)) continue;
+		if (key == 0 || key != m_channel->GetKey()) continue;
+
+		m_messages.clear();
+		if (!m_channel->ProcessPacket(m_buffer.data(), size_t(rc), Clock::now(), m_messages)) continue;
+
+		if (handler)
+		{
+			for (auto& view : m_messages)
+			{
+				handler(h, view);
+			}
+		}
+	}
+}
+
+void ClayEngine::Networking::DatagramSocket::Flush()
+{
+	auto now = Clock::now();
+	while (auto length = m_channel->BuildPacket(m_buffer.data(), now))
+	{
+		if (sendto(m_s, reinterpret_cast<const char*>(m_buffer.data()), int(length), 0, (const SOCKADDR*)&m_sin, sizeof(m_sin)) == SOCKET_ERROR)
+		{
+			if (ProcessWSALastError() != WSAEWOULDBLOCK) break;
+		}
+	}
+}
+
+ClayEngine::Networking::ConnectionThreadFunctor::ConnectionThreadFunctor(ReactorBackendRaw reactor, ClientSocket* socket, DatagramSocket* datagram, std::atomic<ConnectionState>* state)
+	: m_reactor{ reactor }
+	, m_socket{ socket }
+	, m_datagram{ datagram }
+	, m_state{ state }
+{
+
+}
+
+void ClayEngine::Networking::ConnectionThreadFunctor::operator()(std::future<void> future)
+{
+	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
+
+	auto application = ns->GetMessageHandler();
+	auto dispatcher = ns->GetMessageDispatcher();
+	m_snapshot_schema = ns->GetSnapshotSchema();
+	m_snapshots = std::make_unique<SnapshotReceiver>(m_snapshot_schema);
+	m_snapshot_handler = ns->GetSnapshotHandler();
+	m_transforms = ns->GetTransformPipeline();
+
+	m_hints = ns->GetClientConnectionHints();
+	m_connect_timeout = ns->GetClientConnectionTimeout() > 0 ? ns->GetClientConnectionTimeout() : c_connect_timeout_default;
+	m_connect_attempts = ns->GetClientConnectionAttempts();
+	m_connect_handler = ns->GetConnectHandler();
+	m_jitter.seed(std::random_device{}());
+
+	// Transport messages from the server are consumed here, everything else goes to the application
+	MessageHandler handler = [this, application, dispatcher](ConnectionHandle h, const MessageView& view)
+	{
+		if (view.Opcode == c_opcode_datagram_bind) bindDatagrams(view);
+		else if (view.Opcode == c_opcode_session) receiveSession(view);
+		else if (view.Opcode == c_opcode_snapshot) receiveSnapshot(view);
+		else if (view.Opcode == c_opcode_keepalive) m_socket->m_send->Enqueue(m_socket->m_handle, c_opcode_keepalive, 0, nullptr, 0, m_transforms);
+		else if (!dispatcher->Dispatch(h, view) && application) application(h, view);
+	};
+
+	InboundContext inbound = {};
+	inbound.Handler = handler;
+	inbound.Transforms = m_transforms;
+	inbound.Scratch = std::make_unique<uint8_t[]>(size_t(c_transform_scratch_size));
+
+	ReactorEvents events = {};
+	events.reserve(c_reactor_max_events);
+
+	beginConnect();
+
+	while (future.wait_for(Nanoseconds(0)) == std::future_status::timeout)
+	{
+		auto state = m_state->load();
+		if (state == ConnectionState::Failed || state == ConnectionState::Disconnected) break;
+
+		events.clear();
+		if (m_reactor->Wait(events, getWaitTimeout()) == SOCKET_ERROR)
+		{
+			ProcessWSALastError();
+			continue;
+		}
+
+		if (state != ConnectionState::Connected)
+		{
+			// Until connected the stream socket only reports the outcome of the attempt in flight
+			for (auto& element : events)
+			{
+				if (element.Token == m_socket->m_handle && state == ConnectionState::Connecting) finishConnect();
+			}
+
+			auto now = Clock::now();
+			state = m_state->load();
+			if (state == ConnectionState::Connecting && now >= m_deadline)
+			{
+				WriteLine("WSA INFO: Connect attempt timed out");
+				failConnect();
+			}
+			else if (state == ConnectionState::Backoff && now >= m_deadline)
+			{
+				beginConnect();
+			}
+
+			// Anything queued while we were connecting goes out as soon as we are
+			if (m_state->load() != ConnectionState::Connected) continue;
+			m_socket->m_send->TakeFlushRequest();
+			if (!m_socket->Flush(m_reactor) && !dropConnection()) break;
+			continue;
+		}
+
+		bool alive = true;
+		for (auto& element : events)
+		{
+			if (element.Token == c_reactor_datagram_token)
+			{
+				m_datagram->Receive(handler, m_socket->m_handle);
+				continue;
+			}
+
+			if (element.Flags & (c_reactor_readable | c_reactor_closed)) alive = alive && m_socket->Receive(inbound);
+			if (element.Flags & c_reactor_writable) alive = alive && m_socket->Flush(m_reactor);
+		}
+
+		if (alive && m_socket->m_send->TakeFlushRequest()) alive = m_socket->Flush(m_reactor);
+		if (alive && m_datagram_bound) m_datagram->Flush();
+
+		if (!alive && !dropConnection()) break;
+	}
+
+	if (m_socket->m_s != INVALID_SOCKET) m_reactor->Remove(m_socket->m_s);
+	if (m_datagram_bound) m_reactor->Remove(m_datagram->m_s);
+}
+
+void ClayEngine::Networking::ConnectionThreadFunctor::beginConnect()
+{
+	++m_attempt;
+	m_state->store(ConnectionState::Connecting);
+	m_deadline = Clock::now() + Milliseconds(m_connect_timeout);
+
+	// Every attempt gets a fresh socket, one whose connect has failed can't be reused portably
+	m_socket->m_s = socket(m_hints.ai_family, m_hints.ai_socktype, m_hints.ai_protocol);
+	if (m_socket->m_s == INVALID_SOCKET)
+	{
+		ProcessWSALastError();
+		failConnect();
+		return;
+	}
+
+	u_long argp = 1ul;
+	if (ioctlsocket(m_socket->m_s, FIONBIO, &argp) == SOCKET_ERROR)
+	{
+		ProcessWSALastError();
+		failConnect();
+		return;
+	}
+
+	if (connect(m_socket->m_s, (SOCKADDR*)&m_socket->m_sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+	{
+		auto error = WSAGetLastError();
+		if (error != WSAEWOULDBLOCK && error != WSAEINPROGRESS)
+		{
+			ProcessWSALastError();
+			failConnect();
+			return;
+		}
+	}
+
+	// Writability is the connect completing either way, finishConnect() reads which. Some WSAPoll versions never
+	// report a refused connect at all, the attempt deadline covers that.
+	m_reactor->Add(m_socket->m_s, m_socket->m_handle, c_reactor_writable);
+	m_socket->m_want_write = true;
+}
+
+void ClayEngine::Networking::ConnectionThreadFunctor::finishConnect()
+{
+	int error = 0;
+	int length = sizeof(error);
+	if (getsockopt(m_socket->m_s, SOL_SOCKET, SO_ERROR, (char*)&error, &length) == SOCKET_ERROR) error = WSAGetLastError();
+	if (error != 0)
+	{
+		failConnect();
+		return;
+	}
+
+	m_reactor->Modify(m_socket->m_s, m_socket->m_handle, c_reactor_readable);
+	m_socket->m_want_write = false;
+	m_attempt = 0;
+	m_state->store(ConnectionState::Connected);
+
+	// The hello has to be the first thing the server reads, so whatever was queued while we were away goes
+	// back in behind it. A partial frame from the old connection is sent again from its start.
+	std::vector<uint8_t> unsent = {};
+	m_socket->m_recv->Reset();
+	m_socket->m_send->TakeUnsent(unsent);
+	removeHandshakeFrames(unsent);
+
+	std::array<uint8_t, c_session_hello_size> hello = {};
+	for (int i = 0; i < 8; ++i) hello[i] = uint8_t(m_session >> (8 * i));
+	m_socket->m_send->Enqueue(m_socket->m_handle, c_opcode_session, 0, hello.data(), hello.size(), m_transforms);
+	if (!unsent.empty()) m_socket->m_send->EnqueueFrames(m_socket->m_handle, unsent.data(), unsent.size());
+
+	m_resuming = m_session != c_invalid_session;
+	m_resume_deadline = {};
+
+	WriteLine("WSA SUCCESS: Connected to server");
+	if (m_connect_handler && !m_resuming) m_connect_handler(true);
+}
+
+void ClayEngine::Networking::ConnectionThreadFunctor::failConnect()
+{
+	if (m_socket->m_s != INVALID_SOCKET)
+	{
+		m_reactor->Remove(m_socket->m_s);
+		closesocket(m_socket->m_s);
+		m_socket->m_s = INVALID_SOCKET;
+	}
+
+	auto now = Clock::now();
+	if (m_resume_deadline != TimePoint{})
+	{
+		// Coming back after a drop is bounded by the session's grace window rather than by attempts
+		if (now >= m_resume_deadline)
+		{
+			WriteLine("WSA ERROR: Unable to reconnect before the session expired");
+			m_resume_deadline = {};
+			m_state->store(ConnectionState::Disconnected);
+			return;
+		}
+	}
+	else if (m_connect_attempts != 0 && m_attempt >= m_connect_attempts)
+	{
+		WriteLine("WSA ERROR: Unable to connect to server, giving up");
+		m_state->store(ConnectionState::Failed);
+		if (m_connect_handler) m_connect_handler(false);
+		return;
+	}
+
+	auto shift = std::min(m_attempt - 1, size_t(16));
+	auto delay = std::min(int64_t(c_connect_backoff_initial) << shift, int64_t(c_connect_backoff_max));
+	auto wait = std::uniform_int_distribution<int64_t>(delay / 2, delay)(m_jitter);
+
+	m_deadline = now + Milliseconds(wait);
+	if (m_resume_deadline != TimePoint{}) m_deadline = std::min(m_deadline, m_resume_deadline);
+	m_state->store(ConnectionState::Backoff);
+}
+
+bool ClayEngine::Networking::ConnectionThreadFunctor::dropConnection()
+{
+	WriteLine("WSA INFO: Server disconnected");
+
+	m_reactor->Remove(m_socket->m_s);
+	closesocket(m_socket->m_s);
+	m_socket->m_s = INVALID_SOCKET;
+	m_socket->m_want_write = false;
+
+	// Nothing drains the datagram socket until we are connected again, and the reactor is level triggered, so
+	// a snapshot arriving meanwhile would wake every wait. It is watched again once the server binds it anew.
+	if (m_datagram_bound) m_reactor->Remove(m_datagram->m_s);
+	m_datagram_bound = false;
+
+	if (m_session == c_invalid_session || m_session_grace.count() <= 0)
+	{
+		m_state->store(ConnectionState::Disconnected);
+		return false;
+	}
+
+	// The server is holding our session, get back in before it lets go. The first attempt is jittered so a
+	// server restart doesn't have every client knocking at once.
+	m_resume_deadline = Clock::now() + m_session_grace;
+	m_attempt = 0;
+	m_deadline = Clock::now() + Milliseconds(std::uniform_int_distribution<int64_t>(0, c_connect_backoff_initial)(m_jitter));
+	m_state->store(ConnectionState::Backoff);
+	return true;
+}
+
+int ClayEngine::Networking::ConnectionThreadFunctor::getWaitTimeout()
+{
+	// Once the datagram channel is up the loop has to come round for acks and resends even when idle
+	if (m_state->load() == ConnectionState::Connected) return m_datagram_bound ? c_datagram_ack_interval : -1;
+
+	auto remaining = std::chrono::duration_cast<Milliseconds>(m_deadline - Clock::now()).count();
+	return int(std::clamp(remaining + 1, int64_t(0), int64_t(c_connect_backoff_max)));
+}
+
+void ClayEngine::Networking::ConnectionThreadFunctor::bindDatagrams(const MessageView& view)
+{
+	if (view.Length != c_datagram_bind_size || m_datagram->m_s == INVALID_SOCKET) return;
+
+	uint32_t handle = 0;
+	uint32_t key = 0;
+	for (int i = 0; i < 4; ++i) handle |= uint32_t(view.Data[i]) << (8 * i);
+	for (int i = 0; i < 4; ++i) key |= uint32_t(view.Data[4 + i]) << (8 * i);
+	auto port = USHORT(view.Data[8] | (view.Data[9] << 8));
+
+	// The datagram endpoint is the stream's server address on the port the server told us about
+	m_datagram->m_sin = m_socket->m_sin;
+	m_datagram->m_sin.sin_port = htons(port);
+	m_datagram->m_channel->Bind(handle, key);
+
+	// A session that comes back after a drop is bound again under a new key, the channel keeps what was pending
+	if (!m_datagram_bound) m_reactor->Add(m_datagram->m_s, c_reactor_datagram_token, c_reactor_readable);
+	m_datagram_bound = true;
+
+	WriteLine("WSA SUCCESS: Datagram channel bound");
+}
+
+void ClayEngine::Networking::ConnectionThreadFunctor::receiveSnapshot(const MessageView& view)
+{
+	auto snapshot = m_snapshots->Receive(view.Data, view.Length);
+	if (!snapshot) return; // Malformed, or coded against a baseline that has aged out of our history
+
+	if (m_snapshot_handler) m_snapshot_handler(*snapshot);
+
+	// Acks go back the way the channel allows and are flushed at the end of this reactor iteration
+	std::array<uint8_t, c_snapshot_ack_size> ack = { uint8_t(snapshot->Sequence & 0xFF), uint8_t(snapshot->Sequence >> 8) };
+	if (m_datagram_bound)
+	{
+		m_datagram->m_channel->Queue(c_opcode_snapshot_ack, ack.data(), ack.size(), false);
+	}
+	else
+	{
+		m_socket->m_send->Enqueue(m_socket->m_handle, c_opcode_snapshot_ack, 0, ack.data(), ack.size(), m_transforms);
+	}
+}
+
+void ClayEngine::Networking::ConnectionThreadFunctor::receiveSession(const MessageView& view)
+{
+	if (view.Length != c_session_reply_size) return;
+
+	SessionToken token = c_invalid_session;
+	uint32_t grace = 0;
+	for (int i = 0; i < 8; ++i) token |= SessionToken(view.Data[i]) << (8 * i);
+	for (int i = 0; i < 4; ++i) grace |= uint32_t(view.Data[8 + i]) << (8 * i);
+	auto status = SessionStatus(view.Data[12]);
+
+	if (m_resuming && status != SessionStatus::Resumed)
+	{
+		// The server no longer knew us, so nothing it had sent before carries over
+		WriteLine("WSA INFO: Session expired, starting over");
+		m_snapshots = std::make_unique<SnapshotReceiver>(m_snapshot_schema);
+		m_datagram->m_channel->Reset();
+		if (m_connect_handler) m_connect_handler(true);
+	}
+	else if (m_resuming)
+	{
+		WriteLine("WSA SUCCESS: Session resumed");
+	}
+
+	m_session = token;
+	m_session_grace = Milliseconds(grace);
+	m_resuming = false;
+}
+
+ClayEngine::Networking::ClientConnectionModule::ClientConnectionModule(String address)
+{
+	auto ns = ClayEngine::Services::GetService<NetworkSystem>();
+	auto port = ns->GetClientConnectionPort();
+	auto hints = ns->GetClientConnectionHints();
+
+	m_transforms = ns->GetTransformPipeline();
+
+	// The stream socket itself is created by the connection thread, once per connect attempt
+	if (InetPtonA(AF_INET, address.c_str(), &m_socket.m_sin.sin_addr.s_addr) != 1) throw std::exception("WSA ERROR: InetPtonA() invalid server address");
+	m_socket.m_sin.sin_family = ADDRESS_FAMILY(hints.ai_family);
+	m_socket.m_sin.sin_port = htons(port);
+
+	// Our one connection always goes by the first handle of shard zero
+	m_socket.m_handle = MakeConnectionHandle(0, 0, 1);
+	m_socket.m_recv = std::make_unique<ReceiveRing>();
+	m_socket.m_send = std::make_unique<SendQueue>();
+	m_socket.m_stats = std::make_unique<ConnectionStats>();
+	m_socket.m_send->Bind(m_socket.m_handle, m_socket.m_stats.get());
+
+	// The datagram socket is ready up front but stays idle until the server binds a session to it
+	m_datagram.m_channel = std::make_shared<DatagramChannel>();
+	m_datagram.m_s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_datagram.m_s != INVALID_SOCKET)
+	{
+		SOCKADDR_IN d_sin = { 0 };
+		d_sin.sin_family = AF_INET;
+		d_sin.sin_addr.s_addr = htonl(INADDR_ANY);
+		d_sin.sin_port = 0;
+
+		u_long argp = 1ul;
+		if (ioctlsocket(m_datagram.m_s, FIONBIO, &argp) == SOCKET_ERROR || bind(m_datagram.m_s, (SOCKADDR*)&d_sin, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+		{
+			ProcessWSALastError();
+			closesocket(m_datagram.m_s);
+			m_datagram.m_s = INVALID_SOCKET;
+		}
+	}
+
+	m_reactor = MakeReactorBackend();
+	m_thread = std::thread{ ConnectionThreadFunctor(m_reactor.get(), &m_socket, &m_datagram, &m_state), std::move(m_promise.get_future()) };
+
+	WriteLine("WSA SUCCESS: ClientConnectionModule started");
+}
+
+ClayEngine::Networking::ClientConnectionModule::~ClientConnectionModule()
+{
+	m_promise.set_value();
+	if (m_reactor) m_reactor->Wake();
+	if (m_thread.joinable()) m_thread.join();
+
+	if (m_socket.m_s != INVALID_SOCKET)
+	{
+		shutdown(m_socket.m_s, SD_BOTH);
+		closesocket(m_socket.m_s);
+	}
+
+	if (m_datagram.m_s != INVALID_SOCKET) closesocket(m_datagram.m_s);
+}
+
+ClayEngine::Networking::ConnectionState ClayEngine::Networking::ClientConnectionModule::GetState()
+{
+	return m_state.load();
+}
+
+void ClayEngine::Networking::ClientConnectionModule::GetTelemetry(ConnectionTelemetry& out)
+{
+	out = {};
+	out.Handle = m_socket.m_handle;
+	m_socket.m_stats->GetCounters(out.Counters);
+	out.QueuedBytes = m_socket.m_stats->GetQueuedBytes();
+	m_datagram.m_channel->GetTelemetry(out);
+}
+
+void ClayEngine::Networking::ClientConnectionModule::Send(uint8_t opcode, const uint8_t* data, size_t length)
+{
+	if (m_socket.m_send->Enqueue(m_socket.m_handle, opcode, 0, data, length, m_transforms) == EnqueueStatus::FlushRequired) m_reactor->Wake();
+}
+
+void ClayEngine::Networking::ClientConnectionModule::Send(uint8_t opcode, const PayloadWriter& writer)
+{
+	if (m_socket.m_send->Enqueue(m_socket.m_handle, opcode, 0, writer, m_transforms) == EnqueueStatus::FlushRequired) m_reactor->Wake();
+}
+
+bool ClayEngine::Networking::ClientConnectionModule::SendDatagram(uint8_t opcode, const uint8_t* data, size_t length, bool reliable)
+{
+	auto status = m_datagram.m_channel->Queue(opcode, data, length, reliable);
+	if (status == EnqueueStatus::FlushRequired) m_reactor->Wake();
+
+	return status != EnqueueStatus::Rejected;
+}
+#pragma endregion
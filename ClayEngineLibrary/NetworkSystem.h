@@ -7,52 +7,314 @@
 /******************************************************************************/
 
 #include "ClayEngine.h"
+#include "NetworkBuffers.h"
+#include "NetworkCapture.h"
+#include "NetworkMessages.h"
+#include "NetworkDispatch.h"
+#include "NetworkTransforms.h"
+#include "NetworkDatagrams.h"
+#include "NetworkSnapshots.h"
+#include "NetworkInterest.h"
+#include "NetworkSessions.h"
+#include "NetworkTelemetry.h"
+#include "NetworkTimers.h"
 
 namespace ClayEngine
 {
 	namespace Networking
 	{
 		/// <summary>
-		/// Temp struct for holding client sockets created by the listen server module
+		/// Stable 32 bit name for a connection: [shard:6][slot index:12][generation:14]. Live slots always have
+		/// an odd generation, so zero is never a valid handle and a handle to a closed connection stops
+		/// resolving as soon as its slot is released. A stale handle only matches again once its slot has been
+		/// reused 8192 times, and freed slots are reused oldest first to spread that over every free slot.
+		/// </summary>
+		using ConnectionHandle = uint32_t;
+
+		constexpr auto c_handle_generation_bits = 14u;
+		constexpr auto c_handle_index_bits = 12u;
+		constexpr auto c_handle_shard_bits = 6u;
+
+		constexpr auto c_handle_generation_mask = (1u << c_handle_generation_bits) - 1u;
+		constexpr auto c_handle_index_mask = (1u << c_handle_index_bits) - 1u;
+		constexpr auto c_handle_shard_mask = (1u << c_handle_shard_bits) - 1u;
+
+		constexpr auto c_invalid_connection = ConnectionHandle(0);
+		constexpr auto c_max_listen_shards = size_t(1u << c_handle_shard_bits);
+		constexpr auto c_max_connections_per_shard = 4096u;
+
+		static_assert(c_max_connections_per_shard <= (1u << c_handle_index_bits));
+
+		constexpr ConnectionHandle MakeConnectionHandle(uint32_t shard, uint32_t index, uint32_t generation)
+		{
+			return ((shard & c_handle_shard_mask) << (c_handle_index_bits + c_handle_generation_bits))
+				| ((index & c_handle_index_mask) << c_handle_generation_bits)
+				| (generation & c_handle_generation_mask);
+		}
+		constexpr uint32_t GetHandleShard(ConnectionHandle h) { return (h >> (c_handle_index_bits + c_handle_generation_bits)) & c_handle_shard_mask; }
+		constexpr uint32_t GetHandleIndex(ConnectionHandle h) { return (h >> c_handle_generation_bits) & c_handle_index_mask; }
+		constexpr uint32_t GetHandleGeneration(ConnectionHandle h) { return h & c_handle_generation_mask; }
+
+		/// <summary>
+		/// Called once per complete inbound message, the view is only valid for the duration of the call
+		/// </summary>
+		using MessageHandler = std::function<void(ConnectionHandle, const MessageView&)>;
+
+		/// <summary>
+		/// Per reactor thread state for turning raw frames into handler calls, transformed payloads are decoded
+		/// into the scratch buffer and the handler sees the plain message
+		/// </summary>
+		struct InboundContext
+		{
+			MessageHandler Handler = nullptr;
+			TransformPipelineRaw Transforms = nullptr;
+			std::unique_ptr<uint8_t[]> Scratch = nullptr;
+			RateLimitSettings Limits = {};
+		};
+
+		#pragma region Reactor
+		/// <summary>
+		/// Readiness flags used both for the interest set passed to a reactor backend and for the events it reports
+		/// </summary>
+		constexpr auto c_reactor_readable = 0x1u;
+		constexpr auto c_reactor_writable = 0x2u;
+		constexpr auto c_reactor_closed = 0x4u;
+
+		constexpr auto c_reactor_max_events = 256;
+
+		/// <summary>
+		/// A single readiness notification, the token is whatever value the socket was registered with
+		/// </summary>
+		struct ReactorEvent
+		{
+			uint64_t Token = 0;
+			uint32_t Flags = 0;
+		};
+		using ReactorEvents = std::vector<ReactorEvent>;
+
+		/// <summary>
+		/// Readiness notification backend for the reactor loop. The backend owns a wake signal so that another
+		/// thread can break a blocking Wait() without the loop having to poll on a timeout.
+		/// </summary>
+		struct IReactorBackend
+		{
+			virtual ~IReactorBackend() = default;
+
+			virtual bool Add(SOCKET s, uint64_t token, uint32_t interest) = 0;
+			virtual bool Modify(SOCKET s, uint64_t token, uint32_t interest) = 0;
+			virtual void Remove(SOCKET s) = 0;
+
+			/// <summary>
+			/// Block until at least one registered socket is ready, the wake signal fires, or timeout (ms) elapses.
+			/// A negative timeout waits indefinitely. Returns the number of events appended, or SOCKET_ERROR.
+			/// </summary>
+			virtual int Wait(ReactorEvents& events, int timeout) = 0;
+
+			/// <summary>
+			/// Thread safe, breaks the owning thread out of Wait()
+			/// </summary>
+			virtual void Wake() = 0;
+		};
+		using ReactorBackendPtr = std::unique_ptr<IReactorBackend>;
+		using ReactorBackendRaw = IReactorBackend*;
+
+		/// <summary>
+		/// Factory for the readiness backend, WSAPoll. Another platform would add its backend behind this interface.
+		/// </summary>
+		ReactorBackendPtr MakeReactorBackend();
+		#pragma endregion
+
+		/// <summary>
+		/// Reactor token for a listen socket, connection handles only ever occupy the low 32 bits
+		/// </summary>
+		constexpr auto c_reactor_listener_token = 1ull << 32;
+		constexpr auto c_reactor_datagram_token = 2ull << 32;
+
+		/// <summary>
+		/// Stream message the server sends right after it opens or resumes a client's session when datagrams are
+		/// enabled, a resumed session keeps its channel but is bound under a new key. The payload
+		/// is [handle:32][key:32][datagram port:16] and is consumed by the transport, never seen by handlers
+		/// </summary>
+		constexpr uint8_t c_opcode_datagram_bind = 0xFF;
+		constexpr auto c_datagram_bind_size = 10ull;
+
+		/// <summary>
+		/// Server to client entity snapshot, the payload is a SnapshotCodec bit stream. The client answers every
+		/// snapshot it reconstructs with a snapshot ack carrying [sequence:16]. Both are consumed by the transport.
+		/// </summary>
+		constexpr uint8_t c_opcode_snapshot = 0xFE;
+		constexpr uint8_t c_opcode_snapshot_ack = 0xFD;
+		constexpr auto c_snapshot_ack_size = 2ull;
+
+		/// <summary>
+		/// Latency probe, the server sends the payload straight back on the channel it arrived on without the
+		/// message handler seeing it. Used by clients to measure round trip time and by the bot load generator.
+		/// </summary>
+		constexpr uint8_t c_opcode_echo = 0xFC;
+
+		/// <summary>
+		/// Empty message the server sends to a client it has had nothing to say to for a keepalive interval, the
+		/// client answers in kind. Keeps idle but healthy sessions clear of the idle timeout and NAT expiry.
+		/// </summary>
+		constexpr uint8_t c_opcode_keepalive = 0xFB;
+
+		/// <summary>
+		/// Called on the client connection thread with each reconstructed snapshot, valid for the duration of the call
+		/// </summary>
+		using SnapshotHandler = std::function<void(const Snapshot&)>;
+
+		/// <summary>
+		/// A connected stream socket and its framing state, used both for clients accepted by the listen
+		/// server module and for our own outbound connection in the client connection module
 		/// </summary>
 		struct ClientSocket
 		{
-			SOCKET m_s = {};
+			SOCKET m_s = INVALID_SOCKET;
 			SOCKADDR m_sa = {};
 			SOCKADDR_IN m_sin = {};
 			SOCKADDR_STORAGE m_sas = {};
+
+			ConnectionHandle m_handle = c_invalid_connection;
+			ReceiveRingPtr m_recv = nullptr;
+			SendQueuePtr m_send = nullptr;
+			ConnectionStatsPtr m_stats = nullptr;
+			bool m_want_write = false; // Reactor thread only, true while we are registered for writability
+			TokenBucket m_message_tokens = {}; // Reactor thread only, inbound rate limits
+			TokenBucket m_byte_tokens = {};
+
+			/// <summary>
+			/// Drain the socket into the receive ring and hand every complete message to the handler. Messages
+			/// over the context's rate limits are skipped without being decoded. Returns false when the peer has
+			/// closed, the socket has failed, or the peer sent a malformed frame.
+			/// </summary>
+			bool Receive(InboundContext& context);
+
+			/// <summary>
+			/// Reactor thread only, flush the send queue and keep the writable interest in step with whether
+			/// the kernel took everything. Returns false when the socket has failed.
+			/// </summary>
+			bool Flush(ReactorBackendRaw reactor);
 		};
 
 		/// <summary>
-		/// Provides an interface to client sockets that have connected to this server
+		/// Provides an interface to client sockets that have connected to this server. Connections live in a
+		/// generational slot map with a fixed capacity allocated up front, so slots never move and handles
+		/// resolve in O(1). Only the owning reactor thread adds and removes connections; every other thread
+		/// validates a handle against the slot's atomic generation and never takes a table lock.
 		/// </summary>
 		class ClientSocketModule
 		{
-			using Clients = std::vector<ClientSocket>;
-			Clients m_client_sockets = {};
-			std::mutex m_client_sockets_mutex = {};
+			struct Slot
+			{
+				std::atomic<uint32_t> Generation = 0; // Odd while the slot holds a live connection
+				ClientSocket Socket = {};
+			};
+			using Slots = std::unique_ptr<Slot[]>;
+			using FreeList = std::deque<uint32_t>;
+
+			Slots m_slots = nullptr;
+			FreeList m_free_slots = {}; // Reactor thread only, oldest first so a freed slot rests before it is reused
+			std::atomic<uint32_t> m_slots_used = 0; // Slots [0, m_slots_used) have held a connection at some point
+			std::atomic<uint32_t> m_client_count = 0;
+			uint32_t m_shard = 0;
+
+			// Connection lifetime counters, written by the reactor thread only
+			std::atomic<uint64_t> m_accepted = 0;
+			std::atomic<uint64_t> m_refused = 0;
+			std::atomic<uint64_t> m_closed = 0;
+
+			// Connections with freshly queued output, handed to the reactor for its next flush pass
+			using FlushRequests = std::vector<ConnectionHandle>;
+			FlushRequests m_flush_requests = {};
+			std::mutex m_flush_requests_mutex = {};
+
+			ReactorBackendRaw m_reactor = nullptr;
+			std::thread::id m_reactor_thread = {};
+			TransformPipelineRaw m_transforms = nullptr;
+			BackpressureSettings m_backpressure = {};
+
+			Slot* resolve(ConnectionHandle h);
+			bool requestFlush(ConnectionHandle h, EnqueueStatus status);
 
 		public:
-			ClientSocketModule()
-			{
+			ClientSocketModule(ReactorBackendRaw reactor, uint32_t shard, TransformPipelineRaw transforms);
+			~ClientSocketModule();
 
-			}
-			~ClientSocketModule()
-			{
+			/// <summary>
+			/// Called by the reactor thread on startup so sends from its own handlers don't wake it needlessly
+			/// </summary>
+			void SetReactorThread(std::thread::id id);
 
-			}
+			/// <summary>
+			/// Reactor thread only, output limits for connections added from now on
+			/// </summary>
+			void SetBackpressure(const BackpressureSettings& settings);
 
-			void AddClientSocket(SOCKET s, SOCKADDR sa)
-			{
-				std::scoped_lock guard(m_client_sockets_mutex);
-				m_client_sockets.push_back(ClientSocket{ s, sa });
-			}
+			/// <summary>
+			/// Reactor thread only. Returns c_invalid_connection if this shard is at capacity.
+			/// </summary>
+			ConnectionHandle AddClientSocket(SOCKET s, SOCKADDR sa);
+
+			/// <summary>
+			/// Reactor thread only. Shut down, close and forget a client socket, the handle stops resolving.
+			/// </summary>
+			void RemoveClientSocket(ConnectionHandle h);
+
+			/// <summary>
+			/// Reactor thread only, the socket state is not safe to touch from any other thread
+			/// </summary>
+			ClientSocket* GetClientSocket(ConnectionHandle h);
+
+			/// <summary>
+			/// Queue a message to a client from any thread, the owning reactor coalesces everything queued between
+			/// two of its iterations into one flush. Returns false if the handle does not name a live connection
+			/// or the message was dropped by the connection's backpressure policy.
+			/// </summary>
+			bool Send(ConnectionHandle h, uint8_t opcode, const uint8_t* data, size_t length);
+			bool Send(ConnectionHandle h, uint8_t opcode, const PayloadWriter& writer);
+			bool Send(ConnectionHandle h, const SharedMessagePtr& message);
+
+			/// <summary>
+			/// Queue frames that are already encoded for the wire, see SendQueue::EnqueueFrames
+			/// </summary>
+			bool SendFrames(ConnectionHandle h, const uint8_t* data, size_t length);
+
+			/// <summary>
+			/// Any thread, have the owning reactor drop a client as if its socket had failed
+			/// </summary>
+			bool Disconnect(ConnectionHandle h);
+
+			/// <summary>
+			/// Reactor thread only, swap out the list of connections that need a flush
+			/// </summary>
+			void TakeFlushRequests(FlushRequests& requests);
 
-			const Clients& GetClients()
+			/// <summary>
+			/// Visit the handle of every live connection from any thread without locking. Connections that come
+			/// or go during the walk may or may not be visited, sending to one that has just gone is harmless.
+			/// </summary>
+			template<typename Fn>
+			void ForEachConnection(Fn&& fn)
 			{
-				return m_client_sockets;
+				auto used = m_slots_used.load(std::memory_order_acquire);
+				for (uint32_t i = 0; i < used; ++i)
+				{
+					auto generation = m_slots[i].Generation.load(std::memory_order_acquire);
+					if (generation & 1u) fn(MakeConnectionHandle(m_shard, i, generation));
+				}
 			}
 
+			size_t GetClientCount();
+
+			/// <summary>
+			/// Add this shard's counters to a roll up from any thread, without locking
+			/// </summary>
+			void GetTelemetry(NetworkTelemetry& out);
+
+			/// <summary>
+			/// Stream counters for one live connection from any thread, false if the handle does not resolve
+			/// </summary>
+			bool GetConnectionTelemetry(ConnectionHandle h, ConnectionTelemetry& out);
 		};
 		using ClientSocketModulePtr = std::unique_ptr<ClientSocketModule>;
 		using ClientSocketModuleRaw = ClientSocketModule*;
@@ -76,60 +338,408 @@ namespace ClayEngine
 			static void FreeSocket(SOCKET s);
 		};
 
+		class DatagramServerModule;
+		using DatagramServerModuleRaw = DatagramServerModule*;
+
+		/// <summary>
+		/// A client may reconnect before the server has noticed its old connection drop. The old connection is
+		/// then closed and the resume tried again every c_session_resume_retry ms, up to c_session_resume_attempts
+		/// times, before the client is given a new session instead.
+		/// </summary>
+		constexpr auto c_session_resume_retry = 10; // ms
+		constexpr auto c_session_resume_attempts = 50;
+
 		/// <summary>
-		/// Thread entry point for listen and accept socket server
+		/// Thread entry point for listen and accept socket server, runs a reactor loop that accepts new clients
+		/// and drains readable client sockets, sleeping in the backend until there is something to do
 		/// </summary>
 		struct AcceptThreadFunctor
 		{
+			AcceptThreadFunctor(ReactorBackendRaw reactor, SOCKET listener, ClientSocketModuleRaw clients, size_t shard);
+
 			void operator()(std::future<void> future);
 		private:
+			// Per slot deadlines, each mark is the counter value the last time its timer looked
+			struct ConnectionTimers
+			{
+				TimerId Idle = c_invalid_timer;
+				TimerId Keepalive = c_invalid_timer;
+				uint64_t IdleMark = 0;
+				uint64_t KeepaliveMark = 0;
+			};
+
+			ReactorBackendRaw m_reactor = nullptr;
+			SOCKET m_listener = INVALID_SOCKET;
+			ClientSocketModuleRaw m_clients = nullptr;
+			size_t m_shard = 0;
+			InboundContext m_inbound = {};
+			DatagramServerModuleRaw m_datagrams = nullptr;
+			SnapshotReplicatorRaw m_snapshots = nullptr;
+			InterestGridRaw m_interest = nullptr;
+
+			SessionTableRaw m_sessions = nullptr;
+			SessionHandler m_session_handler = nullptr;
+			Milliseconds m_session_grace = Milliseconds(0);
+
+			TimingWheelPtr m_timers = nullptr;
+			std::vector<ConnectionTimers> m_connection_timers = {};
+			Milliseconds m_idle_timeout = Milliseconds(0);
+			Milliseconds m_keepalive_interval = Milliseconds(0);
+
 			std::tuple<bool, SOCKET, SOCKADDR> checkAcceptForClient(SOCKET s);
+			void acceptClients();
+			void receiveFromClient(ConnectionHandle h);
+			void flushClient(ConnectionHandle h);
+			void disconnectClient(ConnectionHandle h);
+
+			void armTimers(ConnectionHandle h);
+			void checkIdle(ConnectionHandle h);
+			void checkKeepalive(ConnectionHandle h);
+			int getWaitTimeout(int timeout);
+
+			void receiveSession(ConnectionHandle h, const MessageView& view);
+			void resumeSession(ConnectionHandle h, SessionToken token, int attempt);
+			void openSession(ConnectionHandle h);
+			void restoreSession(ConnectionHandle h, SessionToken token, ParkedSession& parked);
+			void expireSession(SessionToken token, TimePoint expires);
+			void sendSession(ConnectionHandle h, SessionToken token, SessionStatus status);
+			void bindDatagrams(ConnectionHandle h, uint32_t key);
 		};
 
 		/// <summary>
-		/// Thread management and access context for the AcceptThreadFunctor
+		/// Thread management and access context for the AcceptThreadFunctor. Each context is one shard of the
+		/// listen server: it owns a reactor and the slice of client connections that its thread accepted.
 		/// </summary>
 		class AcceptThreadContext
 		{
 			std::thread m_thread;
 			std::promise<void> m_promise{};
+
+			ReactorBackendPtr m_reactor = nullptr;
+			ClientSocketModulePtr m_clients = nullptr;
+			SOCKET m_listener = INVALID_SOCKET;
+			bool m_owns_listener = false;
+
 		public:
-			AcceptThreadContext();
+			/// <summary>
+			/// Pass INVALID_SOCKET to have this shard bind its own SO_REUSEPORT listener, or an existing listen
+			/// socket to share it with other shards (the caller keeps ownership of a shared socket)
+			/// </summary>
+			AcceptThreadContext(size_t shard, SOCKET listener);
 			~AcceptThreadContext();
+
+			ClientSocketModuleRaw GetClientSocketModule();
+
+			/// <summary>
+			/// Create, bind and listen on a non-blocking socket using the NetworkSystem listen server settings
+			/// </summary>
+			static SOCKET CreateListenSocket(bool reuse_port);
 		};
 		using AcceptThreadContextPtr = std::unique_ptr<AcceptThreadContext>;
 
 		/// <summary>
-		/// A module that manages multiple listen and accept socket threads
+		/// A module that manages multiple listen and accept socket threads. Where the platform supports SO_REUSEPORT
+		/// every shard binds its own listener and the kernel spreads new connections across them, otherwise the
+		/// shards share one listener and whichever reactor wins the accept() race takes the connection.
 		/// </summary>
 		class ListenServerModule
 		{
 			using Listeners = std::vector<AcceptThreadContextPtr>;
 			Listeners m_listeners = {};
 
+			SOCKET m_shared_listener = INVALID_SOCKET;
+
 		public:
 			ListenServerModule();
 			~ListenServerModule();
+
+			size_t GetShardCount();
+			ClientSocketModuleRaw GetClientSocketModule(size_t shard);
 		};
 		using ListenServerModulePtr = std::unique_ptr<ListenServerModule>;
 		using ListenServerModuleRaw = ListenServerModule*;
 
+		/// <summary>
+		/// One UDP socket serving a datagram channel for every stream session. A channel is opened when the
+		/// listen server accepts a client and closed when the stream drops, packets are matched to their
+		/// session by the handle and random key the client was given over the stream. The client's endpoint
+		/// is learned from its packets, so it survives NAT rebinding. Handlers for datagram messages run on
+		/// this module's thread, not on the shard that owns the stream.
+		/// </summary>
+		class DatagramServerModule
+		{
+			struct Session
+			{
+				DatagramChannelPtr Channel = nullptr;
+				SOCKADDR_IN Endpoint = {};
+				bool HasEndpoint = false;
+			};
+			using Sessions = std::unordered_map<ConnectionHandle, Session>;
+
+			std::thread m_thread;
+			std::promise<void> m_promise{};
+
+			ReactorBackendPtr m_reactor = nullptr;
+			SOCKET m_s = INVALID_SOCKET;
+			USHORT m_port = 0;
+
+			Sessions m_sessions = {};
+			std::mutex m_sessions_mutex = {};
+			std::mt19937 m_keys;
+
+			// Totals of channels that have closed, so the roll up covers every session
+			ConnectionTelemetry m_retired = {};
+
+		public:
+			using FlushTargets = std::vector<std::pair<DatagramChannelPtr, SOCKADDR_IN>>;
+
+			DatagramServerModule(USHORT port);
+			~DatagramServerModule();
+
+			USHORT GetPort();
+
+			/// <summary>
+			/// Called by a shard when it accepts a client, returns the key the client must present
+			/// </summary>
+			uint32_t OpenChannel(ConnectionHandle h);
+			void CloseChannel(ConnectionHandle h);
+
+			/// <summary>
+			/// Stop routing a client's channel without closing it, so that a resumed session can take it over
+			/// with its sequence numbers and unacked reliable messages intact
+			/// </summary>
+			DatagramChannelPtr DetachChannel(ConnectionHandle h);
+
+			/// <summary>
+			/// Route an existing channel to a client under a fresh key, returns the key the client must present
+			/// </summary>
+			uint32_t AttachChannel(ConnectionHandle h, DatagramChannelPtr channel);
+
+			/// <summary>
+			/// Fold a detached channel that will never be attached again into the closed channel totals
+			/// </summary>
+			void RetireChannel(const DatagramChannelPtr& channel);
+
+			/// <summary>
+			/// Queue a message on a client's channel from any thread. Returns false if the session has no channel
+			/// or an unreliable message was dropped because the channel's backlog is full.
+			/// </summary>
+			bool Send(ConnectionHandle h, uint8_t opcode, const uint8_t* data, size_t length, bool reliable);
+
+			/// <summary>
+			/// Reactor thread only, validate a packet's identity and record where it came from
+			/// </summary>
+			DatagramChannelPtr AcceptPacket(ConnectionHandle h, uint32_t key, const SOCKADDR_IN& from);
+
+			/// <summary>
+			/// Reactor thread only, every channel whose client endpoint is known
+			/// </summary>
+			void GetFlushTargets(FlushTargets& targets);
+
+			DatagramChannelPtr GetChannel(ConnectionHandle h);
+
+			/// <summary>
+			/// Add packet totals and round trip figures over every channel to a roll up
+			/// </summary>
+			void GetTelemetry(NetworkTelemetry& out);
+		};
+		using DatagramServerModulePtr = std::unique_ptr<DatagramServerModule>;
+
+		/// <summary>
+		/// Thread entry point for the server end of every datagram channel, drains the UDP socket and sends
+		/// whatever each channel has due at least every c_datagram_ack_interval
+		/// </summary>
+		struct DatagramThreadFunctor
+		{
+			DatagramThreadFunctor(ReactorBackendRaw reactor, SOCKET s, DatagramServerModuleRaw datagrams);
+
+			void operator()(std::future<void> future);
+		private:
+			ReactorBackendRaw m_reactor = nullptr;
+			SOCKET m_s = INVALID_SOCKET;
+			DatagramServerModuleRaw m_datagrams = nullptr;
+			MessageHandler m_handler = nullptr;
+
+			std::array<uint8_t, c_max_datagram_size> m_buffer = {};
+			std::vector<MessageView> m_messages = {};
+			DatagramServerModule::FlushTargets m_targets = {};
+
+			void receivePackets();
+			void flushChannels();
+		};
+
+		/// <summary>
+		/// Our end of the datagram channel to the server, bound once the server hands us a session over the stream
+		/// </summary>
+		struct DatagramSocket
+		{
+			SOCKET m_s = INVALID_SOCKET;
+			SOCKADDR_IN m_sin = {}; // Server datagram endpoint, reactor thread only
+			DatagramChannelPtr m_channel = nullptr;
+
+			std::array<uint8_t, c_max_datagram_size> m_buffer = {};
+			std::vector<MessageView> m_messages = {};
+
+			/// <summary>
+			/// Reactor thread only, drain the socket and hand every deliverable message to the handler
+			/// </summary>
+			void Receive(const MessageHandler& handler, ConnectionHandle h);
+
+			/// <summary>
+			/// Reactor thread only, send every packet the channel has due
+			/// </summary>
+			void Flush();
+		};
+
+		/// <summary>
+		/// Where the client connection is in its life, Backoff is the wait between a failed attempt and the next
+		/// </summary>
+		enum class ConnectionState
+		{
+			Connecting,
+			Backoff,
+			Connected,
+			Failed,
+			Disconnected,
+		};
+
+		/// <summary>
+		/// Called on the client connection thread once the connection is up (true) or every attempt allowed
+		/// has failed (false). A dropped connection that comes back and resumes its session is not reported
+		/// again, one that had to start a new session is reported as up, the same as the first connect.
+		/// </summary>
+		using ConnectHandler = std::function<void(bool)>;
+
+		/// <summary>
+		/// Debug console extension, return true if the command was handled
+		/// </summary>
+		using ConsoleHandler = std::function<bool(const String& command)>;
+
+		/// <summary>
+		/// Connect attempt timeout in milliseconds when none is configured, and the bounds of the exponential
+		/// backoff between attempts. Each wait is drawn from [delay / 2, delay] so that clients knocked off by
+		/// the same outage don't all come back in the same instant.
+		/// </summary>
+		constexpr auto c_connect_timeout_default = 5000;
+		constexpr auto c_connect_backoff_initial = 250;
+		constexpr auto c_connect_backoff_max = 10000;
+
+		/// <summary>
+		/// Thread entry point for the client side of a connection, runs a reactor loop over our one socket. The
+		/// connect itself is non-blocking and driven by the same loop, so nothing waits on a server that is down.
+		/// </summary>
+		struct ConnectionThreadFunctor
+		{
+			ConnectionThreadFunctor(ReactorBackendRaw reactor, ClientSocket* socket, DatagramSocket* datagram, std::atomic<ConnectionState>* state);
+
+			void operator()(std::future<void> future);
+		private:
+			ReactorBackendRaw m_reactor = nullptr;
+			ClientSocket* m_socket = nullptr;
+			DatagramSocket* m_datagram = nullptr;
+			bool m_datagram_bound = false;
+
+			std::atomic<ConnectionState>* m_state = nullptr;
+			ADDRINFO m_hints = {};
+			int m_connect_timeout = c_connect_timeout_default;
+			size_t m_connect_attempts = 0; // Zero retries forever
+			size_t m_attempt = 0;
+			TimePoint m_deadline = {}; // End of the current attempt, or of the current backoff
+			ConnectHandler m_connect_handler = nullptr;
+			std::mt19937 m_jitter;
+
+			SnapshotReceiverPtr m_snapshots = nullptr;
+			SnapshotSchema m_snapshot_schema = {};
+			SnapshotHandler m_snapshot_handler = nullptr;
+			TransformPipelineRaw m_transforms = nullptr;
+
+			// Session the server gave us and how long it holds it for us after we drop
+			SessionToken m_session = c_invalid_session;
+			Milliseconds m_session_grace = Milliseconds(0);
+			TimePoint m_resume_deadline = {}; // Set while we are trying to get back in after a drop
+			bool m_resuming = false; // Our hello carried a token and the server has not answered yet
+
+			void beginConnect();
+			void finishConnect();
+			void failConnect();
+			bool dropConnection();
+			int getWaitTimeout();
+
+			void bindDatagrams(const MessageView& view);
+			void receiveSnapshot(const MessageView& view);
+			void receiveSession(const MessageView& view);
+		};
+
 		/// <summary>
 		/// A module that connects to a listen server
 		/// </summary>
 		class ClientConnectionModule
 		{
-			SOCKET m_s = {};
-			SOCKADDR_IN m_sin = {};
+			std::thread m_thread;
+			std::promise<void> m_promise{};
 
-			bool tryConnectToServer();
+			ReactorBackendPtr m_reactor = nullptr;
+			ClientSocket m_socket = {};
+			DatagramSocket m_datagram = {};
+			TransformPipelineRaw m_transforms = nullptr;
+			std::atomic<ConnectionState> m_state = ConnectionState::Connecting;
 
 		public:
+			/// <summary>
+			/// Returns immediately, the connection is made in the background and reported to the ConnectHandler
+			/// </summary>
 			ClientConnectionModule(String address);
 			~ClientConnectionModule();
+
+			ConnectionState GetState();
+
+			/// <summary>
+			/// Counters for our connection across every connect attempt, readable from any thread
+			/// </summary>
+			void GetTelemetry(ConnectionTelemetry& out);
+
+			/// <summary>
+			/// Queue a message to the server from any thread, flushed by the connection reactor
+			/// </summary>
+			void Send(uint8_t opcode, const uint8_t* data, size_t length);
+			void Send(uint8_t opcode, const PayloadWriter& writer);
+
+			/// <summary>
+			/// Queue a message on the datagram channel from any thread. Messages queued before the server has
+			/// bound the channel are held until it does.
+			/// </summary>
+			bool SendDatagram(uint8_t opcode, const uint8_t* data, size_t length, bool reliable);
 		};
 		using ClientConnectionModulePtr = std::unique_ptr<ClientConnectionModule>;
 
+		/// <summary>
+		/// Thread entry point for the telemetry dump, appends a roll up of the listen server every interval
+		/// </summary>
+		struct TelemetryThreadFunctor
+		{
+			TelemetryThreadFunctor(String filename, int interval);
+
+			void operator()(std::future<void> future);
+		private:
+			String m_filename;
+			int m_interval = 0;
+		};
+
+		/// <summary>
+		/// Writes the listen server telemetry to a file as one line of JSON per interval, for dashboards and
+		/// offline analysis. The file is appended to, so restarts add to the same history.
+		/// </summary>
+		class TelemetryModule
+		{
+			std::thread m_thread;
+			std::promise<void> m_promise{};
+
+		public:
+			TelemetryModule(String filename, int interval);
+			~TelemetryModule();
+		};
+		using TelemetryModulePtr = std::unique_ptr<TelemetryModule>;
+
 		/// <summary>
 		/// API for network subsystem
 		/// </summary>
@@ -137,28 +747,91 @@ namespace ClayEngine
 		{
 			WSADATA m_wsadata;
 
-			// Automatically instantiated
-			ClientSocketModulePtr m_client_sockets = nullptr;
-
 			// Conditional instantiation
 			ListenServerModulePtr m_listen_server = nullptr;
+			DatagramServerModulePtr m_datagram_server = nullptr;
 			ADDRINFO m_listen_server_hints = {};
 			USHORT m_listen_server_port = 0;
-			int m_listen_server_loop_timeout = 0;
+			USHORT m_listen_server_datagram_port = 0;
+			int m_listen_server_loop_timeout = -1;
+			size_t m_listen_server_threads = 0;
+			int m_listen_server_idle_timeout = 0;
+			int m_listen_server_keepalive_interval = 0;
+			int m_listen_server_session_grace = 0;
+			BackpressureSettings m_listen_server_backpressure = {};
+			RateLimitSettings m_listen_server_rate_limits = {};
+
+			TelemetryModulePtr m_telemetry = nullptr;
+			String m_telemetry_filename = {};
+			int m_telemetry_interval = 0;
+
+			MessageHandler m_message_handler = nullptr;
+			MessageDispatcherPtr m_dispatcher = nullptr;
+			TransformPipelinePtr m_transforms = nullptr;
+			CaptureWriterPtr m_capture = nullptr;
+
+			SnapshotSchema m_snapshot_schema = {};
+			SnapshotReplicatorPtr m_snapshots = nullptr;
+			SnapshotHandler m_snapshot_handler = nullptr;
+
+			SessionTablePtr m_sessions = nullptr;
+			SessionHandler m_session_handler = nullptr;
+
+			InterestSettings m_interest_settings = {};
+			InterestGridPtr m_interest = nullptr;
+			std::vector<uint32_t> m_publish_observers = {};
+			Snapshot m_publish_snapshot = {};
 
 			ClientConnectionModulePtr m_client_connection = nullptr;
 			ADDRINFO m_client_connection_hints = {};
 			USHORT m_client_connection_port = 0;
 			int m_client_connection_loop_timeout = 0;
+			size_t m_client_connection_attempts = 0;
+			ConnectHandler m_connect_handler = nullptr;
 
 		public:
 			NetworkSystem();
 			~NetworkSystem();
 
+			/// <summary>
+			/// Set before starting the listen server or client connection, every reactor thread takes its own copy
+			/// </summary>
+			void SetMessageHandler(MessageHandler handler);
+			const MessageHandler& GetMessageHandler();
+
+			/// <summary>
+			/// Typed handlers by opcode, register before starting the listen server or client connection. Messages
+			/// with a registered opcode go to the dispatcher, the rest fall through to the message handler.
+			/// </summary>
+			MessageDispatcherRaw GetMessageDispatcher();
+
+			/// <summary>
+			/// Append a stage to the payload pipeline, outbound payloads pass through the stages in the order they
+			/// were added (Compress()->Encrypt()) and inbound payloads in reverse (Decrypt()->Decompress()). Both
+			/// ends must configure the same stages before starting the listen server or client connection.
+			/// </summary>
+			void AddTransform(TransformPtr transform);
+			TransformPipelineRaw GetTransformPipeline();
+
+			/// <summary>
+			/// Quantization used for entity snapshots, both ends must agree on it and set it before starting
+			/// </summary>
+			void SetSnapshotSchema(SnapshotSchema schema);
+			const SnapshotSchema& GetSnapshotSchema();
+
+			/// <summary>
+			/// Set before starting the client connection, receives every snapshot the server publishes to us
+			/// </summary>
+			void SetSnapshotHandler(SnapshotHandler handler);
+			const SnapshotHandler& GetSnapshotHandler();
+
 			#pragma region Listen Server API
 			void StartListenServer();
 			void StopListenServer();
 
+			/// <summary>
+			/// Upper bound in milliseconds that the listen reactor sleeps without socket activity, negative waits indefinitely
+			/// </summary>
 			void SetListenServerTimeout(int timeout);
 			int GetListenServerTimeout();
 
@@ -168,7 +841,188 @@ namespace ClayEngine
 			void SetListenServerPort(USHORT port);
 			USHORT GetListenServerPort();
 
-			ClientSocketModuleRaw GetClientSocketModule();
+			/// <summary>
+			/// UDP port for the datagram channel that rides alongside each stream session, zero (the default) disables it
+			/// </summary>
+			void SetListenServerDatagramPort(USHORT port);
+			USHORT GetListenServerDatagramPort();
+			DatagramServerModuleRaw GetDatagramServerModule();
+
+			/// <summary>
+			/// Number of accept/IO reactor threads the listen server starts, zero means one per hardware thread
+			/// </summary>
+			void SetListenServerThreads(size_t threads);
+			size_t GetListenServerThreads();
+
+			/// <summary>
+			/// Milliseconds without a byte from a client before it is dropped, zero (the default) never drops.
+			/// Checked lazily, so a silent client goes after one to two timeouts.
+			/// </summary>
+			void SetListenServerIdleTimeout(int timeout);
+			int GetListenServerIdleTimeout();
+
+			/// <summary>
+			/// Milliseconds without a message to a client before it is sent a keepalive, zero (the default) sends
+			/// none. Keep it well under the idle timeout so that quiet clients are not dropped.
+			/// </summary>
+			void SetListenServerKeepaliveInterval(int interval);
+			int GetListenServerKeepaliveInterval();
+
+			/// <summary>
+			/// Per client send queue watermarks in bytes and what happens to messages sent to a client that has
+			/// fallen past the high one. Unbounded by default, throws if the low watermark is above the high one.
+			/// </summary>
+			void SetListenServerBackpressure(BackpressureSettings settings);
+			BackpressureSettings GetListenServerBackpressure();
+
+			/// <summary>
+			/// Per client inbound message and byte rates, unlimited by default. Messages over either budget are
+			/// dropped by the reactor on their header alone and counted as rate limited.
+			/// </summary>
+			void SetListenServerRateLimits(RateLimitSettings limits);
+			RateLimitSettings GetListenServerRateLimits();
+
+			/// <summary>
+			/// Milliseconds a dropped client's session is held for it to resume, with its snapshot baselines,
+			/// datagram channel and unsent stream messages. Zero (the default) ends a session with its connection.
+			/// </summary>
+			void SetListenServerSessionGrace(int grace);
+			int GetListenServerSessionGrace();
+
+			/// <summary>
+			/// Set before starting the listen server, called on a reactor thread as sessions open, resume and close.
+			/// Game state keyed by connection handle moves from previous to h on resume.
+			/// </summary>
+			void SetSessionHandler(SessionHandler handler);
+			const SessionHandler& GetSessionHandler();
+			SessionTableRaw GetSessionTable();
+
+			size_t GetListenServerShardCount();
+			ClientSocketModuleRaw GetClientSocketModule(size_t shard);
+
+			/// <summary>
+			/// Queue a message to a connected client from any thread
+			/// </summary>
+			bool Send(ConnectionHandle h, uint8_t opcode, const uint8_t* data, size_t length);
+
+			/// <summary>
+			/// Queue a reflected message (see NetworkMessages.h) to a connected client from any thread, it is
+			/// serialized straight into the client's send queue
+			/// </summary>
+			template<typename T>
+			bool Send(ConnectionHandle h, const T& message)
+			{
+				auto csm = GetClientSocketModule(GetHandleShard(h));
+				if (!csm) return false;
+
+				return csm->Send(h, T::Opcode, [&message](uint8_t* dst, size_t capacity) { return EncodeMessage(message, dst, capacity); });
+			}
+
+			/// <summary>
+			/// Frame and transform a message once so that it can be queued to any number of clients, each of
+			/// them sends the same bytes and nothing is copied per recipient
+			/// </summary>
+			SharedMessagePtr MakeSharedMessage(uint8_t opcode, const uint8_t* data, size_t length);
+
+			template<typename T>
+			SharedMessagePtr MakeSharedMessage(const T& message)
+			{
+				std::array<uint8_t, c_max_message_size> payload;
+				auto length = EncodeMessage(message, payload.data(), payload.size());
+				if (length == c_payload_overflow) throw std::exception("NetworkSystem ERROR: Message exceeds c_max_message_size");
+
+				return MakeSharedMessage(T::Opcode, payload.data(), length);
+			}
+
+			/// <summary>
+			/// Queue a shared message to a connected client from any thread
+			/// </summary>
+			bool Send(ConnectionHandle h, const SharedMessagePtr& message);
+
+			/// <summary>
+			/// Drop a connected client from any thread, its session is parked like that of any other drop
+			/// </summary>
+			bool Disconnect(ConnectionHandle h);
+
+			/// <summary>
+			/// Queue a message to every connected client from any thread, never blocks the accept path. The message
+			/// is serialized once and shared by every client's send queue.
+			/// </summary>
+			void Broadcast(uint8_t opcode, const uint8_t* data, size_t length);
+			void Broadcast(const SharedMessagePtr& message);
+
+			template<typename T>
+			void Broadcast(const T& message)
+			{
+				Broadcast(MakeSharedMessage(message));
+			}
+
+			/// <summary>
+			/// Queue a message on a client's datagram channel from any thread. Unreliable messages are sequenced
+			/// and may be lost, reliable ones are resent until acknowledged but are not ordered.
+			/// </summary>
+			bool SendDatagram(ConnectionHandle h, uint8_t opcode, const uint8_t* data, size_t length, bool reliable = false);
+
+			/// <summary>
+			/// Send a client its view of the world from any thread (one thread per client at a time). The snapshot
+			/// is delta coded against the newest one that client has acknowledged and rides the datagram channel
+			/// when it fits in a packet, the stream otherwise. Returns false if it could not be sent at all.
+			/// </summary>
+			bool PublishSnapshot(ConnectionHandle h, const Snapshot& snapshot);
+			SnapshotReplicatorRaw GetSnapshotReplicator();
+
+			/// <summary>
+			/// Cell size and view radius for area of interest filtering, set before starting the listen server
+			/// </summary>
+			void SetInterestSettings(InterestSettings settings);
+
+			/// <summary>
+			/// The game feeds replicated entities and each client's viewpoint in here, a connection's observer
+			/// is dropped when it disconnects
+			/// </summary>
+			InterestGridRaw GetInterestGrid();
+
+			/// <summary>
+			/// Publish to every client with an observer a snapshot of just the entities relevant to it, call once
+			/// per server tick from the simulation thread
+			/// </summary>
+			void PublishSnapshots();
+
+			/// <summary>
+			/// Append the roll up to filename as a line of JSON every interval milliseconds while the listen server
+			/// runs, set before starting it. Zero (the default) turns the dump off.
+			/// </summary>
+			void SetTelemetryDump(String filename, int interval);
+
+			/// <summary>
+			/// Record every message the listen server receives to filename until StopCapture(), from any thread
+			/// and while the server runs. Throws if the file can't be created.
+			/// </summary>
+			void StartCapture(String filename);
+			uint64_t StopCapture();
+			CaptureWriterRaw GetCaptureWriter();
+
+			/// <summary>
+			/// Run a capture through the dispatcher and message handler on the calling thread, the way the listen
+			/// server would have handled it but without sockets. The server need not be started, register the
+			/// handlers first. Throws if the capture can't be read.
+			/// </summary>
+			ReplayStats ReplayCapture(String filename, ReplayPacing pacing);
+
+			/// <summary>
+			/// Roll up of every shard and the datagram channels from any thread, cheap enough to poll
+			/// </summary>
+			void GetTelemetry(NetworkTelemetry& out);
+
+			/// <summary>
+			/// Counters for one client from any thread, false if the handle does not name a live connection
+			/// </summary>
+			bool GetConnectionTelemetry(ConnectionHandle h, ConnectionTelemetry& out);
+
+			/// <summary>
+			/// Counters for every live client from any thread
+			/// </summary>
+			void GetConnectionTelemetry(std::vector<ConnectionTelemetry>& out);
 #pragma endregion
 
 			#pragma region Client Connection API
@@ -182,6 +1036,22 @@ namespace ClayEngine
 				m_client_connection = nullptr;
 			}
 
+			void SendToServer(uint8_t opcode, const uint8_t* data, size_t length)
+			{
+				if (m_client_connection) m_client_connection->Send(opcode, data, length);
+			}
+
+			template<typename T>
+			void SendToServer(const T& message)
+			{
+				if (m_client_connection) m_client_connection->Send(T::Opcode, [&message](uint8_t* dst, size_t capacity) { return EncodeMessage(message, dst, capacity); });
+			}
+
+			bool SendDatagramToServer(uint8_t opcode, const uint8_t* data, size_t length, bool reliable = false)
+			{
+				return m_client_connection ? m_client_connection->SendDatagram(opcode, data, length, reliable) : false;
+			}
+
 			void SetClientConnectionHints(int family, int socktype, int protocol)
 			{
 				m_client_connection_hints.ai_family = family;
@@ -202,6 +1072,9 @@ namespace ClayEngine
 				return m_client_connection_port;
 			}
 
+			/// <summary>
+			/// Milliseconds a single connect attempt may take before it is abandoned and retried, zero uses c_connect_timeout_default
+			/// </summary>
 			void SetClientConnectionTimeout(int timeout)
 			{
 				m_client_connection_loop_timeout = timeout;
@@ -210,20 +1083,100 @@ namespace ClayEngine
 			{
 				return m_client_connection_loop_timeout;
 			}
+
+			/// <summary>
+			/// Connect attempts before giving up, zero (the default) keeps retrying with backoff until stopped
+			/// </summary>
+			void SetClientConnectionAttempts(size_t attempts)
+			{
+				m_client_connection_attempts = attempts;
+			}
+			size_t GetClientConnectionAttempts()
+			{
+				return m_client_connection_attempts;
+			}
+
+			/// <summary>
+			/// Set before starting the client connection
+			/// </summary>
+			void SetConnectHandler(ConnectHandler handler)
+			{
+				m_connect_handler = handler;
+			}
+			const ConnectHandler& GetConnectHandler()
+			{
+				return m_connect_handler;
+			}
+
+			ConnectionState GetClientConnectionState()
+			{
+				return m_client_connection ? m_client_connection->GetState() : ConnectionState::Disconnected;
+			}
+
+			bool GetClientConnectionTelemetry(ConnectionTelemetry& out)
+			{
+				if (!m_client_connection) return false;
+
+				m_client_connection->GetTelemetry(out);
+				return true;
+			}
 #pragma endregion
 
-			void Run() // Debug dummy
+			/// <summary>
+			/// Debug console: "stats" prints the roll up, "connections" every live client, "dispatch" the time spent
+			/// in each message handler, "capture <file>" starts recording inbound messages and "capture off" stops,
+			/// "quit" returns. Every command is offered to handler first.
+			/// </summary>
+			void Run(const ConsoleHandler& handler = nullptr)
 			{
-				while (true)
+				String s;
+				while (std::cin >> s)
 				{
-					String s;
-					std::cin >> s;
-					break;
+					if (handler && handler(s)) continue;
+
+					if (s == "stats")
+					{
+						NetworkTelemetry telemetry = {};
+						GetTelemetry(telemetry);
+						WriteLine(telemetry.ToString());
+					}
+					else if (s == "connections")
+					{
+						std::vector<ConnectionTelemetry> connections = {};
+						GetConnectionTelemetry(connections);
+						for (auto& connection : connections) WriteLine(connection.ToString());
+					}
+					else if (s == "dispatch")
+					{
+						std::vector<DispatchStats> dispatch = {};
+						m_dispatcher->GetStats(dispatch);
+						for (auto& opcode : dispatch) WriteLine(opcode.ToString());
+					}
+					else if (s == "capture" && std::cin >> s)
+					{
+						if (s == "off")
+						{
+							std::stringstream ss;
+							ss << "Capture INFO: " << StopCapture() << " messages captured";
+							WriteLine(ss.str());
+						}
+						else
+						{
+							try
+							{
+								StartCapture(s);
+								WriteLine("Capture INFO: Capturing to " + s);
+							}
+							catch (std::exception ex)
+							{
+								WriteLine(ex.what());
+							}
+						}
+					}
+					else if (s == "quit") break;
+					else WriteLine("Commands: stats, connections, dispatch, capture <file>|off, quit");
 				}
 			}
-
-			// Compress()->Encrypt()->Send()
-			// Recieve()->Decrypt()->Decompress()
 		};
 		using NetworkSystemPtr = std::unique_ptr<NetworkSystem>;
 		using NetworkSystemRaw = NetworkSystem*;
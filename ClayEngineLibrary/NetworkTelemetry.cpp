@@ -0,0 +1,118 @@
+#include "pch.h"
+#include "NetworkTelemetry.h"
+#include "Storage.h"
+
+namespace
+{
+	using namespace ClayEngine::Networking;
+
+	void writeCounters(ClayEngine::Platform::Document& document, const NetworkCounters& counters)
+	{
+		for (size_t i = 0; i < c_network_counter_count; ++i)
+		{
+			document[c_network_counter_names[i]] = counters[i];
+		}
+	}
+}
+
+#pragma region Connection Stats
+void ClayEngine::Networking::ConnectionStats::Begin()
+{
+	for (size_t i = 0; i < c_network_counter_count; ++i)
+	{
+		m_baseline[i].store(m_counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	m_queued_bytes.store(0, std::memory_order_relaxed);
+}
+
+void ClayEngine::Networking::ConnectionStats::GetCounters(NetworkCounters& out) const
+{
+	for (size_t i = 0; i < c_network_counter_count; ++i)
+	{
+		// A reader racing Begin() on a reused slot may see the new baseline first, never report below zero
+		auto total = m_counters[i].load(std::memory_order_relaxed);
+		auto baseline = m_baseline[i].load(std::memory_order_relaxed);
+		out[i] = (total > baseline) ? total - baseline : 0;
+	}
+}
+
+void ClayEngine::Networking::ConnectionStats::GetTotals(NetworkCounters& out) const
+{
+	for (size_t i = 0; i < c_network_counter_count; ++i)
+	{
+		out[i] = m_counters[i].load(std::memory_order_relaxed);
+	}
+}
+#pragma endregion
+
+#pragma region Telemetry Reports
+ClayEngine::String ClayEngine::Networking::ConnectionTelemetry::ToJson() const
+{
+	Platform::Document document = {};
+	document["handle"] = Handle;
+	writeCounters(document, Counters);
+	document["queued_bytes"] = QueuedBytes;
+	document["rtt_ms"] = RoundTrip;
+	document["packets_sent"] = PacketsSent;
+	document["packets_received"] = PacketsReceived;
+	document["packets_lost"] = PacketsLost;
+	document["resends"] = Resends;
+
+	return document.dump();
+}
+
+ClayEngine::String ClayEngine::Networking::ConnectionTelemetry::ToString() const
+{
+	std::stringstream ss;
+	ss << "0x" << std::hex << std::setw(8) << std::setfill('0') << Handle << std::dec << std::setfill(' ')
+		<< " in " << Counters[size_t(NetworkCounter::BytesIn)] << " B/" << Counters[size_t(NetworkCounter::MessagesIn)]
+		<< " out " << Counters[size_t(NetworkCounter::BytesOut)] << " B/" << Counters[size_t(NetworkCounter::MessagesOut)]
+		<< " queued " << QueuedBytes << " B partial " << Counters[size_t(NetworkCounter::PartialWrites)]
+		<< " errors " << Counters[size_t(NetworkCounter::ProtocolErrors)]
+		<< " dropped " << Counters[size_t(NetworkCounter::MessagesDropped)] << " limited " << Counters[size_t(NetworkCounter::RateLimited)]
+		<< std::fixed << std::setprecision(1) << " rtt " << RoundTrip << " ms lost " << PacketsLost << " resends " << Resends;
+
+	return ss.str();
+}
+
+ClayEngine::String ClayEngine::Networking::NetworkTelemetry::ToJson() const
+{
+	Platform::Document document = {};
+	document["timestamp"] = Timestamp;
+	document["connections"] = Connections;
+	document["accepted"] = Accepted;
+	document["refused"] = Refused;
+	document["closed"] = Closed;
+	document["sessions"] = Sessions;
+	document["parked_sessions"] = ParkedSessions;
+	document["resumed_sessions"] = ResumedSessions;
+	writeCounters(document, Totals);
+	document["queued_bytes"] = QueuedBytes;
+	document["max_queued_bytes"] = MaxQueuedBytes;
+	document["packets_sent"] = PacketsSent;
+	document["packets_received"] = PacketsReceived;
+	document["packets_lost"] = PacketsLost;
+	document["resends"] = Resends;
+	document["mean_rtt_ms"] = MeanRoundTrip;
+	document["max_rtt_ms"] = MaxRoundTrip;
+
+	return document.dump();
+}
+
+ClayEngine::String ClayEngine::Networking::NetworkTelemetry::ToString() const
+{
+	std::stringstream ss;
+	ss << "Connections: " << Connections << " live, " << Accepted << " accepted, " << Refused << " refused, " << Closed << " closed" << std::endl;
+	ss << "Sessions: " << Sessions << " live, " << ParkedSessions << " parked, " << ResumedSessions << " resumed" << std::endl;
+	ss << "Stream: in " << Totals[size_t(NetworkCounter::BytesIn)] << " B/" << Totals[size_t(NetworkCounter::MessagesIn)] << " msgs"
+		<< ", out " << Totals[size_t(NetworkCounter::BytesOut)] << " B/" << Totals[size_t(NetworkCounter::MessagesOut)] << " msgs"
+		<< ", partial writes " << Totals[size_t(NetworkCounter::PartialWrites)]
+		<< ", protocol errors " << Totals[size_t(NetworkCounter::ProtocolErrors)]
+		<< ", dropped " << Totals[size_t(NetworkCounter::MessagesDropped)] << " msgs, rate limited " << Totals[size_t(NetworkCounter::RateLimited)] << " msgs" << std::endl;
+	ss << "Send queues: " << QueuedBytes << " B queued, deepest " << MaxQueuedBytes << " B" << std::endl;
+	ss << "Datagrams: " << PacketsSent << " sent, " << PacketsReceived << " received, " << PacketsLost << " lost, " << Resends << " resends"
+		<< std::fixed << std::setprecision(1) << ", rtt mean " << MeanRoundTrip << " ms max " << MaxRoundTrip << " ms";
+
+	return ss.str();
+}
+#pragma endregion
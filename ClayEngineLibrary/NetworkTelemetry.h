@@ -0,0 +1,163 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Telemetry Library (C) 2022 Epoch Meridian, LLC.         */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// Counters kept for every stream connection, in report order. Bytes are wire bytes, after compression.
+		/// </summary>
+		enum class NetworkCounter
+		{
+			BytesIn,
+			MessagesIn,
+			BytesOut,
+			MessagesOut,
+			PartialWrites, // Flushes the kernel only took part of, a sign of a slow or backed up receiver
+			ProtocolErrors, // Malformed frames and payloads that failed to decode
+			MessagesDropped, // Outbound messages discarded or superseded by send queue backpressure
+			RateLimited, // Inbound messages discarded undecoded for exceeding the connection's rate limits
+			Count,
+		};
+		constexpr auto c_network_counter_count = size_t(NetworkCounter::Count);
+
+		/// <summary>
+		/// Keys used for each counter in the machine readable dump
+		/// </summary>
+		constexpr std::array<const char*, c_network_counter_count> c_network_counter_names = {
+			"bytes_in",
+			"messages_in",
+			"bytes_out",
+			"messages_out",
+			"partial_writes",
+			"protocol_errors",
+			"messages_dropped",
+			"rate_limited",
+		};
+
+		using NetworkCounters = std::array<uint64_t, c_network_counter_count>;
+
+		/// <summary>
+		/// Live counters for one connection slot. Each counter has a single writer at any one time (the reactor
+		/// for reads and flushes, the send queue lock for enqueues) so an update is a relaxed load and store, no
+		/// locked read-modify-write, and costs about the same as a plain increment. Any thread may read.
+		/// Counters keep running across every connection that reuses the slot so totals never go backwards, a
+		/// connection's own figures are taken against the baseline captured when it began.
+		/// </summary>
+		class ConnectionStats
+		{
+			using Counters = std::array<std::atomic<uint64_t>, c_network_counter_count>;
+
+			Counters m_counters = {};
+			Counters m_baseline = {};
+			std::atomic<uint64_t> m_queued_bytes = 0;
+
+		public:
+			void Add(NetworkCounter counter, uint64_t value)
+			{
+				auto& c = m_counters[size_t(counter)];
+				c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+			}
+
+			/// <summary>
+			/// Bytes framed and waiting in the send queue, a gauge rather than a counter
+			/// </summary>
+			void SetQueuedBytes(uint64_t bytes)
+			{
+				m_queued_bytes.store(bytes, std::memory_order_relaxed);
+			}
+			uint64_t GetQueuedBytes() const
+			{
+				return m_queued_bytes.load(std::memory_order_relaxed);
+			}
+
+			/// <summary>
+			/// Owning reactor only, start a new connection's figures from the current totals
+			/// </summary>
+			void Begin();
+
+			/// <summary>
+			/// Counters since Begin(), for the connection currently in the slot
+			/// </summary>
+			void GetCounters(NetworkCounters& out) const;
+
+			/// <summary>
+			/// Counters since the slot was created, for every connection it has held
+			/// </summary>
+			void GetTotals(NetworkCounters& out) const;
+
+			/// <summary>
+			/// One counter since the slot was created, enough to tell whether it has moved since a previous look
+			/// </summary>
+			uint64_t GetTotal(NetworkCounter counter) const
+			{
+				return m_counters[size_t(counter)].load(std::memory_order_relaxed);
+			}
+		};
+		using ConnectionStatsPtr = std::unique_ptr<ConnectionStats>;
+
+		/// <summary>
+		/// One connection as reported to the console and the dump. The round trip, resends and losses come
+		/// from the connection's datagram channel and stay zero without one.
+		/// </summary>
+		struct ConnectionTelemetry
+		{
+			uint32_t Handle = 0;
+			NetworkCounters Counters = {};
+			uint64_t QueuedBytes = 0;
+			float RoundTrip = 0.f; // Smoothed, ms
+			uint64_t PacketsSent = 0;
+			uint64_t PacketsReceived = 0;
+			uint64_t PacketsLost = 0;
+			uint64_t Resends = 0;
+
+			String ToJson() const;
+			String ToString() const;
+		};
+
+		/// <summary>
+		/// Roll up of every shard of the listen server. Counters and datagram totals include connections that
+		/// have since closed, queue depth and round trip are over the connections that are live right now.
+		/// </summary>
+		struct NetworkTelemetry
+		{
+			uint64_t Timestamp = 0; // ms since the Unix epoch, when the roll up was taken
+			uint64_t Connections = 0;
+			uint64_t Accepted = 0;
+			uint64_t Refused = 0; // Turned away at shard capacity
+			uint64_t Closed = 0;
+			uint64_t Sessions = 0; // Held by a live connection
+			uint64_t ParkedSessions = 0; // Waiting out their grace window for the client to come back
+			uint64_t ResumedSessions = 0;
+			NetworkCounters Totals = {};
+
+			uint64_t QueuedBytes = 0;
+			uint64_t MaxQueuedBytes = 0;
+
+			uint64_t PacketsSent = 0;
+			uint64_t PacketsReceived = 0;
+			uint64_t PacketsLost = 0;
+			uint64_t Resends = 0;
+			float MeanRoundTrip = 0.f; // ms, over live channels that have a measurement
+			float MaxRoundTrip = 0.f;
+
+			/// <summary>
+			/// One line of JSON, the format of the periodic dump
+			/// </summary>
+			String ToJson() const;
+
+			/// <summary>
+			/// Multi-line summary for the server console
+			/// </summary>
+			String ToString() const;
+		};
+	}
+}
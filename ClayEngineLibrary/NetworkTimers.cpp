@@ -0,0 +1,212 @@
+#include "pch.h"
+#include "NetworkTimers.h"
+
+#pragma region Timing Wheel
+ClayEngine::Networking::TimingWheel::TimingWheel(TimePoint now, Milliseconds tick)
+	: m_tick{ tick }
+	, m_start{ now }
+{
+	if (m_tick.count() <= 0) throw std::exception("TimingWheel ERROR: Tick must be positive");
+
+	m_slots.fill(c_nil);
+}
+
+uint64_t ClayEngine::Networking::TimingWheel::tickAt(TimePoint time)
+{
+	if (time <= m_start) return 0;
+	return uint64_t(std::chrono::duration_cast<Milliseconds>(time - m_start).count() / m_tick.count());
+}
+
+void ClayEngine::Networking::TimingWheel::link(uint32_t index, uint64_t earliest)
+{
+	auto& node = m_nodes[index];
+
+	// File by distance from the current tick: the first level whose span covers it, or the top level for now
+	auto expiry = std::max(node.Expiry, earliest);
+	auto delta = expiry - m_current;
+
+	uint32_t level = 0;
+	while (level < c_timer_wheel_levels - 1 && delta >= (1ull << (c_timer_wheel_bits * (level + 1)))) ++level;
+	if (delta >= (1ull << (c_timer_wheel_bits * c_timer_wheel_levels))) expiry = m_current + (1ull << (c_timer_wheel_bits * c_timer_wheel_levels)) - 1;
+
+	auto slot = uint32_t(level * c_timer_wheel_slots + ((expiry >> (c_timer_wheel_bits * level)) & c_timer_wheel_mask));
+
+	node.Slot = slot;
+	node.Prev = c_nil;
+	node.Next = m_slots[slot];
+	if (node.Next != c_nil) m_nodes[node.Next].Prev = index;
+	m_slots[slot] = index;
+}
+
+void ClayEngine::Networking::TimingWheel::unlink(uint32_t index)
+{
+	auto& node = m_nodes[index];
+
+	if (node.Prev != c_nil) m_nodes[node.Prev].Next = node.Next;
+	else m_slots[node.Slot] = node.Next;
+	if (node.Next != c_nil) m_nodes[node.Next].Prev = node.Prev;
+
+	node.Prev = c_nil;
+	node.Next = c_nil;
+	node.Slot = c_nil;
+}
+
+void ClayEngine::Networking::TimingWheel::release(uint32_t index)
+{
+	auto& node = m_nodes[index];
+	node.Callback = nullptr;
+
+	// Zero is skipped so that no id, even the one for node zero, is ever c_invalid_timer
+	if (++node.Generation == 0) node.Generation = 1;
+
+	m_free_nodes.push_back(index);
+	--m_armed;
+}
+
+void ClayEngine::Networking::TimingWheel::cascade(uint32_t level)
+{
+	auto slot = uint32_t(level * c_timer_wheel_slots + ((m_current >> (c_timer_wheel_bits * level)) & c_timer_wheel_mask));
+
+	// Detach the whole slot first, a timer that is still too far out may be filed straight back into it
+	auto index = m_slots[slot];
+	m_slots[slot] = c_nil;
+
+	// Runs before this tick's expire(), so a timer due on this very tick goes into the current bottom slot
+	while (index != c_nil)
+	{
+		auto next = m_nodes[index].Next;
+		link(index, m_current);
+		index = next;
+	}
+}
+
+void ClayEngine::Networking::TimingWheel::expire()
+{
+	auto slot = uint32_t(m_current & c_timer_wheel_mask);
+
+	// Take one timer at a time, the callbacks are free to cancel anything else that is due on this tick
+	while (m_slots[slot] != c_nil)
+	{
+		auto index = m_slots[slot];
+		unlink(index);
+
+		auto& node = m_nodes[index];
+		if (node.Expiry > m_current)
+		{
+			link(index, m_current + 1);
+			continue;
+		}
+
+		auto callback = std::move(node.Callback);
+		release(index);
+		if (callback) callback();
+	}
+}
+
+ClayEngine::Networking::TimerId ClayEngine::Networking::TimingWheel::Schedule(Milliseconds delay, TimerCallback callback)
+{
+	uint32_t index = 0;
+	if (!m_free_nodes.empty())
+	{
+		index = m_free_nodes.back();
+		m_free_nodes.pop_back();
+	}
+	else
+	{
+		index = uint32_t(m_nodes.size());
+		m_nodes.emplace_back();
+	}
+
+	auto ticks = (std::max(delay.count(), Milliseconds::rep(0)) + m_tick.count() - 1) / m_tick.count();
+
+	auto& node = m_nodes[index];
+	node.Expiry = m_current + std::max(uint64_t(ticks), uint64_t(1));
+	node.Callback = std::move(callback);
+	link(index, m_current + 1);
+	++m_armed;
+
+	return (TimerId(node.Generation) << 32) | TimerId(index);
+}
+
+bool ClayEngine::Networking::TimingWheel::Reschedule(TimerId id, Milliseconds delay)
+{
+	auto index = uint32_t(id & 0xFFFFFFFFull);
+	if (index >= m_nodes.size()) return false;
+
+	auto& node = m_nodes[index];
+	if (node.Generation != uint32_t(id >> 32) || node.Slot == c_nil) return false;
+
+	auto ticks = (std::max(delay.count(), Milliseconds::rep(0)) + m_tick.count() - 1) / m_tick.count();
+
+	unlink(index);
+	node.Expiry = m_current + std::max(uint64_t(ticks), uint64_t(1));
+	link(index, m_current + 1);
+
+	return true;
+}
+
+bool ClayEngine::Networking::TimingWheel::Cancel(TimerId id)
+{
+	auto index = uint32_t(id & 0xFFFFFFFFull);
+	if (index >= m_nodes.size()) return false;
+
+	auto& node = m_nodes[index];
+	if (node.Generation != uint32_t(id >> 32) || node.Slot == c_nil) return false;
+
+	unlink(index);
+	release(index);
+
+	return true;
+}
+
+void ClayEngine::Networking::TimingWheel::Advance(TimePoint now)
+{
+	auto target = tickAt(now);
+
+	while (m_current < target)
+	{
+		// With nothing armed there is nothing to visit, catch the clock up in one step
+		if (m_armed == 0)
+		{
+			m_current = target;
+			break;
+		}
+
+		++m_current;
+
+		// Each time a level comes round to slot zero, the next level up hands down its current slot
+		if ((m_current & c_timer_wheel_mask) == 0)
+		{
+			for (uint32_t level = 1; level < c_timer_wheel_levels; ++level)
+			{
+				cascade(level);
+				if (((m_current >> (c_timer_wheel_bits * level)) & c_timer_wheel_mask) != 0) break;
+			}
+		}
+
+		expire();
+	}
+}
+
+int ClayEngine::Networking::TimingWheel::GetWaitTimeout(TimePoint now)
+{
+	if (m_armed == 0) return -1;
+
+	// The next occupied slot in this rotation of the bottom level, or the cascade that ends the rotation
+	auto tick = m_current + 1;
+	while (m_slots[tick & c_timer_wheel_mask] == c_nil && (tick & c_timer_wheel_mask) != 0) ++tick;
+
+	auto due = m_start + Milliseconds(m_tick.count() * Milliseconds::rep(tick));
+	if (due <= now) return 0;
+
+	auto remaining = std::chrono::duration_cast<Milliseconds>(due - now).count();
+	if (Milliseconds(remaining) < due - now) ++remaining; // Round up, waking early would only find nothing due
+
+	return int(std::min(remaining, Milliseconds::rep(std::numeric_limits<int>::max())));
+}
+
+size_t ClayEngine::Networking::TimingWheel::GetArmedCount()
+{
+	return m_armed;
+}
+#pragma endregion
@@ -0,0 +1,109 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Timers Library (C) 2022 Epoch Meridian, LLC.            */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// Names a scheduled timer: [generation:32][node index:32]. A timer's node is recycled as soon as it fires
+		/// or is cancelled, and the generation moves on, so a stale id simply stops matching. Zero is never valid.
+		/// </summary>
+		using TimerId = uint64_t;
+		constexpr auto c_invalid_timer = TimerId(0);
+
+		using TimerCallback = std::function<void()>;
+
+		/// <summary>
+		/// Wheel geometry: c_timer_wheel_levels wheels of 2^c_timer_wheel_bits slots, each level one slot
+		/// rotation of the level below. With the default 10ms tick that spans about 46 hours, anything further
+		/// out waits in the top level and is re-filed as it comes around.
+		/// </summary>
+		constexpr auto c_timer_wheel_bits = 6u;
+		constexpr auto c_timer_wheel_slots = 1u << c_timer_wheel_bits;
+		constexpr auto c_timer_wheel_mask = uint64_t(c_timer_wheel_slots - 1);
+		constexpr auto c_timer_wheel_levels = 4u;
+		constexpr auto c_timer_tick_default = 10; // ms
+
+		/// <summary>
+		/// Hierarchical timing wheel for per-connection deadlines. Schedule and Cancel are O(1): timers live in
+		/// intrusive doubly linked slot lists over a recycled node pool, so neither allocates once the pool has
+		/// grown to the working set. Advance only visits the slots whose tick has come, plus one cascade of a
+		/// higher level slot every 2^c_timer_wheel_bits ticks, never the timers that are not yet due. Not thread
+		/// safe, each reactor owns its own wheel and drives it from its loop.
+		/// </summary>
+		class TimingWheel
+		{
+			static constexpr uint32_t c_nil = UINT32_MAX;
+
+			struct Node
+			{
+				uint64_t Expiry = 0; // Absolute tick
+				uint32_t Generation = 1;
+				uint32_t Prev = c_nil;
+				uint32_t Next = c_nil;
+				uint32_t Slot = c_nil; // Index into m_slots while armed
+				TimerCallback Callback = nullptr;
+			};
+			using Nodes = std::vector<Node>;
+			using Slots = std::array<uint32_t, c_timer_wheel_slots * c_timer_wheel_levels>;
+
+			Nodes m_nodes = {};
+			std::vector<uint32_t> m_free_nodes = {};
+			Slots m_slots = {};
+			size_t m_armed = 0;
+
+			Milliseconds m_tick = Milliseconds(c_timer_tick_default);
+			TimePoint m_start = {};
+			uint64_t m_current = 0; // Last tick processed
+
+			uint64_t tickAt(TimePoint time);
+			void link(uint32_t index, uint64_t earliest); // Filed no sooner than the earliest tick
+			void unlink(uint32_t index);
+			void release(uint32_t index);
+			void cascade(uint32_t level);
+			void expire();
+
+		public:
+			TimingWheel(TimePoint now, Milliseconds tick = Milliseconds(c_timer_tick_default));
+			~TimingWheel() = default;
+
+			/// <summary>
+			/// Run callback once delay has passed, rounded up to the next tick
+			/// </summary>
+			TimerId Schedule(Milliseconds delay, TimerCallback callback);
+
+			/// <summary>
+			/// Move an armed timer to a new deadline without touching its callback, false if it already fired
+			/// </summary>
+			bool Reschedule(TimerId id, Milliseconds delay);
+
+			/// <summary>
+			/// Returns false if the timer has already fired or been cancelled
+			/// </summary>
+			bool Cancel(TimerId id);
+
+			/// <summary>
+			/// Fire every timer due at or before now. Callbacks may schedule and cancel freely, timers they schedule
+			/// are due on a later tick at the earliest.
+			/// </summary>
+			void Advance(TimePoint now);
+
+			/// <summary>
+			/// Milliseconds the owner can sleep before the wheel next has work, which is either a due timer or a
+			/// cascade. Negative when nothing is armed.
+			/// </summary>
+			int GetWaitTimeout(TimePoint now);
+
+			size_t GetArmedCount();
+		};
+		using TimingWheelPtr = std::unique_ptr<TimingWheel>;
+	}
+}
@@ -0,0 +1,314 @@
+#include "pch.h"
+#include "NetworkTransforms.h"
+
+namespace
+{
+	inline uint32_t readU32(const uint8_t* p)
+	{
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint32_t hashU32(uint32_t v, uint32_t bits)
+	{
+		return (v * 2654435761u) >> (32u - bits);
+	}
+
+	// Writes the 15+ continuation bytes of an extended length, returns false if dst runs out
+	inline bool writeLength(uint8_t*& dst, const uint8_t* end, size_t length)
+	{
+		while (length >= 255)
+		{
+			if (dst >= end) return false;
+			*dst++ = 255;
+			length -= 255;
+		}
+		if (dst >= end) return false;
+		*dst++ = uint8_t(length);
+		return true;
+	}
+
+	inline bool readLength(const uint8_t*& src, const uint8_t* end, size_t& length)
+	{
+		uint8_t b = 0;
+		do
+		{
+			if (src >= end) return false;
+			b = *src++;
+			length += b;
+		} while (b == 255);
+		return true;
+	}
+}
+
+#pragma region Transform Pipeline
+void ClayEngine::Networking::TransformPipeline::AddTransform(TransformPtr transform)
+{
+	if ((transform->GetFlag() & ~c_message_transform_mask) != 0) throw std::exception("TransformPipeline ERROR: Transform flag is outside c_message_transform_mask");
+
+	for (auto& t : m_transforms)
+	{
+		if (t->GetFlag() & transform->GetFlag()) throw std::exception("TransformPipeline ERROR: Two transforms claim the same header flag");
+	}
+
+	m_transforms.push_back(std::move(transform));
+}
+
+size_t ClayEngine::Networking::TransformPipeline::Forward(const uint8_t* src, size_t length, uint8_t* dst, size_t capacity, uint8_t& flags) const
+{
+	flags = 0;
+	if (m_transforms.empty()) return 0;
+
+	// Intermediate stages ping-pong on the stack, the last stage writes straight into dst
+	std::array<std::array<uint8_t, c_transform_scratch_size>, 2> scratch;
+
+	auto current = src;
+	auto current_length = length;
+	auto last = m_transforms.size() - 1;
+
+	for (size_t i = 0; i < m_transforms.size(); ++i)
+	{
+		// Whichever scratch buffer doesn't hold the input, a declined stage leaves current where it was
+		auto& spare = (current == scratch[0].data()) ? scratch[1] : scratch[0];
+		auto target = (i == last) ? dst : spare.data();
+		auto target_capacity = (i == last) ? capacity : spare.size();
+
+		auto written = m_transforms[i]->Forward(current, current_length, target, target_capacity);
+		if (written == 0) continue; // Stage declined, the next one sees the same bytes
+
+		flags |= m_transforms[i]->GetFlag();
+		current = target;
+		current_length = written;
+	}
+
+	if (flags == 0) return 0;
+	if (current != dst)
+	{
+		// The final stage declined, move the last applied output into place
+		if (current_length > capacity) { flags = 0; return 0; }
+		std::memcpy(dst, current, current_length);
+	}
+
+	return current_length;
+}
+
+bool ClayEngine::Networking::TransformPipeline::Reverse(const uint8_t* src, size_t length, uint8_t flags, uint8_t* scratch, size_t capacity, size_t& written) const
+{
+	flags &= c_message_transform_mask;
+
+	// Intermediate stages ping-pong on the stack, the final stage decodes straight into scratch
+	std::array<std::array<uint8_t, c_transform_scratch_size>, 2> intermediate;
+
+	auto current = src;
+	auto current_length = length;
+	auto applied = uint8_t(0);
+
+	// Count the stages that will run so the final one can decode straight into scratch
+	auto remaining = size_t(0);
+	for (auto& t : m_transforms) if (flags & t->GetFlag()) ++remaining;
+
+	for (auto it = m_transforms.rbegin(); it != m_transforms.rend(); ++it)
+	{
+		auto flag = (*it)->GetFlag();
+		if ((flags & flag) == 0) continue;
+
+		--remaining;
+		auto& spare = (current == intermediate[0].data()) ? intermediate[1] : intermediate[0];
+		auto target = (remaining == 0) ? scratch : spare.data();
+		auto target_capacity = (remaining == 0) ? capacity : spare.size();
+
+		size_t out = 0;
+		if (!(*it)->Reverse(current, current_length, target, target_capacity, out)) return false;
+
+		applied |= flag;
+		current = target;
+		current_length = out;
+	}
+
+	// A flag we have no transform for means the peer is configured differently, treat it as malformed
+	if (applied != flags) return false;
+
+	if (current != scratch)
+	{
+		// No stage ran, the payload passes through as it came
+		if (current_length > capacity) return false;
+		std::memcpy(scratch, current, current_length);
+	}
+
+	written = current_length;
+	return true;
+}
+#pragma endregion
+
+#pragma region LZ Transform
+ClayEngine::Networking::LZTransform::LZTransform(size_t threshold)
+	: m_threshold(threshold)
+{
+}
+
+ClayEngine::Networking::LZTransform::LZTransform(const uint8_t* dictionary, size_t length, size_t threshold)
+	: m_threshold(threshold)
+{
+	if (length > c_max_dictionary) throw std::exception("LZTransform ERROR: Dictionary is too large for 16 bit offsets");
+
+	m_dictionary.assign(dictionary, dictionary + length);
+
+	// Positions are stored +1 so zero can mean empty, later dictionary positions win which keeps offsets short
+	for (size_t i = 0; i + c_min_match <= m_dictionary.size(); ++i)
+	{
+		m_dictionary_table[hashU32(readU32(m_dictionary.data() + i), c_hash_bits)] = uint16_t(i + 1);
+	}
+}
+
+size_t ClayEngine::Networking::LZTransform::Forward(const uint8_t* src, size_t length, uint8_t* dst, size_t capacity) const
+{
+	if (length < m_threshold || length < c_min_match) return 0;
+	if (m_dictionary.size() + length > c_max_offset) return 0; // Positions must fit the 16 bit hash table
+
+	// Only worth sending if it came out smaller
+	auto limit = std::min(capacity, length - 1);
+	auto out = dst;
+	auto out_end = dst + limit;
+
+	// History is addressed in one virtual space: the dictionary occupies [0, base), the payload [base, base + length)
+	auto base = m_dictionary.size();
+	auto dictionary = m_dictionary.data();
+	auto byteAt = [&](size_t position) { return (position < base) ? dictionary[position] : src[position - base]; };
+
+	HashTable table = m_dictionary_table;
+
+	auto emit = [&](size_t anchor, size_t literals, size_t offset, size_t match) -> bool
+	{
+		auto token = out;
+		if (out >= out_end) return false;
+		++out;
+
+		auto literal_nibble = std::min(literals, size_t(15));
+		if (literals >= 15 && !writeLength(out, out_end, literals - 15)) return false;
+		if (size_t(out_end - out) < literals) return false;
+		std::memcpy(out, src + anchor, literals);
+		out += literals;
+
+		auto match_nibble = size_t(0);
+		if (match > 0)
+		{
+			if (out_end - out < 2) return false;
+			*out++ = uint8_t(offset & 0xFF);
+			*out++ = uint8_t(offset >> 8);
+
+			auto extra = match - c_min_match;
+			match_nibble = std::min(extra, size_t(15));
+			if (extra >= 15 && !writeLength(out, out_end, extra - 15)) return false;
+		}
+
+		*token = uint8_t((literal_nibble << 4) | match_nibble);
+		return true;
+	};
+
+	size_t i = 0;
+	size_t anchor = 0;
+	size_t misses = 0;
+
+	while (i + c_min_match <= length)
+	{
+		auto value = readU32(src + i);
+		auto& slot = table[hashU32(value, c_hash_bits)];
+		auto candidate = size_t(slot);
+		auto position = base + i;
+		slot = uint16_t(position + 1);
+
+		if (candidate != 0)
+		{
+			auto match_position = candidate - 1;
+			auto offset = position - match_position;
+
+			auto match = size_t(0);
+			while (i + match < length && byteAt(match_position + match) == src[i + match]) ++match;
+
+			if (offset <= c_max_offset && match >= c_min_match)
+			{
+				if (!emit(anchor, i - anchor, offset, match)) return 0;
+
+				// Seed the table with the tail of the match so back to back repeats are found
+				auto end = i + match;
+				if (end >= 2 && end + 2 <= length)
+				{
+					auto seed = end - 2;
+					table[hashU32(readU32(src + seed), c_hash_bits)] = uint16_t(base + seed + 1);
+				}
+
+				i = end;
+				anchor = i;
+				misses = 0;
+				continue;
+			}
+		}
+
+		// Skip faster through data that isn't compressing
+		i += 1 + (misses++ >> 5);
+	}
+
+	// Trailing literals, a sequence with no match marks the end of the block
+	if (!emit(anchor, length - anchor, 0, 0)) return 0;
+
+	return size_t(out - dst);
+}
+
+bool ClayEngine::Networking::LZTransform::Reverse(const uint8_t* src, size_t length, uint8_t* dst, size_t capacity, size_t& written) const
+{
+	auto in = src;
+	auto in_end = src + length;
+	auto out = dst;
+	auto out_end = dst + capacity;
+	auto base = m_dictionary.size();
+
+	while (in < in_end)
+	{
+		auto token = *in++;
+
+		auto literals = size_t(token >> 4);
+		if (literals == 15 && !readLength(in, in_end, literals)) return false;
+		if (size_t(in_end - in) < literals || size_t(out_end - out) < literals) return false;
+		std::memcpy(out, in, literals);
+		in += literals;
+		out += literals;
+
+		if (in == in_end)
+		{
+			// Last sequence carries literals only
+			if ((token & 0x0F) != 0) return false;
+			break;
+		}
+
+		if (in_end - in < 2) return false;
+		auto offset = size_t(in[0]) | (size_t(in[1]) << 8);
+		in += 2;
+
+		auto match = size_t(token & 0x0F);
+		if (match == 15 && !readLength(in, in_end, match)) return false;
+		match += c_min_match;
+
+		auto produced = size_t(out - dst);
+		if (offset == 0 || offset > produced + base) return false;
+		if (size_t(out_end - out) < match) return false;
+
+		// The part of the match that reaches back into the shared dictionary
+		if (offset > produced)
+		{
+			auto from = base - (offset - produced);
+			auto count = std::min(match, base - from);
+			std::memcpy(out, m_dictionary.data() + from, count);
+			out += count;
+			match -= count;
+		}
+
+		// Byte by byte so overlapping matches (offset < length) replicate correctly
+		auto from = out - offset;
+		while (match-- > 0) *out++ = *from++;
+	}
+
+	written = size_t(out - dst);
+	return true;
+}
+#pragma endregion
@@ -0,0 +1,124 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Network Transforms Library (C) 2022 Epoch Meridian, LLC.        */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "NetworkBuffers.h"
+
+namespace ClayEngine
+{
+	namespace Networking
+	{
+		/// <summary>
+		/// MessageHeader::Flags bits claimed by payload transforms, a receiver reverses every transform whose bit is
+		/// set. The low nibble is reserved for transforms, the high nibble is left for the transport.
+		/// </summary>
+		constexpr uint8_t c_message_transform_mask = 0x0F;
+		constexpr uint8_t c_message_flag_compressed = 0x01;
+		constexpr uint8_t c_message_flag_encrypted = 0x02;
+
+		/// <summary>
+		/// Worst case growth of a payload passing through a transform, and scratch sized for it
+		/// </summary>
+		constexpr auto c_transform_slack = 64ull;
+		constexpr auto c_transform_scratch_size = c_max_message_size + c_transform_slack;
+
+		/// <summary>
+		/// A reversible payload transform (compression, encryption). Implementations must be stateless per call
+		/// so one instance can be shared by every reactor thread and any thread that sends.
+		/// </summary>
+		struct ITransform
+		{
+			virtual ~ITransform() = default;
+
+			/// <summary>
+			/// The header flag that marks a payload as having passed through this transform
+			/// </summary>
+			virtual uint8_t GetFlag() const = 0;
+
+			/// <summary>
+			/// Encode length bytes of src into dst. Returns the encoded length, or zero if the output would not fit
+			/// in capacity or the transform decided it isn't worth applying (the payload is then sent untouched).
+			/// </summary>
+			virtual size_t Forward(const uint8_t* src, size_t length, uint8_t* dst, size_t capacity) const = 0;
+
+			/// <summary>
+			/// Decode length bytes of src into dst, returns false if the input is malformed or doesn't fit
+			/// </summary>
+			virtual bool Reverse(const uint8_t* src, size_t length, uint8_t* dst, size_t capacity, size_t& written) const = 0;
+		};
+		using TransformPtr = std::unique_ptr<ITransform>;
+
+		/// <summary>
+		/// Ordered chain of transforms applied to every outbound payload (Compress()->Encrypt()) and undone in
+		/// reverse on the way in (Decrypt()->Decompress()). The pipeline is configured once at startup and is
+		/// read only after that, per call scratch lives on the caller's stack or in the reactor's inbound context.
+		/// </summary>
+		class TransformPipeline
+		{
+			using Transforms = std::vector<TransformPtr>;
+			Transforms m_transforms = {};
+
+		public:
+			TransformPipeline() = default;
+			~TransformPipeline() = default;
+
+			void AddTransform(TransformPtr transform);
+			bool IsEmpty() const { return m_transforms.empty(); }
+
+			/// <summary>
+			/// Run every transform over src, writing the final stage straight into dst (normally the message slot in
+			/// a send segment). Returns the encoded length and sets flags, or zero if no transform paid off, in which
+			/// case dst is untouched and the caller writes the raw payload.
+			/// </summary>
+			size_t Forward(const uint8_t* src, size_t length, uint8_t* dst, size_t capacity, uint8_t& flags) const;
+
+			/// <summary>
+			/// Undo every transform flagged in flags, decoding into scratch. Returns false if any stage rejects the input.
+			/// </summary>
+			bool Reverse(const uint8_t* src, size_t length, uint8_t flags, uint8_t* scratch, size_t capacity, size_t& written) const;
+		};
+		using TransformPipelinePtr = std::unique_ptr<TransformPipeline>;
+		using TransformPipelineRaw = TransformPipeline*;
+
+		/// <summary>
+		/// LZ77 family codec for small game payloads. Sequences are a token byte (literal run in the high nibble,
+		/// match length - 4 in the low nibble, 15 meaning "more bytes follow"), the literals, and a 16 bit offset.
+		/// An optional shared dictionary of typical message content is treated as history that precedes every
+		/// payload, which is what makes compression pay off on messages of only a few dozen bytes. Both ends
+		/// must be built with the same dictionary bytes.
+		/// </summary>
+		class LZTransform : public ITransform
+		{
+			static constexpr auto c_hash_bits = 12u;
+			static constexpr auto c_hash_size = size_t(1u << c_hash_bits);
+			static constexpr auto c_min_match = size_t(4);
+			static constexpr auto c_max_offset = size_t(0xFFFF);
+			static constexpr auto c_max_dictionary = size_t(0xFFFF - c_max_message_size);
+
+			using Dictionary = std::vector<uint8_t>;
+			using HashTable = std::array<uint16_t, c_hash_size>;
+
+			Dictionary m_dictionary = {};
+			HashTable m_dictionary_table = {}; // Hash table primed with the dictionary, copied as the starting state of each call
+			size_t m_threshold = 0;
+
+		public:
+			/// <summary>
+			/// Payloads shorter than threshold bytes are passed through untouched
+			/// </summary>
+			LZTransform(size_t threshold = 32);
+			LZTransform(const uint8_t* dictionary, size_t length, size_t threshold = 32);
+			~LZTransform() = default;
+
+			uint8_t GetFlag() const override { return c_message_flag_compressed; }
+
+			size_t Forward(const uint8_t* src, size_t length, uint8_t* dst, size_t capacity) const override;
+			bool Reverse(const uint8_t* src, size_t length, uint8_t* dst, size_t capacity, size_t& written) const override;
+		};
+	}
+}
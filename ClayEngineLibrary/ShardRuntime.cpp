@@ -0,0 +1,167 @@
+#include "pch.h"
+#include "ShardRuntime.h"
+
+namespace
+{
+	// Keep the calling thread on one core, false if the OS refused
+	bool pinToCore(size_t core)
+	{
+		return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+	}
+}
+
+#pragma region Simulation Shard
+ClayEngine::String ClayEngine::ShardStats::ToString() const
+{
+	std::stringstream ss;
+	ss << "Shard " << Id << " (core " << Core << (Pinned ? ", pinned" : ", unpinned") << "): mail " << MailReceived << " in, "
+		<< MailRejected << " rejected" << std::endl;
+	ss << Ticks.ToString();
+
+	return ss.str();
+}
+
+ClayEngine::SimulationShard::SimulationShard(ShardRuntimeRaw runtime, ShardId id, size_t core, const ShardSettings& settings, const ShardHandlers& handlers)
+	: m_id{ id }
+	, m_core{ core }
+	, m_pin{ settings.Pin }
+	, m_runtime{ runtime }
+	, m_handlers{ handlers }
+	, m_mailbox{ settings.MailboxCapacity }
+	, m_arena_buffer{ std::make_unique<uint8_t[]>(settings.ArenaSize) }
+	, m_arena{ m_arena_buffer.get(), settings.ArenaSize }
+{
+	m_loop = std::make_unique<TickLoop>(settings.Tick);
+	m_loop->SetPhase(TickPhase::Ingest, [this](uint64_t tick, float elapsed) { ingest(tick, elapsed); });
+	if (m_handlers.Simulate) m_loop->SetPhase(TickPhase::Simulate, [this](uint64_t tick, float elapsed) { m_handlers.Simulate(*this, tick, elapsed); });
+	if (m_handlers.Replicate) m_loop->SetPhase(TickPhase::Replicate, [this](uint64_t tick, float elapsed) { m_handlers.Replicate(*this, tick, elapsed); });
+	m_loop->SetPhase(TickPhase::Flush, [this](uint64_t tick, float elapsed) { flush(tick, elapsed); });
+}
+
+ClayEngine::SimulationShard::~SimulationShard()
+{
+	Stop();
+}
+
+void ClayEngine::SimulationShard::Start()
+{
+	if (m_thread.joinable()) return;
+	m_thread = Thread{ [this]() { run(); } };
+}
+
+void ClayEngine::SimulationShard::Stop()
+{
+	m_loop->Stop();
+	if (m_thread.joinable()) m_thread.join();
+}
+
+void ClayEngine::SimulationShard::run()
+{
+	if (m_pin) m_pinned.store(pinToCore(m_core));
+
+	if (m_handlers.Start) m_handlers.Start(*this);
+	m_loop->Run();
+}
+
+void ClayEngine::SimulationShard::ingest(uint64_t tick, float elapsed)
+{
+	UNREFERENCED_PARAMETER(tick);
+	UNREFERENCED_PARAMETER(elapsed);
+
+	auto count = m_mailbox.Drain([this](const ShardMail& mail)
+		{
+			if (m_handlers.Mail) m_handlers.Mail(*this, mail);
+		}, c_shard_mail_per_tick);
+
+	m_received.fetch_add(count, std::memory_order_relaxed);
+}
+
+void ClayEngine::SimulationShard::flush(uint64_t tick, float elapsed)
+{
+	if (m_handlers.Flush) m_handlers.Flush(*this, tick, elapsed);
+
+	m_arena.release();
+}
+
+bool ClayEngine::SimulationShard::Deliver(const ShardMail& mail)
+{
+	return m_mailbox.TryPush(mail);
+}
+
+bool ClayEngine::SimulationShard::Post(ShardId to, ShardMail mail)
+{
+	mail.From = m_id;
+	return m_runtime->Post(to, mail);
+}
+
+std::pmr::memory_resource* ClayEngine::SimulationShard::GetArena()
+{
+	return &m_arena;
+}
+
+ClayEngine::ShardId ClayEngine::SimulationShard::GetId() const
+{
+	return m_id;
+}
+
+uint64_t ClayEngine::SimulationShard::GetTick() const
+{
+	return m_loop->GetTick();
+}
+
+void ClayEngine::SimulationShard::GetStats(ShardStats& out)
+{
+	out.Id = m_id;
+	out.Core = m_core;
+	out.Pinned = m_pinned.load();
+	out.MailReceived = m_received.load(std::memory_order_relaxed);
+	out.MailRejected = m_mailbox.GetRejected();
+	m_loop->GetStats(out.Ticks);
+}
+#pragma endregion
+
+#pragma region Shard Runtime
+ClayEngine::ShardRuntime::ShardRuntime(ShardSettings settings, ShardHandlers handlers)
+{
+	auto cores = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+	auto count = settings.Count ? settings.Count : std::min((cores > settings.FirstCore) ? cores - settings.FirstCore : size_t(1), size_t(c_max_simulation_shards));
+	if (count > c_max_simulation_shards) throw std::exception("ShardRuntime ERROR: Too many simulation shards");
+
+	// Every shard exists before any starts, so the first tick can already post to the others
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto core = (settings.FirstCore + i) % std::min(cores, size_t(64));
+		m_shards.emplace_back(std::make_unique<SimulationShard>(this, ShardId(i), core, settings, handlers));
+	}
+
+	for (auto& shard : m_shards) shard->Start();
+
+	std::stringstream ss;
+	ss << "ShardRuntime SUCCESS: " << count << " simulation shards started";
+	WriteLine(ss.str());
+}
+
+ClayEngine::ShardRuntime::~ShardRuntime()
+{
+	// Stop them all before any is destroyed, a running shard may still be posting to the rest
+	for (auto& shard : m_shards) shard->Stop();
+	m_shards.clear();
+}
+
+bool ClayEngine::ShardRuntime::Post(ShardId to, const ShardMail& mail)
+{
+	if (to >= m_shards.size()) return false;
+	return m_shards[to]->Deliver(mail);
+}
+
+size_t ClayEngine::ShardRuntime::GetShardCount() const
+{
+	return m_shards.size();
+}
+
+void ClayEngine::ShardRuntime::GetStats(std::vector<ShardStats>& out)
+{
+	out.resize(m_shards.size());
+	for (size_t i = 0; i < m_shards.size(); ++i) m_shards[i]->GetStats(out[i]);
+}
+#pragma endregion
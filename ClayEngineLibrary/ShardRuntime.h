@@ -0,0 +1,172 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Shard Runtime Library (C) 2022 Epoch Meridian, LLC.             */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include <memory_resource>
+
+#include "ClayEngine.h"
+#include "Mailbox.h"
+#include "TickLoop.h"
+
+namespace ClayEngine
+{
+	using ShardId = uint32_t;
+
+	constexpr auto c_max_simulation_shards = 64ull;
+	constexpr auto c_shard_mailbox_capacity_default = 4096ull;
+	constexpr auto c_shard_arena_size_default = 1048576ull; // 1 MiB
+
+	/// <summary>
+	/// Mail taken from a shard's mailbox per tick, anything beyond waits for the next tick
+	/// </summary>
+	constexpr auto c_shard_mail_per_tick = 4096ull;
+
+	/// <summary>
+	/// Fixed size so that mailboxes never allocate, a mailbox cell holding one message fills one cache line.
+	/// Anything bigger than the payload is referred to by an id both sides understand rather than carried.
+	/// </summary>
+	constexpr auto c_shard_mail_payload_size = 44ull;
+	struct ShardMail
+	{
+		ShardId From = 0;
+		uint32_t Handle = 0; // The connection the mail is about, if any
+		uint16_t Kind = 0; // Game defined
+		uint16_t Length = 0;
+		std::array<uint8_t, c_shard_mail_payload_size> Payload = {};
+	};
+	static_assert(sizeof(ShardMail) + sizeof(size_t) <= c_cache_line_size, "A mailbox cell holding ShardMail must fit in a cache line");
+
+	struct ShardSettings
+	{
+		size_t Count = 0; // Zero for one per hardware thread from FirstCore on, at least one
+		size_t FirstCore = 0; // Shard i runs on core (FirstCore + i) modulo the core count
+		bool Pin = true;
+		TickSettings Tick = {};
+		size_t MailboxCapacity = c_shard_mailbox_capacity_default;
+		size_t ArenaSize = c_shard_arena_size_default;
+	};
+
+	class SimulationShard;
+	using SimulationShardRaw = SimulationShard*;
+
+	/// <summary>
+	/// Game code for a shard, every shard gets its own copy and calls it on its own thread only. Mail is handed
+	/// over during the ingest phase of a tick.
+	/// </summary>
+	struct ShardHandlers
+	{
+		std::function<void(SimulationShard& shard)> Start = nullptr; // Once, on the shard's thread before its first tick
+		std::function<void(SimulationShard& shard, const ShardMail& mail)> Mail = nullptr;
+		std::function<void(SimulationShard& shard, uint64_t tick, float elapsed)> Simulate = nullptr;
+		std::function<void(SimulationShard& shard, uint64_t tick, float elapsed)> Replicate = nullptr;
+		std::function<void(SimulationShard& shard, uint64_t tick, float elapsed)> Flush = nullptr;
+	};
+
+	/// <summary>
+	/// Counters for one shard, copied out from any thread
+	/// </summary>
+	struct ShardStats
+	{
+		ShardId Id = 0;
+		size_t Core = 0;
+		bool Pinned = false;
+		uint64_t MailReceived = 0;
+		uint64_t MailRejected = 0; // Posts refused because this shard's mailbox was full
+		TickStats Ticks = {};
+
+		String ToString() const;
+	};
+
+	class ShardRuntime;
+	using ShardRuntimeRaw = ShardRuntime*;
+
+	/// <summary>
+	/// One zone or instance: a thread pinned to a core running its own tick loop, with its own mailbox and a
+	/// per tick arena. Nothing in a shard is shared, other threads reach it only by posting mail, so its
+	/// simulation runs without taking a lock.
+	/// </summary>
+	class SimulationShard
+	{
+		ShardId m_id = 0;
+		size_t m_core = 0;
+		bool m_pin = false;
+		std::atomic<bool> m_pinned = false;
+
+		ShardRuntimeRaw m_runtime = nullptr;
+		ShardHandlers m_handlers = {};
+		TickLoopPtr m_loop = nullptr;
+		Mailbox<ShardMail> m_mailbox;
+		std::atomic<uint64_t> m_received = 0;
+
+		// Scratch memory that lives for one tick, allocations are a pointer bump and are all given back at once
+		std::unique_ptr<uint8_t[]> m_arena_buffer = nullptr;
+		std::pmr::monotonic_buffer_resource m_arena;
+
+		Thread m_thread = {};
+
+		void run();
+		void ingest(uint64_t tick, float elapsed);
+		void flush(uint64_t tick, float elapsed);
+
+	public:
+		SimulationShard(ShardRuntimeRaw runtime, ShardId id, size_t core, const ShardSettings& settings, const ShardHandlers& handlers);
+		SimulationShard(SimulationShard const&) = delete;
+		SimulationShard& operator=(SimulationShard const&) = delete;
+		~SimulationShard();
+
+		void Start();
+		void Stop();
+
+		/// <summary>
+		/// Any thread, false if the mailbox is full
+		/// </summary>
+		bool Deliver(const ShardMail& mail);
+
+		/// <summary>
+		/// Shard thread only, post to another shard (or this one) with From filled in
+		/// </summary>
+		bool Post(ShardId to, ShardMail mail);
+
+		/// <summary>
+		/// Shard thread only, memory for the current tick. Everything allocated from it is released after the
+		/// flush phase, anything that must outlive the tick belongs elsewhere.
+		/// </summary>
+		std::pmr::memory_resource* GetArena();
+
+		ShardId GetId() const;
+		uint64_t GetTick() const;
+		void GetStats(ShardStats& out);
+	};
+	using SimulationShardPtr = std::unique_ptr<SimulationShard>;
+
+	/// <summary>
+	/// Hosts a number of simulation shards in one process, each on its own core. Threads outside the shards
+	/// (the network reactors, the console) post mail to a shard by id.
+	/// </summary>
+	class ShardRuntime
+	{
+		std::vector<SimulationShardPtr> m_shards = {};
+
+	public:
+		/// <summary>
+		/// Starts every shard, throws if the settings ask for more than c_max_simulation_shards
+		/// </summary>
+		ShardRuntime(ShardSettings settings, ShardHandlers handlers);
+		ShardRuntime(ShardRuntime const&) = delete;
+		ShardRuntime& operator=(ShardRuntime const&) = delete;
+		~ShardRuntime();
+
+		/// <summary>
+		/// Any thread, false if there is no such shard or its mailbox is full
+		/// </summary>
+		bool Post(ShardId to, const ShardMail& mail);
+
+		size_t GetShardCount() const;
+		void GetStats(std::vector<ShardStats>& out);
+	};
+	using ShardRuntimePtr = std::unique_ptr<ShardRuntime>;
+}
@@ -0,0 +1,164 @@
+#include "pch.h"
+#include "TickLoop.h"
+
+namespace
+{
+	constexpr std::array<const char*, ClayEngine::c_tick_phase_count> c_tick_phase_names = { "ingest", "simulate", "replicate", "flush" };
+
+	inline double toMilliseconds(double nanoseconds)
+	{
+		return nanoseconds / 1000000.0;
+	}
+}
+
+#pragma region Tick Loop
+ClayEngine::String ClayEngine::TickStats::ToString() const
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(2);
+	ss << "Ticks: " << Ticks << ", " << Overruns << " over budget, " << CaughtUp << " caught up, " << Skipped << " skipped" << std::endl;
+
+	auto line = [&ss](const char* name, const Histogram& histogram)
+	{
+		ss << "  " << name << " (ms): p50 " << toMilliseconds(double(histogram.GetPercentile(50.0)))
+			<< " p99 " << toMilliseconds(double(histogram.GetPercentile(99.0)))
+			<< " max " << toMilliseconds(double(histogram.GetMax()))
+			<< " mean " << toMilliseconds(histogram.GetMean()) << std::endl;
+	};
+
+	for (size_t i = 0; i < c_tick_phase_count; ++i) line(c_tick_phase_names[i], Phases[i]);
+	line("work", Work);
+	line("late", Late);
+
+	auto text = ss.str();
+	text.pop_back();
+	return text;
+}
+
+ClayEngine::TickLoop::TickLoop(TickSettings settings)
+	: m_settings{ settings }
+{
+	if (m_settings.Rate == 0) throw std::exception("TickLoop ERROR: Tick rate must be positive");
+
+	m_interval = Nanoseconds(1000000000ll / int64_t(m_settings.Rate));
+	m_budget = (m_settings.Budget > 0) ? std::chrono::duration_cast<Nanoseconds>(Microseconds(m_settings.Budget)) : m_interval;
+}
+
+void ClayEngine::TickLoop::SetPhase(TickPhase phase, TickCallback callback)
+{
+	m_phases[size_t(phase)] = callback;
+}
+
+void ClayEngine::TickLoop::Run()
+{
+	m_report_time = Clock::now();
+
+	auto boundary = Clock::now();
+	while (!m_stopping.load())
+	{
+		auto now = Clock::now();
+		if (now < boundary)
+		{
+			std::this_thread::sleep_until(boundary);
+			continue;
+		}
+
+		// Whole intervals already gone by on top of the tick that is due now
+		auto behind = uint64_t((now - boundary) / m_interval);
+		auto drop = (m_settings.Policy == OverrunPolicy::Skip) ? behind : (behind > m_settings.MaxCatchUp ? behind - m_settings.MaxCatchUp : 0);
+		if (drop > 0)
+		{
+			boundary += m_interval * int64_t(drop);
+
+			std::scoped_lock guard(m_stats_mutex);
+			m_stats.Skipped += drop;
+		}
+
+		runTick(boundary);
+		boundary += m_interval;
+	}
+
+	m_stopping.store(false);
+}
+
+void ClayEngine::TickLoop::Stop()
+{
+	m_stopping.store(true);
+}
+
+void ClayEngine::TickLoop::runTick(TimePoint boundary)
+{
+	auto tick = m_tick.load(std::memory_order_relaxed);
+	auto elapsed = std::chrono::duration<float>(m_interval).count();
+
+	std::array<Nanoseconds, c_tick_phase_count> times = {};
+	auto start = Clock::now();
+	auto last = start;
+	for (size_t i = 0; i < c_tick_phase_count; ++i)
+	{
+		if (m_phases[i]) m_phases[i](tick, elapsed);
+
+		auto now = Clock::now();
+		times[i] = now - last;
+		last = now;
+	}
+	auto work = Nanoseconds(last - start);
+	auto late = Nanoseconds(start - boundary);
+
+	m_tick.store(tick + 1, std::memory_order_relaxed);
+
+	{
+		std::scoped_lock guard(m_stats_mutex);
+		++m_stats.Ticks;
+		for (size_t i = 0; i < c_tick_phase_count; ++i) m_stats.Phases[i].Record(uint64_t(times[i].count()));
+		m_stats.Work.Record(uint64_t(work.count()));
+		m_stats.Late.Record(uint64_t(std::max(late.count(), int64_t(0))));
+		if (late >= m_interval) ++m_stats.CaughtUp;
+		if (work > m_budget) ++m_stats.Overruns;
+	}
+
+	if (work > m_budget)
+	{
+		++m_report_overruns;
+		m_report_worst = std::max(m_report_worst, work);
+	}
+	reportOverruns(last);
+}
+
+void ClayEngine::TickLoop::reportOverruns(TimePoint now)
+{
+	if (m_report_overruns == 0 || now - m_report_time < Milliseconds(c_tick_report_interval)) return;
+
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1);
+	ss << "TickLoop INFO: " << m_report_overruns << " ticks over the " << toMilliseconds(double(m_budget.count())) << " ms budget, worst "
+		<< toMilliseconds(double(m_report_worst.count())) << " ms";
+	WriteLine(ss.str());
+
+	m_report_time = now;
+	m_report_overruns = 0;
+	m_report_worst = Nanoseconds(0);
+}
+
+uint64_t ClayEngine::TickLoop::GetTick() const
+{
+	return m_tick.load(std::memory_order_relaxed);
+}
+
+const ClayEngine::TickSettings& ClayEngine::TickLoop::GetSettings() const
+{
+	return m_settings;
+}
+
+void ClayEngine::TickLoop::GetStats(TickStats& out)
+{
+	std::scoped_lock guard(m_stats_mutex);
+	out = m_stats;
+}
+
+void ClayEngine::TickLoop::ResetStats()
+{
+	std::scoped_lock guard(m_stats_mutex);
+	m_stats = {};
+}
+#pragma endregion
@@ -0,0 +1,137 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngine Tick Loop Library (C) 2022 Epoch Meridian, LLC.                 */
+/*                                                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#include "ClayEngine.h"
+#include "Histogram.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_tick_rate_default = 30u; // Hz
+	constexpr auto c_tick_catch_up_default = 5u;
+
+	/// <summary>
+	/// Ticks over budget are summed up in one line at most this often, rather than one line per tick
+	/// </summary>
+	constexpr auto c_tick_report_interval = 1000; // ms
+
+	/// <summary>
+	/// What a server does each tick, in order: drain what the network brought in, advance the simulation, build
+	/// what each client should see, and hand the results to the network
+	/// </summary>
+	enum class TickPhase
+	{
+		Ingest,
+		Simulate,
+		Replicate,
+		Flush,
+	};
+	constexpr auto c_tick_phase_count = 4ull;
+
+	/// <summary>
+	/// What to do when ticks run late enough that one or more tick boundaries have already passed
+	/// </summary>
+	enum class OverrunPolicy
+	{
+		CatchUp, // Run the missed ticks back to back, up to MaxCatchUp of them, so simulation keeps up with wall time
+		Skip, // Drop the missed ticks and carry on from the next boundary, simulation falls behind wall time
+	};
+
+	struct TickSettings
+	{
+		uint32_t Rate = c_tick_rate_default;
+		int Budget = 0; // Microseconds of work a tick may take before it is reported, zero for the whole interval
+		OverrunPolicy Policy = OverrunPolicy::CatchUp;
+		uint32_t MaxCatchUp = c_tick_catch_up_default; // Missed ticks beyond this are dropped even when catching up
+	};
+
+	/// <summary>
+	/// Called on the tick loop's thread with the tick number and the fixed step in seconds
+	/// </summary>
+	using TickCallback = std::function<void(uint64_t tick, float elapsed)>;
+
+	/// <summary>
+	/// Counters since the loop started or the last reset, times are in nanoseconds
+	/// </summary>
+	struct TickStats
+	{
+		uint64_t Ticks = 0;
+		uint64_t Overruns = 0; // Ticks whose work took longer than the budget
+		uint64_t CaughtUp = 0; // Ticks run a whole interval or more behind their boundary
+		uint64_t Skipped = 0; // Tick boundaries dropped under either policy
+
+		std::array<Histogram, c_tick_phase_count> Phases = {};
+		Histogram Work = {}; // All phases together
+		Histogram Late = {}; // How far past its boundary each tick started, mostly the sleep overshooting
+
+		String ToString() const;
+	};
+
+	/// <summary>
+	/// Fixed rate server main loop. Each tick runs the phases in order and times them, then the thread sleeps to
+	/// the next tick boundary instead of spinning. Boundaries are fixed from the start, so a tick that runs long
+	/// shortens the sleep before the next rather than pushing every later tick back. Sleep granularity is the OS
+	/// timer's.
+	/// </summary>
+	class TickLoop
+	{
+		TickSettings m_settings = {};
+		Nanoseconds m_interval = Nanoseconds(0);
+		Nanoseconds m_budget = Nanoseconds(0);
+		std::array<TickCallback, c_tick_phase_count> m_phases = {};
+
+		std::atomic<bool> m_stopping = false; // Left set by a Stop() that comes before Run(), so it isn't lost
+		std::atomic<uint64_t> m_tick = 0;
+
+		TickStats m_stats = {};
+		std::mutex m_stats_mutex = {};
+
+		// Overruns since the last report
+		TimePoint m_report_time = {};
+		uint64_t m_report_overruns = 0;
+		Nanoseconds m_report_worst = Nanoseconds(0);
+
+		void runTick(TimePoint boundary);
+		void reportOverruns(TimePoint now);
+
+	public:
+		/// <summary>
+		/// Throws if the rate is zero
+		/// </summary>
+		TickLoop(TickSettings settings = {});
+		TickLoop(TickLoop const&) = delete;
+		TickLoop& operator=(TickLoop const&) = delete;
+		~TickLoop() = default;
+
+		/// <summary>
+		/// Set before Run(), a phase with no callback is skipped
+		/// </summary>
+		void SetPhase(TickPhase phase, TickCallback callback);
+
+		/// <summary>
+		/// Blocks the calling thread ticking until Stop()
+		/// </summary>
+		void Run();
+
+		/// <summary>
+		/// Any thread, the loop returns once the tick in progress (or the sleep before the next) is done. A stop
+		/// that comes before Run() makes it return straight away.
+		/// </summary>
+		void Stop();
+
+		uint64_t GetTick() const;
+		const TickSettings& GetSettings() const;
+
+		/// <summary>
+		/// Any thread, copies the counters out
+		/// </summary>
+		void GetStats(TickStats& out);
+		void ResetStats();
+	};
+	using TickLoopPtr = std::unique_ptr<TickLoop>;
+	using TickLoopRaw = TickLoop*;
+}
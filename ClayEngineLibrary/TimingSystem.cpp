@@ -3,6 +3,18 @@
 
 using namespace ClayEngine;
 
+namespace
+{
+#if defined(_WIN32) && !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+    constexpr DWORD CREATE_WAITABLE_TIMER_HIGH_RESOLUTION = 0x00000002; // Windows 10 1803 and later, older SDKs lack it
+#endif
+
+    inline double toMilliseconds(double nanoseconds)
+    {
+        return nanoseconds / 1000000.0;
+    }
+}
+
 void TickMachine::operator()(Future future)
 {
     auto timing = Services::GetService<TimingSystem>();
@@ -10,7 +22,140 @@ void TickMachine::operator()(Future future)
     while (future.wait_for(Nanoseconds(0)) == std::future_status::timeout)
     {
         timing->RunGameTick();
+        timing->WaitForNextFrame();
+    }
+}
+
+String FramePacerStats::ToString() const
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3);
+    ss << "Frames: " << Frames << ", " << Missed << " missed" << std::endl;
+
+    auto line = [&ss](const char* name, const Histogram& histogram)
+    {
+        ss << "  " << name << " (ms): p50 " << toMilliseconds(double(histogram.GetPercentile(50.0)))
+            << " p99 " << toMilliseconds(double(histogram.GetPercentile(99.0)))
+            << " max " << toMilliseconds(double(histogram.GetMax()))
+            << " mean " << toMilliseconds(histogram.GetMean()) << std::endl;
+    };
+
+    line("wake error", WakeError);
+    line("spin", Spin);
+
+    auto text = ss.str();
+    text.pop_back();
+    return text;
+}
+
+FramePacer::FramePacer(uint32_t rate)
+    : m_rate{ rate }
+{
+#if defined(_WIN32)
+    // The default timer only wakes every 15.6 ms, a high resolution one gets within a fraction of a millisecond
+    m_timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+#endif
+}
+
+FramePacer::~FramePacer()
+{
+#if defined(_WIN32)
+    if (m_timer) CloseHandle(m_timer);
+    m_timer = nullptr;
+#endif
+}
+
+void FramePacer::SetRate(uint32_t rate)
+{
+    m_rate.store(rate, std::memory_order_relaxed);
+}
+
+uint32_t FramePacer::GetRate() const
+{
+    return m_rate.load(std::memory_order_relaxed);
+}
+
+void FramePacer::sleepUntil(TimePoint until)
+{
+#if defined(_WIN32)
+    if (m_timer)
+    {
+        auto remaining = Nanoseconds(until - Clock::now());
+        if (remaining <= Nanoseconds(0)) return;
+
+        LARGE_INTEGER due = {};
+        due.QuadPart = -int64_t(remaining.count() / 100); // Relative, in 100 ns units
+        if (SetWaitableTimer(m_timer, &due, 0, nullptr, nullptr, FALSE))
+        {
+            WaitForSingleObject(m_timer, INFINITE);
+            return;
+        }
     }
+#endif
+    std::this_thread::sleep_until(until);
+}
+
+void FramePacer::Wait()
+{
+    auto rate = m_rate.load(std::memory_order_relaxed);
+    if (rate != m_current_rate)
+    {
+        m_current_rate = rate;
+        if (rate == 0) return;
+
+        m_interval = Nanoseconds(1000000000ll / int64_t(rate));
+        m_deadline = Clock::now() + m_interval;
+    }
+    if (rate == 0) return;
+
+    auto now = Clock::now();
+    auto missed = now >= m_deadline + m_interval;
+    auto spun = Nanoseconds(0);
+
+    if (missed)
+    {
+        // A whole frame behind, start the schedule again from here rather than rush frames out to catch up
+        m_deadline = now;
+    }
+    else if (now < m_deadline)
+    {
+        auto coarse = m_deadline - m_spin;
+        if (now < coarse)
+        {
+            sleepUntil(coarse);
+
+            // Widen the spin at once when a sleep overshoots, narrow it slowly as they settle
+            auto overshoot = Nanoseconds(Clock::now() - coarse);
+            auto target = overshoot + overshoot / 2 + Nanoseconds(Microseconds(c_pacer_spin_min));
+            m_spin = (target > m_spin) ? target : m_spin - (m_spin - target) / 16;
+            m_spin = std::clamp(m_spin, Nanoseconds(Microseconds(c_pacer_spin_min)), std::min(Nanoseconds(Microseconds(c_pacer_spin_max)), m_interval / 2));
+        }
+
+        auto start = Clock::now();
+        while (Clock::now() < m_deadline) std::this_thread::yield();
+        spun = Nanoseconds(Clock::now() - start);
+    }
+
+    auto error = Nanoseconds(Clock::now() - m_deadline);
+    m_deadline += m_interval;
+
+    std::scoped_lock guard(m_stats_mutex);
+    ++m_stats.Frames;
+    if (missed) ++m_stats.Missed;
+    m_stats.WakeError.Record(uint64_t(std::max(error.count(), int64_t(0))));
+    m_stats.Spin.Record(uint64_t(spun.count()));
+}
+
+void FramePacer::GetStats(FramePacerStats& out)
+{
+    std::scoped_lock guard(m_stats_mutex);
+    out = m_stats;
+}
+
+void FramePacer::ResetStats()
+{
+    std::scoped_lock guard(m_stats_mutex);
+    m_stats = {};
 }
 
 TimingCore::TimingCore()
@@ -71,7 +216,7 @@ void TimingCore::UpdateTimer()
 
 TimingSystem::TimingSystem()
 {
-
+    m_pacer = std::make_unique<FramePacer>();
 }
 
 TimingSystem::~TimingSystem()
@@ -125,6 +270,21 @@ void TimingSystem::RunGameTick()
     m_rs->Present();
 }
 
+void TimingSystem::WaitForNextFrame()
+{
+    m_pacer->Wait();
+}
+
+void TimingSystem::SetFrameRate(uint32_t rate)
+{
+    m_pacer->SetRate(rate);
+}
+
+void TimingSystem::GetPacerStats(FramePacerStats& out)
+{
+    m_pacer->GetStats(out);
+}
+
 void TimingSystem::AddUpdateCallback(UpdateCallback fn)
 {
     m_update_callbacks_mtx.lock();
@@ -8,6 +8,7 @@
 
 #include "ClayEngine.h"
 #include "RenderSystem.h"
+#include "Histogram.h"
 
 namespace ClayEngine
 {
@@ -17,6 +18,77 @@ namespace ClayEngine
 
 	inline uint64_t SecondsToTicks(double seconds) noexcept { return static_cast<uint64_t>(seconds * c_ticks_per_second); }
 
+	/// <summary>
+	/// The pacer sleeps until this long before a frame is due and spins the rest of the way, widened when the
+	/// OS sleep is seen to overshoot by more
+	/// </summary>
+	constexpr auto c_pacer_spin_default = 1000; // us
+	constexpr auto c_pacer_spin_min = 100; // us
+	constexpr auto c_pacer_spin_max = 4000; // us
+
+	/// <summary>
+	/// Counters since the pacer was built or reset, times are in nanoseconds
+	/// </summary>
+	struct FramePacerStats
+	{
+		uint64_t Frames = 0;
+		uint64_t Missed = 0; // Frames that ran a whole interval or more late, the schedule restarts from them
+
+		Histogram WakeError = {}; // How far past the deadline each wait returned
+		Histogram Spin = {}; // Time spent yielding after the coarse sleep
+
+		String ToString() const;
+	};
+
+	/// <summary>
+	/// Holds a loop to a frame rate without burning a core. Each wait sleeps on the OS timer until shortly before
+	/// the next deadline, then yields in a loop for the last stretch, which is where the OS timer is too coarse
+	/// to be trusted. The stretch left to spin follows how far the sleeps have been overshooting. Deadlines are
+	/// fixed from the first frame, so a slow frame shortens the next wait rather than shifting every later one.
+	/// </summary>
+	class FramePacer
+	{
+		std::atomic<uint32_t> m_rate = 0;
+		uint32_t m_current_rate = 0; // Rate the schedule below was built for
+		Nanoseconds m_interval = Nanoseconds(0);
+		TimePoint m_deadline = {};
+		Nanoseconds m_spin = Microseconds(c_pacer_spin_default);
+
+#if defined(_WIN32)
+		HANDLE m_timer = nullptr;
+#endif
+
+		FramePacerStats m_stats = {};
+		std::mutex m_stats_mutex = {};
+
+		void sleepUntil(TimePoint until);
+
+	public:
+		FramePacer(uint32_t rate = c_target_frame_rate);
+		FramePacer(FramePacer const&) = delete;
+		FramePacer& operator=(FramePacer const&) = delete;
+		~FramePacer();
+
+		/// <summary>
+		/// Any thread, frames per second or zero to not pace at all. Takes effect at the next wait.
+		/// </summary>
+		void SetRate(uint32_t rate);
+		uint32_t GetRate() const;
+
+		/// <summary>
+		/// Called once per frame on the paced thread, returns at the next frame's deadline
+		/// </summary>
+		void Wait();
+
+		/// <summary>
+		/// Any thread, copies the counters out
+		/// </summary>
+		void GetStats(FramePacerStats& out);
+		void ResetStats();
+	};
+	using FramePacerPtr = std::unique_ptr<FramePacer>;
+	using FramePacerRaw = FramePacer*;
+
 	/// <summary>
 	/// This functor serves as the entry point for the game ticker's thread
 	/// </summary>
@@ -77,6 +149,8 @@ namespace ClayEngine
 		TimingCorePtr m_timer = nullptr;
 		bool m_timer_running = false;
 
+		FramePacerPtr m_pacer = nullptr;
+
 		RenderSystemRaw m_rs = nullptr;
 
 		UpdateCallbacks m_update_callbacks = {};
@@ -94,6 +168,17 @@ namespace ClayEngine
 
 		void RunGameTick();
 
+		/// <summary>
+		/// Block the ticker thread until the next frame is due
+		/// </summary>
+		void WaitForNextFrame();
+
+		/// <summary>
+		/// Frames per second the ticker is held to, zero to leave it to vsync (or run flat out without it)
+		/// </summary>
+		void SetFrameRate(uint32_t rate);
+		void GetPacerStats(FramePacerStats& out);
+
 		void AddUpdateCallback(UpdateCallback fn);
 		void OnUpdateCallback(float elapsedTime);
 		void ClearUpdateCallbacks();
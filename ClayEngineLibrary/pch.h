@@ -86,6 +86,7 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
 #include <future>
 
@@ -93,8 +94,12 @@
 #include <tuple>
 #include <array>
 #include <list>
+#include <deque>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <set>
+#include <random>
 
 #include <string>
 #include <sstream>
@@ -8,6 +8,8 @@
 
 #include "ClayEngine.h"
 #include "NetworkSystem.h"
+#include "ShardRuntime.h"
+#include "TickLoop.h"
 
 namespace ClayEngine
 {
@@ -20,9 +22,42 @@ namespace ClayEngine
 		Default,
 		Initializing,
 		DebugRunning,
+		Replaying,
 		Shutdown,
 	};
 
+	/// <summary>
+	/// ClayEngineServer --replay capture.bin [--timed] runs a capture through the game's handlers and exits, no
+	/// listen server is started. Unpaced by default, --timed keeps the gaps between messages.
+	/// </summary>
+	constexpr auto c_replay_switch = L"--replay";
+	constexpr auto c_replay_timed_switch = L"--timed";
+
+	/// <summary>
+	/// ClayEngineServer --shards N hosts N simulation shards (zones) alongside the network tick, N from one to
+	/// c_max_simulation_shards
+	/// </summary>
+	constexpr auto c_shards_switch = L"--shards";
+
+	/// <summary>
+	/// Text chat, relayed by the server to every connected client with the sender filled in
+	/// </summary>
+	struct ChatMessage
+	{
+		static constexpr uint8_t Opcode = 0x10;
+		static constexpr uint8_t Version = 1;
+
+		ConnectionHandle Sender = c_invalid_connection;
+		String Text = {};
+
+		static constexpr auto GetFields()
+		{
+			return std::make_tuple(
+				MakeMessageField(&ChatMessage::Sender),
+				MakeMessageField(&ChatMessage::Text));
+		}
+	};
+
 	class ServerCoreSystem
 	{
 		ServerCoreState m_state = ServerCoreState::Default;
@@ -30,6 +65,21 @@ namespace ClayEngine
 		bool m_shutdown = false;
 
 		NetworkSystemPtr m_network = nullptr;
+		TickLoopPtr m_tick_loop = nullptr;
+		Thread m_console = {};
+
+		ShardRuntimePtr m_shards = nullptr;
+		ShardSettings m_shard_settings = {};
+		bool m_shards_enabled = false;
+
+		// Chat arrives on the reactor threads and is relayed on the tick
+		std::vector<ChatMessage> m_chat_inbox = {};
+		std::mutex m_chat_inbox_mutex = {};
+		std::vector<ChatMessage> m_chat_pending = {};
+		std::vector<ChatMessage> m_chat_outbox = {};
+
+		String m_replay_filename = {};
+		ReplayPacing m_replay_pacing = ReplayPacing::Unpaced;
 
 	public:
 		ServerCoreSystem()
@@ -43,6 +93,15 @@ namespace ClayEngine
 
 		void StopServices()
 		{
+			if (m_tick_loop) m_tick_loop->Stop();
+			if (m_console.joinable()) m_console.join();
+
+			if (m_shards)
+			{
+				m_shards.reset();
+				m_shards = nullptr;
+			}
+
 			if (m_network)
 			{
 				Services::RemoveService<NetworkSystem>();
@@ -63,6 +122,102 @@ namespace ClayEngine
 			return m_shutdown;
 		}
 
+		/// <summary>
+		/// Set before the first state change to replay a capture instead of serving clients
+		/// </summary>
+		void SetReplay(String filename, ReplayPacing pacing)
+		{
+			m_replay_filename = filename;
+			m_replay_pacing = pacing;
+		}
+
+		/// <summary>
+		/// Set before the first state change to run simulation shards, count zero for one per core besides the
+		/// network tick's
+		/// </summary>
+		void SetShards(size_t count)
+		{
+			m_shard_settings.Count = count;
+			m_shards_enabled = true;
+		}
+
+		/// <summary>
+		/// Called on a listen server reactor thread
+		/// </summary>
+		void OnChat(ConnectionHandle h, const ChatMessage& message)
+		{
+			ChatMessage relay = message;
+			relay.Sender = h;
+
+			std::scoped_lock guard(m_chat_inbox_mutex);
+			m_chat_inbox.push_back(std::move(relay));
+		}
+
+		/// <summary>
+		/// Tick phases, called on the main thread
+		/// </summary>
+		void OnIngest(uint64_t tick, float elapsed)
+		{
+			UNREFERENCED_PARAMETER(tick);
+			UNREFERENCED_PARAMETER(elapsed);
+
+			m_chat_pending.clear();
+			std::scoped_lock guard(m_chat_inbox_mutex);
+			std::swap(m_chat_pending, m_chat_inbox);
+		}
+
+		void OnSimulate(uint64_t tick, float elapsed)
+		{
+			UNREFERENCED_PARAMETER(tick);
+			UNREFERENCED_PARAMETER(elapsed);
+
+			for (auto& chat : m_chat_pending)
+			{
+				if (!chat.Text.empty()) m_chat_outbox.push_back(std::move(chat));
+			}
+		}
+
+		void OnReplicate(uint64_t tick, float elapsed)
+		{
+			UNREFERENCED_PARAMETER(tick);
+			UNREFERENCED_PARAMETER(elapsed);
+
+			m_network->PublishSnapshots();
+		}
+
+		void OnFlush(uint64_t tick, float elapsed)
+		{
+			UNREFERENCED_PARAMETER(tick);
+			UNREFERENCED_PARAMETER(elapsed);
+
+			for (auto& chat : m_chat_outbox) m_network->Broadcast(chat);
+			m_chat_outbox.clear();
+		}
+
+		/// <summary>
+		/// Debug console additions: "ticks" prints the tick loop's timings, "shards" those of every simulation shard
+		/// </summary>
+		bool OnConsole(const String& command)
+		{
+			if (command == "ticks")
+			{
+				TickStats stats = {};
+				m_tick_loop->GetStats(stats);
+				WriteLine(stats.ToString());
+				return true;
+			}
+
+			if (command == "shards" && m_shards)
+			{
+				std::vector<ShardStats> stats = {};
+				m_shards->GetStats(stats);
+				for (auto& shard : stats) WriteLine(shard.ToString());
+				return true;
+			}
+
+			return false;
+		}
+
 		bool GetStateChanged()
 		{
 			return m_state_changed;
@@ -88,9 +243,40 @@ namespace ClayEngine
 					m_network = Services::MakeService<NetworkSystem>();
 					m_network->SetListenServerHints(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 					m_network->SetListenServerPort(48000);
-					m_network->SetListenServerTimeout(125);
+					m_network->SetListenServerDatagramPort(48000);
+					m_network->AddTransform(std::make_unique<LZTransform>());
+					m_network->SetListenServerIdleTimeout(30000);
+					m_network->SetListenServerKeepaliveInterval(10000);
+					m_network->SetListenServerSessionGrace(30000);
+					m_network->SetListenServerBackpressure({ 1048576, 262144, BackpressurePolicy::Disconnect });
+					m_network->SetListenServerRateLimits({ 120, 240, 262144, 524288 });
+					m_network->SetTelemetryDump("telemetry.jsonl", 10000);
+					m_network->GetMessageDispatcher()->Register<ChatMessage, ServerCoreSystem, &ServerCoreSystem::OnChat>(this);
+
+					m_tick_loop = std::make_unique<TickLoop>(TickSettings{ c_tick_rate_default, 0, OverrunPolicy::CatchUp, c_tick_catch_up_default });
+					m_tick_loop->SetPhase(TickPhase::Ingest, [this](uint64_t tick, float elapsed) { OnIngest(tick, elapsed); });
+					m_tick_loop->SetPhase(TickPhase::Simulate, [this](uint64_t tick, float elapsed) { OnSimulate(tick, elapsed); });
+					m_tick_loop->SetPhase(TickPhase::Replicate, [this](uint64_t tick, float elapsed) { OnReplicate(tick, elapsed); });
+					m_tick_loop->SetPhase(TickPhase::Flush, [this](uint64_t tick, float elapsed) { OnFlush(tick, elapsed); });
+
+					if (!m_replay_filename.empty())
+					{
+						m_state = ServerCoreState::Replaying;
+						m_state_changed = true;
+						break;
+					}
+
 					m_network->StartListenServer();
 
+					// Zones tick on their own cores, the main thread keeps the network tick. No zone logic yet,
+					// game code plugs in through the shard handlers.
+					if (m_shards_enabled)
+					{
+						// Core zero stays with the network tick, so one shard per remaining core by default
+						m_shard_settings.FirstCore = 1;
+						m_shards = std::make_unique<ShardRuntime>(m_shard_settings, ShardHandlers{});
+					}
+
 					m_state = ServerCoreState::DebugRunning;
 					m_state_changed = true;
 				}
@@ -99,7 +285,40 @@ namespace ClayEngine
 				{
 					WriteLine("OnStateChanged INFO: ServerCoreState::DebugRunning");
 
-					m_network->Run();
+					// The console blocks on std::cin, so it gets its own thread and the main thread ticks until "quit"
+					m_console = Thread{ [this]()
+						{
+							m_network->Run([this](const String& command) { return OnConsole(command); });
+							m_tick_loop->Stop();
+						} };
+					m_tick_loop->Run();
+					m_console.join();
+
+					TickStats stats = {};
+					m_tick_loop->GetStats(stats);
+					WriteLine(stats.ToString());
+
+					m_state = ServerCoreState::Shutdown;
+					m_state_changed = true;
+				}
+				break;
+			case ServerCoreState::Replaying:
+				{
+					WriteLine("OnStateChanged INFO: ServerCoreState::Replaying");
+
+					try
+					{
+						auto stats = m_network->ReplayCapture(m_replay_filename, m_replay_pacing);
+						WriteLine(stats.ToString());
+
+						std::vector<DispatchStats> dispatch = {};
+						m_network->GetMessageDispatcher()->GetStats(dispatch);
+						for (auto& opcode : dispatch) WriteLine(opcode.ToString());
+					}
+					catch (std::exception ex)
+					{
+						WriteLine(ex.what());
+					}
 
 					m_state = ServerCoreState::Shutdown;
 					m_state_changed = true;
@@ -12,7 +12,7 @@ namespace
 	SettingsPtr g_settings = nullptr;
 }
 
-int wmain()
+int wmain(int argc, wchar_t* argv[])
 {
 	try
 	{
@@ -26,17 +26,42 @@ int wmain()
 
 	g_core = Services::MakeService<ServerCoreSystem>();
 
-	while (g_core)
+	if (argc > 2 && std::wstring(argv[1]) == c_replay_switch)
 	{
-		if (g_core->GetStateChanged())
+		auto timed = argc > 3 && std::wstring(argv[3]) == c_replay_timed_switch;
+		g_core->SetReplay(ToString(argv[2]), timed ? ReplayPacing::Original : ReplayPacing::Unpaced);
+	}
+	else if (argc > 2 && std::wstring(argv[1]) == c_shards_switch)
+	{
+		// Signed so a negative count is refused rather than wrapping, trailing junk is refused too
+		auto count = int64_t(0);
+		try
+		{
+			size_t end = 0;
+			count = std::stoll(argv[2], &end);
+			if (argv[2][end] != L'\0') count = 0;
+		}
+		catch (std::exception) {}
+
+		if (count < 1 || count > int64_t(c_max_simulation_shards))
 		{
-			g_core->OnStateChanged();
+			std::cout << "wmain ERROR: --shards needs a shard count from 1 to " << c_max_simulation_shards << std::endl;
+			g_core.reset();
+			return -1;
+		}
 
-			if (g_core->GetShutdown())
-			{
-				g_core.reset();
-				g_core = nullptr;
-			}
+		g_core->SetShards(size_t(count));
+	}
+
+	// Every state hands straight on to the next, the long running ones block inside OnStateChanged()
+	while (g_core && g_core->GetStateChanged())
+	{
+		g_core->OnStateChanged();
+
+		if (g_core->GetShutdown())
+		{
+			g_core.reset();
+			g_core = nullptr;
 		}
 	}
 